@@ -1181,6 +1181,7 @@ static int at_voicecall_probe(struct ofono_voicecall *vc, unsigned int vendor,
 		return -ENOMEM;
 
 	vd->chat = g_at_chat_clone(chat);
+	g_at_chat_set_priority(vd->chat, G_AT_CHAT_PRIORITY_HIGH);
 	vd->vendor = vendor;
 	vd->tone_duration = TONE_DURATION;
 
@@ -36,14 +36,35 @@
 
 #include "qmimodem.h"
 
+/* Downlink aggregation asked of the modem, it may settle for less */
+#define QMAP_MUX_ID		1
+#define QMAP_MAX_DATAGRAMS	32
+#define QMAP_MAX_SIZE		16384
+
 struct gprs_context_data {
 	struct qmi_service *wds;
 	struct qmi_service *wda;
 	struct qmi_device *dev;
 	unsigned int active_context;
 	uint32_t pkt_handle;
+	bool has_endpoint;
+	uint32_t endpoint;
+	char *mux_interface;
 };
 
+static const char *get_interface(struct ofono_gprs_context *gc)
+{
+	struct gprs_context_data *data = ofono_gprs_context_get_data(gc);
+	struct ofono_modem *modem;
+
+	if (data->mux_interface)
+		return data->mux_interface;
+
+	modem = ofono_gprs_context_get_modem(gc);
+
+	return ofono_modem_get_string(modem, "NetworkInterface");
+}
+
 static void pkt_status_notify(struct qmi_result *result, void *user_data)
 {
 	struct ofono_gprs_context *gc = user_data;
@@ -80,8 +101,6 @@ static void get_settings_cb(struct qmi_result *result, void *user_data)
 	struct cb_data *cbd = user_data;
 	ofono_gprs_context_cb_t cb = cbd->cb;
 	struct ofono_gprs_context *gc = cbd->user;
-	struct ofono_modem *modem;
-	const char *interface;
 	uint8_t pdp_type, ip_family;
 	uint32_t ip_addr;
 	struct in_addr addr;
@@ -147,10 +166,7 @@ static void get_settings_cb(struct qmi_result *result, void *user_data)
 		ofono_gprs_context_set_ipv4_dns_servers(gc, dns);
 
 done:
-	modem = ofono_gprs_context_get_modem(gc);
-	interface = ofono_modem_get_string(modem, "NetworkInterface");
-
-	ofono_gprs_context_set_interface(gc, interface);
+	ofono_gprs_context_set_interface(gc, get_interface(gc));
 
 	CALLBACK_WITH_SUCCESS(cb, cbd->data);
 }
@@ -161,8 +177,6 @@ static void start_net_cb(struct qmi_result *result, void *user_data)
 	ofono_gprs_context_cb_t cb = cbd->cb;
 	struct ofono_gprs_context *gc = cbd->user;
 	struct gprs_context_data *data = ofono_gprs_context_get_data(gc);
-	struct ofono_modem *modem;
-	const char *interface;
 	uint32_t handle;
 
 	DBG("");
@@ -185,10 +199,7 @@ static void start_net_cb(struct qmi_result *result, void *user_data)
 					get_settings_cb, cbd, g_free) > 0)
 		return;
 
-	modem = ofono_gprs_context_get_modem(gc);
-	interface = ofono_modem_get_string(modem, "NetworkInterface");
-
-	ofono_gprs_context_set_interface(gc, interface);
+	ofono_gprs_context_set_interface(gc, get_interface(gc));
 
 	CALLBACK_WITH_SUCCESS(cb, cbd->data);
 
@@ -371,6 +382,55 @@ static void qmi_gprs_context_detach_shutdown(struct ofono_gprs_context *gc,
 	qmi_deactivate_primary(gc, cid, NULL, NULL);
 }
 
+static void disable_aggregation(struct ofono_gprs_context *gc);
+
+static void bind_mux_data_port_cb(struct qmi_result *result, void *user_data)
+{
+	struct ofono_gprs_context *gc = user_data;
+	struct gprs_context_data *data = ofono_gprs_context_get_data(gc);
+
+	DBG("");
+
+	if (!qmi_result_set_error(result, NULL))
+		return;
+
+	ofono_warn("Failed to bind to QMAP mux id, disabling aggregation");
+
+	disable_aggregation(gc);
+	qmi_device_del_mux_link(data->dev, QMAP_MUX_ID);
+	g_free(data->mux_interface);
+	data->mux_interface = NULL;
+}
+
+static void bind_mux_data_port(struct ofono_gprs_context *gc)
+{
+	struct gprs_context_data *data = ofono_gprs_context_get_data(gc);
+	struct qmi_wda_endpoint_info endpoint;
+	struct qmi_param *param;
+
+	param = qmi_param_new();
+	if (!param)
+		goto error;
+
+	if (data->has_endpoint) {
+		endpoint.type = GUINT32_TO_LE(QMI_WDA_ENDPOINT_TYPE_HSUSB);
+		endpoint.interface = GUINT32_TO_LE(data->endpoint);
+		qmi_param_append(param, QMI_WDS_PARAM_ENDPOINT_INFO,
+					sizeof(endpoint), &endpoint);
+	}
+
+	qmi_param_append_uint8(param, QMI_WDS_PARAM_MUX_ID, QMAP_MUX_ID);
+
+	if (qmi_service_send(data->wds, QMI_WDS_BIND_MUX_DATA_PORT, param,
+					bind_mux_data_port_cb, gc, NULL) > 0)
+		return;
+
+	qmi_param_free(param);
+
+error:
+	bind_mux_data_port_cb(NULL, gc);
+}
+
 static void create_wds_cb(struct qmi_service *service, void *user_data)
 {
 	struct ofono_gprs_context *gc = user_data;
@@ -388,22 +448,27 @@ static void create_wds_cb(struct qmi_service *service, void *user_data)
 
 	qmi_service_register(data->wds, QMI_WDS_PKT_STATUS_IND,
 					pkt_status_notify, gc, NULL);
+
+	if (data->mux_interface)
+		bind_mux_data_port(gc);
 }
 
-static void get_data_format_cb(struct qmi_result *result, void *user_data)
+static void create_wds(struct ofono_gprs_context *gc)
 {
-	struct ofono_gprs_context *gc = user_data;
 	struct gprs_context_data *data = ofono_gprs_context_get_data(gc);
-	uint32_t llproto;
-	enum qmi_device_expected_data_format expected_llproto;
 
-	DBG("");
+	/* Falling back from aggregation after WDS is already up */
+	if (data->wds)
+		return;
 
-	if (qmi_result_set_error(result, NULL))
-		goto done;
+	qmi_service_create_shared(data->dev, QMI_SERVICE_WDS, create_wds_cb, gc,
+									NULL);
+}
 
-	if (!qmi_result_get_uint32(result, QMI_WDA_LL_PROTOCOL, &llproto))
-		goto done;
+static void sync_expected_data_format(struct gprs_context_data *data,
+							uint32_t llproto)
+{
+	enum qmi_device_expected_data_format expected_llproto;
 
 	expected_llproto = qmi_device_get_expected_data_format(data->dev);
 
@@ -424,16 +489,127 @@ static void get_data_format_cb(struct qmi_result *result, void *user_data)
 		else
 			DBG("expected data set to raw-ip");
 	}
+}
+
+static void get_data_format_cb(struct qmi_result *result, void *user_data)
+{
+	struct ofono_gprs_context *gc = user_data;
+	struct gprs_context_data *data = ofono_gprs_context_get_data(gc);
+	uint32_t llproto;
+
+	DBG("");
+
+	if (qmi_result_set_error(result, NULL))
+		goto done;
+
+	if (!qmi_result_get_uint32(result, QMI_WDA_LL_PROTOCOL, &llproto))
+		goto done;
+
+	sync_expected_data_format(data, llproto);
 
 done:
-	qmi_service_create_shared(data->dev, QMI_SERVICE_WDS, create_wds_cb, gc,
-									NULL);
+	create_wds(gc);
+}
+
+/* Keeps whatever format the modem uses, the kernel is told about it */
+static void get_data_format(struct ofono_gprs_context *gc)
+{
+	struct gprs_context_data *data = ofono_gprs_context_get_data(gc);
+
+	if (qmi_service_send(data->wda, QMI_WDA_GET_DATA_FORMAT, NULL,
+					get_data_format_cb, gc, NULL) > 0)
+		return;
+
+	create_wds(gc);
+}
+
+static void disable_aggregation(struct ofono_gprs_context *gc)
+{
+	struct gprs_context_data *data = ofono_gprs_context_get_data(gc);
+	struct qmi_param *param;
+
+	param = qmi_param_new();
+	if (!param)
+		goto error;
+
+	qmi_param_append_uint32(param, QMI_WDA_UL_DATA_AGG_PROTOCOL,
+					QMI_WDA_DATA_AGG_PROTOCOL_DISABLED);
+	qmi_param_append_uint32(param, QMI_WDA_DL_DATA_AGG_PROTOCOL,
+					QMI_WDA_DATA_AGG_PROTOCOL_DISABLED);
+
+	/* The reply carries the data format, same as a get would */
+	if (qmi_service_send(data->wda, QMI_WDA_SET_DATA_FORMAT, param,
+					get_data_format_cb, gc, NULL) > 0)
+		return;
+
+	qmi_param_free(param);
+
+error:
+	create_wds(gc);
+}
+
+static void set_data_format_cb(struct qmi_result *result, void *user_data)
+{
+	struct ofono_gprs_context *gc = user_data;
+	struct gprs_context_data *data = ofono_gprs_context_get_data(gc);
+	uint32_t llproto;
+	uint32_t ul_agg;
+	uint32_t dl_agg;
+	uint32_t max_size;
+
+	DBG("");
+
+	if (qmi_result_set_error(result, NULL)) {
+		/* Older firmware */
+		get_data_format(gc);
+		return;
+	}
+
+	if (!qmi_result_get_uint32(result, QMI_WDA_LL_PROTOCOL, &llproto))
+		goto done;
+
+	sync_expected_data_format(data, llproto);
+
+	if (!qmi_result_get_uint32(result, QMI_WDA_UL_DATA_AGG_PROTOCOL,
+								&ul_agg) ||
+			!qmi_result_get_uint32(result,
+					QMI_WDA_DL_DATA_AGG_PROTOCOL, &dl_agg))
+		goto done;
+
+	if (llproto != QMI_WDA_DATA_LINK_PROTOCOL_RAW_IP ||
+			ul_agg != QMI_WDA_DATA_AGG_PROTOCOL_QMAP ||
+			dl_agg != QMI_WDA_DATA_AGG_PROTOCOL_QMAP)
+		goto disable;
+
+	if (!qmi_result_get_uint32(result, QMI_WDA_DL_DATA_AGG_MAX_SIZE,
+								&max_size))
+		max_size = QMAP_MAX_SIZE;
+
+	DBG("QMAP aggregation up to %u bytes", max_size);
+
+	data->mux_interface = qmi_device_add_mux_link(data->dev, QMAP_MUX_ID,
+								max_size);
+	if (data->mux_interface) {
+		DBG("QMAP mux interface %s", data->mux_interface);
+		goto done;
+	}
+
+	DBG("No QMAP support in the kernel");
+
+disable:
+	disable_aggregation(gc);
+	return;
+
+done:
+	create_wds(gc);
 }
 
 static void create_wda_cb(struct qmi_service *service, void *user_data)
 {
 	struct ofono_gprs_context *gc = user_data;
 	struct gprs_context_data *data = ofono_gprs_context_get_data(gc);
+	struct qmi_wda_endpoint_info endpoint;
+	struct qmi_param *param;
 
 	DBG("");
 
@@ -444,13 +620,46 @@ static void create_wda_cb(struct qmi_service *service, void *user_data)
 
 	data->wda = qmi_service_ref(service);
 
-	if (qmi_service_send(data->wda, QMI_WDA_GET_DATA_FORMAT, NULL,
-					get_data_format_cb, gc, NULL) > 0)
+	/* Without the raw_ip knob qmi_wwan only speaks 802.3 */
+	if (qmi_device_get_expected_data_format(data->dev) ==
+			QMI_DEVICE_EXPECTED_DATA_FORMAT_UNKNOWN) {
+		DBG("No raw-ip support in the kernel");
+		get_data_format(gc);
 		return;
+	}
+
+	param = qmi_param_new();
+	if (!param)
+		goto error;
+
+	qmi_param_append_uint32(param, QMI_WDA_LL_PROTOCOL,
+					QMI_WDA_DATA_LINK_PROTOCOL_RAW_IP);
+	qmi_param_append_uint32(param, QMI_WDA_UL_DATA_AGG_PROTOCOL,
+					QMI_WDA_DATA_AGG_PROTOCOL_QMAP);
+	qmi_param_append_uint32(param, QMI_WDA_DL_DATA_AGG_PROTOCOL,
+					QMI_WDA_DATA_AGG_PROTOCOL_QMAP);
+	qmi_param_append_uint32(param, QMI_WDA_DL_DATA_AGG_MAX_DATAGRAMS,
+					QMAP_MAX_DATAGRAMS);
+	qmi_param_append_uint32(param, QMI_WDA_DL_DATA_AGG_MAX_SIZE,
+					QMAP_MAX_SIZE);
+
+	data->has_endpoint = qmi_device_get_endpoint(data->dev,
+							&data->endpoint);
+	if (data->has_endpoint) {
+		endpoint.type = GUINT32_TO_LE(QMI_WDA_ENDPOINT_TYPE_HSUSB);
+		endpoint.interface = GUINT32_TO_LE(data->endpoint);
+		qmi_param_append(param, QMI_WDA_ENDPOINT_INFO,
+					sizeof(endpoint), &endpoint);
+	}
+
+	if (qmi_service_send(data->wda, QMI_WDA_SET_DATA_FORMAT, param,
+					set_data_format_cb, gc, NULL) > 0)
+		return;
+
+	qmi_param_free(param);
 
 error:
-	qmi_service_create_shared(data->dev, QMI_SERVICE_WDS, create_wds_cb, gc,
-									NULL);
+	create_wds(gc);
 }
 
 static int qmi_gprs_context_probe(struct ofono_gprs_context *gc,
@@ -489,6 +698,11 @@ static void qmi_gprs_context_remove(struct ofono_gprs_context *gc)
 		qmi_service_unref(data->wda);
 	}
 
+	if (data->mux_interface) {
+		qmi_device_del_mux_link(data->dev, QMAP_MUX_ID);
+		g_free(data->mux_interface);
+	}
+
 	g_free(data);
 }
 
@@ -32,6 +32,9 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
 
 #include <glib.h>
 
@@ -61,9 +64,16 @@ struct qmi_device {
 	bool close_on_unref;
 	guint read_watch;
 	guint write_watch;
+	uint8_t *rx_buf;		/* Frames split across reads */
+	size_t rx_len;
 	GQueue *req_queue;
-	GQueue *control_queue;
-	GQueue *service_queue;
+	GHashTable *pending;		/* Sent, keyed by __request_key */
+	GQueue *pending_order;		/* Sent, by deadline */
+	guint pending_timeout;
+	gint64 pending_deadline;	/* What pending_timeout is set for */
+	unsigned int request_timeout;	/* In seconds */
+	unsigned int timed_out;		/* Requests that got no response */
+	unsigned int unknown_tid;	/* Responses matching no request */
 	GQueue *discovery_queue;
 	uint8_t next_control_tid;
 	uint16_t next_service_tid;
@@ -75,13 +85,17 @@ struct qmi_device {
 	struct qmi_version *version_list;
 	uint8_t version_count;
 	GHashTable *service_list;
+	GHashTable *notify_table;	/* Subscribers by __notify_key */
+	GSList *notify_removed;		/* Unregistered during dispatch */
 	unsigned int release_users;
 	qmi_shutdown_func_t shutdown_func;
 	void *shutdown_user_data;
 	qmi_destroy_func_t shutdown_destroy;
 	guint shutdown_source;
+	uint32_t saved_mtu;		/* Before a mux link, 0 if untouched */
 	bool shutting_down : 1;
 	bool destroyed : 1;
+	bool in_indication : 1;
 };
 
 struct qmi_service {
@@ -96,8 +110,9 @@ struct qmi_service {
 };
 
 struct qmi_param {
-	void *data;
-	uint16_t length;
+	uint8_t *buf;		/* Room for the request headers, then TLVs */
+	size_t size;
+	uint16_t length;	/* Of the TLVs alone */
 };
 
 struct qmi_result {
@@ -106,11 +121,17 @@ struct qmi_result {
 	uint16_t error;
 	const void *data;
 	uint16_t length;
+	bool indexed;		/* Index built, on first lookup */
+	uint16_t index[256];	/* Value offset per TLV type, 0 if absent */
 };
 
 struct qmi_request {
 	uint16_t tid;
+	uint8_t service;
 	uint8_t client;
+	uint16_t message;
+	gint64 deadline;	/* Once sent, in monotonic time */
+	GList *pending_link;	/* In pending_order, once sent */
 	void *buf;
 	size_t len;
 	qmi_message_func_t callback;
@@ -120,9 +141,11 @@ struct qmi_request {
 struct qmi_notify {
 	uint16_t id;
 	uint16_t message;
+	struct qmi_service *service;
 	qmi_result_func_t callback;
 	void *user_data;
 	qmi_destroy_func_t destroy;
+	bool destroyed;
 };
 
 struct qmi_mux_hdr {
@@ -160,34 +183,54 @@ struct qmi_tlv_hdr {
 } __attribute__ ((packed));
 #define QMI_TLV_HDR_SIZE 3
 
+/* The length field does not count the frame byte */
+#define QMI_MUX_MAX_SIZE (0xffff + 1)
+
+/* Service request headers, reserved in front of the TLVs of a param */
+#define QMI_PARAM_HEADROOM (QMI_MUX_HDR_SIZE + QMI_SERVICE_HDR_SIZE + \
+						QMI_MESSAGE_HDR_SIZE)
+
+/* Holds typical NAS and WDS requests without growing */
+#define QMI_PARAM_INITIAL_SIZE 128
+
+/* Generous, as network scans can keep the modem busy for minutes */
+#define QMI_REQUEST_TIMEOUT	180
+
 void qmi_free(void *ptr)
 {
 	free(ptr);
 }
 
-static struct qmi_request *__request_alloc(uint8_t service,
+static uint16_t __request_headroom(uint8_t service)
+{
+	if (service == QMI_SERVICE_CONTROL)
+		return QMI_CONTROL_HDR_SIZE;
+
+	return QMI_SERVICE_HDR_SIZE;
+}
+
+/*
+ * Takes over buf, which has to start with room for the headers and
+ * carry the length bytes of the message right after them.
+ */
+static struct qmi_request *__request_new(uint8_t service,
 				uint8_t client, uint16_t message,
-				const void *data,
-				uint16_t length, qmi_message_func_t func,
-				void *user_data)
+				void *buf, uint16_t length,
+				qmi_message_func_t func, void *user_data)
 {
 	struct qmi_request *req;
 	struct qmi_mux_hdr *hdr;
 	struct qmi_message_hdr *msg;
-	uint16_t headroom;
+	uint16_t headroom = __request_headroom(service);
 
 	req = g_new0(struct qmi_request, 1);
 
-	if (service == QMI_SERVICE_CONTROL)
-		headroom = QMI_CONTROL_HDR_SIZE;
-	else
-		headroom = QMI_SERVICE_HDR_SIZE;
-
 	req->len = QMI_MUX_HDR_SIZE + headroom + QMI_MESSAGE_HDR_SIZE + length;
+	req->buf = buf;
 
-	req->buf = g_malloc(req->len);
-
+	req->service = service;
 	req->client = client;
+	req->message = message;
 
 	hdr = req->buf;
 
@@ -202,16 +245,31 @@ static struct qmi_request *__request_alloc(uint8_t service,
 	msg->message = GUINT16_TO_LE(message);
 	msg->length = GUINT16_TO_LE(length);
 
-	if (data && length > 0)
-		memcpy(req->buf + QMI_MUX_HDR_SIZE + headroom +
-					QMI_MESSAGE_HDR_SIZE, data, length);
-
 	req->callback = func;
 	req->user_data = user_data;
 
 	return req;
 }
 
+static struct qmi_request *__request_alloc(uint8_t service,
+				uint8_t client, uint16_t message,
+				const void *data,
+				uint16_t length, qmi_message_func_t func,
+				void *user_data)
+{
+	uint16_t offset = QMI_MUX_HDR_SIZE + __request_headroom(service) +
+							QMI_MESSAGE_HDR_SIZE;
+	uint8_t *buf;
+
+	buf = g_malloc(offset + length);
+
+	if (data && length > 0)
+		memcpy(buf + offset, data, length);
+
+	return __request_new(service, client, message, buf, length,
+							func, user_data);
+}
+
 static void __request_free(gpointer data, gpointer user_data)
 {
 	struct qmi_request *req = data;
@@ -220,6 +278,12 @@ static void __request_free(gpointer data, gpointer user_data)
 	g_free(req);
 }
 
+static void __request_free_pending(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	__request_free(value, NULL);
+}
+
 static gint __request_compare(gconstpointer a, gconstpointer b)
 {
 	const struct qmi_request *req = a;
@@ -228,6 +292,78 @@ static gint __request_compare(gconstpointer a, gconstpointer b)
 	return req->tid - tid;
 }
 
+static gpointer __request_key(uint8_t service, uint8_t client, uint16_t tid)
+{
+	return GUINT_TO_POINTER(tid | (client << 16) | ((guint) service << 24));
+}
+
+/*
+ * Sent requests are kept ordered by deadline, so that only the first one
+ * has to be looked at for timeouts.  With the same timeout for all of
+ * them this is the order they were sent in.
+ */
+static void __pending_add(struct qmi_device *device, struct qmi_request *req)
+{
+	GList *l;
+
+	req->deadline = g_get_monotonic_time() +
+			(gint64) device->request_timeout * G_USEC_PER_SEC;
+
+	for (l = device->pending_order->tail; l; l = l->prev) {
+		struct qmi_request *prev = l->data;
+
+		if (prev->deadline <= req->deadline)
+			break;
+	}
+
+	if (l) {
+		g_queue_insert_after(device->pending_order, l, req);
+		req->pending_link = l->next;
+	} else {
+		g_queue_push_head(device->pending_order, req);
+		req->pending_link = device->pending_order->head;
+	}
+
+	g_hash_table_insert(device->pending,
+			__request_key(req->service, req->client, req->tid),
+			req);
+}
+
+static void __pending_steal(struct qmi_device *device,
+					struct qmi_request *req)
+{
+	g_hash_table_steal(device->pending,
+			__request_key(req->service, req->client, req->tid));
+
+	g_queue_delete_link(device->pending_order, req->pending_link);
+	req->pending_link = NULL;
+}
+
+/* Takes a request out of the device, whether it has been sent or not */
+static struct qmi_request *__request_remove(struct qmi_device *device,
+				uint8_t service, uint8_t client, uint16_t tid)
+{
+	struct qmi_request *req;
+	gpointer key;
+	GList *list;
+
+	list = g_queue_find_custom(device->req_queue,
+				GUINT_TO_POINTER(tid), __request_compare);
+	if (list) {
+		req = list->data;
+		g_queue_delete_link(device->req_queue, list);
+		return req;
+	}
+
+	key = __request_key(service, client, tid);
+
+	req = g_hash_table_lookup(device->pending, key);
+	if (req)
+		__pending_steal(device, req);
+
+	return req;
+}
+
 static void __discovery_free(gpointer data, gpointer user_data)
 {
 	struct discovery *d = data;
@@ -254,6 +390,65 @@ static gint __notify_compare(gconstpointer a, gconstpointer b)
 	return notify->id - id;
 }
 
+static gpointer __notify_key(uint8_t type, uint16_t message)
+{
+	return GUINT_TO_POINTER((type << 16) | message);
+}
+
+/* Lets an indication go straight to the notifies waiting for it */
+static void __notify_link(struct qmi_device *device,
+					struct qmi_notify *notify)
+{
+	gpointer key = __notify_key(notify->service->type, notify->message);
+	GSList *list = g_hash_table_lookup(device->notify_table, key);
+
+	if (!list)
+		g_hash_table_insert(device->notify_table, key,
+					g_slist_append(NULL, notify));
+	else
+		g_slist_append(list, notify);
+}
+
+static void __notify_unlink(struct qmi_device *device,
+					struct qmi_notify *notify)
+{
+	gpointer key = __notify_key(notify->service->type, notify->message);
+	GSList *list = g_hash_table_lookup(device->notify_table, key);
+
+	list = g_slist_remove(list, notify);
+
+	if (!list)
+		g_hash_table_remove(device->notify_table, key);
+	else
+		g_hash_table_insert(device->notify_table, key, list);
+}
+
+/*
+ * Unlinks and frees a notify, unless an indication is being dispatched.
+ * Then it is only marked, the lists are left alone until that is done.
+ */
+static void __notify_release(struct qmi_device *device,
+					struct qmi_notify *notify)
+{
+	if (device && device->in_indication) {
+		notify->destroyed = true;
+		device->notify_removed = g_slist_prepend(device->notify_removed,
+								notify);
+		return;
+	}
+
+	if (device)
+		__notify_unlink(device, notify);
+
+	__notify_free(notify, NULL);
+}
+
+static void __notify_table_free(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	g_slist_free(value);
+}
+
 static gboolean __service_compare_shared(gpointer key, gpointer value,
 							gpointer user_data)
 {
@@ -641,11 +836,12 @@ static void __debug_device(struct qmi_device *device,
 	device->debug_func(strbuf, device->debug_data);
 }
 
+static void wakeup_timeout(struct qmi_device *device);
+
 static gboolean can_write_data(GIOChannel *channel, GIOCondition cond,
 							gpointer user_data)
 {
 	struct qmi_device *device = user_data;
-	struct qmi_mux_hdr *hdr;
 	struct qmi_request *req;
 	ssize_t bytes_written;
 
@@ -663,12 +859,8 @@ static gboolean can_write_data(GIOChannel *channel, GIOCondition cond,
 	__debug_msg(' ', req->buf, bytes_written,
 				device->debug_func, device->debug_data);
 
-	hdr = req->buf;
-
-	if (hdr->service == QMI_SERVICE_CONTROL)
-		g_queue_push_tail(device->control_queue, req);
-	else
-		g_queue_push_tail(device->service_queue, req);
+	__pending_add(device, req);
+	wakeup_timeout(device);
 
 	g_free(req->buf);
 	req->buf = NULL;
@@ -679,6 +871,84 @@ static gboolean can_write_data(GIOChannel *channel, GIOCondition cond,
 	return FALSE;
 }
 
+/*
+ * Fail every request whose deadline has passed.  The callbacks see no
+ * response data at all, which they already treat as an error.
+ */
+static gboolean pending_timeout(gpointer user_data)
+{
+	struct qmi_device *device = user_data;
+	gint64 now = g_get_monotonic_time();
+	struct qmi_request *req;
+	GSList *expired = NULL;
+	GSList *l;
+
+	device->pending_timeout = 0;
+
+	while ((req = g_queue_peek_head(device->pending_order))) {
+		if (req->deadline > now)
+			break;
+
+		__pending_steal(device, req);
+		expired = g_slist_prepend(expired, req);
+	}
+
+	wakeup_timeout(device);
+
+	expired = g_slist_reverse(expired);
+
+	for (l = expired; l; l = l->next) {
+		req = l->data;
+
+		device->timed_out++;
+
+		__debug_device(device, "request timed out [service=%d,"
+				"client=%d,tid=%d] (%u total)",
+				req->service, req->client, req->tid,
+				device->timed_out);
+
+		if (req->callback)
+			req->callback(req->message, 0, NULL, req->user_data);
+
+		__request_free(req, NULL);
+	}
+
+	g_slist_free(expired);
+
+	return FALSE;
+}
+
+/*
+ * A single timer, set for the first deadline.  It is left alone when
+ * that request completes, waking up early only means setting it again.
+ * A shorter request timeout can put a new request first, then the timer
+ * has to come forward.
+ */
+static void wakeup_timeout(struct qmi_device *device)
+{
+	struct qmi_request *req;
+	gint64 now;
+
+	req = g_queue_peek_head(device->pending_order);
+	if (!req)
+		return;
+
+	if (device->pending_timeout > 0) {
+		if (req->deadline >= device->pending_deadline)
+			return;
+
+		g_source_remove(device->pending_timeout);
+	}
+
+	device->pending_deadline = req->deadline;
+	now = g_get_monotonic_time();
+
+	device->pending_timeout = g_timeout_add_seconds(
+			req->deadline > now ? (req->deadline - now +
+					G_USEC_PER_SEC - 1) / G_USEC_PER_SEC : 0,
+			pending_timeout, device);
+}
+
 static void write_watch_destroy(gpointer user_data)
 {
 	struct qmi_device *device = user_data;
@@ -729,66 +999,71 @@ static uint16_t __request_submit(struct qmi_device *device,
 	return req->tid;
 }
 
-static void service_notify(gpointer key, gpointer value, gpointer user_data)
-{
-	struct qmi_service *service = value;
-	struct qmi_result *result = user_data;
-	GList *list;
-
-	for (list = g_list_first(service->notify_list); list;
-						list = g_list_next(list)) {
-		struct qmi_notify *notify = list->data;
-
-		if (notify->message == result->message)
-			notify->callback(result, notify->user_data);
-	}
-}
-
 static void handle_indication(struct qmi_device *device,
 			uint8_t service_type, uint8_t client_id,
 			uint16_t message, uint16_t length, const void *data)
 {
-	struct qmi_service *service;
 	struct qmi_result result;
-	unsigned int hash_id;
+	GSList *list;
 
 	if (service_type == QMI_SERVICE_CONTROL)
 		return;
 
+	list = g_hash_table_lookup(device->notify_table,
+					__notify_key(service_type, message));
+	if (!list)
+		return;
+
 	result.result = 0;
 	result.error = 0;
 	result.message = message;
 	result.data = data;
 	result.length = length;
+	result.indexed = false;
 
-	if (client_id == 0xff) {
-		g_hash_table_foreach(device->service_list,
-						service_notify, &result);
-		return;
+	/* Callbacks may unregister any notify, see __notify_release */
+	device->in_indication = true;
+
+	for (; list; list = list->next) {
+		struct qmi_notify *notify = list->data;
+
+		if (notify->destroyed)
+			continue;
+
+		/* Client id 0xff is a broadcast to all clients of the type */
+		if (client_id != 0xff &&
+				notify->service->client_id != client_id)
+			continue;
+
+		notify->callback(&result, notify->user_data);
 	}
 
-	hash_id = service_type | (client_id << 8);
+	device->in_indication = false;
 
-	service = g_hash_table_lookup(device->service_list,
-					GUINT_TO_POINTER(hash_id));
-	if (!service)
-		return;
+	while (device->notify_removed) {
+		struct qmi_notify *notify = device->notify_removed->data;
 
-	service_notify(NULL, service, &result);
+		device->notify_removed = g_slist_delete_link(
+					device->notify_removed,
+					device->notify_removed);
+
+		__notify_release(device, notify);
+	}
 }
 
 static void handle_packet(struct qmi_device *device,
-				const struct qmi_mux_hdr *hdr, const void *buf)
+				const struct qmi_mux_hdr *hdr, const void *buf,
+				size_t size)
 {
 	struct qmi_request *req;
 	uint16_t message, length;
 	const void *data;
+	unsigned int tid;
+	gpointer key;
 
 	if (hdr->service == QMI_SERVICE_CONTROL) {
 		const struct qmi_control_hdr *control = buf;
 		const struct qmi_message_hdr *msg;
-		unsigned int tid;
-		GList *list;
 
 		/* Ignore control messages with client identifier */
 		if (hdr->client != 0x00)
@@ -799,6 +1074,10 @@ static void handle_packet(struct qmi_device *device,
 		message = GUINT16_FROM_LE(msg->message);
 		length = GUINT16_FROM_LE(msg->length);
 
+		if (QMI_CONTROL_HDR_SIZE + QMI_MESSAGE_HDR_SIZE +
+							length > size)
+			return;
+
 		data = buf + QMI_CONTROL_HDR_SIZE + QMI_MESSAGE_HDR_SIZE;
 
 		tid = control->transaction;
@@ -808,26 +1087,22 @@ static void handle_packet(struct qmi_device *device,
 							message, length, data);
 			return;
 		}
-
-		list = g_queue_find_custom(device->control_queue,
-				GUINT_TO_POINTER(tid), __request_compare);
-		if (!list)
-			return;
-
-		req = list->data;
-
-		g_queue_delete_link(device->control_queue, list);
 	} else {
 		const struct qmi_service_hdr *service = buf;
 		const struct qmi_message_hdr *msg;
-		unsigned int tid;
-		GList *list;
+
+		if (QMI_SERVICE_HDR_SIZE + QMI_MESSAGE_HDR_SIZE > size)
+			return;
 
 		msg = buf + QMI_SERVICE_HDR_SIZE;
 
 		message = GUINT16_FROM_LE(msg->message);
 		length = GUINT16_FROM_LE(msg->length);
 
+		if (QMI_SERVICE_HDR_SIZE + QMI_MESSAGE_HDR_SIZE +
+							length > size)
+			return;
+
 		data = buf + QMI_SERVICE_HDR_SIZE + QMI_MESSAGE_HDR_SIZE;
 
 		tid = GUINT16_FROM_LE(service->transaction);
@@ -837,17 +1112,23 @@ static void handle_packet(struct qmi_device *device,
 							message, length, data);
 			return;
 		}
+	}
 
-		list = g_queue_find_custom(device->service_queue,
-				GUINT_TO_POINTER(tid), __request_compare);
-		if (!list)
-			return;
+	key = __request_key(hdr->service, hdr->client, tid);
 
-		req = list->data;
+	req = g_hash_table_lookup(device->pending, key);
+	if (!req) {
+		device->unknown_tid++;
 
-		g_queue_delete_link(device->service_queue, list);
+		__debug_device(device, "response with unknown tid [service=%d,"
+				"client=%d,tid=%d] (%u total)",
+				hdr->service, hdr->client, tid,
+				device->unknown_tid);
+		return;
 	}
 
+	__pending_steal(device, req);
+
 	if (req->callback)
 		req->callback(message, length, data, req->user_data);
 
@@ -859,49 +1140,86 @@ static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 {
 	struct qmi_device *device = user_data;
 	struct qmi_mux_hdr *hdr;
-	unsigned char buf[2048];
 	ssize_t bytes_read;
-	uint16_t offset;
+	size_t offset;
 
 	if (cond & G_IO_NVAL)
 		return FALSE;
 
-	bytes_read = read(device->fd, buf, sizeof(buf));
+	/* Whatever is left over is less than a frame, so there is room */
+	bytes_read = read(device->fd, device->rx_buf + device->rx_len,
+					QMI_MUX_MAX_SIZE - device->rx_len);
 	if (bytes_read < 0)
 		return TRUE;
 
-	__hexdump('<', buf, bytes_read,
+	__hexdump('<', device->rx_buf + device->rx_len, bytes_read,
 				device->debug_func, device->debug_data);
 
+	device->rx_len += bytes_read;
+
 	offset = 0;
 
-	while (offset < bytes_read) {
-		uint16_t len;
+	/* The callbacks may drop what was the last reference otherwise */
+	qmi_device_ref(device);
 
-		/* Check if QMI mux header fits into packet */
-		if (bytes_read - offset < QMI_MUX_HDR_SIZE)
-			break;
+	/* Frames are handled where they are, only a partial one is moved */
+	while (offset < device->rx_len) {
+		size_t avail = device->rx_len - offset;
+		size_t len = 0;
 
-		hdr = (void *) (buf + offset);
+		hdr = (void *) (device->rx_buf + offset);
 
-		/* Check for fixed frame and flags value */
-		if (hdr->frame != 0x01 || hdr->flags != 0x80)
-			break;
+		if (hdr->frame == 0x01) {
+			/* Wait for the rest of the QMI mux header */
+			if (avail < QMI_MUX_HDR_SIZE)
+				break;
+
+			len = GUINT16_FROM_LE(hdr->length) + 1;
+
+			/* Check for fixed flags value and a sane length */
+			if (hdr->flags != 0x80 || len < QMI_MUX_HDR_SIZE +
+					QMI_CONTROL_HDR_SIZE + QMI_MESSAGE_HDR_SIZE)
+				len = 0;
+		}
+
+		/* Resynchronize on the next frame byte after garbage */
+		if (len == 0) {
+			uint8_t *next = memchr(device->rx_buf + offset + 1,
+							0x01, avail - 1);
+			size_t skip = next ? (size_t) (next - (uint8_t *) hdr) :
+									avail;
 
-		len = GUINT16_FROM_LE(hdr->length) + 1;
+			__debug_device(device, "skipping %zu bytes", skip);
 
-		/* Check that packet size matches frame size */
-		if (bytes_read - offset < len)
+			offset += skip;
+			continue;
+		}
+
+		/* Check that the whole frame has arrived */
+		if (avail < len)
 			break;
 
-		__debug_msg(' ', buf + offset, len,
+		__debug_msg(' ', device->rx_buf + offset, len,
 				device->debug_func, device->debug_data);
 
-		handle_packet(device, hdr, buf + offset + QMI_MUX_HDR_SIZE);
+		handle_packet(device, hdr, device->rx_buf + offset +
+					QMI_MUX_HDR_SIZE, len - QMI_MUX_HDR_SIZE);
 
 		offset += len;
+
+		/* Released by a callback, nobody is left for the rest */
+		if (device->ref_count == 1)
+			break;
 	}
 
+	device->rx_len -= offset;
+
+	if (device->rx_len > 0 && offset > 0)
+		memmove(device->rx_buf, device->rx_buf + offset,
+							device->rx_len);
+
+	qmi_device_unref(device);
+
 	return TRUE;
 }
 
@@ -966,6 +1284,12 @@ struct qmi_device *qmi_device_new(int fd)
 		}
 	}
 
+	device->rx_buf = g_try_malloc(QMI_MUX_MAX_SIZE);
+	if (!device->rx_buf) {
+		g_free(device);
+		return NULL;
+	}
+
 	device->io = g_io_channel_unix_new(device->fd);
 
 	g_io_channel_set_encoding(device->io, NULL, NULL);
@@ -978,13 +1302,16 @@ struct qmi_device *qmi_device_new(int fd)
 	g_io_channel_unref(device->io);
 
 	device->req_queue = g_queue_new();
-	device->control_queue = g_queue_new();
-	device->service_queue = g_queue_new();
+	device->pending = g_hash_table_new(g_direct_hash, g_direct_equal);
+	device->pending_order = g_queue_new();
+	device->request_timeout = QMI_REQUEST_TIMEOUT;
 	device->discovery_queue = g_queue_new();
 
 	device->service_list = g_hash_table_new_full(g_direct_hash,
 					g_direct_equal, NULL, service_destroy);
 
+	device->notify_table = g_hash_table_new(g_direct_hash, g_direct_equal);
+
 	device->next_control_tid = 1;
 	device->next_service_tid = 256;
 
@@ -1011,11 +1338,12 @@ void qmi_device_unref(struct qmi_device *device)
 
 	__debug_device(device, "device %p free", device);
 
-	g_queue_foreach(device->control_queue, __request_free, NULL);
-	g_queue_free(device->control_queue);
+	g_hash_table_foreach(device->pending, __request_free_pending, NULL);
+	g_hash_table_destroy(device->pending);
+	g_queue_free(device->pending_order);
 
-	g_queue_foreach(device->service_queue, __request_free, NULL);
-	g_queue_free(device->service_queue);
+	if (device->pending_timeout > 0)
+		g_source_remove(device->pending_timeout);
 
 	g_queue_foreach(device->req_queue, __request_free, NULL);
 	g_queue_free(device->req_queue);
@@ -1037,8 +1365,12 @@ void qmi_device_unref(struct qmi_device *device)
 
 	g_hash_table_destroy(device->service_list);
 
+	g_hash_table_foreach(device->notify_table, __notify_table_free, NULL);
+	g_hash_table_destroy(device->notify_table);
+
 	g_free(device->version_str);
 	g_free(device->version_list);
+	g_free(device->rx_buf);
 
 	if (device->shutting_down)
 		device->destroyed = true;
@@ -1046,6 +1378,18 @@ void qmi_device_unref(struct qmi_device *device)
 		g_free(device);
 }
 
+/* Applies to requests sent from now on */
+bool qmi_device_set_request_timeout(struct qmi_device *device,
+						unsigned int seconds)
+{
+	if (device == NULL || seconds == 0)
+		return false;
+
+	device->request_timeout = seconds;
+
+	return true;
+}
+
 void qmi_device_set_debug(struct qmi_device *device,
 				qmi_debug_func_t func, void *user_data)
 {
@@ -1249,36 +1593,21 @@ static gboolean discover_reply(gpointer user_data)
 	struct discover_data *data = user_data;
 	struct qmi_device *device = data->device;
 	unsigned int tid = data->tid;
-	GList *list;
 	struct qmi_request *req = NULL;
 
 	data->timeout = 0;
 
 	/* remove request from queues */
-	if (tid != 0) {
-		list = g_queue_find_custom(device->req_queue,
-				GUINT_TO_POINTER(tid), __request_compare);
-
-		if (list) {
-			req = list->data;
-			g_queue_delete_link(device->req_queue, list);
-		} else {
-			list = g_queue_find_custom(device->control_queue,
-				GUINT_TO_POINTER(tid), __request_compare);
-
-			if (list) {
-				req = list->data;
-				g_queue_delete_link(device->control_queue,
-								list);
-			}
-		}
-	}
+	if (tid != 0)
+		req = __request_remove(device, QMI_SERVICE_CONTROL, 0x00, tid);
 
 	if (data->func)
 		data->func(data->user_data);
 
 	__qmi_device_discovery_complete(data->device, &data->super);
-	__request_free(req, NULL);
+
+	if (req)
+		__request_free(req, NULL);
 
 	return FALSE;
 }
@@ -1642,6 +1971,302 @@ done:
 	return res;
 }
 
+static bool write_qmi_attr(const char *interface, const char *attr,
+							const char *value)
+{
+	char *sysfs_path;
+	bool res = false;
+	int fd;
+
+	sysfs_path = g_strdup_printf("/sys/class/net/%s/qmi/%s",
+							interface, attr);
+
+	fd = open(sysfs_path, O_WRONLY);
+	if (fd < 0) {
+		/* maybe not supported by kernel */
+		DBG("Error %d in open(%s)", errno, sysfs_path);
+		goto done;
+	}
+
+	if (write(fd, value, strlen(value)) < 0)
+		DBG("Error %d in write(%s)", errno, sysfs_path);
+	else
+		res = true;
+
+	close(fd);
+
+done:
+	g_free(sysfs_path);
+
+	return res;
+}
+
+/* qmi_wwan links every qmimux device it creates as an upper device */
+static char *find_mux_link(const char *interface, uint8_t mux_id)
+{
+	char *dir_path;
+	DIR *dir;
+	struct dirent *dir_entry;
+	char *link = NULL;
+
+	dir_path = g_strdup_printf("/sys/class/net/%s", interface);
+	dir = opendir(dir_path);
+	g_free(dir_path);
+
+	if (!dir)
+		return NULL;
+
+	while (!link && (dir_entry = readdir(dir)) != NULL) {
+		const char *upper = dir_entry->d_name + strlen("upper_");
+		char *sysfs_path;
+		char value[8];
+		ssize_t len;
+		int fd;
+
+		if (!g_str_has_prefix(dir_entry->d_name, "upper_"))
+			continue;
+
+		sysfs_path = g_strdup_printf("/sys/class/net/%s/qmap/mux_id",
+								upper);
+		fd = open(sysfs_path, O_RDONLY);
+		g_free(sysfs_path);
+
+		if (fd < 0)
+			continue;
+
+		len = read(fd, value, sizeof(value) - 1);
+		close(fd);
+
+		if (len <= 0)
+			continue;
+
+		value[len] = '\0';
+
+		if (strtoul(value, NULL, 0) == mux_id)
+			link = g_strdup(upper);
+	}
+
+	closedir(dir);
+
+	return link;
+}
+
+static bool get_interface_mtu(const char *interface, uint32_t *mtu)
+{
+	struct ifreq ifr;
+	int sk;
+	int err;
+
+	sk = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sk < 0)
+		return false;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, interface, IFNAMSIZ - 1);
+
+	err = ioctl(sk, SIOCGIFMTU, &ifr);
+	if (err < 0)
+		DBG("Error %d getting MTU of %s", errno, interface);
+	else
+		*mtu = ifr.ifr_mtu;
+
+	close(sk);
+
+	return err == 0;
+}
+
+static bool set_interface_mtu(const char *interface, uint32_t mtu)
+{
+	struct ifreq ifr;
+	int sk;
+	int err;
+
+	sk = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sk < 0)
+		return false;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, interface, IFNAMSIZ - 1);
+	ifr.ifr_mtu = mtu;
+
+	err = ioctl(sk, SIOCSIFMTU, &ifr);
+	if (err < 0)
+		DBG("Error %d setting MTU %u on %s", errno, mtu, interface);
+
+	close(sk);
+
+	return err == 0;
+}
+
+/* The qmimux links only pass traffic while the master is up */
+static bool set_interface_up(const char *interface)
+{
+	struct ifreq ifr;
+	int sk;
+	int err;
+
+	sk = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (sk < 0)
+		return false;
+
+	memset(&ifr, 0, sizeof(ifr));
+	strncpy(ifr.ifr_name, interface, IFNAMSIZ - 1);
+
+	err = ioctl(sk, SIOCGIFFLAGS, &ifr);
+	if (err < 0)
+		goto done;
+
+	if (ifr.ifr_flags & IFF_UP)
+		goto done;
+
+	ifr.ifr_flags |= IFF_UP;
+
+	err = ioctl(sk, SIOCSIFFLAGS, &ifr);
+
+done:
+	if (err < 0)
+		DBG("Error %d bringing up %s", errno, interface);
+
+	close(sk);
+
+	return err == 0;
+}
+
+static void restore_interface_mtu(struct qmi_device *device,
+						const char *interface)
+{
+	if (!device->saved_mtu)
+		return;
+
+	set_interface_mtu(interface, device->saved_mtu);
+	device->saved_mtu = 0;
+}
+
+/*
+ * Creates (or finds) the qmimux link carrying QMAP mux_id on top of the
+ * device's network interface, which has to be in raw-ip mode.  The
+ * downlink URBs are sized after the MTU of that interface, so once the
+ * link is there it gets raised to max_size for aggregated frames to fit,
+ * and the interface is brought up.  qmi_device_del_mux_link puts the MTU
+ * back.  Returns the name of the link, NULL if the kernel does not
+ * support qmimux.
+ */
+char *qmi_device_add_mux_link(struct qmi_device *device, uint8_t mux_id,
+							uint32_t max_size)
+{
+	char *interface;
+	char *link = NULL;
+	char value[8];
+
+	if (!device)
+		return NULL;
+
+	interface = get_device_interface(device);
+	if (!interface) {
+		DBG("Error while getting interface name");
+		return NULL;
+	}
+
+	/* Fails if the link is left over from earlier, which is fine */
+	snprintf(value, sizeof(value), "%u", mux_id);
+	write_qmi_attr(interface, "add_mux", value);
+
+	link = find_mux_link(interface, mux_id);
+	if (!link)
+		goto done;
+
+	if (!device->saved_mtu &&
+			!get_interface_mtu(interface, &device->saved_mtu))
+		goto error;
+
+	if (!set_interface_mtu(interface, max_size))
+		goto error;
+
+	if (set_interface_up(interface))
+		goto done;
+
+error:
+	restore_interface_mtu(device, interface);
+	write_qmi_attr(interface, "del_mux", value);
+
+	g_free(link);
+	link = NULL;
+
+done:
+	g_free(interface);
+
+	return link;
+}
+
+bool qmi_device_del_mux_link(struct qmi_device *device, uint8_t mux_id)
+{
+	char *interface;
+	char value[8];
+	bool res;
+
+	if (!device)
+		return false;
+
+	interface = get_device_interface(device);
+	if (!interface)
+		return false;
+
+	snprintf(value, sizeof(value), "%u", mux_id);
+	res = write_qmi_attr(interface, "del_mux", value);
+
+	restore_interface_mtu(device, interface);
+
+	g_free(interface);
+
+	return res;
+}
+
+/* The USB interface number, which QMAP calls the endpoint */
+bool qmi_device_get_endpoint(struct qmi_device *device, uint32_t *number)
+{
+	char * const driver_names[] = { "usbmisc", "usb" };
+	char file_path[PATH_MAX];
+	char *file_name;
+	unsigned int i;
+
+	if (!device || !number)
+		return false;
+
+	if (!get_device_file_name(device, file_path, sizeof(file_path)))
+		return false;
+
+	file_name = basename(file_path);
+
+	for (i = 0; i < G_N_ELEMENTS(driver_names); i++) {
+		char *sysfs_path;
+		char value[8];
+		ssize_t len;
+		int fd;
+
+		sysfs_path = g_strdup_printf(
+				"/sys/class/%s/%s/device/bInterfaceNumber",
+				driver_names[i], file_name);
+		fd = open(sysfs_path, O_RDONLY);
+		g_free(sysfs_path);
+
+		if (fd < 0)
+			continue;
+
+		len = read(fd, value, sizeof(value) - 1);
+		close(fd);
+
+		if (len <= 0)
+			continue;
+
+		value[len] = '\0';
+		*number = strtoul(value, NULL, 16);
+
+		return true;
+	}
+
+	return false;
+}
+
 struct qmi_param *qmi_param_new(void)
 {
 	struct qmi_param *param;
@@ -1658,7 +2283,7 @@ void qmi_param_free(struct qmi_param *param)
 	if (!param)
 		return;
 
-	g_free(param->data);
+	g_free(param->buf);
 	g_free(param);
 }
 
@@ -1666,7 +2291,7 @@ bool qmi_param_append(struct qmi_param *param, uint8_t type,
 					uint16_t length, const void *data)
 {
 	struct qmi_tlv_hdr *tlv;
-	void *ptr;
+	size_t needed;
 
 	if (!param || !type)
 		return false;
@@ -1677,22 +2302,34 @@ bool qmi_param_append(struct qmi_param *param, uint8_t type,
 	if (!data)
 		return false;
 
-	if (param->data)
-		ptr = g_try_realloc(param->data,
-				param->length + QMI_TLV_HDR_SIZE + length);
-	else
-		ptr = g_try_malloc(QMI_TLV_HDR_SIZE + length);
+	needed = QMI_PARAM_HEADROOM + param->length + QMI_TLV_HDR_SIZE + length;
 
-	if (!ptr)
+	/* The QMUX length field has to cover it all */
+	if (needed > QMI_MUX_MAX_SIZE)
 		return false;
 
-	tlv = ptr + param->length;
+	if (needed > param->size) {
+		size_t size = param->size ? param->size : QMI_PARAM_INITIAL_SIZE;
+		uint8_t *buf;
+
+		while (size < needed)
+			size *= 2;
+
+		buf = g_try_realloc(param->buf, size);
+		if (!buf)
+			return false;
+
+		param->buf = buf;
+		param->size = size;
+	}
+
+	tlv = (struct qmi_tlv_hdr *) (param->buf + QMI_PARAM_HEADROOM +
+							param->length);
 
 	tlv->type = type;
 	tlv->length = GUINT16_TO_LE(length);
 	memcpy(tlv->value, data, length);
 
-	param->data = ptr;
 	param->length += QMI_TLV_HDR_SIZE + length;
 
 	return true;
@@ -1800,13 +2437,67 @@ const char *qmi_result_get_error(struct qmi_result *result)
 	return __error_to_string(result->error);
 }
 
+/*
+ * Walk the TLVs once, checking that each fits into the message, and note
+ * where the value of each type starts.  A TLV overrunning the message
+ * makes the whole chain untrustworthy, so nothing gets indexed then.
+ */
+static void __result_index(struct qmi_result *result)
+{
+	const uint8_t *data = result->data;
+	unsigned int offset = 0;
+
+	result->indexed = true;
+	memset(result->index, 0, sizeof(result->index));
+
+	while (offset + QMI_TLV_HDR_SIZE <= result->length) {
+		const struct qmi_tlv_hdr *tlv = (const void *) (data + offset);
+		unsigned int end = offset + QMI_TLV_HDR_SIZE +
+					GUINT16_FROM_LE(tlv->length);
+
+		if (end > result->length) {
+			DBG("malformed TLVs in message 0x%04x",
+							result->message);
+			memset(result->index, 0, sizeof(result->index));
+			return;
+		}
+
+		/* Like a linear search, the first of a type wins */
+		if (!result->index[tlv->type])
+			result->index[tlv->type] = offset + QMI_TLV_HDR_SIZE;
+
+		offset = end;
+	}
+}
+
+static const void *__result_get(struct qmi_result *result, uint8_t type,
+							uint16_t *length)
+{
+	const struct qmi_tlv_hdr *tlv;
+	uint16_t offset;
+
+	if (!result->indexed)
+		__result_index(result);
+
+	offset = result->index[type];
+	if (!offset)
+		return NULL;
+
+	tlv = result->data + offset - QMI_TLV_HDR_SIZE;
+
+	if (length)
+		*length = GUINT16_FROM_LE(tlv->length);
+
+	return tlv->value;
+}
+
 const void *qmi_result_get(struct qmi_result *result, uint8_t type,
 							uint16_t *length)
 {
 	if (!result || !type)
 		return NULL;
 
-	return tlv_get(result->data, result->length, type, length);
+	return __result_get(result, type, length);
 }
 
 char *qmi_result_get_string(struct qmi_result *result, uint8_t type)
@@ -1817,7 +2508,7 @@ char *qmi_result_get_string(struct qmi_result *result, uint8_t type)
 	if (!result || !type)
 		return NULL;
 
-	ptr = tlv_get(result->data, result->length, type, &len);
+	ptr = __result_get(result, type, &len);
 	if (!ptr)
 		return NULL;
 
@@ -1833,7 +2524,7 @@ bool qmi_result_get_uint8(struct qmi_result *result, uint8_t type,
 	if (!result || !type)
 		return false;
 
-	ptr = tlv_get(result->data, result->length, type, &len);
+	ptr = __result_get(result, type, &len);
 	if (!ptr)
 		return false;
 
@@ -1852,7 +2543,7 @@ bool qmi_result_get_int16(struct qmi_result *result, uint8_t type,
 	if (!result || !type)
 		return false;
 
-	ptr = tlv_get(result->data, result->length, type, &len);
+	ptr = __result_get(result, type, &len);
 	if (!ptr)
 		return false;
 
@@ -1873,7 +2564,7 @@ bool qmi_result_get_uint16(struct qmi_result *result, uint8_t type,
 	if (!result || !type)
 		return false;
 
-	ptr = tlv_get(result->data, result->length, type, &len);
+	ptr = __result_get(result, type, &len);
 	if (!ptr)
 		return false;
 
@@ -1895,7 +2586,7 @@ bool qmi_result_get_uint32(struct qmi_result *result, uint8_t type,
 	if (!result || !type)
 		return false;
 
-	ptr = tlv_get(result->data, result->length, type, &len);
+	ptr = __result_get(result, type, &len);
 	if (!ptr)
 		return false;
 
@@ -1917,7 +2608,7 @@ bool qmi_result_get_uint64(struct qmi_result *result, uint8_t type,
 	if (!result || !type)
 		return false;
 
-	ptr = tlv_get(result->data, result->length, type, &len);
+	ptr = __result_get(result, type, &len);
 	if (!ptr)
 		return false;
 
@@ -1938,6 +2629,7 @@ struct service_create_data {
 	qmi_create_func_t func;
 	void *user_data;
 	qmi_destroy_func_t destroy;
+	uint16_t tid;
 	guint timeout;
 };
 
@@ -1959,12 +2651,21 @@ static void service_create_data_free(gpointer user_data)
 static gboolean service_create_reply(gpointer user_data)
 {
 	struct service_create_data *data = user_data;
+	struct qmi_request *req;
 
 	data->timeout = 0;
+
+	/* A late response must not find the request, data is gone by then */
+	req = __request_remove(data->device, QMI_SERVICE_CONTROL, 0x00,
+								data->tid);
+
 	data->func(NULL, data->user_data);
 
 	__qmi_device_discovery_complete(data->device, &data->super);
 
+	if (req)
+		__request_free(req, NULL);
+
 	return FALSE;
 }
 
@@ -2062,7 +2763,7 @@ static bool service_create(struct qmi_device *device,
 			client_req, sizeof(client_req),
 			service_create_callback, data);
 
-	__request_submit(device, req);
+	data->tid = __request_submit(device, req);
 
 	data->timeout = g_timeout_add_seconds(8, service_create_reply, data);
 	__qmi_device_discovery_started(device, &data->super);
@@ -2254,6 +2955,11 @@ static void service_send_callback(uint16_t message, uint16_t length,
 	result.message = message;
 	result.data = buffer;
 	result.length = length;
+	result.indexed = false;
+
+	/* No response at all, e.g. timed out, or one without a result */
+	result.result = 0x0001;
+	result.error = 0x0003;
 
 	result_code = tlv_get(buffer, length, 0x02, &len);
 	if (!result_code)
@@ -2300,11 +3006,16 @@ uint16_t qmi_service_send(struct qmi_service *service,
 	data->user_data = user_data;
 	data->destroy = destroy;
 
-	req = __request_alloc(service->type, service->client_id,
-				message,
-				param ? param->data : NULL,
-				param ? param->length : 0,
-				service_send_callback, data);
+	/* The TLVs already sit behind room for the headers */
+	if (param && param->buf) {
+		req = __request_new(service->type, service->client_id,
+					message, param->buf, param->length,
+					service_send_callback, data);
+		param->buf = NULL;
+	} else
+		req = __request_alloc(service->type, service->client_id,
+					message, NULL, 0,
+					service_send_callback, data);
 
 	qmi_param_free(param);
 
@@ -2318,7 +3029,6 @@ bool qmi_service_cancel(struct qmi_service *service, uint16_t id)
 	unsigned int tid = id;
 	struct qmi_device *device;
 	struct qmi_request *req;
-	GList *list;
 
 	if (!service || !tid)
 		return false;
@@ -2330,22 +3040,9 @@ bool qmi_service_cancel(struct qmi_service *service, uint16_t id)
 	if (!device)
 		return false;
 
-	list = g_queue_find_custom(device->req_queue,
-				GUINT_TO_POINTER(tid), __request_compare);
-	if (list) {
-		req = list->data;
-
-		g_queue_delete_link(device->req_queue, list);
-	} else {
-		list = g_queue_find_custom(device->service_queue,
-				GUINT_TO_POINTER(tid), __request_compare);
-		if (!list)
-			return false;
-
-		req = list->data;
-
-		g_queue_delete_link(device->service_queue, list);
-	}
+	req = __request_remove(device, service->type, service->client_id, tid);
+	if (!req)
+		return false;
 
 	service_send_free(req->user_data);
 
@@ -2354,7 +3051,7 @@ bool qmi_service_cancel(struct qmi_service *service, uint16_t id)
 	return true;
 }
 
-static GQueue *remove_client(GQueue *queue, uint8_t client)
+static GQueue *remove_client(GQueue *queue, uint8_t service, uint8_t client)
 {
 	GQueue *new_queue;
 	GList *list;
@@ -2370,7 +3067,8 @@ static GQueue *remove_client(GQueue *queue, uint8_t client)
 
 		req = list->data;
 
-		if (!req->client || req->client != client) {
+		if (!req->client || req->client != client ||
+						req->service != service) {
 			g_queue_push_tail_link(new_queue, list);
 			continue;
 		}
@@ -2385,6 +3083,25 @@ static GQueue *remove_client(GQueue *queue, uint8_t client)
 	return new_queue;
 }
 
+static gboolean remove_client_pending(gpointer key, gpointer value,
+							gpointer user_data)
+{
+	struct qmi_request *req = value;
+	struct qmi_service *service = user_data;
+
+	if (!req->client || req->client != service->client_id ||
+					req->service != service->type)
+		return FALSE;
+
+	g_queue_delete_link(service->device->pending_order, req->pending_link);
+
+	service_send_free(req->user_data);
+
+	__request_free(req, NULL);
+
+	return TRUE;
+}
+
 bool qmi_service_cancel_all(struct qmi_service *service)
 {
 	struct qmi_device *device;
@@ -2399,11 +3116,11 @@ bool qmi_service_cancel_all(struct qmi_service *service)
 	if (!device)
 		return false;
 
-	device->req_queue = remove_client(device->req_queue,
+	device->req_queue = remove_client(device->req_queue, service->type,
 						service->client_id);
 
-	device->service_queue = remove_client(device->service_queue,
-							service->client_id);
+	g_hash_table_foreach_steal(device->pending, remove_client_pending,
+								service);
 
 	return true;
 }
@@ -2426,12 +3143,16 @@ uint16_t qmi_service_register(struct qmi_service *service,
 
 	notify->id = service->next_notify_id++;
 	notify->message = message;
+	notify->service = service;
 	notify->callback = func;
 	notify->user_data = user_data;
 	notify->destroy = destroy;
 
 	service->notify_list = g_list_append(service->notify_list, notify);
 
+	if (service->device)
+		__notify_link(service->device, notify);
+
 	return notify->id;
 }
 
@@ -2453,17 +3174,21 @@ bool qmi_service_unregister(struct qmi_service *service, uint16_t id)
 
 	service->notify_list = g_list_delete_link(service->notify_list, list);
 
-	__notify_free(notify, NULL);
+	__notify_release(service->device, notify);
 
 	return true;
 }
 
 bool qmi_service_unregister_all(struct qmi_service *service)
 {
+	GList *list;
+
 	if (!service)
 		return false;
 
-	g_list_foreach(service->notify_list, __notify_free, NULL);
+	for (list = service->notify_list; list; list = list->next)
+		__notify_release(service->device, list->data);
+
 	g_list_free(service->notify_list);
 
 	service->notify_list = NULL;
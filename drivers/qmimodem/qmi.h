@@ -83,6 +83,9 @@ void qmi_device_set_debug(struct qmi_device *device,
 
 void qmi_device_set_close_on_unref(struct qmi_device *device, bool do_close);
 
+bool qmi_device_set_request_timeout(struct qmi_device *device,
+						unsigned int seconds);
+
 bool qmi_device_discover(struct qmi_device *device, qmi_discover_func_t func,
 				void *user_data, qmi_destroy_func_t destroy);
 bool qmi_device_shutdown(struct qmi_device *device, qmi_shutdown_func_t func,
@@ -101,6 +104,11 @@ enum qmi_device_expected_data_format qmi_device_get_expected_data_format(
 bool qmi_device_set_expected_data_format(struct qmi_device *device,
 			enum qmi_device_expected_data_format format);
 
+char *qmi_device_add_mux_link(struct qmi_device *device, uint8_t mux_id,
+							uint32_t max_size);
+bool qmi_device_del_mux_link(struct qmi_device *device, uint8_t mux_id);
+bool qmi_device_get_endpoint(struct qmi_device *device, uint32_t *number);
+
 struct qmi_param;
 
 struct qmi_param *qmi_param_new(void);
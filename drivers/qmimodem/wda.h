@@ -23,3 +23,18 @@
 #define QMI_WDA_DATA_LINK_PROTOCOL_UNKNOWN	0
 #define QMI_WDA_DATA_LINK_PROTOCOL_802_3	1
 #define QMI_WDA_DATA_LINK_PROTOCOL_RAW_IP	2
+
+#define QMI_WDA_UL_DATA_AGG_PROTOCOL	0x12	/* uint32_t */
+#define QMI_WDA_DL_DATA_AGG_PROTOCOL	0x13	/* uint32_t */
+#define QMI_WDA_DL_DATA_AGG_MAX_DATAGRAMS	0x15	/* uint32_t */
+#define QMI_WDA_DL_DATA_AGG_MAX_SIZE	0x16	/* uint32_t */
+#define QMI_WDA_ENDPOINT_INFO		0x17	/* Set only */
+struct qmi_wda_endpoint_info {
+	uint32_t type;
+	uint32_t interface;
+} __attribute__((__packed__));
+
+#define QMI_WDA_DATA_AGG_PROTOCOL_DISABLED	0
+#define QMI_WDA_DATA_AGG_PROTOCOL_QMAP		5
+
+#define QMI_WDA_ENDPOINT_TYPE_HSUSB		2
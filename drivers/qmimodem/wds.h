@@ -25,6 +25,7 @@
 #define QMI_WDS_PKT_STATUS_IND	34	/* Packet data connection status indication */
 
 #define QMI_WDS_GET_SETTINGS	45	/* Get the runtime data session settings */
+#define QMI_WDS_BIND_MUX_DATA_PORT	162	/* Bind client to a QMAP mux id */
 
 
 /* Start WDS network interface */
@@ -70,3 +71,7 @@ struct qmi_wds_notify_conn_status {
 #define QMI_WDS_PDP_TYPE_PPP			0x01
 #define QMI_WDS_PDP_TYPE_IPV6			0x02
 #define QMI_WDS_PDP_TYPE_IPV4V6			0x03
+
+/* Bind client to a QMAP mux id */
+#define QMI_WDS_PARAM_ENDPOINT_INFO		0x10	/* type, interface */
+#define QMI_WDS_PARAM_MUX_ID			0x11	/* uint8 */
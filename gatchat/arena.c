@@ -0,0 +1,128 @@
+/*
+ *
+ *  AT chat library with GLib integration
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "arena.h"
+
+#define ARENA_ALIGN(size) (((size) + 7) & ~7U)
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	unsigned int size;
+	unsigned int used;
+	unsigned char data[] __attribute__((aligned(8)));
+};
+
+struct arena {
+	struct arena_chunk *chunks;	/* Current chunk first */
+	unsigned int chunk_size;
+};
+
+static struct arena_chunk *arena_chunk_new(unsigned int size)
+{
+	struct arena_chunk *chunk;
+
+	chunk = g_try_malloc(sizeof(struct arena_chunk) + size);
+	if (chunk == NULL)
+		return NULL;
+
+	chunk->next = NULL;
+	chunk->size = size;
+	chunk->used = 0;
+
+	return chunk;
+}
+
+struct arena *arena_new(unsigned int chunk_size)
+{
+	struct arena *arena;
+
+	arena = g_try_new0(struct arena, 1);
+	if (arena == NULL)
+		return NULL;
+
+	arena->chunk_size = ARENA_ALIGN(chunk_size);
+	arena->chunks = arena_chunk_new(arena->chunk_size);
+	if (arena->chunks == NULL) {
+		g_free(arena);
+		return NULL;
+	}
+
+	return arena;
+}
+
+void arena_free(struct arena *arena)
+{
+	struct arena_chunk *chunk;
+
+	if (arena == NULL)
+		return;
+
+	while ((chunk = arena->chunks)) {
+		arena->chunks = chunk->next;
+		g_free(chunk);
+	}
+
+	g_free(arena);
+}
+
+void *arena_alloc(struct arena *arena, unsigned int size)
+{
+	struct arena_chunk *chunk = arena->chunks;
+	void *ptr;
+
+	size = ARENA_ALIGN(size);
+
+	if (chunk->size - chunk->used < size) {
+		chunk = arena_chunk_new(MAX(size, arena->chunk_size));
+		if (chunk == NULL)
+			return NULL;
+
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+	}
+
+	ptr = chunk->data + chunk->used;
+	chunk->used += size;
+
+	return ptr;
+}
+
+void arena_reset(struct arena *arena)
+{
+	struct arena_chunk *chunk;
+
+	/* The chunk allocated by arena_new is always the last one */
+	while (arena->chunks->next) {
+		chunk = arena->chunks;
+		arena->chunks = chunk->next;
+		g_free(chunk);
+	}
+
+	arena->chunks->used = 0;
+}
@@ -0,0 +1,46 @@
+/*
+ *
+ *  AT chat library with GLib integration
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+struct arena;
+
+/*!
+ * Creates a new bump allocator handing out memory from chunks of
+ * chunk_size bytes.  Requests larger than that get a chunk of their own.
+ */
+struct arena *arena_new(unsigned int chunk_size);
+
+/*!
+ * Frees the arena and all memory allocated from it
+ */
+void arena_free(struct arena *arena);
+
+/*!
+ * Allocates size bytes from the arena, suitably aligned for any type.
+ * The memory stays valid until the next arena_reset or arena_free.
+ * Returns NULL on allocation failure.
+ */
+void *arena_alloc(struct arena *arena, unsigned int size);
+
+/*!
+ * Releases everything allocated from the arena at once.  The first chunk
+ * is kept for reuse, so a warm arena does not touch the heap again.
+ */
+void arena_reset(struct arena *arena);
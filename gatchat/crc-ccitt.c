@@ -59,3 +59,52 @@ const guint16 crc_ccitt_table[256] = {
 	0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330,
 	0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78
 };
+
+/*
+ * crc_ccitt_slice[n][i] is the CRC of byte i followed by n + 1 zero bytes,
+ * which lets crc_ccitt consume four bytes per step.  Derived from
+ * crc_ccitt_table on first use.
+ */
+static guint16 crc_ccitt_slice[3][256];
+static gboolean crc_ccitt_slice_ready;
+
+static void crc_ccitt_slice_init(void)
+{
+	unsigned int i;
+	unsigned int n;
+	guint16 crc;
+
+	for (i = 0; i < 256; i++) {
+		crc = crc_ccitt_table[i];
+
+		for (n = 0; n < 3; n++) {
+			crc = (crc >> 8) ^ crc_ccitt_table[crc & 0xff];
+			crc_ccitt_slice[n][i] = crc;
+		}
+	}
+
+	crc_ccitt_slice_ready = TRUE;
+}
+
+guint16 crc_ccitt(guint16 crc, const guint8 *buffer, gsize len)
+{
+	if (crc_ccitt_slice_ready == FALSE)
+		crc_ccitt_slice_init();
+
+	while (len >= 4) {
+		crc ^= buffer[0] | (buffer[1] << 8);
+
+		crc = crc_ccitt_slice[2][crc & 0xff] ^
+			crc_ccitt_slice[1][crc >> 8] ^
+			crc_ccitt_slice[0][buffer[2]] ^
+			crc_ccitt_table[buffer[3]];
+
+		buffer += 4;
+		len -= 4;
+	}
+
+	while (len--)
+		crc = crc_ccitt_byte(crc, *buffer++);
+
+	return crc;
+}
@@ -33,6 +33,7 @@
 #include <glib.h>
 
 #include "ringbuffer.h"
+#include "arena.h"
 #include "gatchat.h"
 #include "gatio.h"
 
@@ -41,6 +42,8 @@
 #define COMMAND_FLAG_EXPECT_PDU			0x1
 #define COMMAND_FLAG_EXPECT_SHORT_PROMPT	0x2
 
+#define LINE_ARENA_CHUNK_SIZE	4096
+
 struct at_chat;
 static void chat_wakeup_writer(struct at_chat *chat);
 
@@ -56,6 +59,11 @@ struct at_command {
 	GAtNotifyFunc listing;
 	gpointer user_data;
 	GDestroyNotify notify;
+	GAtChatPriority priority;
+	guint timeout;				/* msec, 0 for no timeout */
+	gint64 queued_time;			/* usec, monotonic */
+	gint64 sent_time;			/* First byte written */
+	gint64 response_time;			/* First byte received */
 };
 
 struct at_notify_node {
@@ -75,6 +83,18 @@ struct at_notify {
 	gboolean pdu;
 };
 
+/*
+ * Character trie over the registered notification prefixes, so that an
+ * incoming line only visits the prefixes it actually starts with.  Children
+ * are kept as a sibling list, the fan-out per character is small.
+ */
+struct at_notify_trie {
+	char c;
+	struct at_notify *notify;		/* Set if a prefix ends here */
+	struct at_notify_trie *child;
+	struct at_notify_trie *next;
+};
+
 struct terminator_info {
 	char *terminator;
 	int len;
@@ -119,6 +139,85 @@ static void at_notify_destroy(gpointer user_data)
 	g_free(notify);
 }
 
+static struct at_notify_trie *at_notify_trie_child(struct at_notify_trie *node,
+							char c)
+{
+	struct at_notify_trie *child;
+
+	for (child = node->child; child; child = child->next)
+		if (child->c == c)
+			return child;
+
+	return NULL;
+}
+
+static gboolean at_notify_trie_insert(struct at_notify_trie *node,
+					const char *prefix,
+					struct at_notify *notify)
+{
+	struct at_notify_trie *child;
+
+	for (; *prefix; prefix++) {
+		child = at_notify_trie_child(node, *prefix);
+
+		if (child == NULL) {
+			child = g_try_new0(struct at_notify_trie, 1);
+			if (child == NULL)
+				return FALSE;
+
+			child->c = *prefix;
+			child->next = node->child;
+			node->child = child;
+		}
+
+		node = child;
+	}
+
+	node->notify = notify;
+
+	return TRUE;
+}
+
+static void at_notify_trie_remove(struct at_notify_trie *node,
+					const char *prefix)
+{
+	struct at_notify_trie **link;
+	struct at_notify_trie *child;
+
+	if (*prefix == '\0') {
+		node->notify = NULL;
+		return;
+	}
+
+	for (link = &node->child; *link; link = &(*link)->next)
+		if ((*link)->c == *prefix)
+			break;
+
+	child = *link;
+	if (child == NULL)
+		return;
+
+	at_notify_trie_remove(child, prefix + 1);
+
+	/* Prune branches that no longer lead to any prefix */
+	if (child->notify == NULL && child->child == NULL) {
+		*link = child->next;
+		g_free(child);
+	}
+}
+
+static void at_notify_trie_free(struct at_notify_trie *node)
+{
+	struct at_notify_trie *next;
+
+	while (node) {
+		next = node->next;
+		at_notify_trie_free(node->child);
+		g_free(node);
+		node = next;
+	}
+}
+
 static gint at_command_compare_by_id(gconstpointer a, gconstpointer b)
 {
 	const struct at_command *command = a;
@@ -185,8 +284,10 @@ static gboolean at_chat_unregister_all(struct at_chat *chat,
 			g_slist_free_1(t);
 		}
 
-		if (notify->nodes == NULL)
+		if (notify->nodes == NULL) {
+			at_notify_trie_remove(chat->notify_trie, key);
 			g_hash_table_iter_remove(&iter);
+		}
 	}
 
 	return TRUE;
@@ -298,17 +399,18 @@ static void chat_cleanup(struct at_chat *chat)
 	chat->command_queue = NULL;
 
 	/* Cleanup any response lines we have pending */
-	g_slist_free_full(chat->response_lines, g_free);
 	chat->response_lines = NULL;
+	chat->pdu_notify = NULL;
+
+	arena_free(chat->line_arena);
+	chat->line_arena = NULL;
 
 	/* Cleanup registered notifications */
 	g_hash_table_destroy(chat->notify_list);
 	chat->notify_list = NULL;
 
-	if (chat->pdu_notify) {
-		g_free(chat->pdu_notify);
-		chat->pdu_notify = NULL;
-	}
+	at_notify_trie_free(chat->notify_trie);
+	chat->notify_trie = NULL;
 
 	if (chat->wakeup) {
 		g_free(chat->wakeup);
@@ -325,6 +427,16 @@ static void chat_cleanup(struct at_chat *chat)
 		chat->timeout_source = 0;
 	}
 
+	if (chat->cmd_timeout_source) {
+		g_source_remove(chat->cmd_timeout_source);
+		chat->cmd_timeout_source = 0;
+	}
+
+	if (chat->stale_source) {
+		g_source_remove(chat->stale_source);
+		chat->stale_source = 0;
+	}
+
 	g_at_syntax_unref(chat->syntax);
 	chat->syntax = NULL;
 
@@ -356,51 +468,106 @@ static void at_notify_call_callback(gpointer data, gpointer user_data)
 
 static gboolean at_chat_match_notify(struct at_chat *chat, char *line)
 {
-	GHashTableIter iter;
+	struct at_notify_trie *node = chat->notify_trie;
 	struct at_notify *notify;
-	gpointer key, value;
+	const char *p = line;
 	gboolean ret = FALSE;
+	gboolean pdu = FALSE;
 	GAtResult result;
+	GSList lines;
 
-	g_hash_table_iter_init(&iter, chat->notify_list);
-	result.lines = 0;
+	lines.data = line;
+	lines.next = NULL;
+
+	result.lines = &lines;
 	result.final_or_pdu = 0;
 
 	chat->in_notify = TRUE;
 
-	while (g_hash_table_iter_next(&iter, &key, &value)) {
-		notify = value;
-
-		if (!g_str_has_prefix(line, key))
-			continue;
+	/*
+	 * Walk down the trie along the line, every node carrying a notify
+	 * on the way is a registered prefix of this line
+	 */
+	while (node) {
+		notify = node->notify;
 
-		if (notify->pdu) {
+		if (notify && notify->pdu) {
 			chat->pdu_notify = line;
 
 			if (chat->syntax->set_hint)
 				chat->syntax->set_hint(chat->syntax,
 							G_AT_SYNTAX_EXPECT_PDU);
-			return TRUE;
+			pdu = TRUE;
+			break;
+		}
+
+		if (notify) {
+			g_slist_foreach(notify->nodes, at_notify_call_callback,
+						&result);
+			ret = TRUE;
 		}
 
-		if (result.lines == NULL)
-			result.lines = g_slist_prepend(NULL, line);
+		if (*p == '\0')
+			break;
 
-		g_slist_foreach(notify->nodes, at_notify_call_callback,
-					&result);
-		ret = TRUE;
+		node = at_notify_trie_child(node, *p++);
 	}
 
 	chat->in_notify = FALSE;
 
-	if (ret) {
-		g_slist_free(result.lines);
-		g_free(line);
-
+	if (ret)
 		at_chat_unregister_all(chat, FALSE, node_is_destroyed, NULL);
+
+	return ret || pdu;
+}
+
+static void latency_record(guint *histogram, gint64 usec)
+{
+	guint msec = usec / 1000;
+	int bucket = 0;
+
+	/* Bucket n holds samples in [2^(n-1), 2^n) ms, the last overflows */
+	while (msec && bucket < G_AT_CHAT_LATENCY_BUCKETS - 1) {
+		msec >>= 1;
+		bucket += 1;
 	}
 
-	return ret;
+	histogram[bucket] += 1;
+}
+
+static void at_command_record_latency(struct at_chat *p,
+					struct at_command *cmd)
+{
+	gint64 now = g_get_monotonic_time();
+	GAtChatLatency *latency = &p->latency;
+
+	/* Wakeup commands are not interesting, nor is anything never sent */
+	if (cmd->id == 0 || cmd->sent_time == 0)
+		return;
+
+	latency_record(latency->queue_wait,
+				cmd->sent_time - cmd->queued_time);
+
+	if (cmd->response_time)
+		latency_record(latency->first_byte,
+				cmd->response_time - cmd->sent_time);
+
+	latency_record(latency->final, now - cmd->sent_time);
+
+	if (p->debugf) {
+		char *str;
+		int len = strcspn(cmd->cmd, "\r\032");
+
+		str = g_strdup_printf("%.*s: wait %u ms, first byte %d ms, "
+					"final %u ms", len, cmd->cmd,
+			(guint) ((cmd->sent_time - cmd->queued_time) / 1000),
+			cmd->response_time ?
+			(int) ((cmd->response_time - cmd->sent_time) / 1000) :
+			-1,
+			(guint) ((now - cmd->sent_time) / 1000));
+		p->debugf(str, p->debug_data);
+		g_free(str);
+	}
 }
 
 static void at_chat_finish_command(struct at_chat *p, gboolean ok, char *final)
@@ -412,6 +579,13 @@ static void at_chat_finish_command(struct at_chat *p, gboolean ok, char *final)
 	if (cmd == NULL)
 		return;
 
+	if (p->cmd_timeout_source) {
+		g_source_remove(p->cmd_timeout_source);
+		p->cmd_timeout_source = 0;
+	}
+
+	at_command_record_latency(p, cmd);
+
 	p->cmd_bytes_written = 0;
 
 	if (g_queue_peek_head(p->command_queue))
@@ -431,9 +605,7 @@ static void at_chat_finish_command(struct at_chat *p, gboolean ok, char *final)
 		cmd->callback(ok, &result, cmd->user_data);
 	}
 
-	g_slist_free_full(response_lines, g_free);
-
-	g_free(final);
+	/* The lines and the final response live in the line arena */
 	at_command_destroy(cmd);
 }
 
@@ -489,6 +661,52 @@ static gboolean check_terminator(struct terminator_info *info, char *line)
 	return FALSE;
 }
 
+static gboolean at_chat_is_final(struct at_chat *p, char *line)
+{
+	int size = sizeof(terminator_table) / sizeof(struct terminator_info);
+	int i;
+	GSList *l;
+
+	for (i = 0; i < size; i++) {
+		if (check_terminator(&terminator_table[i], line) &&
+				(p->terminator_blacklist & 1 << i) == 0)
+			return TRUE;
+	}
+
+	for (l = p->terminator_list; l; l = l->next) {
+		if (check_terminator(l->data, line))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void at_chat_end_stale(struct at_chat *p)
+{
+	if (p->stale_source) {
+		g_source_remove(p->stale_source);
+		p->stale_source = 0;
+	}
+
+	if (g_queue_peek_head(p->command_queue))
+		chat_wakeup_writer(p);
+}
+
+static gboolean stale_final_timeout(gpointer user_data)
+{
+	struct at_chat *chat = user_data;
+
+	chat->stale_source = 0;
+
+	if (chat->debugf)
+		chat->debugf("No late final response, moving on",
+							chat->debug_data);
+
+	at_chat_end_stale(chat);
+
+	return FALSE;
+}
+
 static gboolean at_chat_handle_command_response(struct at_chat *p,
 							struct at_command *cmd,
 							char *line)
@@ -550,16 +768,26 @@ out:
 
 	if (cmd->listing) {
 		GAtResult result;
+		GSList lines;
 
-		result.lines = g_slist_prepend(NULL, line);
+		lines.data = line;
+		lines.next = NULL;
+
+		result.lines = &lines;
 		result.final_or_pdu = NULL;
 
 		cmd->listing(&result, cmd->user_data);
+	} else {
+		GSList *l = arena_alloc(p->line_arena, sizeof(GSList));
 
-		g_slist_free(result.lines);
-		g_free(line);
-	} else
-		p->response_lines = g_slist_prepend(p->response_lines, line);
+		/* Out of memory, drop the line like extract_line would */
+		if (l == NULL)
+			return TRUE;
+
+		l->data = line;
+		l->next = p->response_lines;
+		p->response_lines = l;
+	}
 
 	return TRUE;
 }
@@ -576,6 +804,19 @@ static void have_line(struct at_chat *p, char *str)
 	if (!strncmp(str, "AT", 2))
 		goto done;
 
+	/* Whatever still comes for a timed out command is not for the next */
+	if (p->stale_source) {
+		if (at_chat_is_final(p, str)) {
+			at_chat_end_stale(p);
+			goto done;
+		}
+
+		if (at_chat_match_notify(p, str) == TRUE)
+			return;
+
+		goto done;
+	}
+
 	cmd = g_queue_peek_head(p->command_queue);
 
 	if (cmd && p->cmd_bytes_written > 0) {
@@ -604,33 +845,30 @@ static void have_line(struct at_chat *p, char *str)
 done:
 	printf("ignoring line\n");
 	/* No matches & no commands active, ignore line */
-	g_free(str);
 }
 
 static void have_notify_pdu(struct at_chat *p, char *pdu, GAtResult *result)
 {
-	GHashTableIter iter;
+	struct at_notify_trie *node = p->notify_trie;
 	struct at_notify *notify;
-	char *prefix;
-	gpointer key, value;
+	const char *c = p->pdu_notify;
 	gboolean called = FALSE;
 
 	p->in_notify = TRUE;
 
-	g_hash_table_iter_init(&iter, p->notify_list);
-
-	while (g_hash_table_iter_next(&iter, &key, &value)) {
-		prefix = key;
-		notify = value;
+	while (node) {
+		notify = node->notify;
 
-		if (!g_str_has_prefix(p->pdu_notify, prefix))
-			continue;
+		if (notify && notify->pdu) {
+			g_slist_foreach(notify->nodes, at_notify_call_callback,
+						result);
+			called = TRUE;
+		}
 
-		if (!notify->pdu)
-			continue;
+		if (*c == '\0')
+			break;
 
-		g_slist_foreach(notify->nodes, at_notify_call_callback, result);
-		called = TRUE;
+		node = at_notify_trie_child(node, *c++);
 	}
 
 	p->in_notify = FALSE;
@@ -643,12 +881,16 @@ static void have_pdu(struct at_chat *p, char *pdu)
 {
 	struct at_command *cmd;
 	GAtResult result;
+	GSList lines;
 	gboolean listing_pdu = FALSE;
 
 	if (pdu == NULL)
 		goto error;
 
-	result.lines = g_slist_prepend(NULL, p->pdu_notify);
+	lines.data = p->pdu_notify;
+	lines.next = NULL;
+
+	result.lines = &lines;
 	result.final_or_pdu = pdu;
 
 	cmd = g_queue_peek_head(p->command_queue);
@@ -670,55 +912,115 @@ static void have_pdu(struct at_chat *p, char *pdu)
 	} else
 		have_notify_pdu(p, pdu, &result);
 
-	g_slist_free(result.lines);
-
 error:
-	g_free(p->pdu_notify);
+	/* Both the PDU and its notification line live in the line arena */
 	p->pdu_notify = NULL;
+}
+
+/*
+ * Returns the offset of the CR or LF ending the line in buf, or len if the
+ * line continues past it.  Line endings inside quoted strings do not count,
+ * in_string carries the quoting state over the ring buffer wrap.
+ */
+static unsigned int scan_line_end(const unsigned char *buf, unsigned int len,
+					gboolean *in_string)
+{
+	const unsigned char *end = buf + len;
+	const unsigned char *p = buf;
+	const unsigned char *eol;
+	const unsigned char *lf;
+	const unsigned char *quote;
+
+	while (p < end) {
+		if (*in_string) {
+			quote = memchr(p, '"', end - p);
+			if (quote == NULL)
+				return len;
+
+			*in_string = FALSE;
+			p = quote + 1;
+			continue;
+		}
 
-	if (pdu)
-		g_free(pdu);
+		eol = memchr(p, '\r', end - p);
+		if (eol == NULL)
+			eol = end;
+
+		lf = memchr(p, '\n', eol - p);
+		if (lf)
+			eol = lf;
+
+		quote = memchr(p, '"', eol - p);
+		if (quote == NULL)
+			return eol - buf;
+
+		*in_string = TRUE;
+		p = quote + 1;
+	}
+
+	return len;
 }
 
 static char *extract_line(struct at_chat *p, struct ring_buffer *rbuf)
 {
 	unsigned int wrap = ring_buffer_len_no_wrap(rbuf);
 	unsigned int pos = 0;
-	unsigned char *buf = ring_buffer_read_ptr(rbuf, pos);
+	unsigned char *buf;
 	gboolean in_string = FALSE;
 	int strip_front = 0;
 	int line_length = 0;
+	unsigned int end;
 	char *line;
 
+	/* Skip the CR / LF left over from the previous line */
 	while (pos < p->read_so_far) {
-		if (in_string == FALSE && (*buf == '\r' || *buf == '\n')) {
-			if (!line_length)
-				strip_front += 1;
-			else
-				break;
-		} else {
-			if (*buf == '"')
-				in_string = !in_string;
+		buf = ring_buffer_read_ptr(rbuf, pos);
 
-			line_length += 1;
-		}
+		if (*buf != '\r' && *buf != '\n')
+			break;
 
-		buf += 1;
 		pos += 1;
+	}
+
+	strip_front = pos;
+	wrap = MIN(wrap, p->read_so_far);
+
+	if (pos < wrap) {
+		buf = ring_buffer_read_ptr(rbuf, pos);
+		end = pos + scan_line_end(buf, wrap - pos, &in_string);
+
+		if (end < wrap)
+			goto out;
 
-		if (pos == wrap)
-			buf = ring_buffer_read_ptr(rbuf, pos);
+		pos = wrap;
 	}
 
-	line = g_try_new(char, line_length + 1);
+	buf = ring_buffer_read_ptr(rbuf, pos);
+	end = pos + scan_line_end(buf, p->read_so_far - pos, &in_string);
+
+out:
+	line_length = end - strip_front;
+
+	/*
+	 * Lines are bump allocated, recycle the arena once nothing from it
+	 * is referenced anymore: no response lines collected for the current
+	 * command, no notification waiting for its PDU and no line being
+	 * dispatched further up the stack.
+	 */
+	if (p->dispatch_depth == 0 && p->response_lines == NULL &&
+			p->pdu_notify == NULL)
+		arena_reset(p->line_arena);
+
+	line = arena_alloc(p->line_arena, line_length + 1);
 	if (line == NULL) {
-		ring_buffer_drain(rbuf, p->read_so_far);
+		g_at_io_drain_ring_buffer(p->io, p->read_so_far);
 		return NULL;
 	}
 
-	ring_buffer_drain(rbuf, strip_front);
+	g_at_io_drain_ring_buffer(p->io, strip_front);
 	ring_buffer_read(rbuf, line, line_length);
-	ring_buffer_drain(rbuf, p->read_so_far - strip_front - line_length);
+	g_at_io_drain_ring_buffer(p->io,
+				p->read_so_far - strip_front - line_length);
 
 	line[line_length] = '\0';
 
@@ -733,6 +1035,10 @@ static void new_bytes(struct ring_buffer *rbuf, gpointer user_data)
 	unsigned char *buf = ring_buffer_read_ptr(rbuf, p->read_so_far);
 
 	GAtSyntaxResult result;
+	struct at_command *cmd = g_queue_peek_head(p->command_queue);
+
+	if (cmd && p->cmd_bytes_written > 0 && cmd->response_time == 0)
+		cmd->response_time = g_get_monotonic_time();
 
 	p->in_read_handler = TRUE;
 
@@ -751,6 +1057,8 @@ static void new_bytes(struct ring_buffer *rbuf, gpointer user_data)
 		if (result == G_AT_SYNTAX_RESULT_UNSURE)
 			continue;
 
+		p->dispatch_depth += 1;
+
 		switch (result) {
 		case G_AT_SYNTAX_RESULT_LINE:
 		case G_AT_SYNTAX_RESULT_MULTILINE:
@@ -763,14 +1071,16 @@ static void new_bytes(struct ring_buffer *rbuf, gpointer user_data)
 
 		case G_AT_SYNTAX_RESULT_PROMPT:
 			chat_wakeup_writer(p);
-			ring_buffer_drain(rbuf, p->read_so_far);
+			g_at_io_drain_ring_buffer(p->io, p->read_so_far);
 			break;
 
 		default:
-			ring_buffer_drain(rbuf, p->read_so_far);
+			g_at_io_drain_ring_buffer(p->io, p->read_so_far);
 			break;
 		}
 
+		p->dispatch_depth -= 1;
+
 		len -= p->read_so_far;
 		wrap -= p->read_so_far;
 		p->read_so_far = 0;
@@ -822,6 +1132,57 @@ static gboolean wakeup_no_response(gpointer user_data)
 	return TRUE;
 }
 
+static char timeout_final[] = "ERROR";
+
+static gboolean command_timeout(gpointer user_data)
+{
+	struct at_chat *chat = user_data;
+	struct at_command *cmd = g_queue_peek_head(chat->command_queue);
+
+	chat->cmd_timeout_source = 0;
+
+	if (cmd == NULL)
+		return FALSE;
+
+	chat->latency.timeouts += 1;
+
+	if (chat->debugf) {
+		int len = strcspn(cmd->cmd, "\r\032");
+		char *str = g_strdup_printf("%.*s: timed out after %u ms",
+						len, cmd->cmd, cmd->timeout);
+
+		chat->debugf(str, chat->debug_data);
+		g_free(str);
+	}
+
+	/*
+	 * Fail the command so that the commands queued behind it get a
+	 * chance to run.  Its final response may still be on the way, give
+	 * it another timeout before sending the next command.
+	 */
+	chat->stale_source = g_timeout_add(cmd->timeout,
+						stale_final_timeout, chat);
+
+	at_chat_finish_command(chat, FALSE, timeout_final);
+
+	return FALSE;
+}
+
+static void at_command_start_timer(struct at_chat *chat,
+					struct at_command *cmd)
+{
+	if (chat->cmd_timeout_source) {
+		g_source_remove(chat->cmd_timeout_source);
+		chat->cmd_timeout_source = 0;
+	}
+
+	if (cmd->timeout == 0)
+		return;
+
+	chat->cmd_timeout_source = g_timeout_add(cmd->timeout,
+							command_timeout, chat);
+}
+
 static gboolean can_write_data(gpointer data)
 {
 	struct at_chat *chat = data;
@@ -844,6 +1205,10 @@ static gboolean can_write_data(gpointer data)
 	if (cmd == NULL)
 		return FALSE;
 
+	/* The timed out command before it might still answer */
+	if (chat->stale_source)
+		return FALSE;
+
 	len = strlen(cmd->cmd);
 
 	/* For some reason write watcher fired, but we've already
@@ -879,6 +1244,11 @@ static gboolean can_write_data(gpointer data)
 						wakeup_no_response, chat);
 	}
 
+	if (chat->cmd_bytes_written == 0) {
+		cmd->sent_time = g_get_monotonic_time();
+		at_command_start_timer(chat, cmd);
+	}
+
 	towrite = len - chat->cmd_bytes_written;
 
 	cr = strchr(cmd->cmd + chat->cmd_bytes_written, '\r');
@@ -938,6 +1308,16 @@ static void at_chat_suspend(struct at_chat *chat)
 {
 	chat->suspended = TRUE;
 
+	if (chat->cmd_timeout_source) {
+		g_source_remove(chat->cmd_timeout_source);
+		chat->cmd_timeout_source = 0;
+	}
+
+	if (chat->stale_source) {
+		g_source_remove(chat->stale_source);
+		chat->stale_source = 0;
+	}
+
 	g_at_io_set_write_handler(chat->io, NULL, NULL);
 	g_at_io_set_read_handler(chat->io, NULL, NULL);
 	g_at_io_set_debug(chat->io, NULL, NULL);
@@ -957,8 +1337,15 @@ static void at_chat_resume(struct at_chat *chat)
 	g_at_io_set_debug(chat->io, chat->debugf, chat->debug_data);
 	g_at_io_set_read_handler(chat->io, new_bytes, chat);
 
-	if (g_queue_get_length(chat->command_queue) > 0)
+	if (g_queue_get_length(chat->command_queue) > 0) {
+		struct at_command *cmd = g_queue_peek_head(chat->command_queue);
+
+		/* Restart the deadline of a command already on the wire */
+		if (chat->cmd_bytes_written > 0)
+			at_command_start_timer(chat, cmd);
+
 		chat_wakeup_writer(chat);
+	}
 }
 
 static void at_chat_unref(struct at_chat *chat)
@@ -1021,10 +1408,42 @@ static gboolean at_chat_set_wakeup_command(struct at_chat *chat,
 	return TRUE;
 }
 
+static void at_chat_queue_command(struct at_chat *chat, struct at_command *c)
+{
+	GList *l = g_queue_peek_head_link(chat->command_queue);
+	struct at_command *queued;
+
+	/*
+	 * Never jump ahead of a command already on the wire, nor of a
+	 * wakeup command which must go out first
+	 */
+	if (l) {
+		queued = l->data;
+
+		if (chat->cmd_bytes_written > 0 || queued->id == 0)
+			l = l->next;
+	}
+
+	/* Keep FIFO order within a priority class */
+	for (; l; l = l->next) {
+		queued = l->data;
+
+		if (queued->priority > c->priority)
+			break;
+	}
+
+	if (l)
+		g_queue_insert_before(chat->command_queue, l, c);
+	else
+		g_queue_push_tail(chat->command_queue, c);
+}
+
 static guint at_chat_send_common(struct at_chat *chat, guint gid,
+					GAtChatPriority priority,
 					const char *cmd,
 					const char **prefix_list,
 					guint flags,
+					guint timeout,
 					GAtNotifyFunc listing,
 					GAtResultFunc func,
 					gpointer user_data,
@@ -1043,8 +1462,11 @@ static guint at_chat_send_common(struct at_chat *chat, guint gid,
 		return 0;
 
 	c->id = chat->next_cmd_id++;
+	c->priority = priority;
+	c->timeout = timeout;
+	c->queued_time = g_get_monotonic_time();
 
-	g_queue_push_tail(chat->command_queue, c);
+	at_chat_queue_command(chat, c);
 
 	if (g_queue_get_length(chat->command_queue) == 1)
 		chat_wakeup_writer(chat);
@@ -1061,16 +1483,24 @@ static struct at_notify *at_notify_create(struct at_chat *chat,
 
 	key = g_strdup(prefix);
 	if (key == NULL)
-		return 0;
+		return NULL;
 
 	notify = g_try_new0(struct at_notify, 1);
 	if (notify == NULL) {
 		g_free(key);
-		return 0;
+		return NULL;
 	}
 
 	notify->pdu = pdu;
 
+	if (at_notify_trie_insert(chat->notify_trie, key, notify) == FALSE) {
+		/* Drop the nodes added before running out of memory */
+		at_notify_trie_remove(chat->notify_trie, key);
+		g_free(notify);
+		g_free(key);
+		return NULL;
+	}
+
 	g_hash_table_insert(chat->notify_list, key, notify);
 
 	return notify;
@@ -1236,8 +1666,10 @@ static gboolean at_chat_unregister(struct at_chat *chat, gboolean mark_only,
 		at_notify_node_destroy(node, NULL);
 		notify->nodes = g_slist_remove(notify->nodes, node);
 
-		if (notify->nodes == NULL)
+		if (notify->nodes == NULL) {
+			at_notify_trie_remove(chat->notify_trie, key);
 			g_hash_table_iter_remove(&iter);
+		}
 
 		return TRUE;
 	}
@@ -1286,6 +1718,10 @@ static struct at_chat *create_chat(GIOChannel *channel, GIOFlags flags,
 
 	g_at_io_set_disconnect_function(chat->io, io_disconnect, chat);
 
+	chat->line_arena = arena_new(LINE_ARENA_CHUNK_SIZE);
+	if (chat->line_arena == NULL)
+		goto error;
+
 	chat->command_queue = g_queue_new();
 	if (chat->command_queue == NULL)
 		goto error;
@@ -1293,6 +1729,10 @@ static struct at_chat *create_chat(GIOChannel *channel, GIOFlags flags,
 	chat->notify_list = g_hash_table_new_full(g_str_hash, g_str_equal,
 						g_free, at_notify_destroy);
 
+	chat->notify_trie = g_try_new0(struct at_notify_trie, 1);
+	if (chat->notify_trie == NULL)
+		goto error;
+
 	g_at_io_set_read_handler(chat->io, new_bytes, chat);
 
 	chat->syntax = g_at_syntax_ref(syntax);
@@ -1308,6 +1748,9 @@ error:
 	if (chat->notify_list)
 		g_hash_table_destroy(chat->notify_list);
 
+	arena_free(chat->line_arena);
+	at_notify_trie_free(chat->notify_trie);
+
 	g_free(chat);
 	return NULL;
 }
@@ -1328,6 +1771,7 @@ static GAtChat *g_at_chat_new_common(GIOChannel *channel, GIOFlags flags,
 	}
 
 	chat->group = chat->parent->next_gid++;
+	chat->priority = G_AT_CHAT_PRIORITY_DEFAULT;
 	chat->ref_count = 1;
 
 	return chat;
@@ -1356,6 +1800,7 @@ GAtChat *g_at_chat_clone(GAtChat *clone)
 
 	chat->parent = clone->parent;
 	chat->group = chat->parent->next_gid++;
+	chat->priority = G_AT_CHAT_PRIORITY_DEFAULT;
 	chat->ref_count = 1;
 	g_atomic_int_inc(&chat->parent->ref_count);
 
@@ -1491,6 +1936,14 @@ void g_at_chat_blacklist_terminator(GAtChat *chat,
 	at_chat_blacklist_terminator(chat->parent, terminator);
 }
 
+void g_at_chat_set_priority(GAtChat *chat, GAtChatPriority priority)
+{
+	if (chat == NULL)
+		return;
+
+	chat->priority = priority;
+}
+
 gboolean g_at_chat_set_wakeup_command(GAtChat *chat, const char *cmd,
 					unsigned int timeout, unsigned int msec)
 {
@@ -1504,8 +1957,8 @@ guint g_at_chat_send(GAtChat *chat, const char *cmd,
 			const char **prefix_list, GAtResultFunc func,
 			gpointer user_data, GDestroyNotify notify)
 {
-	return at_chat_send_common(chat->parent, chat->group,
-					cmd, prefix_list, 0, NULL,
+	return at_chat_send_common(chat->parent, chat->group, chat->priority,
+					cmd, prefix_list, 0, 0, NULL,
 					func, user_data, notify);
 }
 
@@ -1517,8 +1970,8 @@ guint g_at_chat_send_listing(GAtChat *chat, const char *cmd,
 	if (listing == NULL)
 		return 0;
 
-	return at_chat_send_common(chat->parent, chat->group,
-					cmd, prefix_list, 0,
+	return at_chat_send_common(chat->parent, chat->group, chat->priority,
+					cmd, prefix_list, 0, 0,
 					listing, func, user_data, notify);
 }
 
@@ -1530,9 +1983,9 @@ guint g_at_chat_send_pdu_listing(GAtChat *chat, const char *cmd,
 	if (listing == NULL)
 		return 0;
 
-	return at_chat_send_common(chat->parent, chat->group,
+	return at_chat_send_common(chat->parent, chat->group, chat->priority,
 					cmd, prefix_list,
-					COMMAND_FLAG_EXPECT_PDU,
+					COMMAND_FLAG_EXPECT_PDU, 0,
 					listing, func, user_data, notify);
 }
 
@@ -1542,9 +1995,20 @@ guint g_at_chat_send_and_expect_short_prompt(GAtChat *chat, const char *cmd,
 						gpointer user_data,
 						GDestroyNotify notify)
 {
-	return at_chat_send_common(chat->parent, chat->group,
+	return at_chat_send_common(chat->parent, chat->group, chat->priority,
 					cmd, prefix_list,
-					COMMAND_FLAG_EXPECT_SHORT_PROMPT,
+					COMMAND_FLAG_EXPECT_SHORT_PROMPT, 0,
+					NULL, func, user_data, notify);
+}
+
+guint g_at_chat_send_with_timeout(GAtChat *chat, const char *cmd,
+					const char **prefix_list,
+					guint timeout, GAtResultFunc func,
+					gpointer user_data,
+					GDestroyNotify notify)
+{
+	return at_chat_send_common(chat->parent, chat->group, chat->priority,
+					cmd, prefix_list, 0, timeout,
 					NULL, func, user_data, notify);
 }
 
@@ -1604,3 +2068,21 @@ gboolean g_at_chat_unregister_all(GAtChat *chat)
 					node_compare_by_group,
 					GUINT_TO_POINTER(chat->group));
 }
+
+gboolean g_at_chat_get_latency(GAtChat *chat, GAtChatLatency *latency)
+{
+	if (chat == NULL || latency == NULL)
+		return FALSE;
+
+	memcpy(latency, &chat->parent->latency, sizeof(GAtChatLatency));
+
+	return TRUE;
+}
+
+void g_at_chat_reset_latency(GAtChat *chat)
+{
+	if (chat == NULL)
+		return;
+
+	memset(&chat->parent->latency, 0, sizeof(GAtChatLatency));
+}
@@ -54,6 +54,34 @@ enum _GAtChatTerminator {
 
 typedef enum _GAtChatTerminator GAtChatTerminator;
 
+/*
+ * Commands of a higher priority class are sent ahead of any queued
+ * commands of a lower class, the order within a class is preserved
+ */
+enum _GAtChatPriority {
+	G_AT_CHAT_PRIORITY_HIGH,	/* Latency critical, e.g. call control */
+	G_AT_CHAT_PRIORITY_DEFAULT,
+	G_AT_CHAT_PRIORITY_LOW,		/* Bulk, e.g. phonebook listings */
+};
+
+typedef enum _GAtChatPriority GAtChatPriority;
+
+#define G_AT_CHAT_LATENCY_BUCKETS 16
+
+/*
+ * Log2 histograms of command round trip times.  Bucket 0 counts samples
+ * below 1 ms, bucket n samples in [2^(n-1), 2^n) ms and the last bucket
+ * everything above.
+ */
+struct _GAtChatLatency {
+	guint queue_wait[G_AT_CHAT_LATENCY_BUCKETS];	/* Queued to sent */
+	guint first_byte[G_AT_CHAT_LATENCY_BUCKETS];	/* Sent to response */
+	guint final[G_AT_CHAT_LATENCY_BUCKETS];		/* Sent to final */
+	guint timeouts;					/* Commands timed out */
+};
+
+typedef struct _GAtChatLatency GAtChatLatency;
+
 GAtChat *g_at_chat_new(GIOChannel *channel, GAtSyntax *syntax);
 GAtChat *g_at_chat_new_blocking(GIOChannel *channel, GAtSyntax *syntax);
 
@@ -74,6 +102,12 @@ void g_at_chat_resume(GAtChat *chat);
 gboolean g_at_chat_set_disconnect_function(GAtChat *chat,
 			GAtDisconnectFunc disconnect, gpointer user_data);
 
+/*!
+ * Sets the priority class of all commands subsequently queued through this
+ * chat.  Clones start out with G_AT_CHAT_PRIORITY_DEFAULT.
+ */
+void g_at_chat_set_priority(GAtChat *chat, GAtChatPriority priority);
+
 /*!
  * If the function is not NULL, then on every read/write from the GIOChannel
  * provided to GAtChat the logging function will be called with the
@@ -147,6 +181,19 @@ guint g_at_chat_send_and_expect_short_prompt(GAtChat *chat, const char *cmd,
 				const char **valid_resp, GAtResultFunc func,
 				gpointer user_data, GDestroyNotify notify);
 
+/*!
+ * Same as g_at_chat_send except that the command is failed if no final
+ * response arrives within timeout milliseconds after it started being
+ * written to the modem.  The callback is then called with success set to
+ * FALSE and an ERROR final response.  Responses the modem still sends for
+ * the failed command are discarded: the next queued command is only sent
+ * once its late final response arrives, or after another timeout.
+ */
+guint g_at_chat_send_with_timeout(GAtChat *chat, const char *cmd,
+				const char **valid_resp, guint timeout,
+				GAtResultFunc func, gpointer user_data,
+				GDestroyNotify notify);
+
 gboolean g_at_chat_cancel(GAtChat *chat, guint id);
 gboolean g_at_chat_cancel_all(GAtChat *chat);
 
@@ -167,10 +214,14 @@ void g_at_chat_add_terminator(GAtChat *chat, char *terminator,
 void g_at_chat_blacklist_terminator(GAtChat *chat,
 						GAtChatTerminator terminator);
 
+gboolean g_at_chat_get_latency(GAtChat *chat, GAtChatLatency *latency);
+void g_at_chat_reset_latency(GAtChat *chat);
+
 struct _GAtChat {
 	gint ref_count;
 	struct at_chat *parent;
 	guint group;
+	GAtChatPriority priority;
 	GAtChat *slave;
 };
 
@@ -183,6 +234,7 @@ struct at_chat {
 	GQueue *command_queue;			/* Command queue */
 	guint cmd_bytes_written;		/* bytes written from cmd */
 	GHashTable *notify_list;		/* List of notification reg */
+	struct at_notify_trie *notify_trie;	/* Prefix index of notify_list */
 	GAtDisconnectFunc user_disconnect;	/* user disconnect func */
 	gpointer user_disconnect_data;		/* user disconnect data */
 	guint read_so_far;			/* Number of bytes processed */
@@ -191,6 +243,8 @@ struct at_chat {
 	gpointer debug_data;			/* Data to pass to debug func */
 	char *pdu_notify;			/* Unsolicited Resp w/ PDU */
 	GSList *response_lines;			/* char * lines of the response */
+	struct arena *line_arena;		/* Owns lines and list nodes */
+	guint dispatch_depth;			/* Lines being dispatched */
 	char *wakeup;				/* command sent to wakeup modem */
 	gint timeout_source;
 	gdouble inactivity_time;		/* Period of inactivity */
@@ -202,6 +256,9 @@ struct at_chat {
 	gboolean in_notify;
 	GSList *terminator_list;		/* Non-standard terminator */
 	guint16 terminator_blacklist;		/* Blacklisted terinators */
+	guint cmd_timeout_source;		/* Deadline of head command */
+	guint stale_source;			/* Final of a timed out cmd due */
+	GAtChatLatency latency;			/* Round trip statistics */
 };
 
 #ifdef __cplusplus
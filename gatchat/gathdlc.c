@@ -29,6 +29,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <glib.h>
 
@@ -63,6 +64,7 @@ struct _GAtHDLC {
 	gboolean decode_escape;
 	guint32 xmit_accm[8];
 	guint32 recv_accm;
+	guint8 recv_special[256];	/* Bytes the decoder can't copy as-is */
 	GAtReceiveFunc receive_func;
 	gpointer receive_data;
 	GAtDebugFunc debugf;
@@ -143,12 +145,24 @@ void g_at_hdlc_set_recording(GAtHDLC *hdlc, const char *filename)
 					S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
 }
 
+static void update_recv_special(GAtHDLC *hdlc)
+{
+	unsigned int c;
+
+	for (c = 0; c < 0x20; c++)
+		hdlc->recv_special[c] = (hdlc->recv_accm & (1 << c)) != 0;
+
+	hdlc->recv_special[HDLC_FLAG] = TRUE;
+	hdlc->recv_special[HDLC_ESCAPE] = TRUE;
+}
+
 void g_at_hdlc_set_recv_accm(GAtHDLC *hdlc, guint32 accm)
 {
 	if (hdlc == NULL)
 		return;
 
 	hdlc->recv_accm = accm;
+	update_recv_special(hdlc);
 }
 
 guint32 g_at_hdlc_get_recv_accm(GAtHDLC *hdlc)
@@ -272,6 +286,41 @@ static void new_bytes(struct ring_buffer *rbuf, gpointer user_data)
 	hdlc->in_read_handler = TRUE;
 
 	while (pos < len) {
+		/*
+		 * Fast path, the run of bytes up to the next flag, escape
+		 * or ACCM mapped character is copied in bulk.  Everything
+		 * else goes through the byte by byte loop below.
+		 */
+		if (hdlc->decode_escape == FALSE && !(hdlc->no_carrier_detect &&
+						hdlc->decode_offset == 0)) {
+			unsigned int end = pos < wrap ? wrap : len;
+			unsigned int max = MIN(end - pos,
+					BUFFER_SIZE - hdlc->decode_offset);
+			unsigned int run = 0;
+
+			while (run < max && !hdlc->recv_special[buf[run]])
+				run++;
+
+			if (run > 0) {
+				memcpy(hdlc->decode_buffer + hdlc->decode_offset,
+								buf, run);
+				hdlc->decode_fcs = crc_ccitt(hdlc->decode_fcs,
+								buf, run);
+				hdlc->decode_offset += run;
+
+				buf += run;
+				pos += run;
+
+				if (pos == wrap) {
+					buf = ring_buffer_read_ptr(rbuf, pos);
+					hdlc_record(hdlc, TRUE, buf,
+							len - wrap);
+				}
+
+				continue;
+			}
+		}
+
 		/*
 		 * We try to detect NO CARRIER conditions here.  We
 		 * (ab) use the fact that a HDLC_FLAG must be followed
@@ -320,7 +369,7 @@ static void new_bytes(struct ring_buffer *rbuf, gpointer user_data)
 	}
 
 out:
-	ring_buffer_drain(rbuf, pos);
+	g_at_io_drain_ring_buffer(hdlc->io, pos);
 
 	hdlc->in_read_handler = FALSE;
 
@@ -348,6 +397,7 @@ GAtHDLC *g_at_hdlc_new_from_io(GAtIO *io)
 	hdlc->xmit_accm[0] = ~0U;
 	hdlc->xmit_accm[3] = 0x60000000; /* 0x7d, 0x7e */
 	hdlc->recv_accm = ~0U;
+	update_recv_special(hdlc);
 
 	write_buffer = ring_buffer_new(BUFFER_SIZE);
 	if (!write_buffer)
@@ -440,7 +490,8 @@ void g_at_hdlc_unref(GAtHDLC *hdlc)
 
 	g_free(hdlc->decode_buffer);
 
-	g_timer_destroy(hdlc->timer);
+	if (hdlc->timer)
+		g_timer_destroy(hdlc->timer);
 
 	if (hdlc->in_read_handler)
 		hdlc->destroyed = TRUE;
@@ -528,7 +579,7 @@ GAtIO *g_at_hdlc_get_io(GAtHDLC *hdlc)
 	return hdlc->io;
 }
 
-#define NEED_ESCAPE(xmit_accm, c) xmit_accm[c >> 5] & (1 << (c & 0x1f))
+#define NEED_ESCAPE(xmit_accm, c) (xmit_accm[(c) >> 5] & (1 << ((c) & 0x1f)))
 
 gboolean g_at_hdlc_send(GAtHDLC *hdlc, const unsigned char *data, gsize size)
 {
@@ -579,6 +630,32 @@ gboolean g_at_hdlc_send(GAtHDLC *hdlc, const unsigned char *data, gsize size)
 	}
 
 	while (pos < avail && i < size) {
+		/* Fast path, copy the run of bytes needing no escape in bulk */
+		if (escape == FALSE) {
+			unsigned int end = pos < wrap ? wrap : avail;
+			gsize max = MIN(size - i, end - pos);
+			gsize run = 0;
+
+			while (run < max &&
+				!NEED_ESCAPE(hdlc->xmit_accm, data[i + run]))
+				run++;
+
+			if (run > 0) {
+				memcpy(buf, data + i, run);
+				fcs = crc_ccitt(fcs, data + i, run);
+
+				i += run;
+				buf += run;
+				pos += run;
+
+				if (pos == wrap)
+					buf = ring_buffer_write_ptr(write_buffer,
+									pos);
+
+				continue;
+			}
+		}
+
 		if (escape == TRUE) {
 			fcs = HDLC_FCS(fcs, data[i]);
 			*buf = data[i++] ^ HDLC_TRANS;
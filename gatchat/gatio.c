@@ -29,17 +29,32 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <sys/uio.h>
 
 #include <glib.h>
 
 #include "ringbuffer.h"
 #include "gatio.h"
 #include "gatutil.h"
+#include "gatmux.h"
+
+#define IO_BUFFER_SIZE		8192
+#define IO_BUFFER_MAX_SIZE	(16 * IO_BUFFER_SIZE)
 
 static void read_watcher_destroy_notify(gpointer user_data)
 {
 	GAtIO *io = user_data;
 
+	/*
+	 * Reading is only paused, keep everything around for the resume.
+	 * That includes the channel, which the watch held on to.
+	 */
+	if (io->read_paused && !io->destroyed) {
+		g_io_channel_ref(io->channel);
+		io->read_watch = 0;
+		return;
+	}
+
 	ring_buffer_free(io->buf);
 	io->buf = NULL;
 
@@ -58,6 +73,45 @@ static void read_watcher_destroy_notify(gpointer user_data)
 		io->user_disconnect(io->user_disconnect_data);
 }
 
+static gsize read_iov(GAtIO *io, GIOStatus *status)
+{
+	struct iovec iov[2];
+	int count;
+	ssize_t rbytes;
+	gsize len;
+
+	count = ring_buffer_write_iov(io->buf, iov);
+
+	rbytes = readv(io->fd, iov, count);
+	if (rbytes < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			*status = G_IO_STATUS_AGAIN;
+		else
+			*status = G_IO_STATUS_ERROR;
+
+		return 0;
+	}
+
+	if (rbytes == 0) {
+		*status = G_IO_STATUS_EOF;
+		return 0;
+	}
+
+	*status = G_IO_STATUS_NORMAL;
+
+	len = MIN((gsize) rbytes, iov[0].iov_len);
+	g_at_util_debug_chat(TRUE, iov[0].iov_base, len,
+				io->debugf, io->debug_data);
+
+	if ((gsize) rbytes > len)
+		g_at_util_debug_chat(TRUE, iov[1].iov_base, rbytes - len,
+					io->debugf, io->debug_data);
+
+	ring_buffer_write_advance(io->buf, rbytes);
+
+	return rbytes;
+}
+
 static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 				gpointer data)
 {
@@ -68,10 +122,22 @@ static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 	gsize toread;
 	gsize total_read = 0;
 	guint read_count = 0;
+	guint len;
 
 	if (cond & G_IO_NVAL)
 		return FALSE;
 
+	/*
+	 * On a plain fd a single readv fills the buffer on both sides of
+	 * the wrap, bypassing GIOChannel altogether
+	 */
+	if (io->fd >= 0 && ring_buffer_avail(io->buf) > 0) {
+		rbytes = read_iov(io, &status);
+		total_read = rbytes;
+		read_count = 1;
+		goto done;
+	}
+
 	/* Regardless of condition, try to read all the data available */
 	do {
 		toread = ring_buffer_avail_no_wrap(io->buf);
@@ -97,6 +163,11 @@ static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 	} while (status == G_IO_STATUS_NORMAL && rbytes > 0 &&
 					read_count < io->max_read_attempts);
 
+done:
+	len = ring_buffer_len(io->buf);
+	if (len > io->stats.high_water)
+		io->stats.high_water = len;
+
 	if (total_read > 0 && io->read_handler)
 		io->read_handler(io->buf, io->read_data);
 
@@ -106,11 +177,44 @@ static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 	if (read_count > 0 && rbytes == 0 && status != G_IO_STATUS_AGAIN)
 		return FALSE;
 
-	/* We're overflowing the buffer, shutdown the socket */
+	if (ring_buffer_avail(io->buf) > 0)
+		return TRUE;
+
+	/* The reader is not keeping up, make more room if we still can */
+	if (ring_buffer_grow(io->buf) > 0) {
+		io->stats.grows += 1;
+		return TRUE;
+	}
+
+	/*
+	 * Stop reading until the buffer drains instead of overflowing it,
+	 * the data stays queued in the channel meanwhile
+	 */
+	io->read_paused = TRUE;
+	io->stats.pauses += 1;
+
+	return FALSE;
+}
+
+static void io_add_read_watch(GAtIO *io)
+{
+	io->read_watch = g_io_add_watch_full(io->channel, G_PRIORITY_DEFAULT,
+				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				received_data, io,
+				read_watcher_destroy_notify);
+}
+
+static void io_resume_read(GAtIO *io)
+{
+	if (io->read_paused == FALSE || io->read_suspended == TRUE)
+		return;
+
 	if (ring_buffer_avail(io->buf) == 0)
-		return FALSE;
+		return;
 
-	return TRUE;
+	io->read_paused = FALSE;
+	io_add_read_watch(io);
+	g_io_channel_unref(io->channel);
 }
 
 gsize g_at_io_write(GAtIO *io, const gchar *data, gsize count)
@@ -122,7 +226,9 @@ gsize g_at_io_write(GAtIO *io, const gchar *data, gsize count)
 						count, &bytes_written, NULL);
 
 	if (status != G_IO_STATUS_NORMAL) {
-		g_source_remove(io->read_watch);
+		if (io->read_watch > 0)
+			g_source_remove(io->read_watch);
+
 		return 0;
 	}
 
@@ -183,7 +289,7 @@ static GAtIO *create_io(GIOChannel *channel, GIOFlags flags)
 		io->use_write_watch = FALSE;
 	}
 
-	io->buf = ring_buffer_new(8192);
+	io->buf = ring_buffer_new_growable(IO_BUFFER_SIZE, IO_BUFFER_MAX_SIZE);
 
 	if (!io->buf)
 		goto error;
@@ -192,10 +298,17 @@ static GAtIO *create_io(GIOChannel *channel, GIOFlags flags)
 		goto error;
 
 	io->channel = channel;
-	io->read_watch = g_io_add_watch_full(channel, G_PRIORITY_DEFAULT,
-				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
-				received_data, io,
-				read_watcher_destroy_notify);
+
+	/*
+	 * Plain unix channels are read without going through GIOChannel,
+	 * GAtMux channels are the only other kind in use
+	 */
+	if (g_at_mux_is_channel(channel))
+		io->fd = -1;
+	else
+		io->fd = g_io_channel_unix_get_fd(channel);
+
+	io_add_read_watch(io);
 
 	return io;
 
@@ -226,6 +339,14 @@ GIOChannel *g_at_io_get_channel(GAtIO *io)
 	return io->channel;
 }
 
+int g_at_io_get_fd(GAtIO *io)
+{
+	if (io == NULL)
+		return -1;
+
+	return io->fd;
+}
+
 gboolean g_at_io_set_read_handler(GAtIO *io, GAtIOReadFunc read_handler,
 					gpointer user_data)
 {
@@ -238,6 +359,8 @@ gboolean g_at_io_set_read_handler(GAtIO *io, GAtIOReadFunc read_handler,
 	if (read_handler && ring_buffer_len(io->buf) > 0)
 		read_handler(io->buf, user_data);
 
+	io_resume_read(io);
+
 	return TRUE;
 }
 
@@ -328,10 +451,17 @@ void g_at_io_unref(GAtIO *io)
 	 * destroyed already.  We have to wait until the read_watcher
 	 * destroy function gets called
 	 */
-	if (io->read_watch > 0)
+	if (io->read_watch > 0) {
 		io->destroyed = TRUE;
-	else
-		g_free(io);
+		return;
+	}
+
+	/* Only set if reading was paused, otherwise already freed */
+	if (io->read_paused && io->channel)
+		g_io_channel_unref(io->channel);
+
+	ring_buffer_free(io->buf);
+	g_free(io);
 }
 
 gboolean g_at_io_set_disconnect_function(GAtIO *io,
@@ -370,4 +500,44 @@ void g_at_io_set_write_done(GAtIO *io, GAtDisconnectFunc func,
 void g_at_io_drain_ring_buffer(GAtIO *io, guint len)
 {
 	ring_buffer_drain(io->buf, len);
+
+	io_resume_read(io);
+}
+
+/*
+ * Stop reading from the channel, e.g. while someone else services the
+ * underlying fd.  Whatever is already buffered stays in the buffer.
+ */
+void g_at_io_suspend_read(GAtIO *io)
+{
+	if (io == NULL || io->read_suspended == TRUE)
+		return;
+
+	io->read_suspended = TRUE;
+
+	if (io->read_watch == 0)
+		return;
+
+	/* Keep the buffers around, the same as for a full buffer */
+	io->read_paused = TRUE;
+	g_source_remove(io->read_watch);
+}
+
+void g_at_io_resume_read(GAtIO *io)
+{
+	if (io == NULL || io->read_suspended == FALSE)
+		return;
+
+	io->read_suspended = FALSE;
+	io_resume_read(io);
+}
+
+gboolean g_at_io_get_stats(GAtIO *io, GAtIOStats *stats)
+{
+	if (io == NULL || stats == NULL)
+		return FALSE;
+
+	*stats = io->stats;
+
+	return TRUE;
 }
@@ -37,10 +37,24 @@ struct ring_buffer;
 typedef void (*GAtIOReadFunc)(struct ring_buffer *buffer, gpointer user_data);
 typedef gboolean (*GAtIOWriteFunc)(gpointer user_data);
 
+/*
+ * The read buffer starts small and doubles whenever the reader leaves it
+ * full, up to a ceiling.  Once at the ceiling, reading from the channel
+ * is paused until the reader drains some of the buffer.
+ */
+struct _GAtIOStats {
+	guint high_water;			/* Most bytes ever buffered */
+	guint grows;				/* Times the buffer grew */
+	guint pauses;				/* Times reading was paused */
+};
+
+typedef struct _GAtIOStats GAtIOStats;
+
 GAtIO *g_at_io_new(GIOChannel *channel);
 GAtIO *g_at_io_new_blocking(GIOChannel *channel);
 
 GIOChannel *g_at_io_get_channel(GAtIO *io);
+int g_at_io_get_fd(GAtIO *io);
 
 GAtIO *g_at_io_ref(GAtIO *io);
 void g_at_io_unref(GAtIO *io);
@@ -54,6 +68,9 @@ void g_at_io_set_write_done(GAtIO *io, GAtDisconnectFunc func,
 
 void g_at_io_drain_ring_buffer(GAtIO *io, guint len);
 
+void g_at_io_suspend_read(GAtIO *io);
+void g_at_io_resume_read(GAtIO *io);
+
 gsize g_at_io_write(GAtIO *io, const gchar *data, gsize count);
 
 gboolean g_at_io_set_disconnect_function(GAtIO *io,
@@ -61,11 +78,14 @@ gboolean g_at_io_set_disconnect_function(GAtIO *io,
 
 gboolean g_at_io_set_debug(GAtIO *io, GAtDebugFunc func, gpointer user_data);
 
+gboolean g_at_io_get_stats(GAtIO *io, GAtIOStats *stats);
+
 struct _GAtIO {
 	gint ref_count;				/* Ref count */
 	guint read_watch;			/* GSource read id, 0 if no */
 	guint write_watch;			/* GSource write id, 0 if no */
 	GIOChannel *channel;			/* comms channel */
+	int fd;					/* Raw fd of channel or -1 */
 	GAtDisconnectFunc user_disconnect;	/* user disconnect func */
 	gpointer user_disconnect_data;		/* user disconnect data */
 	struct ring_buffer *buf;		/* Current read buffer */
@@ -80,6 +100,9 @@ struct _GAtIO {
 	GAtDisconnectFunc write_done_func;	/* tx empty notifier */
 	gpointer write_done_data;		/* tx empty data */
 	gboolean destroyed;			/* Re-entrancy guard */
+	gboolean read_paused;			/* Read buffer is at ceiling */
+	gboolean read_suspended;		/* Reading stopped by the user */
+	GAtIOStats stats;			/* Read buffer statistics */
 };
 
 
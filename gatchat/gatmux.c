@@ -28,7 +28,9 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
 #include <alloca.h>
+#include <sys/uio.h>
 
 #pragma GCC diagnostic ignored "-Wpragmas"
 #pragma GCC diagnostic ignored "-Wcast-function-type"
@@ -52,9 +54,12 @@ typedef void (*GAtMuxWriteFrame)(GAtMux *mux, guint8 dlc, guint8 control,
  * Refer to Section 5.6 in 27.007
  */
 #define MAX_CHANNELS 61
-#define BITMAP_SIZE 8
+#define MIN_SOURCES 4
 #define MUX_CHANNEL_BUFFER_SIZE 4096
 #define MUX_BUFFER_SIZE 4096
+#define MUX_TX_BUFFER_SIZE 8192
+#define MUX_QUANTUM 128		/* Bytes per round for each unit of weight */
+#define MUX_MAX_WEIGHT 16
 
 struct _GAtMuxChannel
 {
@@ -62,9 +67,15 @@ struct _GAtMuxChannel
 	GAtMux *mux;
 	GIOCondition condition;
 	struct ring_buffer *buffer;
-	GSList *sources;
+	struct ring_buffer *tx_buffer;	/* Written, not yet framed */
+	GAtMuxWatch **sources;		/* Newest first */
+	guint n_sources;
+	guint max_sources;
 	gboolean throttled;
 	guint dlc;
+	GAtMuxPriority priority;
+	guint weight;			/* Credits per round, in quanta */
+	GAtMuxChannelStats stats;
 };
 
 struct _GAtMuxWatch
@@ -79,16 +90,18 @@ struct _GAtMux {
 	guint read_watch;			/* GSource read id, 0 if none */
 	guint write_watch;			/* GSource write id, 0 if none */
 	GIOChannel *channel;			/* main serial channel */
+	int fd;					/* Raw fd of channel or -1 */
 	GAtDisconnectFunc user_disconnect;	/* user disconnect func */
 	gpointer user_disconnect_data;		/* user disconnect data */
 	GAtDebugFunc debugf;			/* debugging output function */
 	gpointer debug_data;			/* Data to pass to debug func */
 	GAtMuxChannel *dlcs[MAX_CHANNELS];	/* DLCs opened by the MUX */
-	guint8 newdata[BITMAP_SIZE];		/* Channels that got new data */
+	guint64 newdata;			/* Channels that got new data */
 	const GAtMuxDriver *driver;		/* Driver functions */
 	void *driver_data;			/* Driver data */
-	char buf[MUX_BUFFER_SIZE];		/* Buffer on the main mux */
-	int buf_used;				/* Bytes of buf being used */
+	struct ring_buffer *buf;		/* Buffer on the main mux */
+	struct ring_buffer *tx_buffer;		/* Frames the channel refused */
+	guint next_dlc[2];			/* Round robin, per priority */
 	gboolean shutdown;
 };
 
@@ -119,9 +132,13 @@ static inline void debug(GAtMux *mux, const char *format, ...)
 
 static void dispatch_sources(GAtMuxChannel *channel, GIOCondition condition)
 {
-	GSList *c;
-	GSList *p;
-	GSList *refs;
+	GAtMuxWatch **refs;
+	guint n_refs;
+	guint i;
+	guint j;
+
+	if (channel->n_sources == 0)
+		return;
 
 	/*
 	 * Don't reference destroyed sources, they may have zero reference
@@ -130,34 +147,25 @@ static void dispatch_sources(GAtMuxChannel *channel, GIOCondition condition)
 	 * the count would result in double free (first when we decrement
 	 * the reference count and then when we return from the finalize
 	 * callback).
+	 *
+	 * Keep the references to all sources for the duration of the loop.
+	 * Callbacks may add and remove the sources, i.e. channel->sources
+	 * may keep changing during the loop.  The snapshot lives on the
+	 * stack, this runs for every frame received.
 	 */
 
-	p = NULL;
-	refs = NULL;
+	refs = alloca(channel->n_sources * sizeof(GAtMuxWatch *));
+	n_refs = 0;
 
-	for (c = channel->sources; c; c = c->next) {
-		GSource *s = c->data;
+	for (i = 0; i < channel->n_sources; i++) {
+		GSource *s = &channel->sources[i]->source;
 
-		if (!g_source_is_destroyed(s)) {
-			GSList *l = g_slist_append(NULL, g_source_ref(s));
-
-			if (p)
-				p->next = l;
-			else
-				refs = l;
-
-			p = l;
-		}
+		if (!g_source_is_destroyed(s))
+			refs[n_refs++] = (GAtMuxWatch *) g_source_ref(s);
 	}
 
-	/*
-	 * Keep the references to all sources for the duration of the loop.
-	 * Callbacks may add and remove the sources, i.e. channel->sources
-	 * may keep changing during the loop.
-	 */
-
-	for (c = refs; c; c = c->next) {
-		GAtMuxWatch *w = c->data;
+	for (i = 0; i < n_refs; i++) {
+		GAtMuxWatch *w = refs[i];
 		GSource *s = &w->source;
 
 		if (g_source_is_destroyed(s))
@@ -199,29 +207,18 @@ static void dispatch_sources(GAtMuxChannel *channel, GIOCondition condition)
 	 * guaranteed.
 	 */
 
-	p = NULL;
-	c = channel->sources;
-
-	while (c) {
-		GSList *n = c->next;
-		GSource *s = c->data;
+	for (i = 0, j = 0; i < channel->n_sources; i++) {
+		GAtMuxWatch *w = channel->sources[i];
 
-		if (g_source_is_destroyed(s)) {
-			if (p)
-				p->next = n;
-			else
-				channel->sources = n;
-
-			g_slist_free_1(c);
-		} else {
-			p = c;
-		}
-
-		c = n;
+		if (!g_source_is_destroyed(&w->source))
+			channel->sources[j++] = w;
 	}
 
+	channel->n_sources = j;
+
 	/* Release temporary references */
-	g_slist_free_full(refs, (GDestroyNotify) g_source_unref);
+	for (i = 0; i < n_refs; i++)
+		g_source_unref(&refs[i]->source);
 }
 
 static gboolean received_data(GIOChannel *channel, GIOCondition cond,
@@ -238,28 +235,56 @@ static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 	debug(mux, "received data");
 
 	bytes_read = 0;
-	status = g_io_channel_read_chars(mux->channel, mux->buf + mux->buf_used,
-					sizeof(mux->buf) - mux->buf_used,
-					&bytes_read, NULL);
 
-	mux->buf_used += bytes_read;
+	if (mux->fd >= 0) {
+		/* Plain fd, skip the GIOChannel layer and fill both sides */
+		struct iovec iov[2];
+		int count = ring_buffer_write_iov(mux->buf, iov);
+		ssize_t rbytes = readv(mux->fd, iov, count);
+
+		if (rbytes > 0) {
+			bytes_read = rbytes;
+			status = G_IO_STATUS_NORMAL;
+		} else if (rbytes == 0)
+			status = G_IO_STATUS_EOF;
+		else if (errno == EAGAIN || errno == EINTR)
+			status = G_IO_STATUS_AGAIN;
+		else
+			status = G_IO_STATUS_ERROR;
+	} else
+		status = g_io_channel_read_chars(mux->channel,
+				(gchar *) ring_buffer_write_ptr(mux->buf, 0),
+				ring_buffer_avail_no_wrap(mux->buf),
+				&bytes_read, NULL);
+
+	ring_buffer_write_advance(mux->buf, bytes_read);
 
 	if (bytes_read > 0 && mux->driver->feed_data) {
+		int len;
 		int nread;
+		guint64 pending;
 
-		memset(mux->newdata, 0, BITMAP_SIZE);
+		mux->newdata = 0;
 
-		nread = mux->driver->feed_data(mux, mux->buf, mux->buf_used);
-		mux->buf_used -= nread;
+		/*
+		 * Hand over the data as it lies in the buffer, one piece on
+		 * each side of the wrap.  Whatever the driver leaves stays
+		 * put until more arrives.
+		 */
+		while ((len = ring_buffer_len_no_wrap(mux->buf)) > 0) {
+			nread = mux->driver->feed_data(mux,
+					ring_buffer_read_ptr(mux->buf, 0), len);
+			ring_buffer_drain(mux->buf, nread);
 
-		if (mux->buf_used > 0)
-			memmove(mux->buf, mux->buf + nread, mux->buf_used);
+			if (nread < len)
+				break;
+		}
 
-		for (i = 1; i <= MAX_CHANNELS; i++) {
-			int offset = i / 8;
-			int bit = i % 8;
+		for (pending = mux->newdata; pending; pending &= pending - 1) {
+			i = __builtin_ctzll(pending);
 
-			if (!(mux->newdata[offset] & (1 << bit)))
+			/* Closed by one of the callbacks dispatched so far */
+			if (mux->dlcs[i-1] == NULL)
 				continue;
 
 			debug(mux, "dispatching sources for channel: %p",
@@ -275,7 +300,7 @@ static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 	if (status != G_IO_STATUS_NORMAL && status != G_IO_STATUS_AGAIN)
 		return FALSE;
 
-	if (mux->buf_used == sizeof(mux->buf))
+	if (ring_buffer_avail(mux->buf) == 0)
 		return FALSE;
 
 	return TRUE;
@@ -288,6 +313,122 @@ static void write_watcher_destroy_notify(gpointer user_data)
 	mux->write_watch = 0;
 }
 
+/* Returns TRUE once everything the channel refused earlier went out */
+static gboolean flush_tx_buffer(GAtMux *mux)
+{
+	unsigned int len;
+	gsize bytes_written;
+	GIOStatus status;
+
+	while ((len = ring_buffer_len_no_wrap(mux->tx_buffer)) > 0) {
+		bytes_written = 0;
+		status = g_io_channel_write_chars(mux->channel,
+				(gchar *) ring_buffer_read_ptr(mux->tx_buffer, 0),
+				len, &bytes_written, NULL);
+
+		ring_buffer_drain(mux->tx_buffer, bytes_written);
+
+		if (status != G_IO_STATUS_NORMAL || bytes_written < len)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean channel_can_send(GAtMuxChannel *channel)
+{
+	if (channel == NULL || channel->throttled)
+		return FALSE;
+
+	return ring_buffer_len(channel->tx_buffer) > 0;
+}
+
+static GAtMuxChannel *next_channel(GAtMux *mux, GAtMuxPriority priority)
+{
+	int n;
+
+	for (n = 0; n < MAX_CHANNELS; n++) {
+		int i = (mux->next_dlc[priority] + n) % MAX_CHANNELS;
+		GAtMuxChannel *channel = mux->dlcs[i];
+
+		if (channel == NULL || channel->priority != priority)
+			continue;
+
+		if (!channel_can_send(channel))
+			continue;
+
+		mux->next_dlc[priority] = (i + 1) % MAX_CHANNELS;
+
+		return channel;
+	}
+
+	return NULL;
+}
+
+/* Frame up to the channel's credits worth of its queued data */
+static void channel_send(GAtMux *mux, GAtMuxChannel *channel)
+{
+	int credits = channel->weight * MUX_QUANTUM;
+	int len;
+
+	while (credits > 0) {
+		len = ring_buffer_len_no_wrap(channel->tx_buffer);
+		if (len == 0)
+			break;
+
+		len = MIN(len, credits);
+
+		if (mux->driver->write)
+			mux->driver->write(mux, channel->dlc,
+				ring_buffer_read_ptr(channel->tx_buffer, 0),
+				len);
+
+		ring_buffer_drain(channel->tx_buffer, len);
+		channel->stats.bytes_sent += len;
+		credits -= len;
+	}
+}
+
+/*
+ * Keep framing queued data for as long as the channel takes it, strictly
+ * preferring control channels.  Once the channel pushes back nothing new
+ * is framed, so a control write waits for at most one round of data.
+ */
+static void schedule_writes(GAtMux *mux)
+{
+	GAtMuxChannel *channel;
+
+	while (ring_buffer_len(mux->tx_buffer) == 0) {
+		channel = next_channel(mux, G_AT_MUX_PRIORITY_CONTROL);
+
+		if (channel == NULL)
+			channel = next_channel(mux, G_AT_MUX_PRIORITY_DATA);
+
+		if (channel == NULL)
+			break;
+
+		channel_send(mux, channel);
+	}
+}
+
+static gboolean channel_wants_write(GAtMuxChannel *channel)
+{
+	guint i;
+
+	if (channel == NULL || channel->throttled)
+		return FALSE;
+
+	if (ring_buffer_len(channel->tx_buffer) > 0)
+		return TRUE;
+
+	for (i = 0; i < channel->n_sources; i++) {
+		if (channel->sources[i]->condition & G_IO_OUT)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
 static gboolean can_write_data(GIOChannel *chan, GIOCondition cond,
 				gpointer data)
 {
@@ -299,6 +440,10 @@ static gboolean can_write_data(GIOChannel *chan, GIOCondition cond,
 
 	debug(mux, "can write data");
 
+	if (flush_tx_buffer(mux) == FALSE)
+		return TRUE;
+
+	/* Let the writers top up their queues first */
 	for (dlc = 0; dlc < MAX_CHANNELS; dlc += 1) {
 		GAtMuxChannel *channel = mux->dlcs[dlc];
 
@@ -310,28 +455,22 @@ static gboolean can_write_data(GIOChannel *chan, GIOCondition cond,
 		if (channel->throttled)
 			continue;
 
+		if (ring_buffer_avail(channel->tx_buffer) == 0)
+			continue;
+
 		debug(mux, "dispatching write sources: %p", channel);
 
 		dispatch_sources(channel, G_IO_OUT);
 	}
 
-	for (dlc = 0; dlc < MAX_CHANNELS; dlc += 1) {
-		GAtMuxChannel *channel = mux->dlcs[dlc];
-		GSList *l;
-		GAtMuxWatch *source;
-
-		if (channel == NULL)
-			continue;
-
-		if (channel->throttled)
-			continue;
+	schedule_writes(mux);
 
-		for (l = channel->sources; l; l = l->next) {
-			source = l->data;
+	if (ring_buffer_len(mux->tx_buffer) > 0)
+		return TRUE;
 
-			if (source->condition & G_IO_OUT)
-				return TRUE;
-		}
+	for (dlc = 0; dlc < MAX_CHANNELS; dlc += 1) {
+		if (channel_wants_write(mux->dlcs[dlc]))
+			return TRUE;
 	}
 
 	return FALSE;
@@ -353,13 +492,23 @@ static void wakeup_writer(GAtMux *mux)
 
 int g_at_mux_raw_write(GAtMux *mux, const void *data, int towrite)
 {
-	gssize count = towrite;
-	gsize bytes_written;
+	gsize bytes_written = 0;
+	int queued;
+
+	/* Frames must not overtake the ones still waiting for the channel */
+	if (ring_buffer_len(mux->tx_buffer) == 0)
+		g_io_channel_write_chars(mux->channel, (gchar *) data,
+					towrite, &bytes_written, NULL);
+
+	if ((int) bytes_written == towrite)
+		return bytes_written;
 
-	g_io_channel_write_chars(mux->channel, (gchar *) data,
-					count, &bytes_written, NULL);
+	queued = ring_buffer_write(mux->tx_buffer,
+					(const guint8 *) data + bytes_written,
+					towrite - bytes_written);
+	wakeup_writer(mux);
 
-	return bytes_written;
+	return bytes_written + MAX(queued, 0);
 }
 
 void g_at_mux_feed_dlc_data(GAtMux *mux, guint8 dlc,
@@ -368,8 +517,6 @@ void g_at_mux_feed_dlc_data(GAtMux *mux, guint8 dlc,
 	GAtMuxChannel *channel;
 
 	int written;
-	int offset;
-	int bit;
 
 	debug(mux, "deliver_data: dlc: %hu", dlc);
 
@@ -386,10 +533,9 @@ void g_at_mux_feed_dlc_data(GAtMux *mux, guint8 dlc,
 	if (written < 0)
 		return;
 
-	offset = dlc / 8;
-	bit = dlc % 8;
+	channel->stats.bytes_received += written;
 
-	mux->newdata[offset] |= 1 << bit;
+	mux->newdata |= (guint64) 1 << dlc;
 	channel->condition |= G_IO_IN;
 }
 
@@ -407,19 +553,11 @@ void g_at_mux_set_dlc_status(GAtMux *mux, guint8 dlc, int status)
 		return;
 
 	if (status & G_AT_MUX_DLC_STATUS_RTR) {
-		GSList *l;
-
 		mux->dlcs[dlc-1]->throttled = FALSE;
 		debug(mux, "setting throttled to FALSE");
 
-		for (l = mux->dlcs[dlc-1]->sources; l; l = l->next) {
-			GAtMuxWatch *source = l->data;
-
-			if (source->condition & G_IO_OUT) {
-				wakeup_writer(mux);
-				break;
-			}
-		}
+		if (channel_wants_write(channel))
+			wakeup_writer(mux);
 	} else
 		mux->dlcs[dlc-1]->throttled = TRUE;
 }
@@ -470,7 +608,19 @@ static void watch_finalize(GSource *source)
 	GAtMuxWatch *watch = (GAtMuxWatch *) source;
 	GAtMuxChannel *dlc = (GAtMuxChannel *) watch->channel;
 
-	dlc->sources = g_slist_remove(dlc->sources, watch);
+	guint i;
+
+	/* Already gone if it was pruned after being destroyed */
+	for (i = 0; i < dlc->n_sources; i++) {
+		if (dlc->sources[i] != watch)
+			continue;
+
+		dlc->n_sources -= 1;
+		memmove(dlc->sources + i, dlc->sources + i + 1,
+				(dlc->n_sources - i) * sizeof(GAtMuxWatch *));
+		break;
+	}
+
 	g_io_channel_unref(watch->channel);
 }
 
@@ -503,10 +653,28 @@ static GIOStatus channel_write(GIOChannel *channel, const gchar *buf,
 {
 	GAtMuxChannel *mux_channel = (GAtMuxChannel *) channel;
 	GAtMux *mux = mux_channel->mux;
+	GAtMuxChannelStats *stats = &mux_channel->stats;
+	int written;
+	guint depth;
+
+	/* Queued only, the writer decides whose data goes out next */
+	written = ring_buffer_write(mux_channel->tx_buffer, buf, count);
+	if (written < 0)
+		written = 0;
+
+	if ((gsize) written < count)
+		stats->queue_full += 1;
+
+	stats->bytes_queued += written;
 
-	if (mux->driver->write)
-		mux->driver->write(mux, mux_channel->dlc, buf, count);
-	*bytes_written = count;
+	depth = ring_buffer_len(mux_channel->tx_buffer);
+	if (depth > stats->max_queue_depth)
+		stats->max_queue_depth = depth;
+
+	if (written > 0 && mux_channel->throttled == FALSE)
+		wakeup_writer(mux);
+
+	*bytes_written = written;
 
 	return G_IO_STATUS_NORMAL;
 }
@@ -539,6 +707,8 @@ static void channel_free(GIOChannel *channel)
 	GAtMuxChannel *mux_channel = (GAtMuxChannel *) channel;
 
 	ring_buffer_free(mux_channel->buffer);
+	ring_buffer_free(mux_channel->tx_buffer);
+	g_free(mux_channel->sources);
 
 	g_free(channel);
 }
@@ -567,7 +737,16 @@ static GSource *channel_create_watch(GIOChannel *channel,
 			condition & G_IO_OUT,
 			condition & G_IO_IN);
 
-	dlc->sources = g_slist_prepend(dlc->sources, watch);
+	if (dlc->n_sources == dlc->max_sources) {
+		dlc->max_sources = MAX(dlc->max_sources * 2, MIN_SOURCES);
+		dlc->sources = g_renew(GAtMuxWatch *, dlc->sources,
+						dlc->max_sources);
+	}
+
+	memmove(dlc->sources + 1, dlc->sources,
+			dlc->n_sources * sizeof(GAtMuxWatch *));
+	dlc->sources[0] = watch;
+	dlc->n_sources += 1;
 
 	return source;
 }
@@ -596,6 +775,11 @@ static GIOFuncs channel_funcs = {
 	channel_get_flags,
 };
 
+gboolean g_at_mux_is_channel(GIOChannel *channel)
+{
+	return channel->funcs == &channel_funcs;
+}
+
 GAtMux *g_at_mux_new(GIOChannel *channel, const GAtMuxDriver *driver)
 {
 	GAtMux *mux;
@@ -607,6 +791,19 @@ GAtMux *g_at_mux_new(GIOChannel *channel, const GAtMuxDriver *driver)
 	if (mux == NULL)
 		return NULL;
 
+	mux->buf = ring_buffer_new(MUX_BUFFER_SIZE);
+	if (mux->buf == NULL) {
+		g_free(mux);
+		return NULL;
+	}
+
+	mux->tx_buffer = ring_buffer_new(MUX_TX_BUFFER_SIZE);
+	if (mux->tx_buffer == NULL) {
+		ring_buffer_free(mux->buf);
+		g_free(mux);
+		return NULL;
+	}
+
 	mux->ref_count = 1;
 	mux->driver = driver;
 	mux->shutdown = TRUE;
@@ -616,6 +813,14 @@ GAtMux *g_at_mux_new(GIOChannel *channel, const GAtMuxDriver *driver)
 
 	g_io_channel_set_close_on_unref(channel, TRUE);
 
+	/* Reading the fd directly is only safe without GIOChannel buffering */
+	if (g_io_channel_get_encoding(channel) == NULL &&
+			g_io_channel_get_buffered(channel) == FALSE &&
+			!g_at_mux_is_channel(channel))
+		mux->fd = g_io_channel_unix_get_fd(channel);
+	else
+		mux->fd = -1;
+
 	return mux;
 }
 
@@ -642,6 +847,8 @@ void g_at_mux_unref(GAtMux *mux)
 		if (mux->driver->remove)
 			mux->driver->remove(mux);
 
+		ring_buffer_free(mux->buf);
+		ring_buffer_free(mux->tx_buffer);
 		g_free(mux);
 	}
 }
@@ -700,6 +907,13 @@ gboolean g_at_mux_shutdown(GAtMux *mux)
 	if (mux->driver->shutdown)
 		mux->driver->shutdown(mux);
 
+	/* One last go at the closing frames, then drop what is left */
+	flush_tx_buffer(mux);
+	ring_buffer_reset(mux->tx_buffer);
+
+	if (mux->write_watch > 0)
+		g_source_remove(mux->write_watch);
+
 	mux->shutdown = TRUE;
 
 	return TRUE;
@@ -764,7 +978,10 @@ GIOChannel *g_at_mux_create_channel(GAtMux *mux)
 	mux_channel->mux = mux;
 	mux_channel->dlc = i+1;
 	mux_channel->buffer = ring_buffer_new(MUX_CHANNEL_BUFFER_SIZE);
+	mux_channel->tx_buffer = ring_buffer_new(MUX_CHANNEL_BUFFER_SIZE);
 	mux_channel->throttled = FALSE;
+	mux_channel->priority = G_AT_MUX_PRIORITY_CONTROL;
+	mux_channel->weight = 1;
 
 	mux->dlcs[i] = mux_channel;
 
@@ -773,6 +990,57 @@ GIOChannel *g_at_mux_create_channel(GAtMux *mux)
 	return channel;
 }
 
+static GAtMuxChannel *find_channel(GAtMux *mux, GIOChannel *channel)
+{
+	int i;
+
+	if (mux == NULL || channel == NULL)
+		return NULL;
+
+	for (i = 0; i < MAX_CHANNELS; i++) {
+		if ((GIOChannel *) mux->dlcs[i] == channel)
+			return mux->dlcs[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Channels start out as control channels.  Bulk traffic such as PPP
+ * should be moved to the data class so it cannot hold up AT commands.
+ */
+gboolean g_at_mux_set_channel_priority(GAtMux *mux, GIOChannel *channel,
+					GAtMuxPriority priority, guint weight)
+{
+	GAtMuxChannel *mux_channel = find_channel(mux, channel);
+
+	if (mux_channel == NULL)
+		return FALSE;
+
+	if (priority != G_AT_MUX_PRIORITY_CONTROL &&
+			priority != G_AT_MUX_PRIORITY_DATA)
+		return FALSE;
+
+	mux_channel->priority = priority;
+	mux_channel->weight = CLAMP(weight, 1, MUX_MAX_WEIGHT);
+
+	return TRUE;
+}
+
+gboolean g_at_mux_get_channel_stats(GAtMux *mux, GIOChannel *channel,
+					GAtMuxChannelStats *stats)
+{
+	GAtMuxChannel *mux_channel = find_channel(mux, channel);
+
+	if (mux_channel == NULL || stats == NULL)
+		return FALSE;
+
+	*stats = mux_channel->stats;
+	stats->queue_depth = ring_buffer_len(mux_channel->tx_buffer);
+
+	return TRUE;
+}
+
 static void msd_free(gpointer user_data)
 {
 	struct mux_setup_data *msd = user_data;
@@ -962,6 +1230,7 @@ gboolean g_at_mux_setup_gsm0710(GAtChat *chat,
 
 struct gsm0710_data {
 	int frame_size;
+	struct gsm0710_parser *parser;
 };
 
 /* Process an incoming GSM 07.10 packet */
@@ -1038,6 +1307,7 @@ static void gsm0710_basic_remove(GAtMux *mux)
 {
 	struct gsm0710_data *gd = g_at_mux_get_data(mux);
 
+	gsm0710_parser_free(gd->parser);
 	g_free(gd);
 	g_at_mux_set_data(mux, NULL);
 }
@@ -1090,32 +1360,22 @@ static gboolean gsm0710_basic_close_dlc(GAtMux *mux, guint8 dlc)
 	return TRUE;
 }
 
-static int gsm0710_basic_feed_data(GAtMux *mux, void *data, int len)
+static void gsm0710_basic_frame(guint8 dlc, guint8 type,
+					const guint8 *data, int len,
+					gpointer user_data)
 {
-	int total = 0;
-	int nread;
-	guint8 dlc;
-	guint8 ctrl;
-	guint8 *frame;
-	int frame_len;
-
-	do {
-		frame = NULL;
-		nread = gsm0710_basic_extract_frame(data, len, &dlc, &ctrl,
-							&frame, &frame_len);
-
-		total += nread;
-		data += nread;
-		len -= nread;
+	gsm0710_packet(user_data, dlc, type, data, len,
+				gsm0710_basic_write_frame);
+}
 
-		if (frame == NULL)
-			break;
+/* The parser keeps partial frames itself, so everything is consumed */
+static int gsm0710_basic_feed_data(GAtMux *mux, void *data, int len)
+{
+	struct gsm0710_data *gd = g_at_mux_get_data(mux);
 
-		gsm0710_packet(mux, dlc, ctrl, frame, frame_len,
-				gsm0710_basic_write_frame);
-	} while (nread > 0);
+	gsm0710_parser_feed(gd->parser, data, len);
 
-	return total;
+	return len;
 }
 
 static void gsm0710_basic_set_status(GAtMux *mux, guint8 dlc, guint8 status)
@@ -1173,6 +1433,13 @@ GAtMux *g_at_mux_new_gsm0710_basic(GIOChannel *channel, int frame_size)
 
 	g_at_mux_set_data(mux, gd);
 
+	gd->parser = gsm0710_parser_new(FALSE, GSM0710_BUFFER_SIZE,
+					gsm0710_basic_frame, mux);
+	if (gd->parser == NULL) {
+		g_at_mux_unref(mux);
+		return NULL;
+	}
+
 	return mux;
 }
 
@@ -1192,6 +1459,7 @@ static void gsm0710_advanced_remove(GAtMux *mux)
 {
 	struct gsm0710_data *gd = g_at_mux_get_data(mux);
 
+	gsm0710_parser_free(gd->parser);
 	g_free(gd);
 	g_at_mux_set_data(mux, NULL);
 }
@@ -1244,32 +1512,22 @@ static gboolean gsm0710_advanced_close_dlc(GAtMux *mux, guint8 dlc)
 	return TRUE;
 }
 
-static int gsm0710_advanced_feed_data(GAtMux *mux, void *data, int len)
+static void gsm0710_advanced_frame(guint8 dlc, guint8 type,
+					const guint8 *data, int len,
+					gpointer user_data)
 {
-	int total = 0;
-	int nread;
-	guint8 dlc;
-	guint8 ctrl;
-	guint8 *frame;
-	int frame_len;
-
-	do {
-		frame = NULL;
-		nread = gsm0710_advanced_extract_frame(data, len, &dlc, &ctrl,
-							&frame, &frame_len);
-
-		total += nread;
-		data += nread;
-		len -= nread;
+	gsm0710_packet(user_data, dlc, type, data, len,
+				gsm0710_advanced_write_frame);
+}
 
-		if (frame == NULL)
-			break;
+/* The parser keeps partial frames itself, so everything is consumed */
+static int gsm0710_advanced_feed_data(GAtMux *mux, void *data, int len)
+{
+	struct gsm0710_data *gd = g_at_mux_get_data(mux);
 
-		gsm0710_packet(mux, dlc, ctrl, frame, frame_len,
-				gsm0710_advanced_write_frame);
-	} while (nread > 0);
+	gsm0710_parser_feed(gd->parser, data, len);
 
-	return total;
+	return len;
 }
 
 static void gsm0710_advanced_set_status(GAtMux *mux, guint8 dlc, guint8 status)
@@ -1328,5 +1586,12 @@ GAtMux *g_at_mux_new_gsm0710_advanced(GIOChannel *channel, int frame_size)
 
 	g_at_mux_set_data(mux, gd);
 
+	gd->parser = gsm0710_parser_new(TRUE, GSM0710_BUFFER_SIZE,
+					gsm0710_advanced_frame, mux);
+	if (gd->parser == NULL) {
+		g_at_mux_unref(mux);
+		return NULL;
+	}
+
 	return mux;
 }
@@ -34,6 +34,8 @@ struct _GAtMux;
 typedef struct _GAtMux GAtMux;
 typedef struct _GAtMuxDriver GAtMuxDriver;
 typedef enum _GAtMuxChannelStatus GAtMuxChannelStatus;
+typedef enum _GAtMuxPriority GAtMuxPriority;
+typedef struct _GAtMuxChannelStats GAtMuxChannelStats;
 typedef void (*GAtMuxSetupFunc)(GAtMux *mux, gpointer user_data);
 
 enum _GAtMuxDlcStatus {
@@ -43,6 +45,25 @@ enum _GAtMuxDlcStatus {
 	G_AT_MUX_DLC_STATUS_DV = 0x80,
 };
 
+/*
+ * Writes to control channels are always framed before any data channel
+ * gets a turn.  Data channels share what is left of the link in round
+ * robin, each sending up to its weight in credits per round.
+ */
+enum _GAtMuxPriority {
+	G_AT_MUX_PRIORITY_CONTROL = 0,
+	G_AT_MUX_PRIORITY_DATA = 1,
+};
+
+struct _GAtMuxChannelStats {
+	guint64 bytes_queued;			/* Accepted from the writer */
+	guint64 bytes_sent;			/* Handed over for framing */
+	guint64 bytes_received;			/* Delivered to the reader */
+	guint queue_depth;			/* Bytes waiting to be sent */
+	guint max_queue_depth;			/* Most bytes ever waiting */
+	guint queue_full;			/* Writes cut short */
+};
+
 struct _GAtMuxDriver {
 	void (*remove)(GAtMux *mux);
 	gboolean (*startup)(GAtMux *mux);
@@ -70,6 +91,12 @@ gboolean g_at_mux_set_disconnect_function(GAtMux *mux,
 gboolean g_at_mux_set_debug(GAtMux *mux, GAtDebugFunc func, gpointer user_data);
 
 GIOChannel *g_at_mux_create_channel(GAtMux *mux);
+gboolean g_at_mux_is_channel(GIOChannel *channel);
+
+gboolean g_at_mux_set_channel_priority(GAtMux *mux, GIOChannel *channel,
+					GAtMuxPriority priority, guint weight);
+gboolean g_at_mux_get_channel_stats(GAtMux *mux, GIOChannel *channel,
+					GAtMuxChannelStats *stats);
 
 /*!
  * Multiplexer driver integration functions
@@ -64,6 +64,7 @@ struct _GAtPPP {
 	struct ppp_net *net;
 	struct ppp_chap *chap;
 	struct ppp_pap *pap;
+	struct ppp_vj *vj;
 	GAtHDLC *hdlc;
 	gint mtu;
 	char username[256];
@@ -85,6 +86,10 @@ struct _GAtPPP {
 	gboolean suspended;
 	gboolean xmit_acfc;
 	gboolean xmit_pfc;
+	guint net_read_budget;
+	guint recv_vj_slots;
+	guint xmit_vj_slots;
+	gboolean xmit_vj_cslot;
 };
 
 void ppp_debug(GAtPPP *ppp, const char *str)
@@ -175,6 +180,7 @@ static void ppp_receive(const unsigned char *buf, gsize len, void *data)
 	unsigned int offset = 0;
 	guint16 protocol;
 	const guint8 *packet;
+	gsize iplen;
 
 	if (len == 0)
 		return;
@@ -218,6 +224,19 @@ static void ppp_receive(const unsigned char *buf, gsize len, void *data)
 	case PPP_IP_PROTO:
 		ppp_net_process_packet(ppp->net, packet, len - offset);
 		break;
+	case PPP_VJ_COMP:
+	case PPP_VJ_UNCOMP:
+		if (ppp->recv_vj_slots == 0) {
+			pppcp_send_protocol_reject(ppp->lcp, buf, len);
+			break;
+		}
+
+		packet = ppp_vj_decompress(ppp->vj, protocol, packet,
+						len - offset, &iplen);
+		if (packet != NULL)
+			ppp_net_process_packet(ppp->net, packet, iplen);
+
+		break;
 	case LCP_PROTOCOL:
 		pppcp_process_packet(ppp->lcp, packet, len - offset);
 		break;
@@ -339,6 +358,21 @@ void ppp_transmit(GAtPPP *ppp, guint8 *packet, guint infolen)
 {
 	guint16 proto = ppp_proto(packet);
 
+	if (proto == PPP_IP_PROTO && ppp->xmit_vj_slots > 0) {
+		struct ppp_header *header;
+		guint offset;
+
+		proto = ppp_vj_compress(ppp->vj, packet + sizeof(*header),
+						&infolen, &offset);
+
+		/* The header got shorter, move the PPP header up with it */
+		packet += offset;
+		header = (struct ppp_header *) packet;
+		header->address = PPP_ADDR_FIELD;
+		header->control = PPP_CTRL;
+		header->proto = htons(proto);
+	}
+
 	if (proto == LCP_PROTOCOL) {
 		ppp_send_lcp_frame(ppp, packet, infolen);
 		return;
@@ -421,6 +455,18 @@ void ppp_ipcp_up_notify(GAtPPP *ppp, const char *local, const char *peer,
 	if (ppp_net_set_mtu(ppp->net, ppp->mtu) == FALSE)
 		DBG(ppp, "Unable to set MTU");
 
+	ppp_net_set_read_budget(ppp->net, ppp->net_read_budget);
+
+	if (ppp->recv_vj_slots > 0 || ppp->xmit_vj_slots > 0) {
+		ppp->vj = ppp_vj_new(ppp->recv_vj_slots, ppp->xmit_vj_slots,
+					ppp->xmit_vj_cslot);
+		if (ppp->vj == NULL) {
+			ppp->disconnect_reason = G_AT_PPP_REASON_NET_FAIL;
+			pppcp_signal_close(ppp->lcp);
+			return;
+		}
+	}
+
 	ppp_enter_phase(ppp, PPP_PHASE_LINK_UP);
 
 	if (ppp->connect_cb)
@@ -431,6 +477,11 @@ void ppp_ipcp_up_notify(GAtPPP *ppp, const char *local, const char *peer,
 
 void ppp_ipcp_down_notify(GAtPPP *ppp)
 {
+	ppp_vj_free(ppp->vj);
+	ppp->vj = NULL;
+	ppp->recv_vj_slots = 0;
+	ppp->xmit_vj_slots = 0;
+
 	/* Most likely we failed to create the interface */
 	if (ppp->net == NULL)
 		return;
@@ -518,6 +569,17 @@ void ppp_set_xmit_pfc(GAtPPP *ppp, gboolean pfc)
 	ppp->xmit_pfc = pfc;
 }
 
+void ppp_set_recv_vj(GAtPPP *ppp, guint8 max_slot_id)
+{
+	ppp->recv_vj_slots = max_slot_id + 1;
+}
+
+void ppp_set_xmit_vj(GAtPPP *ppp, guint8 max_slot_id, gboolean comp_slot_id)
+{
+	ppp->xmit_vj_slots = max_slot_id + 1;
+	ppp->xmit_vj_cslot = comp_slot_id;
+}
+
 static void io_disconnect(gpointer user_data)
 {
 	GAtPPP *ppp = user_data;
@@ -768,6 +830,8 @@ void g_at_ppp_unref(GAtPPP *ppp)
 	else if (ppp->fd >= 0)
 		close(ppp->fd);
 
+	ppp_vj_free(ppp->vj);
+
 	if (ppp->pap)
 		ppp_pap_free(ppp->pap);
 
@@ -816,6 +880,41 @@ void g_at_ppp_set_pfc_enabled(GAtPPP *ppp, gboolean enabled)
 	lcp_set_pfc_enabled(ppp->lcp, enabled);
 }
 
+void g_at_ppp_set_vj_enabled(GAtPPP *ppp, gboolean enabled)
+{
+	ipcp_set_vj_enabled(ppp->ipcp, enabled);
+}
+
+void g_at_ppp_set_accm(GAtPPP *ppp, guint32 accm)
+{
+	lcp_set_accm(ppp->lcp, accm);
+}
+
+void g_at_ppp_set_mru(GAtPPP *ppp, guint16 mru)
+{
+	lcp_set_mru(ppp->lcp, mru);
+}
+
+/* Packets read from the tun interface per wakeup, 0 for the default */
+void g_at_ppp_set_net_read_budget(GAtPPP *ppp, guint budget)
+{
+	if (ppp == NULL)
+		return;
+
+	ppp->net_read_budget = budget;
+	ppp_net_set_read_budget(ppp->net, budget);
+}
+
+gboolean g_at_ppp_get_net_stats(GAtPPP *ppp, GAtPPPNetStats *stats)
+{
+	if (ppp == NULL || ppp->net == NULL || stats == NULL)
+		return FALSE;
+
+	ppp_net_get_stats(ppp->net, stats);
+
+	return TRUE;
+}
+
 static GAtPPP *ppp_init_common(gboolean is_server, guint32 ip)
 {
 	GAtPPP *ppp;
@@ -848,6 +947,23 @@ GAtPPP *g_at_ppp_new(void)
 	return ppp_init_common(FALSE, 0);
 }
 
+/*
+ * Uses fd instead of creating a tun interface.  Besides a tun fd this
+ * can be a packet socket, e.g. to move the IP traffic through a test
+ * harness.
+ */
+GAtPPP *g_at_ppp_new_full(int fd)
+{
+	GAtPPP *ppp;
+
+	ppp = ppp_init_common(FALSE, 0);
+
+	if (ppp != NULL)
+		ppp->fd = fd;
+
+	return ppp;
+}
+
 GAtPPP *g_at_ppp_server_new_full(const char *local, int fd)
 {
 	GAtPPP *ppp;
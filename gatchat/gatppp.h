@@ -49,6 +49,21 @@ typedef enum _GAtPPPAuthMethod {
 	G_AT_PPP_AUTH_METHOD_NONE,
 } GAtPPPAuthMethod;
 
+/*
+ * Tun interface statistics, meant for tuning the number of packets read
+ * from the interface per main loop wakeup
+ */
+struct _GAtPPPNetStats {
+	guint wakeups;			/* Tun read wakeups */
+	guint packets_read;		/* Packets read from tun */
+	guint max_per_wakeup;		/* Most packets read in a wakeup */
+	guint budget_exhausted;		/* Wakeups that used up the budget */
+	guint packets_written;		/* Packets written to tun */
+	guint packets_dropped;		/* Packets tun had no room for */
+};
+
+typedef struct _GAtPPPNetStats GAtPPPNetStats;
+
 typedef void (*GAtPPPConnectFunc)(const char *iface, const char *local,
 					const char *peer,
 					const char *dns1, const char *dns2,
@@ -57,6 +72,7 @@ typedef void (*GAtPPPDisconnectFunc)(GAtPPPDisconnectReason reason,
 					gpointer user_data);
 
 GAtPPP *g_at_ppp_new(void);
+GAtPPP *g_at_ppp_new_full(int fd);
 GAtPPP *g_at_ppp_server_new(const char *local);
 GAtPPP *g_at_ppp_server_new_full(const char *local, int fd);
 
@@ -90,6 +106,12 @@ void g_at_ppp_set_server_info(GAtPPP *ppp, const char *remote_ip,
 
 void g_at_ppp_set_acfc_enabled(GAtPPP *ppp, gboolean enabled);
 void g_at_ppp_set_pfc_enabled(GAtPPP *ppp, gboolean enabled);
+void g_at_ppp_set_vj_enabled(GAtPPP *ppp, gboolean enabled);
+void g_at_ppp_set_accm(GAtPPP *ppp, guint32 accm);
+void g_at_ppp_set_mru(GAtPPP *ppp, guint16 mru);
+
+void g_at_ppp_set_net_read_budget(GAtPPP *ppp, guint budget);
+gboolean g_at_ppp_get_net_stats(GAtPPP *ppp, GAtPPPNetStats *stats);
 
 #ifdef __cplusplus
 }
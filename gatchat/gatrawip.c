@@ -23,6 +23,8 @@
 #include <config.h>
 #endif
 
+#define _GNU_SOURCE
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
@@ -35,15 +37,53 @@
 #include "ringbuffer.h"
 #include "gatrawip.h"
 
+#define SPLICE_CHUNK	(64 * 1024)
+#define GUARD_TIMEOUT	1000	/* Pause before and after '+++', in ms */
+#define HDLC_FLAG	0x7e
+
+static const char no_carrier[] = "\r\nNO CARRIER";
+
+/*
+ * Moves data from one fd to another through a pipe with splice(), so the
+ * bytes never get copied into our address space
+ */
+struct rawip_splice {
+	GAtRawIP *rawip;
+	GAtIO *in_io;		/* Not reading while we splice */
+	GIOChannel *in;
+	GIOChannel *out;
+	int in_fd;
+	int out_fd;
+	int pipe[2];
+	gsize pending;		/* Bytes sitting in the pipe */
+	guint in_watch;
+	guint out_watch;
+};
+
 struct _GAtRawIP {
 	gint ref_count;
 	GAtIO *io;
 	GAtIO *tun_io;
+	gboolean is_tun;			/* tun_io is a tun interface */
 	char *ifname;
 	struct ring_buffer *write_buffer;
 	struct ring_buffer *tun_write_buffer;
+	gboolean splice_enabled;
+	struct rawip_splice *rx_splice;		/* Modem to tun */
+	struct rawip_splice *tx_splice;		/* Tun to modem */
+	GAtRawIPStats stats;
 	GAtDebugFunc debugf;
 	gpointer debug_data;
+	GAtSuspendFunc suspend_func;
+	gpointer suspend_data;
+	guint suspend_source;
+	GTimer *timer;
+	guint num_plus;
+	gboolean no_carrier_detect;
+	gboolean tun_frame_end;		/* tun_io last sent a flag */
+	GAtDisconnectFunc disconnect_func;
+	gpointer disconnect_data;
+	guint disconnect_source;
 };
 
 GAtRawIP *g_at_rawip_new(GIOChannel *channel)
@@ -74,6 +114,7 @@ GAtRawIP *g_at_rawip_new_from_io(GAtIO *io)
 
 	rawip->write_buffer = NULL;
 	rawip->tun_write_buffer = NULL;
+	rawip->tun_frame_end = TRUE;
 
 	rawip->io = g_at_io_ref(io);
 
@@ -100,6 +141,9 @@ void g_at_rawip_unref(GAtRawIP *rawip)
 
 	g_at_rawip_shutdown(rawip);
 
+	if (rawip->timer)
+		g_timer_destroy(rawip->timer);
+
 	g_at_io_unref(rawip->io);
 	rawip->io = NULL;
 
@@ -109,6 +153,208 @@ void g_at_rawip_unref(GAtRawIP *rawip)
 	g_free(rawip);
 }
 
+static void debug(GAtRawIP *rawip, const char *str)
+{
+	if (rawip->debugf)
+		rawip->debugf(str, rawip->debug_data);
+}
+
+static void splice_free(struct rawip_splice *sp)
+{
+	if (sp->in_watch > 0)
+		g_source_remove(sp->in_watch);
+
+	if (sp->out_watch > 0)
+		g_source_remove(sp->out_watch);
+
+	close(sp->pipe[0]);
+	close(sp->pipe[1]);
+
+	g_free(sp);
+}
+
+static gboolean splice_flush(struct rawip_splice *sp)
+{
+	ssize_t n;
+
+	while (sp->pending > 0) {
+		n = splice(sp->pipe[0], NULL, sp->out_fd, NULL, sp->pending,
+				SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return errno == EAGAIN;
+		}
+
+		sp->pending -= n;
+		sp->rawip->stats.spliced += n;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Hand the fd back to GAtIO, which then gets to see the hangup or error
+ * that made us stop and reports it the usual way
+ */
+static void splice_stop(struct rawip_splice *sp)
+{
+	GAtRawIP *rawip = sp->rawip;
+
+	splice_flush(sp);
+
+	if (rawip->rx_splice == sp)
+		rawip->rx_splice = NULL;
+	else
+		rawip->tx_splice = NULL;
+
+	g_at_io_resume_read(sp->in_io);
+
+	splice_free(sp);
+}
+
+static gboolean splice_out_cb(GIOChannel *channel, GIOCondition cond,
+				gpointer user_data);
+
+static gboolean splice_in_cb(GIOChannel *channel, GIOCondition cond,
+				gpointer user_data)
+{
+	struct rawip_splice *sp = user_data;
+	ssize_t n;
+
+	if (cond & G_IO_NVAL)
+		goto stop;
+
+	n = splice(sp->in_fd, NULL, sp->pipe[1], NULL, SPLICE_CHUNK,
+				SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (n > 0)
+		sp->pending += n;
+	else if (n == 0 || (errno != EAGAIN && errno != EINTR))
+		goto stop;
+
+	if (splice_flush(sp) == FALSE)
+		goto stop;
+
+	if (sp->pending == 0)
+		return TRUE;
+
+	/* The pipe is backed up, wait for the other side to take more */
+	sp->in_watch = 0;
+	sp->out_watch = g_io_add_watch(sp->out,
+				G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				splice_out_cb, sp);
+	return FALSE;
+
+stop:
+	sp->in_watch = 0;
+	splice_stop(sp);
+	return FALSE;
+}
+
+static gboolean splice_out_cb(GIOChannel *channel, GIOCondition cond,
+				gpointer user_data)
+{
+	struct rawip_splice *sp = user_data;
+
+	if (cond & (G_IO_NVAL | G_IO_HUP | G_IO_ERR))
+		goto stop;
+
+	if (splice_flush(sp) == FALSE)
+		goto stop;
+
+	if (sp->pending > 0)
+		return TRUE;
+
+	sp->out_watch = 0;
+	sp->in_watch = g_io_add_watch(sp->in,
+				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				splice_in_cb, sp);
+	return FALSE;
+
+stop:
+	sp->out_watch = 0;
+	splice_stop(sp);
+	return FALSE;
+}
+
+static struct rawip_splice *splice_new(GAtRawIP *rawip, GAtIO *in_io,
+					GAtIO *out_io)
+{
+	struct rawip_splice *sp;
+	GIOChannel *in = g_at_io_get_channel(in_io);
+	GIOChannel *out = g_at_io_get_channel(out_io);
+	int in_fd = g_at_io_get_fd(in_io);
+	int out_fd = g_at_io_get_fd(out_io);
+
+	if (in_fd < 0 || out_fd < 0)
+		return NULL;
+
+	sp = g_try_new0(struct rawip_splice, 1);
+	if (sp == NULL)
+		return NULL;
+
+	if (pipe2(sp->pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+		g_free(sp);
+		return NULL;
+	}
+
+	/*
+	 * With nothing in the pipe yet this returns straight away, with
+	 * EINVAL if the fd does not implement splice (e.g. tun)
+	 */
+	if (splice(sp->pipe[0], NULL, out_fd, NULL, 1,
+				SPLICE_F_NONBLOCK) < 0 && errno == EINVAL) {
+		debug(rawip, "splice not supported for writing, copying");
+		splice_free(sp);
+		return NULL;
+	}
+
+	sp->rawip = rawip;
+	sp->in_io = in_io;
+	sp->in = in;
+	sp->out = out;
+	sp->in_fd = in_fd;
+	sp->out_fd = out_fd;
+
+	return sp;
+}
+
+/*
+ * Take over reading once everything GAtIO had buffered has been written
+ * out, so that nothing gets reordered
+ */
+static void splice_start(struct rawip_splice *sp)
+{
+	ssize_t n;
+
+	if (sp == NULL || sp->in_watch > 0 || sp->out_watch > 0)
+		return;
+
+	g_at_io_suspend_read(sp->in_io);
+
+	/* The first read tells whether the input side supports splice */
+	n = splice(sp->in_fd, NULL, sp->pipe[1], NULL, SPLICE_CHUNK,
+				SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (n < 0 && errno == EINVAL) {
+		debug(sp->rawip, "splice not supported for reading, copying");
+		splice_stop(sp);
+		return;
+	}
+
+	if (n > 0)
+		sp->pending += n;
+
+	if (sp->pending > 0)
+		sp->out_watch = g_io_add_watch(sp->out,
+				G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				splice_out_cb, sp);
+	else
+		sp->in_watch = g_io_add_watch(sp->in,
+				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				splice_in_cb, sp);
+}
+
 static gboolean can_write_data(gpointer data)
 {
 	GAtRawIP *rawip = data;
@@ -123,13 +369,17 @@ static gboolean can_write_data(gpointer data)
 	buf = ring_buffer_read_ptr(rawip->write_buffer, 0);
 
 	bytes_written = g_at_io_write(rawip->io, (gchar *) buf, len);
-	ring_buffer_drain(rawip->write_buffer, bytes_written);
+	g_at_io_drain_ring_buffer(rawip->tun_io, bytes_written);
+	rawip->stats.copied += bytes_written;
 
 	if (ring_buffer_len(rawip->write_buffer) > 0)
 		return TRUE;
 
 	rawip->write_buffer = NULL;
 
+	/* Everything read so far went out, safe to switch over now */
+	splice_start(rawip->tx_splice);
+
 	return FALSE;
 }
 
@@ -147,45 +397,195 @@ static gboolean tun_write_data(gpointer data)
 	buf = ring_buffer_read_ptr(rawip->tun_write_buffer, 0);
 
 	bytes_written = g_at_io_write(rawip->tun_io, (gchar *) buf, len);
-	ring_buffer_drain(rawip->tun_write_buffer, bytes_written);
+	g_at_io_drain_ring_buffer(rawip->io, bytes_written);
+	rawip->stats.copied += bytes_written;
 
 	if (ring_buffer_len(rawip->tun_write_buffer) > 0)
 		return TRUE;
 
 	rawip->tun_write_buffer = NULL;
 
+	splice_start(rawip->rx_splice);
+
+	return FALSE;
+}
+
+static gboolean rawip_suspend(gpointer user_data)
+{
+	GAtRawIP *rawip = user_data;
+
+	rawip->suspend_source = 0;
+
+	/* The escape sequence is for us, not for the other side */
+	g_at_io_drain_ring_buffer(rawip->io, 3);
+
+	g_at_rawip_shutdown(rawip);
+
+	if (rawip->suspend_func)
+		rawip->suspend_func(rawip->suspend_data);
+
 	return FALSE;
 }
 
+static gboolean check_escape(GAtRawIP *rawip, struct ring_buffer *rbuf)
+{
+	unsigned int len = ring_buffer_len(rbuf);
+	unsigned int wrap = ring_buffer_len_no_wrap(rbuf);
+	unsigned char *buf = ring_buffer_read_ptr(rbuf, 0);
+	unsigned int pos = 0;
+	unsigned int elapsed = g_timer_elapsed(rawip->timer, NULL) * 1000;
+	unsigned int num_plus = 0;
+	gboolean guard_timeout = FALSE;
+
+	if (elapsed >= GUARD_TIMEOUT)
+		guard_timeout = TRUE;
+
+	while (pos < len && pos < 3) {
+		if (*buf != '+')
+			break;
+
+		num_plus++;
+		buf++;
+		pos++;
+
+		if (pos == wrap)
+			buf = ring_buffer_read_ptr(rbuf, pos);
+	}
+
+	if (num_plus != len)
+		return FALSE;
+
+	/* We got some escape chars, but no guard timeout first */
+	if (guard_timeout == FALSE && rawip->num_plus == 0)
+		return FALSE;
+
+	if (num_plus != 3) {
+		rawip->num_plus = num_plus;
+		return TRUE;
+	}
+
+	rawip->num_plus = 0;
+	rawip->suspend_source = g_timeout_add(GUARD_TIMEOUT,
+						rawip_suspend, rawip);
+
+	return TRUE;
+}
+
 static void new_bytes(struct ring_buffer *rbuf, gpointer user_data)
 {
 	GAtRawIP *rawip = user_data;
 
+	/* Held back '+' are passed on along with whatever followed them */
+	if (rawip->suspend_source > 0) {
+		g_source_remove(rawip->suspend_source);
+		rawip->suspend_source = 0;
+		g_timer_start(rawip->timer);
+	} else if (rawip->timer) {
+		gboolean escaping = check_escape(rawip, rbuf);
+
+		g_timer_start(rawip->timer);
+
+		if (escaping)
+			return;
+	}
+
 	rawip->tun_write_buffer = rbuf;
 
 	g_at_io_set_write_handler(rawip->tun_io, tun_write_data, rawip);
 }
 
+static gboolean rawip_disconnect(gpointer user_data)
+{
+	GAtRawIP *rawip = user_data;
+
+	rawip->disconnect_source = 0;
+
+	g_at_rawip_shutdown(rawip);
+
+	if (rawip->disconnect_func)
+		rawip->disconnect_func(rawip->disconnect_data);
+
+	return FALSE;
+}
+
+/*
+ * A modem on a tty reports the end of the call with a result code, not
+ * with a hangup.  PPP never has a CR right after a flag, so (as GAtHDLC
+ * does) a CR there is taken to start one.  Returns TRUE for the bytes to
+ * be held back.
+ */
+static gboolean check_no_carrier(GAtRawIP *rawip, struct ring_buffer *rbuf)
+{
+	unsigned int len = ring_buffer_len(rbuf);
+	unsigned int wrap = ring_buffer_len_no_wrap(rbuf);
+	unsigned char *buf = ring_buffer_read_ptr(rbuf, 0);
+	unsigned int pos = 0;
+
+	/* Anything not yet written out came before, and was no flag */
+	if (rawip->write_buffer != NULL || rawip->tun_frame_end == FALSE)
+		return FALSE;
+
+	while (pos < len && pos < sizeof(no_carrier) - 1) {
+		if (*buf != no_carrier[pos])
+			return FALSE;
+
+		buf++;
+		pos++;
+
+		if (pos == wrap)
+			buf = ring_buffer_read_ptr(rbuf, pos);
+	}
+
+	/* Wait for the rest of it */
+	if (pos < sizeof(no_carrier) - 1)
+		return TRUE;
+
+	if (rawip->disconnect_source == 0)
+		rawip->disconnect_source = g_idle_add(rawip_disconnect, rawip);
+
+	return TRUE;
+}
+
 static void tun_bytes(struct ring_buffer *rbuf, gpointer user_data)
 {
 	GAtRawIP *rawip = user_data;
+	unsigned int len = ring_buffer_len(rbuf);
+
+	if (rawip->no_carrier_detect) {
+		if (check_no_carrier(rawip, rbuf))
+			return;
+
+		rawip->tun_frame_end =
+			*ring_buffer_read_ptr(rbuf, len - 1) == HDLC_FLAG;
+	}
 
 	rawip->write_buffer = rbuf;
 
 	g_at_io_set_write_handler(rawip->io, can_write_data, rawip);
 }
 
-static void create_tun(GAtRawIP *rawip)
+static void create_tun(GAtRawIP *rawip, int fd)
 {
 	GIOChannel *channel;
 	struct ifreq ifr;
-	int fd, err;
+	int err;
+
+	memset(&ifr, 0, sizeof(ifr));
+
+	if (fd >= 0) {
+		/* Already set up by the caller, only look up the name */
+		if (ioctl(fd, TUNGETIFF, (void *) &ifr) == 0) {
+			rawip->ifname = g_strdup(ifr.ifr_name);
+			rawip->is_tun = TRUE;
+		}
+
+		goto done;
+	}
 
 	fd = open("/dev/net/tun", O_RDWR);
 	if (fd < 0)
 		return;
 
-	memset(&ifr, 0, sizeof(ifr));
 	ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
 	strcpy(ifr.ifr_name, "gprs%d");
 
@@ -196,7 +596,9 @@ static void create_tun(GAtRawIP *rawip)
 	}
 
 	rawip->ifname = g_strdup(ifr.ifr_name);
+	rawip->is_tun = TRUE;
 
+done:
 	channel = g_io_channel_unix_new(fd);
 	if (channel == NULL) {
 		close(fd);
@@ -209,17 +611,66 @@ static void create_tun(GAtRawIP *rawip)
 }
 
 void g_at_rawip_open(GAtRawIP *rawip)
+{
+	g_at_rawip_open_full(rawip, -1);
+}
+
+static void rawip_start(GAtRawIP *rawip)
+{
+	g_at_io_set_read_handler(rawip->io, new_bytes, rawip);
+	g_at_io_set_read_handler(rawip->tun_io, tun_bytes, rawip);
+
+	if (rawip->splice_enabled == FALSE)
+		return;
+
+	/* tun implements neither splice_read nor splice_write */
+	if (rawip->is_tun) {
+		debug(rawip, "splice not supported by tun, copying");
+		return;
+	}
+
+	/* Bytes we watch have to come through our buffers */
+	if (rawip->timer == NULL)
+		rawip->rx_splice = splice_new(rawip, rawip->io, rawip->tun_io);
+
+	if (rawip->no_carrier_detect == FALSE)
+		rawip->tx_splice = splice_new(rawip, rawip->tun_io, rawip->io);
+
+	/* Whatever is buffered already has to go out first */
+	if (rawip->tun_write_buffer == NULL)
+		splice_start(rawip->rx_splice);
+
+	if (rawip->write_buffer == NULL)
+		splice_start(rawip->tx_splice);
+}
+
+/* Like g_at_rawip_open, but uses (and takes over) an existing tun fd */
+void g_at_rawip_open_full(GAtRawIP *rawip, int fd)
 {
 	if (rawip == NULL)
 		return;
 
-	create_tun(rawip);
+	create_tun(rawip, fd);
 
 	if (rawip->tun_io == NULL)
 		return;
 
-	g_at_io_set_read_handler(rawip->io, new_bytes, rawip);
-	g_at_io_set_read_handler(rawip->tun_io, tun_bytes, rawip);
+	rawip_start(rawip);
+}
+
+/*
+ * Relays the bytes between our io and another one, e.g. a second serial
+ * port, without any tun interface involved.  Anything io has buffered
+ * already is passed on first.
+ */
+void g_at_rawip_open_io(GAtRawIP *rawip, GAtIO *io)
+{
+	if (rawip == NULL || io == NULL)
+		return;
+
+	rawip->tun_io = g_at_io_ref(io);
+
+	rawip_start(rawip);
 }
 
 void g_at_rawip_shutdown(GAtRawIP *rawip)
@@ -227,17 +678,39 @@ void g_at_rawip_shutdown(GAtRawIP *rawip)
 	if (rawip == NULL)
 		return;
 
+	if (rawip->suspend_source > 0) {
+		g_source_remove(rawip->suspend_source);
+		rawip->suspend_source = 0;
+	}
+
+	if (rawip->disconnect_source > 0) {
+		g_source_remove(rawip->disconnect_source);
+		rawip->disconnect_source = 0;
+	}
+
 	if (rawip->tun_io == NULL)
 		return;
 
+	/* The modem io goes back to its previous owner, reading again */
+	if (rawip->rx_splice)
+		splice_stop(rawip->rx_splice);
+
+	if (rawip->tx_splice)
+		splice_stop(rawip->tx_splice);
+
 	g_at_io_set_read_handler(rawip->io, NULL, NULL);
 	g_at_io_set_read_handler(rawip->tun_io, NULL, NULL);
 
+	/* Either io can outlive us, so no writer may point back to us */
+	g_at_io_set_write_handler(rawip->io, NULL, NULL);
+	g_at_io_set_write_handler(rawip->tun_io, NULL, NULL);
+
 	rawip->write_buffer = NULL;
 	rawip->tun_write_buffer = NULL;
 
 	g_at_io_unref(rawip->tun_io);
 	rawip->tun_io = NULL;
+	rawip->is_tun = FALSE;
 }
 
 const char *g_at_rawip_get_interface(GAtRawIP *rawip)
@@ -248,6 +721,87 @@ const char *g_at_rawip_get_interface(GAtRawIP *rawip)
 	return rawip->ifname;
 }
 
+/*
+ * Move the data between the modem and the other fd with splice() rather
+ * than copying it through our ring buffers.  A tun interface does not
+ * support splice, so this only helps when relaying to another io or a
+ * socket.  Each direction falls back to copying if its fds do not
+ * support splice.  Must be set before opening.
+ */
+void g_at_rawip_set_splice_enabled(GAtRawIP *rawip, gboolean enabled)
+{
+	if (rawip == NULL)
+		return;
+
+	rawip->splice_enabled = enabled;
+}
+
+/*
+ * Watch what is read from io for a '+++' escape sequence, surrounded by
+ * the guard times.  The sequence is not passed on, the relay is shut
+ * down and func called instead.  Turns off splice for that direction,
+ * so it must be set before opening.
+ */
+void g_at_rawip_set_suspend_function(GAtRawIP *rawip, GAtSuspendFunc func,
+							gpointer user_data)
+{
+	if (rawip == NULL)
+		return;
+
+	if (func == NULL) {
+		if (rawip->timer) {
+			g_timer_destroy(rawip->timer);
+			rawip->timer = NULL;
+		}
+
+		if (rawip->suspend_source > 0) {
+			g_source_remove(rawip->suspend_source);
+			rawip->suspend_source = 0;
+		}
+	} else if (rawip->timer == NULL)
+		rawip->timer = g_timer_new();
+
+	rawip->suspend_func = func;
+	rawip->suspend_data = user_data;
+}
+
+/*
+ * Watch what is read from the other io for a NO CARRIER result code in
+ * between PPP frames, on which the relay is shut down and the
+ * disconnect function called.  Turns off splice for that direction, so
+ * it must be set before opening.
+ */
+void g_at_rawip_set_no_carrier_detect(GAtRawIP *rawip, gboolean detect)
+{
+	if (rawip == NULL)
+		return;
+
+	rawip->no_carrier_detect = detect;
+}
+
+void g_at_rawip_set_disconnect_function(GAtRawIP *rawip,
+					GAtDisconnectFunc func,
+					gpointer user_data)
+{
+	if (rawip == NULL)
+		return;
+
+	rawip->disconnect_func = func;
+	rawip->disconnect_data = user_data;
+}
+
+gboolean g_at_rawip_get_stats(GAtRawIP *rawip, GAtRawIPStats *stats)
+{
+	if (rawip == NULL || stats == NULL)
+		return FALSE;
+
+	*stats = rawip->stats;
+	stats->rx_spliced = rawip->rx_splice != NULL;
+	stats->tx_spliced = rawip->tx_splice != NULL;
+
+	return TRUE;
+}
+
 void g_at_rawip_set_debug(GAtRawIP *rawip, GAtDebugFunc func,
 						gpointer user_data)
 {
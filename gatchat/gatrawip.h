@@ -33,6 +33,15 @@ struct _GAtRawIP;
 
 typedef struct _GAtRawIP GAtRawIP;
 
+struct _GAtRawIPStats {
+	guint64 copied;			/* Bytes copied through ring buffers */
+	guint64 spliced;		/* Bytes moved with splice() */
+	gboolean rx_spliced;		/* Modem to tun uses splice() */
+	gboolean tx_spliced;		/* Tun to modem uses splice() */
+};
+
+typedef struct _GAtRawIPStats GAtRawIPStats;
+
 GAtRawIP *g_at_rawip_new(GIOChannel *channel);
 GAtRawIP *g_at_rawip_new_from_io(GAtIO *io);
 
@@ -40,10 +49,21 @@ GAtRawIP *g_at_rawip_ref(GAtRawIP *rawip);
 void g_at_rawip_unref(GAtRawIP *rawip);
 
 void g_at_rawip_open(GAtRawIP *rawip);
+void g_at_rawip_open_full(GAtRawIP *rawip, int fd);
+void g_at_rawip_open_io(GAtRawIP *rawip, GAtIO *io);
 void g_at_rawip_shutdown(GAtRawIP *rawip);
 
 const char *g_at_rawip_get_interface(GAtRawIP *rawip);
 
+void g_at_rawip_set_splice_enabled(GAtRawIP *rawip, gboolean enabled);
+void g_at_rawip_set_suspend_function(GAtRawIP *rawip, GAtSuspendFunc func,
+							gpointer user_data);
+void g_at_rawip_set_no_carrier_detect(GAtRawIP *rawip, gboolean detect);
+void g_at_rawip_set_disconnect_function(GAtRawIP *rawip,
+					GAtDisconnectFunc func,
+					gpointer user_data);
+gboolean g_at_rawip_get_stats(GAtRawIP *rawip, GAtRawIPStats *stats);
+
 void g_at_rawip_set_debug(GAtRawIP *rawip, GAtDebugFunc func,
 						gpointer user_data);
 
@@ -30,6 +30,26 @@
 
 #include "gatresult.h"
 
+#define SPAN_NONE	G_MAXUINT16
+
+/*
+ * Start and the position just past the end of the quoted strings and
+ * lists of a line, in the order they start.  Built on demand for the
+ * iterator whose index_serial matches, and sized to the line.  Nothing
+ * parses results from more than one thread, so all iterators share it.
+ */
+struct span {
+	guint16 start;
+	guint16 end;
+};
+
+static struct {
+	struct span *spans;
+	unsigned int size;
+	unsigned int count;
+	unsigned int serial;
+} span_index;
+
 void g_at_result_iter_init(GAtResultIter *iter, GAtResult *result)
 {
 	iter->result = result;
@@ -37,6 +57,8 @@ void g_at_result_iter_init(GAtResultIter *iter, GAtResult *result)
 	iter->pre.data = NULL;
 	iter->l = &iter->pre;
 	iter->line_pos = 0;
+	iter->line_len = 0;
+	iter->index_serial = 0;
 }
 
 gboolean g_at_result_iter_next(GAtResultIter *iter, const char *prefix)
@@ -62,18 +84,23 @@ gboolean g_at_result_iter_next(GAtResultIter *iter, const char *prefix)
 
 		iter->line_pos = prefix_len;
 
-		while (iter->line_pos < strlen(line) &&
+		while (iter->line_pos < (unsigned int) linelen &&
 			line[iter->line_pos] == ' ')
 			iter->line_pos += 1;
 
 		goto out;
 	}
 
+	iter->line_len = 0;
+	iter->index_serial = 0;
+
 	return FALSE;
 
 out:
 	/* Already checked the length to be no more than buflen */
-	strcpy(iter->buf, line);
+	memcpy(iter->buf, line, linelen + 1);
+	iter->line_len = linelen;
+	iter->index_serial = 0;
 	return TRUE;
 }
 
@@ -94,6 +121,148 @@ const char *g_at_result_iter_raw_line(GAtResultIter *iter)
 	return line;
 }
 
+static unsigned int skip_until(const char *line, unsigned int start,
+					unsigned int len, const char delim)
+{
+	unsigned int i = start;
+
+	while (i < len) {
+		if (line[i] == delim)
+			return i;
+
+		if (line[i] == '\"') {
+			i += 1;
+			while (i < len && line[i] != '\"')
+				i += 1;
+
+			if (i < len)
+				i += 1;
+
+			continue;
+		}
+
+		if (line[i] != '(') {
+			i += 1;
+			continue;
+		}
+
+		i = skip_until(line, i+1, len, ')');
+
+		if (i < len)
+			i += 1;
+	}
+
+	return i;
+}
+
+/*
+ * Pair up every quoted string and (nested) list of the line in one pass,
+ * using the same rules as skip_until: quotes do not nest, lists do and may
+ * contain quoted strings.  Unterminated spans extend to the end of line.
+ * While a list is open its end links to the list enclosing it.
+ */
+static gboolean build_span_index(GAtResultIter *iter, const char *line,
+					unsigned int len)
+{
+	unsigned int open = SPAN_NONE;
+	unsigned int size = 0;
+	unsigned int i;
+	unsigned int j;
+	unsigned int k;
+
+	for (i = 0; i < len; i++)
+		if (line[i] == '"' || line[i] == '(')
+			size += 1;
+
+	if (size > span_index.size) {
+		struct span *spans = g_try_renew(struct span,
+						span_index.spans, size);
+
+		if (spans == NULL)
+			return FALSE;
+
+		span_index.spans = spans;
+		span_index.size = size;
+	}
+
+	span_index.count = 0;
+	i = 0;
+
+	while (i < len) {
+		if (line[i] != '"' && line[i] != '(') {
+			if (line[i] == ')' && open != SPAN_NONE) {
+				k = open;
+				open = span_index.spans[k].end;
+				span_index.spans[k].end = i + 1;
+			}
+
+			i += 1;
+			continue;
+		}
+
+		k = span_index.count++;
+		span_index.spans[k].start = i;
+
+		if (line[i] == '(') {
+			span_index.spans[k].end = open;
+			open = k;
+			i += 1;
+			continue;
+		}
+
+		for (j = i + 1; j < len && line[j] != '"'; j++)
+			;
+
+		if (j < len)
+			j += 1;
+
+		span_index.spans[k].end = j;
+		i = j;
+	}
+
+	while (open != SPAN_NONE) {
+		k = open;
+		open = span_index.spans[k].end;
+		span_index.spans[k].end = len;
+	}
+
+	/* Never 0, which stands for no index */
+	if (++span_index.serial == 0)
+		span_index.serial = 1;
+
+	iter->index_serial = span_index.serial;
+
+	return TRUE;
+}
+
+/* Where the span starting at pos ends, 0 if none starts there */
+static unsigned int span_index_lookup(unsigned int pos)
+{
+	unsigned int lo = 0;
+	unsigned int hi = span_index.count;
+	unsigned int mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+
+		if (span_index.spans[mid].start == pos)
+			return span_index.spans[mid].end;
+
+		if (span_index.spans[mid].start < pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return 0;
+}
+
+static inline gboolean span_index_valid(GAtResultIter *iter)
+{
+	return iter->index_serial != 0 &&
+			iter->index_serial == span_index.serial;
+}
+
 static inline int skip_to_next_field(const char *line, int pos, int len)
 {
 	if (pos < len && line[pos] == ',')
@@ -120,7 +289,7 @@ gboolean g_at_result_iter_next_unquoted_string(GAtResultIter *iter,
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	pos = iter->line_pos;
 
@@ -164,7 +333,7 @@ gboolean g_at_result_iter_next_string(GAtResultIter *iter, const char **str)
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	pos = iter->line_pos;
 
@@ -178,10 +347,17 @@ gboolean g_at_result_iter_next_string(GAtResultIter *iter, const char **str)
 	if (line[pos++] != '"')
 		return FALSE;
 
-	end = pos;
+	/* Once the line is indexed, where the string ends is known */
+	end = span_index_valid(iter) ? span_index_lookup(pos - 1) : 0;
 
-	while (end < len && line[end] != '"')
-		end += 1;
+	if (end > pos) {
+		end -= 1;
+	} else {
+		end = pos;
+
+		while (end < len && line[end] != '"')
+			end += 1;
+	}
 
 	if (line[end] != '"')
 		return FALSE;
@@ -216,7 +392,7 @@ gboolean g_at_result_iter_next_hexstring(GAtResultIter *iter,
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	pos = iter->line_pos;
 	bufpos = iter->buf + pos;
@@ -271,7 +447,7 @@ gboolean g_at_result_iter_next_number(GAtResultIter *iter, gint *number)
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	pos = iter->line_pos;
 	end = pos;
@@ -306,7 +482,7 @@ gboolean g_at_result_iter_next_number_default(GAtResultIter *iter, gint dflt,
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	pos = skip_to_next_field(line, iter->line_pos, len);
 
@@ -338,7 +514,7 @@ gboolean g_at_result_iter_next_range(GAtResultIter *iter, gint *min, gint *max)
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	pos = iter->line_pos;
 
@@ -382,35 +558,34 @@ out:
 	return TRUE;
 }
 
-static gint skip_until(const char *line, int start, const char delim)
+static unsigned int skip_until_indexed(GAtResultIter *iter, const char *line,
+					unsigned int start, const char delim)
 {
-	int len = strlen(line);
-	int i = start;
+	unsigned int len = iter->line_len;
+	unsigned int i = start;
+	unsigned int end;
+
+	if (!span_index_valid(iter) && !build_span_index(iter, line, len))
+		return skip_until(line, start, len, delim);
 
 	while (i < len) {
 		if (line[i] == delim)
 			return i;
 
-		if (line[i] == '\"') {
-			i += 1;
-			while (i < len && line[i] != '\"')
-				i += 1;
-
-			if (i < len)
-				i += 1;
-
-			continue;
-		}
-
-		if (line[i] != '(') {
+		if (line[i] != '"' && line[i] != '(') {
 			i += 1;
 			continue;
 		}
 
-		i = skip_until(line, i+1, ')');
+		/*
+		 * Not the start of a span as seen from the beginning of the
+		 * line, we must be inside a string.  Do what we always did.
+		 */
+		end = span_index_lookup(i);
+		if (end == 0)
+			return skip_until(line, i, len, delim);
 
-		if (i < len)
-			i += 1;
+		i = end;
 	}
 
 	return i;
@@ -429,12 +604,12 @@ gboolean g_at_result_iter_skip_next(GAtResultIter *iter)
 
 	line = iter->l->data;
 
-	skipped_to = skip_until(line, iter->line_pos, ',');
+	skipped_to = skip_until_indexed(iter, line, iter->line_pos, ',');
 
 	if (skipped_to == iter->line_pos && line[skipped_to] != ',')
 		return FALSE;
 
-	iter->line_pos = skip_to_next_field(line, skipped_to, strlen(line));
+	iter->line_pos = skip_to_next_field(line, skipped_to, iter->line_len);
 
 	return TRUE;
 }
@@ -451,7 +626,7 @@ gboolean g_at_result_iter_open_list(GAtResultIter *iter)
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	if (iter->line_pos >= len)
 		return FALSE;
@@ -461,8 +636,7 @@ gboolean g_at_result_iter_open_list(GAtResultIter *iter)
 
 	iter->line_pos += 1;
 
-	while (iter->line_pos < strlen(line) &&
-		line[iter->line_pos] == ' ')
+	while (iter->line_pos < len && line[iter->line_pos] == ' ')
 		iter->line_pos += 1;
 
 	return TRUE;
@@ -480,7 +654,7 @@ gboolean g_at_result_iter_close_list(GAtResultIter *iter)
 		return FALSE;
 
 	line = iter->l->data;
-	len = strlen(line);
+	len = iter->line_len;
 
 	if (iter->line_pos >= len)
 		return FALSE;
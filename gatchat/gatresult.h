@@ -41,6 +41,8 @@ struct _GAtResultIter {
 	char buf[G_AT_RESULT_LINE_LENGTH_MAX + 1];
 	unsigned int line_pos;
 	GSList pre;
+	unsigned int line_len;
+	unsigned int index_serial;	/* Span index of this line, 0 if none */
 };
 
 typedef struct _GAtResultIter GAtResultIter;
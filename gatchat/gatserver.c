@@ -970,12 +970,12 @@ static char *extract_line(GAtServer *p, struct ring_buffer *rbuf)
 
 	line = g_try_new(char, line_length + 1);
 	if (line == NULL) {
-		ring_buffer_drain(rbuf, p->read_so_far);
+		g_at_io_drain_ring_buffer(p->io, p->read_so_far);
 		return NULL;
 	}
 
 	/* Strip leading whitespace + AT */
-	ring_buffer_drain(rbuf, strip_front + 2);
+	g_at_io_drain_ring_buffer(p->io, strip_front + 2);
 
 	pos = 0;
 	i = 0;
@@ -1002,7 +1002,7 @@ static char *extract_line(GAtServer *p, struct ring_buffer *rbuf)
 	}
 
 	/* Strip S3 */
-	ring_buffer_drain(rbuf, p->read_so_far - strip_front - 2);
+	g_at_io_drain_ring_buffer(p->io, p->read_so_far - strip_front - 2);
 
 	line[i] = '\0';
 
@@ -1019,7 +1019,7 @@ static void new_bytes(struct ring_buffer *rbuf, gpointer user_data)
 
 	/* We do not support command abortion, so ignore input */
 	if (p->final_async) {
-		ring_buffer_drain(rbuf, len);
+		g_at_io_drain_ring_buffer(p->io, len);
 		return;
 	}
 
@@ -1050,7 +1050,7 @@ static void new_bytes(struct ring_buffer *rbuf, gpointer user_data)
 			 * Empty commands must be OK by the DCE
 			 */
 			g_at_server_send_final(p, G_AT_SERVER_RESULT_OK);
-			ring_buffer_drain(rbuf, p->read_so_far);
+			g_at_io_drain_ring_buffer(p->io, p->read_so_far);
 			break;
 
 		case PARSER_RESULT_COMMAND:
@@ -1070,7 +1070,7 @@ static void new_bytes(struct ring_buffer *rbuf, gpointer user_data)
 
 		case PARSER_RESULT_REPEAT_LAST:
 			p->cur_pos = 0;
-			ring_buffer_drain(rbuf, p->read_so_far);
+			g_at_io_drain_ring_buffer(p->io, p->read_so_far);
 
 			if (p->last_line)
 				server_parse_line(p);
@@ -1080,7 +1080,7 @@ static void new_bytes(struct ring_buffer *rbuf, gpointer user_data)
 			break;
 
 		case PARSER_RESULT_GARBAGE:
-			ring_buffer_drain(rbuf, p->read_so_far);
+			g_at_io_drain_ring_buffer(p->io, p->read_so_far);
 			break;
 		}
 
@@ -1096,7 +1096,7 @@ static void new_bytes(struct ring_buffer *rbuf, gpointer user_data)
 		 * e.g. AT+CMD1\rAT+CMD2
 		 */
 		if (result != PARSER_RESULT_GARBAGE) {
-			ring_buffer_drain(rbuf, len);
+			g_at_io_drain_ring_buffer(p->io, len);
 			break;
 		}
 	}
@@ -23,6 +23,8 @@
 #include <config.h>
 #endif
 
+#include <string.h>
+
 #include <glib.h>
 
 #include "gatsyntax.h"
@@ -59,6 +61,24 @@ enum GSM_PERMISSIVE_STATE {
 	GSM_PERMISSIVE_STATE_SHORT_PROMPT,
 };
 
+/*
+ * Most of the bytes of a response or PDU are of no interest to the state
+ * machines below.  These return the offset of the next byte that is, or
+ * len if there is none, letting memchr do the scanning.
+ */
+static inline gsize skip_to(const char *bytes, gsize start, gsize len, char c)
+{
+	const char *p = memchr(bytes + start, c, len - start);
+
+	return p ? (gsize) (p - bytes) : len;
+}
+
+static inline gsize skip_to_either(const char *bytes, gsize start, gsize len,
+					char c1, char c2)
+{
+	return skip_to(bytes, start, skip_to(bytes, start, len, c1), c2);
+}
+
 static void gsmv1_hint(GAtSyntax *syntax, GAtSyntaxExpectHint hint)
 {
 	switch (hint) {
@@ -121,11 +141,19 @@ static GAtSyntaxResult gsmv1_feed(GAtSyntax *syntax,
 				syntax->state = GSMV1_STATE_TERMINATOR_CR;
 			else if (byte == '"')
 				syntax->state = GSMV1_STATE_RESPONSE_STRING;
+			else {
+				i = skip_to_either(bytes, i, *len, '\r', '"');
+				continue;
+			}
 			break;
 
 		case GSMV1_STATE_RESPONSE_STRING:
 			if (byte == '"')
 				syntax->state = GSMV1_STATE_RESPONSE;
+			else {
+				i = skip_to(bytes, i, *len, '"');
+				continue;
+			}
 			break;
 
 		case GSMV1_STATE_TERMINATOR_CR:
@@ -149,6 +177,10 @@ static GAtSyntaxResult gsmv1_feed(GAtSyntax *syntax,
 		case GSMV1_STATE_MULTILINE_RESPONSE:
 			if (byte == '\r')
 				syntax->state = GSMV1_STATE_MULTILINE_TERMINATOR_CR;
+			else {
+				i = skip_to(bytes, i, *len, '\r');
+				continue;
+			}
 			break;
 
 		case GSMV1_STATE_MULTILINE_TERMINATOR_CR:
@@ -186,6 +218,10 @@ static GAtSyntaxResult gsmv1_feed(GAtSyntax *syntax,
 		case GSMV1_STATE_PDU:
 			if (byte == '\r')
 				syntax->state = GSMV1_STATE_PDU_CR;
+			else {
+				i = skip_to(bytes, i, *len, '\r');
+				continue;
+			}
 			break;
 
 		case GSMV1_STATE_PDU_CR:
@@ -221,7 +257,8 @@ static GAtSyntaxResult gsmv1_feed(GAtSyntax *syntax,
 				goto out;
 			}
 
-			break;
+			i = skip_to_either(bytes, i, *len, '\r', 26);
+			continue;
 
 		case GSMV1_STATE_PPP_DATA:
 			if (byte == '~') {
@@ -231,7 +268,8 @@ static GAtSyntaxResult gsmv1_feed(GAtSyntax *syntax,
 				goto out;
 			}
 
-			break;
+			i = skip_to(bytes, i, *len, '~');
+			continue;
 
 		case GSMV1_STATE_SHORT_PROMPT:
 			if (byte == '\r')
@@ -304,6 +342,10 @@ static GAtSyntaxResult gsm_permissive_feed(GAtSyntax *syntax,
 			} else if (byte == '"')
 				syntax->state =
 					GSM_PERMISSIVE_STATE_RESPONSE_STRING;
+			else {
+				i = skip_to_either(bytes, i, *len, '\r', '"');
+				continue;
+			}
 			break;
 
 		case GSM_PERMISSIVE_STATE_RESPONSE_STRING:
@@ -314,6 +356,9 @@ static GAtSyntaxResult gsm_permissive_feed(GAtSyntax *syntax,
 				i += 1;
 				res = G_AT_SYNTAX_RESULT_LINE;
 				goto out;
+			} else {
+				i = skip_to_either(bytes, i, *len, '\r', '"');
+				continue;
 			}
 			break;
 
@@ -330,7 +375,9 @@ static GAtSyntaxResult gsm_permissive_feed(GAtSyntax *syntax,
 				res = G_AT_SYNTAX_RESULT_PDU;
 				goto out;
 			}
-			break;
+
+			i = skip_to(bytes, i, *len, '\r');
+			continue;
 
 		case GSM_PERMISSIVE_STATE_PROMPT:
 			if (byte == ' ') {
@@ -356,3 +356,343 @@ int gsm0710_basic_fill_frame(guint8 *frame, guint8 dlc, guint8 type,
 
 	return size;
 }
+
+enum parser_state {
+	PARSER_HUNT,		/* Looking for an opening flag */
+	PARSER_ADDRESS,
+	PARSER_CONTROL,
+	PARSER_LENGTH,
+	PARSER_LENGTH2,
+	PARSER_INFO,
+	PARSER_FCS,
+	PARSER_END,		/* Expecting the closing flag */
+	PARSER_CONTENT,		/* Advanced mode, everything up to the flag */
+};
+
+/*
+ * Incremental frame parser.  Input can be split anywhere, every byte is
+ * looked at exactly once and the header FCS is computed as it arrives.
+ * Information fields are copied out only when they span a feed.
+ */
+struct gsm0710_parser {
+	gboolean advanced;
+	enum parser_state state;
+	guint8 crc;		/* Running FCS over the header */
+	guint8 address;
+	guint8 control;
+	int length;		/* Basic mode information length */
+	int pos;		/* Bytes of the frame buffered so far */
+	gboolean escape;	/* Advanced mode, 0x7D seen */
+	gboolean discard;	/* Bad or oversized frame, skip to its end */
+	const guint8 *direct;	/* Information field inside the input */
+	guint8 *buf;
+	int max_len;
+	GSM0710FrameFunc func;
+	gpointer user_data;
+};
+
+struct gsm0710_parser *gsm0710_parser_new(gboolean advanced, int max_len,
+						GSM0710FrameFunc func,
+						gpointer user_data)
+{
+	struct gsm0710_parser *parser;
+
+	parser = g_try_new0(struct gsm0710_parser, 1);
+	if (parser == NULL)
+		return NULL;
+
+	/* Advanced mode buffers address, control and FCS as well */
+	parser->buf = g_try_malloc(max_len + 3);
+	if (parser->buf == NULL) {
+		g_free(parser);
+		return NULL;
+	}
+
+	parser->advanced = advanced;
+	parser->max_len = max_len;
+	parser->func = func;
+	parser->user_data = user_data;
+	parser->state = PARSER_HUNT;
+
+	return parser;
+}
+
+void gsm0710_parser_free(struct gsm0710_parser *parser)
+{
+	if (parser == NULL)
+		return;
+
+	g_free(parser->buf);
+	g_free(parser);
+}
+
+void gsm0710_parser_reset(struct gsm0710_parser *parser)
+{
+	parser->state = PARSER_HUNT;
+	parser->escape = FALSE;
+	parser->discard = FALSE;
+	parser->direct = NULL;
+	parser->pos = 0;
+}
+
+static void basic_start_frame(struct gsm0710_parser *parser)
+{
+	parser->state = PARSER_ADDRESS;
+	parser->crc = 0xFF;
+	parser->pos = 0;
+	parser->discard = FALSE;
+	parser->direct = NULL;
+}
+
+/* Returns the number of bytes consumed from data */
+static int basic_feed_info(struct gsm0710_parser *parser,
+				const guint8 *data, int len)
+{
+	int want = parser->length - parser->pos;
+
+	/*
+	 * The whole field, FCS and closing flag included, is at hand, so
+	 * the frame completes within this feed and can be handed out in
+	 * place
+	 */
+	if (parser->pos == 0 && parser->discard == FALSE && len >= want + 2) {
+		parser->direct = data;
+		parser->pos = parser->length;
+		parser->state = PARSER_FCS;
+		return want;
+	}
+
+	want = MIN(want, len);
+
+	if (parser->discard == FALSE)
+		memcpy(parser->buf + parser->pos, data, want);
+
+	parser->pos += want;
+
+	if (parser->pos == parser->length)
+		parser->state = PARSER_FCS;
+
+	return want;
+}
+
+static void basic_feed(struct gsm0710_parser *parser,
+				const guint8 *data, int len)
+{
+	const guint8 *frame;
+	guint8 c;
+	int i = 0;
+
+	while (i < len) {
+		if (parser->state == PARSER_INFO) {
+			i += basic_feed_info(parser, data + i, len - i);
+			continue;
+		}
+
+		c = data[i++];
+
+		switch (parser->state) {
+		case PARSER_HUNT:
+			if (c == 0xF9)
+				basic_start_frame(parser);
+			break;
+		case PARSER_ADDRESS:
+			/* Skip additional 0xF9 bytes between frames */
+			if (c == 0xF9)
+				break;
+
+			/*
+			 * A clear EA bit means a long channel number, which
+			 * 27.010 Section 5.2.3 says makes the frame invalid
+			 */
+			if ((c & 0x01) == 0) {
+				parser->state = PARSER_HUNT;
+				break;
+			}
+
+			parser->address = c;
+			parser->crc = crc_table[parser->crc ^ c];
+			parser->state = PARSER_CONTROL;
+			break;
+		case PARSER_CONTROL:
+			parser->control = c;
+			parser->crc = crc_table[parser->crc ^ c];
+			parser->state = PARSER_LENGTH;
+			break;
+		case PARSER_LENGTH:
+			parser->crc = crc_table[parser->crc ^ c];
+			parser->length = c >> 1;
+
+			if ((c & 0x01) == 0) {
+				parser->state = PARSER_LENGTH2;
+				break;
+			}
+
+			goto length_done;
+		case PARSER_LENGTH2:
+			parser->crc = crc_table[parser->crc ^ c];
+			parser->length |= c << 7;
+
+length_done:
+			/* Too long to keep, but still skipped as a frame */
+			if (parser->length > parser->max_len)
+				parser->discard = TRUE;
+
+			if (parser->length > 0)
+				parser->state = PARSER_INFO;
+			else
+				parser->state = PARSER_FCS;
+
+			break;
+		case PARSER_FCS:
+			/* Only the header is covered, Section 5.2.1.6 */
+			if (crc_table[parser->crc ^ c] != 0xCF)
+				parser->discard = TRUE;
+
+			parser->state = PARSER_END;
+			break;
+		case PARSER_END:
+			if (c != 0xF9) {
+				parser->state = PARSER_HUNT;
+				parser->direct = NULL;
+				break;
+			}
+
+			if (parser->discard == FALSE) {
+				frame = parser->direct ? parser->direct :
+								parser->buf;
+
+				parser->func(parser->address >> 2,
+						parser->control & 0xEF,
+						frame, parser->length,
+						parser->user_data);
+			}
+
+			/*
+			 * "The closing flag may also be the opening flag of
+			 * the following frame", Section 5.2.6.1
+			 */
+			basic_start_frame(parser);
+			break;
+		default:
+			parser->state = PARSER_HUNT;
+			break;
+		}
+	}
+}
+
+static void advanced_end_frame(struct gsm0710_parser *parser)
+{
+	guint8 *frame = parser->buf;
+	int len = parser->pos;
+
+	if (parser->discard || len < 3)
+		return;
+
+	/* Validate the checksum on the packet header */
+	if (crc_table[parser->crc ^ frame[len - 1]] != 0xCF)
+		return;
+
+	parser->func((frame[0] >> 2) & 0x3F, frame[1] & 0xEF,
+				frame + 2, len - 3, parser->user_data);
+}
+
+static void advanced_feed(struct gsm0710_parser *parser,
+				const guint8 *data, int len)
+{
+	int i = 0;
+	int run;
+	guint8 c;
+
+	while (i < len) {
+		if (parser->state == PARSER_HUNT) {
+			const guint8 *flag = memchr(data + i, 0x7E, len - i);
+
+			if (flag == NULL)
+				return;
+
+			i = flag - data + 1;
+			parser->state = PARSER_CONTENT;
+			parser->crc = 0xFF;
+			parser->pos = 0;
+			parser->escape = FALSE;
+			parser->discard = FALSE;
+			continue;
+		}
+
+		/* Copy runs of plain bytes in one go */
+		for (run = 0; i + run < len && parser->escape == FALSE; run++) {
+			c = data[i + run];
+
+			if (c == 0x7E || c == 0x7D)
+				break;
+		}
+
+		if (run > 0) {
+			if (parser->pos + run > parser->max_len + 3)
+				parser->discard = TRUE;
+
+			if (parser->discard == FALSE) {
+				memcpy(parser->buf + parser->pos, data + i, run);
+
+				/* Address and control make up the header */
+				while (parser->pos < 2 && run > 0) {
+					parser->crc = crc_table[parser->crc ^
+							data[i]];
+					parser->pos += 1;
+					run -= 1;
+					i += 1;
+				}
+
+				parser->pos += run;
+			}
+
+			i += run;
+			continue;
+		}
+
+		c = data[i++];
+
+		if (c == 0x7E) {
+			/* Skip additional 0x7E bytes between frames */
+			if (parser->pos > 0 || parser->discard)
+				advanced_end_frame(parser);
+
+			parser->crc = 0xFF;
+			parser->pos = 0;
+			parser->escape = FALSE;
+			parser->discard = FALSE;
+			continue;
+		}
+
+		if (c == 0x7D && parser->escape == FALSE) {
+			parser->escape = TRUE;
+			continue;
+		}
+
+		parser->escape = FALSE;
+		c ^= 0x20;
+
+		if (parser->pos >= parser->max_len + 3)
+			parser->discard = TRUE;
+
+		if (parser->discard)
+			continue;
+
+		if (parser->pos < 2)
+			parser->crc = crc_table[parser->crc ^ c];
+
+		parser->buf[parser->pos++] = c;
+	}
+}
+
+void gsm0710_parser_feed(struct gsm0710_parser *parser,
+				const guint8 *data, int len)
+{
+	if (parser == NULL || len <= 0)
+		return;
+
+	if (parser->advanced)
+		advanced_feed(parser, data, len);
+	else
+		basic_feed(parser, data, len);
+}
@@ -48,6 +48,21 @@ int gsm0710_advanced_extract_frame(guint8 *data, int len,
 
 int gsm0710_advanced_fill_frame(guint8 *frame, guint8 dlc, guint8 type,
 					const guint8 *data, int len);
+
+typedef void (*GSM0710FrameFunc)(guint8 dlc, guint8 type,
+					const guint8 *data, int len,
+					gpointer user_data);
+
+struct gsm0710_parser;
+
+struct gsm0710_parser *gsm0710_parser_new(gboolean advanced, int max_len,
+						GSM0710FrameFunc func,
+						gpointer user_data);
+void gsm0710_parser_free(struct gsm0710_parser *parser);
+void gsm0710_parser_reset(struct gsm0710_parser *parser);
+void gsm0710_parser_feed(struct gsm0710_parser *parser,
+				const guint8 *data, int len);
+
 #ifdef __cplusplus
 };
 #endif
@@ -59,6 +59,7 @@ static gchar *option_pppdump = NULL;
 static gboolean option_bluetooth = FALSE;
 static gboolean option_acfc = FALSE;
 static gboolean option_pfc = FALSE;
+static gboolean option_vj = FALSE;
 
 static GAtPPP *ppp;
 static GAtChat *control;
@@ -373,6 +374,7 @@ static void connect_cb(gboolean ok, GAtResult *result, gpointer user_data)
 
 	g_at_ppp_set_acfc_enabled(ppp, option_acfc);
 	g_at_ppp_set_pfc_enabled(ppp, option_pfc);
+	g_at_ppp_set_vj_enabled(ppp, option_vj);
 
 	/* set connect and disconnect callbacks */
 	g_at_ppp_set_connect_function(ppp, ppp_connect, NULL);
@@ -687,6 +689,8 @@ static GOptionEntry options[] = {
 				"Use Protocol Field Compression" },
 	{ "acfc", 0, 0, G_OPTION_ARG_NONE, &option_acfc,
 				"Use Address & Control Field Compression" },
+	{ "vj", 0, 0, G_OPTION_ARG_NONE, &option_vj,
+				"Use Van Jacobson TCP/IP Header Compression" },
 	{ NULL },
 };
 
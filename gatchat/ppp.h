@@ -28,6 +28,8 @@
 #define IPV6CP_PROTO	0x8057
 #define PPP_IP_PROTO	0x0021
 #define PPP_IPV6_PROTO	0x0057
+#define PPP_VJ_COMP	0x002d
+#define PPP_VJ_UNCOMP	0x002f
 #define MD5		5
 
 #define DBG(p, fmt, arg...) do {				\
@@ -40,6 +42,7 @@
 struct ppp_chap;
 struct ppp_net;
 struct ppp_pap;
+struct ppp_vj;
 
 struct ppp_header {
 	guint8 address;
@@ -92,12 +95,15 @@ void lcp_free(struct pppcp_data *lcp);
 void lcp_protocol_reject(struct pppcp_data *lcp, guint8 *packet, gsize len);
 void lcp_set_acfc_enabled(struct pppcp_data *pppcp, gboolean enabled);
 void lcp_set_pfc_enabled(struct pppcp_data *pppcp, gboolean enabled);
+void lcp_set_accm(struct pppcp_data *pppcp, guint32 accm);
+void lcp_set_mru(struct pppcp_data *pppcp, guint16 mru);
 
 /* IPCP related functions */
 struct pppcp_data *ipcp_new(GAtPPP *ppp, gboolean is_server, guint32 ip);
 void ipcp_free(struct pppcp_data *data);
 void ipcp_set_server_info(struct pppcp_data *ipcp, guint32 peer_addr,
 				guint32 dns1, guint32 dns2);
+void ipcp_set_vj_enabled(struct pppcp_data *ipcp, gboolean enabled);
 
 /* IPv6 CP related functions */
 struct pppcp_data *ipv6cp_new(GAtPPP *ppp, gboolean is_server,
@@ -127,6 +133,18 @@ void ppp_net_free(struct ppp_net *net);
 gboolean ppp_net_set_mtu(struct ppp_net *net, guint16 mtu);
 void ppp_net_suspend_interface(struct ppp_net *net);
 void ppp_net_resume_interface(struct ppp_net *net);
+void ppp_net_set_read_budget(struct ppp_net *net, guint budget);
+void ppp_net_get_stats(struct ppp_net *net, GAtPPPNetStats *stats);
+
+/* VJ TCP/IP header compression related functions */
+struct ppp_vj *ppp_vj_new(guint recv_slots, guint xmit_slots,
+				gboolean xmit_cslot);
+void ppp_vj_free(struct ppp_vj *vj);
+guint16 ppp_vj_compress(struct ppp_vj *vj, guint8 *ip, guint *len,
+				guint *offset);
+const guint8 *ppp_vj_decompress(struct ppp_vj *vj, guint16 proto,
+				const guint8 *data, gsize len,
+				gsize *out_len);
 
 /* PPP functions related to main GAtPPP object */
 void ppp_debug(GAtPPP *ppp, const char *str);
@@ -145,4 +163,6 @@ void ppp_set_xmit_accm(GAtPPP *ppp, guint32 accm);
 void ppp_set_mtu(GAtPPP *ppp, const guint8 *data);
 void ppp_set_xmit_acfc(GAtPPP *ppp, gboolean acfc);
 void ppp_set_xmit_pfc(GAtPPP *ppp, gboolean pfc);
+void ppp_set_recv_vj(GAtPPP *ppp, guint8 max_slot_id);
+void ppp_set_xmit_vj(GAtPPP *ppp, guint8 max_slot_id, gboolean comp_slot_id);
 struct ppp_header *ppp_packet_new(gsize infolen, guint16 protocol);
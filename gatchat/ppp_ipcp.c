@@ -54,14 +54,18 @@ enum ipcp_option_types {
 	SECONDARY_NBNS_SERVER	= 132,
 };
 
-/* We request IP_ADDRESS, PRIMARY/SECONDARY DNS & NBNS */
-#define MAX_CONFIG_OPTION_SIZE 5*6
+/* We request IP_ADDRESS, PRIMARY/SECONDARY DNS & NBNS and VJ compression */
+#define MAX_CONFIG_OPTION_SIZE 6*6
 
 #define REQ_OPTION_IPADDR	0x01
 #define REQ_OPTION_DNS1		0x02
 #define REQ_OPTION_DNS2		0x04
 #define REQ_OPTION_NBNS1	0x08
 #define REQ_OPTION_NBNS2	0x10
+#define REQ_OPTION_VJ		0x20
+
+/* RFC 1332: Max-Slot-Id is the number of slots minus one */
+#define VJ_MAX_SLOT_ID		15
 
 #define MAX_IPCP_FAILURE	100
 
@@ -76,6 +80,12 @@ struct ipcp_data {
 	guint32 nbns1;
 	guint32 nbns2;
 	gboolean is_server;
+	gboolean vj_enabled;
+	guint8 vj_max_slot_id;
+	gboolean vj_comp_slot_id;
+	gboolean peer_vj;
+	guint8 peer_vj_max_slot_id;
+	gboolean peer_vj_comp_slot_id;
 };
 
 #define FILL_IP(options, req, type, var)		\
@@ -102,14 +112,35 @@ static void ipcp_generate_config_options(struct ipcp_data *ipcp)
 	FILL_IP(ipcp->options, ipcp->req_options & REQ_OPTION_NBNS2,
 					SECONDARY_NBNS_SERVER, &ipcp->nbns2);
 
+	if (ipcp->req_options & REQ_OPTION_VJ) {
+		ipcp->options[len] = IP_COMPRESSION_PROTO;
+		ipcp->options[len + 1] = 6;
+		put_network_short(ipcp->options + len + 2, PPP_VJ_COMP);
+		ipcp->options[len + 4] = ipcp->vj_max_slot_id;
+		ipcp->options[len + 5] = ipcp->vj_comp_slot_id;
+
+		len += 6;
+	}
+
 	ipcp->options_len = len;
 }
 
+static void ipcp_reset_vj_options(struct ipcp_data *ipcp)
+{
+	if (ipcp->vj_enabled)
+		ipcp->req_options |= REQ_OPTION_VJ;
+
+	ipcp->vj_max_slot_id = VJ_MAX_SLOT_ID;
+	ipcp->vj_comp_slot_id = TRUE;
+	ipcp->peer_vj = FALSE;
+}
+
 static void ipcp_reset_client_config_options(struct ipcp_data *ipcp)
 {
 	ipcp->req_options = REQ_OPTION_IPADDR | REQ_OPTION_DNS1 |
 				REQ_OPTION_DNS2 | REQ_OPTION_NBNS1 |
 				REQ_OPTION_NBNS2;
+	ipcp_reset_vj_options(ipcp);
 
 	ipcp->local_addr = 0;
 	ipcp->peer_addr = 0;
@@ -128,6 +159,7 @@ static void ipcp_reset_server_config_options(struct ipcp_data *ipcp)
 	else
 		ipcp->req_options = 0;
 
+	ipcp_reset_vj_options(ipcp);
 	ipcp_generate_config_options(ipcp);
 }
 
@@ -144,6 +176,7 @@ void ipcp_set_server_info(struct pppcp_data *pppcp, guint32 peer_addr,
 static void ipcp_up(struct pppcp_data *pppcp)
 {
 	struct ipcp_data *ipcp = pppcp_get_data(pppcp);
+	GAtPPP *ppp = pppcp_get_ppp(pppcp);
 	char local[INET_ADDRSTRLEN];
 	char peer[INET_ADDRSTRLEN];
 	char dns1[INET_ADDRSTRLEN];
@@ -166,7 +199,15 @@ static void ipcp_up(struct pppcp_data *pppcp)
 	addr.s_addr = ipcp->dns2;
 	inet_ntop(AF_INET, &addr, dns2, INET_ADDRSTRLEN);
 
-	ppp_ipcp_up_notify(pppcp_get_ppp(pppcp), local[0] ? local : NULL,
+	/* The options we have now are the ones the peer acked */
+	if (ipcp->req_options & REQ_OPTION_VJ)
+		ppp_set_recv_vj(ppp, ipcp->vj_max_slot_id);
+
+	if (ipcp->peer_vj)
+		ppp_set_xmit_vj(ppp, ipcp->peer_vj_max_slot_id,
+					ipcp->peer_vj_comp_slot_id);
+
+	ppp_ipcp_up_notify(ppp, local[0] ? local : NULL,
 					peer[0] ? peer : NULL,
 					dns1[0] ? dns1 : NULL,
 					dns2[0] ? dns2 : NULL);
@@ -226,21 +267,46 @@ static void ipcp_rca(struct pppcp_data *pppcp,
 	}
 }
 
+/*
+ * The peer suggests other compression parameters, take them as long as
+ * it is still VJ and we have enough slots
+ */
+static void ipcp_vj_nak(struct ipcp_data *ipcp, const guint8 *data,
+				guint8 len)
+{
+	if (len < 4 || get_host_short(data) != PPP_VJ_COMP) {
+		ipcp->req_options &= ~REQ_OPTION_VJ;
+		return;
+	}
+
+	ipcp->req_options |= REQ_OPTION_VJ;
+	ipcp->vj_max_slot_id = MIN(data[2], VJ_MAX_SLOT_ID);
+	ipcp->vj_comp_slot_id = data[3] ? TRUE : FALSE;
+}
+
 static void ipcp_rcn_nak(struct pppcp_data *pppcp,
 				const struct pppcp_packet *packet)
 {
 	struct ipcp_data *ipcp = pppcp_get_data(pppcp);
 	struct ppp_option_iter iter;
 
-	if (ipcp->is_server)
-		return;
-
 	ppp_option_iter_init(&iter, packet);
 
 	while (ppp_option_iter_next(&iter) == TRUE) {
 		const guint8 *data = ppp_option_iter_get_data(&iter);
+		guint8 type = ppp_option_iter_get_type(&iter);
 
-		switch (ppp_option_iter_get_type(&iter)) {
+		if (type == IP_COMPRESSION_PROTO) {
+			ipcp_vj_nak(ipcp, data,
+					ppp_option_iter_get_length(&iter));
+			continue;
+		}
+
+		/* The server does not take addresses from its peer */
+		if (ipcp->is_server)
+			continue;
+
+		switch (type) {
 		case IP_ADDRESS:
 			ipcp->req_options |= REQ_OPTION_IPADDR;
 			memcpy(&ipcp->local_addr, data, 4);
@@ -295,6 +361,9 @@ static void ipcp_rcn_rej(struct pppcp_data *pppcp,
 		case SECONDARY_NBNS_SERVER:
 			ipcp->req_options &= ~REQ_OPTION_NBNS2;
 			break;
+		case IP_COMPRESSION_PROTO:
+			ipcp->req_options &= ~REQ_OPTION_VJ;
+			break;
 		default:
 			break;
 		}
@@ -304,6 +373,26 @@ static void ipcp_rcn_rej(struct pppcp_data *pppcp,
 	pppcp_set_local_options(pppcp, ipcp->options, ipcp->options_len);
 }
 
+/*
+ * The peer asks to receive VJ compressed packets, we go along with it if
+ * compression is enabled on our side
+ */
+static gboolean ipcp_accept_vj(struct ipcp_data *ipcp, const guint8 *data,
+				guint8 len)
+{
+	if (ipcp->vj_enabled == FALSE)
+		return FALSE;
+
+	if (len != 4 || get_host_short(data) != PPP_VJ_COMP)
+		return FALSE;
+
+	ipcp->peer_vj = TRUE;
+	ipcp->peer_vj_max_slot_id = data[2];
+	ipcp->peer_vj_comp_slot_id = data[3] ? TRUE : FALSE;
+
+	return TRUE;
+}
+
 static enum rcr_result ipcp_server_rcr(struct ipcp_data *ipcp,
 					const struct pppcp_packet *packet,
 					guint8 **new_options, guint16 *new_len)
@@ -341,6 +430,12 @@ static enum rcr_result ipcp_server_rcr(struct ipcp_data *ipcp,
 			FILL_IP(nak_options, addr != ipcp->dns2 || addr == 0,
 					type, &ipcp->dns2);
 			break;
+		case IP_COMPRESSION_PROTO:
+			if (ipcp_accept_vj(ipcp, data,
+					ppp_option_iter_get_length(&iter)))
+				break;
+
+			/* fall through */
 		default:
 			/* Reject */
 			if (rej_options == NULL) {
@@ -393,6 +488,11 @@ static enum rcr_result ipcp_client_rcr(struct ipcp_data *ipcp,
 		const guint8 *data = ppp_option_iter_get_data(&iter);
 		guint8 type = ppp_option_iter_get_type(&iter);
 
+		if (type == IP_COMPRESSION_PROTO &&
+				ipcp_accept_vj(ipcp, data,
+					ppp_option_iter_get_length(&iter)))
+			continue;
+
 		switch (type) {
 		case IP_ADDRESS:
 			memcpy(&ipcp->peer_addr, data, 4);
@@ -442,6 +542,9 @@ static enum rcr_result ipcp_rcr(struct pppcp_data *pppcp,
 {
 	struct ipcp_data *ipcp = pppcp_get_data(pppcp);
 
+	/* Only the last request we accept decides whether we compress */
+	ipcp->peer_vj = FALSE;
+
 	if (ipcp->is_server)
 		return ipcp_server_rcr(ipcp, packet, new_options, new_len);
 	else
@@ -496,6 +599,24 @@ struct pppcp_data *ipcp_new(GAtPPP *ppp, gboolean is_server, guint32 ip)
 	return pppcp;
 }
 
+void ipcp_set_vj_enabled(struct pppcp_data *pppcp, gboolean enabled)
+{
+	struct ipcp_data *ipcp = pppcp_get_data(pppcp);
+
+	if (ipcp->vj_enabled == enabled)
+		return;
+
+	ipcp->vj_enabled = enabled;
+
+	if (enabled == TRUE)
+		ipcp->req_options |= REQ_OPTION_VJ;
+	else
+		ipcp->req_options &= ~REQ_OPTION_VJ;
+
+	ipcp_generate_config_options(ipcp);
+	pppcp_set_local_options(pppcp, ipcp->options, ipcp->options_len);
+}
+
 void ipcp_free(struct pppcp_data *data)
 {
 	struct ipcp_data *ipcp = pppcp_get_data(data);
@@ -415,6 +415,29 @@ void lcp_set_acfc_enabled(struct pppcp_data *pppcp, gboolean enabled)
 	pppcp_set_local_options(pppcp, lcp->options, lcp->options_len);
 }
 
+/* Control characters the peer has to escape when sending to us */
+void lcp_set_accm(struct pppcp_data *pppcp, guint32 accm)
+{
+	struct lcp_data *lcp = pppcp_get_data(pppcp);
+
+	lcp->accm = accm;
+	lcp->req_options |= REQ_OPTION_ACCM;
+
+	lcp_generate_config_options(lcp);
+	pppcp_set_local_options(pppcp, lcp->options, lcp->options_len);
+}
+
+void lcp_set_mru(struct pppcp_data *pppcp, guint16 mru)
+{
+	struct lcp_data *lcp = pppcp_get_data(pppcp);
+
+	lcp->mru = mru;
+	lcp->req_options |= REQ_OPTION_MRU;
+
+	lcp_generate_config_options(lcp);
+	pppcp_set_local_options(pppcp, lcp->options, lcp->options_len);
+}
+
 void lcp_set_pfc_enabled(struct pppcp_data *pppcp, gboolean enabled)
 {
 	struct lcp_data *lcp = pppcp_get_data(pppcp);
@@ -24,12 +24,14 @@
 #endif
 
 #include <stdio.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
 #include <net/if.h>
 #include <linux/if_tun.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <arpa/inet.h>
 
 #include <glib.h>
@@ -39,13 +41,21 @@
 #include "ppp.h"
 
 #define MAX_PACKET 1500
+#define DEFAULT_READ_BUDGET 16	/* Packets read from tun per wakeup */
+#define MAX_WRITE_QUEUE 64	/* Packets held back while tun is full */
 
 struct ppp_net {
 	GAtPPP *ppp;
 	char *if_name;
 	GIOChannel *channel;
+	int fd;
+	gboolean is_tun;		/* FALSE for a packet socket */
 	guint watch;
+	GQueue *write_queue;
+	guint write_watch;
 	gint mtu;
+	guint read_budget;
+	GAtPPPNetStats stats;
 	struct ppp_header *ppp_packet;
 };
 
@@ -59,6 +69,10 @@ gboolean ppp_net_set_mtu(struct ppp_net *net, guint16 mtu)
 
 	net->mtu = mtu;
 
+	/* Reads are already capped at the MTU, nothing else to set */
+	if (net->is_tun == FALSE)
+		return TRUE;
+
 	sk = socket(AF_INET, SOCK_DGRAM, 0);
 	if (sk < 0)
 		return FALSE;
@@ -77,52 +91,135 @@ gboolean ppp_net_set_mtu(struct ppp_net *net, guint16 mtu)
 	return TRUE;
 }
 
+static void free_packet(gpointer data)
+{
+	g_byte_array_free(data, TRUE);
+}
+
+static gboolean ppp_net_write_callback(GIOChannel *channel,
+					GIOCondition cond, gpointer userdata)
+{
+	struct ppp_net *net = userdata;
+	GByteArray *packet;
+
+	while ((packet = g_queue_peek_head(net->write_queue))) {
+		if (write(net->fd, packet->data, packet->len) >= 0)
+			net->stats.packets_written += 1;
+		else if (errno == EAGAIN || errno == EINTR)
+			return TRUE;
+		else
+			net->stats.packets_dropped += 1;
+
+		g_queue_pop_head(net->write_queue);
+		free_packet(packet);
+	}
+
+	net->write_watch = 0;
+
+	return FALSE;
+}
+
+static void ppp_net_queue_packet(struct ppp_net *net, const guint8 *data,
+					gsize len)
+{
+	GByteArray *packet;
+
+	if (g_queue_get_length(net->write_queue) >= MAX_WRITE_QUEUE) {
+		net->stats.packets_dropped += 1;
+		return;
+	}
+
+	packet = g_byte_array_sized_new(len);
+	g_byte_array_append(packet, data, len);
+	g_queue_push_tail(net->write_queue, packet);
+
+	if (net->write_watch == 0)
+		net->write_watch = g_io_add_watch(net->channel, G_IO_OUT,
+						ppp_net_write_callback, net);
+}
+
 void ppp_net_process_packet(struct ppp_net *net, const guint8 *packet,
 				gsize plen)
 {
-	GIOStatus status;
-	gsize bytes_written;
-	guint16 len;
+	gsize len;
 
 	if (plen < 4)
 		return;
 
 	/* find the length of the packet to transmit */
-	len = get_host_short(&packet[2]);
-	status = g_io_channel_write_chars(net->channel, (gchar *) packet,
-						MIN(len, plen),
-						&bytes_written, NULL);
+	len = MIN(get_host_short(&packet[2]), plen);
+
+	/* Stay behind the packets already waiting for the interface */
+	if (!g_queue_is_empty(net->write_queue)) {
+		ppp_net_queue_packet(net, packet, len);
+		return;
+	}
 
-	if (status != G_IO_STATUS_NORMAL)
+	/* Every write to tun is a packet of its own, skip GIOChannel */
+	if (write(net->fd, packet, len) >= 0) {
+		net->stats.packets_written += 1;
 		return;
+	}
+
+	if (errno == EAGAIN || errno == EINTR)
+		ppp_net_queue_packet(net, packet, len);
+	else
+		net->stats.packets_dropped += 1;
 }
 
 /*
  * packets received by the tun interface need to be written to
- * the modem.  So, just read a packet, write out to the modem
+ * the modem.  So, read up to read_budget packets and write them out
+ * to the modem, they are all encoded into the HDLC write buffer in
+ * one go and written out together.
  */
 static gboolean ppp_net_callback(GIOChannel *channel, GIOCondition cond,
 				gpointer userdata)
 {
 	struct ppp_net *net = (struct ppp_net *) userdata;
-	GIOStatus status;
-	gsize bytes_read;
-	gchar *buf = (gchar *) net->ppp_packet->info;
+	guint8 *buf = net->ppp_packet->info;
+	ssize_t bytes_read = 0;
+	guint packets = 0;
 
 	if (cond & (G_IO_NVAL | G_IO_ERR | G_IO_HUP))
 		return FALSE;
 
-	if (cond & G_IO_IN) {
+	if (!(cond & G_IO_IN))
+		return TRUE;
+
+	net->stats.wakeups += 1;
+
+	while (packets < net->read_budget) {
 		/* leave space to add PPP protocol field */
-		status = g_io_channel_read_chars(channel, buf, net->mtu,
-							&bytes_read, NULL);
-		if (bytes_read > 0)
-			ppp_transmit(net->ppp, (guint8 *) net->ppp_packet,
-					bytes_read);
-
-		if (status != G_IO_STATUS_NORMAL && status != G_IO_STATUS_AGAIN)
-			return FALSE;
+		bytes_read = read(net->fd, buf, net->mtu);
+		if (bytes_read <= 0)
+			break;
+
+		/* VJ relabels the packet it sends uncompressed in place */
+		net->ppp_packet->proto = htons(PPP_IP_PROTO);
+
+		ppp_transmit(net->ppp, (guint8 *) net->ppp_packet,
+				bytes_read);
+		packets += 1;
 	}
+
+	net->stats.packets_read += packets;
+
+	if (packets > net->stats.max_per_wakeup)
+		net->stats.max_per_wakeup = packets;
+
+	/* Out of budget, there is likely more waiting */
+	if (packets == net->read_budget) {
+		net->stats.budget_exhausted += 1;
+		return TRUE;
+	}
+
+	if (bytes_read == 0)
+		return FALSE;
+
+	if (bytes_read < 0 && errno != EAGAIN && errno != EINTR)
+		return FALSE;
+
 	return TRUE;
 }
 
@@ -131,6 +228,30 @@ const char *ppp_net_get_interface(struct ppp_net *net)
 	return net->if_name;
 }
 
+void ppp_net_set_read_budget(struct ppp_net *net, guint budget)
+{
+	if (net == NULL)
+		return;
+
+	net->read_budget = budget > 0 ? budget : DEFAULT_READ_BUDGET;
+}
+
+void ppp_net_get_stats(struct ppp_net *net, GAtPPPNetStats *stats)
+{
+	*stats = net->stats;
+}
+
+static gboolean is_packet_socket(int fd)
+{
+	int type;
+	socklen_t len = sizeof(type);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0)
+		return FALSE;
+
+	return type == SOCK_SEQPACKET || type == SOCK_DGRAM;
+}
+
 struct ppp_net *ppp_net_new(GAtPPP *ppp, int fd)
 {
 	struct ppp_net *net;
@@ -146,6 +267,8 @@ struct ppp_net *ppp_net_new(GAtPPP *ppp, int fd)
 	if (net->ppp_packet == NULL)
 		goto error;
 
+	net->write_queue = g_queue_new();
+
 	/*
 	 * If the fd value is still the default one,
 	 * open the tun interface and configure it.
@@ -170,10 +293,16 @@ struct ppp_net *ppp_net_new(GAtPPP *ppp, int fd)
 			goto error;
 	} else {
 		err = ioctl(fd, TUNGETIFF, (void *) &ifr);
-		if (err < 0)
+		if (err < 0 && is_packet_socket(fd) == FALSE)
 			goto error;
+
+		/* Each read and write still carries exactly one packet */
+		if (err < 0)
+			snprintf(ifr.ifr_name, IFNAMSIZ, "sock%d", fd);
 	}
 
+	net->is_tun = err == 0;
+
 	net->if_name = strdup(ifr.ifr_name);
 
 	/* create a channel for reading and writing to this interface */
@@ -181,24 +310,30 @@ struct ppp_net *ppp_net_new(GAtPPP *ppp, int fd)
 	if (channel == NULL)
 		goto error;
 
-	if (!g_at_util_setup_io(channel, 0))
+	/* Reads are looped until the interface runs dry */
+	if (!g_at_util_setup_io(channel, G_IO_FLAG_NONBLOCK))
 		goto error;
 
 	g_io_channel_set_buffered(channel, FALSE);
 
 	net->channel = channel;
+	net->fd = fd;
 	net->watch = g_io_add_watch(channel,
 			G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
 			ppp_net_callback, net);
 	net->ppp = ppp;
 
 	net->mtu = MAX_PACKET;
+	net->read_budget = DEFAULT_READ_BUDGET;
 	return net;
 
 error:
 	if (channel)
 		g_io_channel_unref(channel);
 
+	if (net->write_queue)
+		g_queue_free(net->write_queue);
+
 	g_free(net->if_name);
 	g_free(net->ppp_packet);
 	g_free(net);
@@ -217,6 +352,11 @@ void ppp_net_free(struct ppp_net *net)
 		net->watch = 0;
 	}
 
+	if (net->write_watch)
+		g_source_remove(net->write_watch);
+
+	g_queue_free_full(net->write_queue, free_packet);
+
 	g_io_channel_unref(net->channel);
 
 	g_free(net->ppp_packet);
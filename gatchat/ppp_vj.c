@@ -0,0 +1,605 @@
+/*
+ *
+ *  PPP library with GLib integration
+ *
+ *  Copyright (C) 2009-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <arpa/inet.h>
+#include <glib.h>
+
+#include "gatutil.h"
+#include "gatppp.h"
+#include "ppp.h"
+
+/*
+ * Van Jacobson TCP/IP header compression, RFC 1144.
+ *
+ * Each direction keeps a table of slots holding the last IP + TCP header
+ * seen for a TCP connection.  Packets for a known connection are sent as
+ * a small set of deltas against that header (PPP_VJ_COMP), anything the
+ * peer cannot reconstruct from the deltas is sent as a full packet with
+ * the slot number in the IP protocol field (PPP_VJ_UNCOMP).
+ */
+
+#define VJ_MAX_HDR	128	/* Largest IP + TCP header we keep */
+#define VJ_MAX_PACKET	1500
+
+#define IP_PROTO_TCP	6
+
+/* Bits of the change mask */
+#define NEW_C		0x40	/* Connection number present */
+#define NEW_I		0x20	/* IP ID delta present */
+#define TCP_PUSH_BIT	0x10
+#define NEW_S		0x08	/* Sequence number delta present */
+#define NEW_A		0x04	/* Ack number delta present */
+#define NEW_W		0x02	/* Window delta present */
+#define NEW_U		0x01	/* Urgent pointer present */
+
+/* Combinations that cannot happen and are reused for common cases */
+#define SPECIAL_I	(NEW_S | NEW_W | NEW_U)	/* Echoed interactive data */
+#define SPECIAL_D	(NEW_S | NEW_A | NEW_W | NEW_U)	/* Unidirectional */
+#define SPECIALS_MASK	(NEW_S | NEW_A | NEW_W | NEW_U)
+
+/* TCP flags */
+#define TH_FIN		0x01
+#define TH_SYN		0x02
+#define TH_RST		0x04
+#define TH_PUSH		0x08
+#define TH_ACK		0x10
+#define TH_URG		0x20
+
+/* Offsets into the IP and TCP headers */
+#define IP_LEN(ip)	((ip) + 2)
+#define IP_ID(ip)	((ip) + 4)
+#define IP_CKSUM(ip)	((ip) + 10)
+#define TH_SEQ(th)	((th) + 4)
+#define TH_ACKNUM(th)	((th) + 8)
+#define TH_FLAGS(th)	((th) + 13)
+#define TH_WIN(th)	((th) + 14)
+#define TH_CKSUM(th)	((th) + 16)
+#define TH_URP(th)	((th) + 18)
+
+#define ip_hdr_len(ip)	(((ip)[0] & 0x0f) * 4)
+#define tcp_hdr_len(th)	(((th)[12] >> 4) * 4)
+
+struct vj_slot {
+	guint8 hdr[VJ_MAX_HDR];
+	guint8 hlen;		/* 0 if the slot was never used */
+	guint32 stamp;		/* Last use, for picking a slot to recycle */
+};
+
+struct ppp_vj {
+	struct vj_slot *xmit;
+	guint xmit_slots;
+	gboolean xmit_cslot;	/* Peer allows the slot id to be omitted */
+	guint xmit_last;
+	guint32 xmit_stamp;
+	struct vj_slot *recv;
+	guint recv_slots;
+	guint recv_last;
+	gboolean recv_toss;	/* Drop until we get an explicit slot id */
+	guint8 recv_buf[VJ_MAX_PACKET];
+};
+
+static inline void put_network_long(guint8 *p, guint32 val)
+{
+	p[0] = val >> 24;
+	p[1] = val >> 16;
+	p[2] = val >> 8;
+	p[3] = val;
+}
+
+static guint16 ip_checksum(const guint8 *ip, guint len)
+{
+	guint32 sum = 0;
+	guint i;
+
+	for (i = 0; i + 1 < len; i += 2)
+		sum += (ip[i] << 8) | ip[i + 1];
+
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return ~sum & 0xffff;
+}
+
+/*
+ * Deltas are sent as a single octet when they fit in 1-255, zero is used
+ * as an escape for a following 16 bit value
+ */
+static guint8 *vj_encode(guint8 *cp, guint16 val)
+{
+	if (val == 0 || val > 255) {
+		cp[0] = 0;
+		cp[1] = val >> 8;
+		cp[2] = val;
+		return cp + 3;
+	}
+
+	cp[0] = val;
+	return cp + 1;
+}
+
+static gboolean vj_decode(const guint8 **cp, const guint8 *end, guint16 *val)
+{
+	const guint8 *p = *cp;
+
+	if (p >= end)
+		return FALSE;
+
+	if (p[0] != 0) {
+		*val = p[0];
+		*cp = p + 1;
+		return TRUE;
+	}
+
+	if (end - p < 3)
+		return FALSE;
+
+	*val = (p[1] << 8) | p[2];
+	*cp = p + 3;
+
+	return TRUE;
+}
+
+static guint vj_xmit_lookup(struct ppp_vj *vj, const guint8 *ip,
+				const guint8 *th, gboolean *found)
+{
+	guint oldest = 0;
+	guint i;
+
+	for (i = 0; i < vj->xmit_slots; i++) {
+		struct vj_slot *slot = &vj->xmit[i];
+		const guint8 *oth = slot->hdr + ip_hdr_len(slot->hdr);
+
+		if (slot->hlen == 0) {
+			oldest = i;
+			break;
+		}
+
+		if (memcmp(slot->hdr + 12, ip + 12, 8) == 0 &&
+				memcmp(oth, th, 4) == 0) {
+			*found = TRUE;
+			slot->stamp = ++vj->xmit_stamp;
+			return i;
+		}
+
+		if (slot->stamp < vj->xmit[oldest].stamp)
+			oldest = i;
+	}
+
+	*found = FALSE;
+	vj->xmit[oldest].stamp = ++vj->xmit_stamp;
+
+	return oldest;
+}
+
+/*
+ * Compress the IP packet in place.  Returns the PPP protocol to send the
+ * result with, offset is set to the number of bytes the packet now
+ * starts into the original buffer.
+ */
+guint16 ppp_vj_compress(struct ppp_vj *vj, guint8 *ip, guint *len,
+				guint *offset)
+{
+	guint8 deltas[16];
+	guint8 *cp = deltas;
+	guint8 changes = 0;
+	guint8 *th;
+	guint8 *oip;
+	guint8 *oth;
+	guint8 *out;
+	guint ihl, thl, hlen, chlen;
+	guint id;
+	gboolean found;
+	guint16 olen;
+	guint16 delta;
+	guint32 delta_s;
+	guint32 delta_a;
+
+	*offset = 0;
+
+	if (vj == NULL || vj->xmit_slots == 0 || *len < 40)
+		return PPP_IP_PROTO;
+
+	if ((ip[0] >> 4) != 4 || ip[9] != IP_PROTO_TCP)
+		return PPP_IP_PROTO;
+
+	/* Fragments are sent as is */
+	if ((get_host_short(ip + 6) & 0x3fff) != 0)
+		return PPP_IP_PROTO;
+
+	ihl = ip_hdr_len(ip);
+	if (ihl < 20 || *len < ihl + 20)
+		return PPP_IP_PROTO;
+
+	th = ip + ihl;
+	thl = tcp_hdr_len(th);
+	hlen = ihl + thl;
+
+	if (thl < 20 || hlen > *len || hlen > VJ_MAX_HDR)
+		return PPP_IP_PROTO;
+
+	if ((*TH_FLAGS(th) & (TH_SYN | TH_FIN | TH_RST | TH_ACK)) != TH_ACK)
+		return PPP_IP_PROTO;
+
+	id = vj_xmit_lookup(vj, ip, th, &found);
+	if (found == FALSE)
+		goto uncompressed;
+
+	oip = vj->xmit[id].hdr;
+	oth = oip + ihl;
+	olen = get_host_short(IP_LEN(oip));
+
+	/*
+	 * Everything the decompressor copies from its saved header has to
+	 * be unchanged: version, header lengths, TOS, fragment field, TTL,
+	 * IP and TCP options and the TCP flags other than PSH and URG.
+	 */
+	if (ip[0] != oip[0] || ip[1] != oip[1] ||
+			memcmp(ip + 6, oip + 6, 4) != 0 ||
+			th[12] != oth[12] ||
+			((*TH_FLAGS(th) ^ *TH_FLAGS(oth)) &
+				~(TH_PUSH | TH_URG)) != 0 ||
+			memcmp(ip + 20, oip + 20, ihl - 20) != 0 ||
+			memcmp(th + 20, oth + 20, thl - 20) != 0)
+		goto uncompressed;
+
+	if (*TH_FLAGS(th) & TH_URG) {
+		cp = vj_encode(cp, get_host_short(TH_URP(th)));
+		changes |= NEW_U;
+	} else if (memcmp(TH_URP(th), TH_URP(oth), 2) != 0)
+		goto uncompressed;
+
+	delta = get_host_short(TH_WIN(th)) - get_host_short(TH_WIN(oth));
+	if (delta != 0) {
+		cp = vj_encode(cp, delta);
+		changes |= NEW_W;
+	}
+
+	delta_a = get_host_long(TH_ACKNUM(th)) - get_host_long(TH_ACKNUM(oth));
+	if (delta_a != 0) {
+		if (delta_a > 0xffff)
+			goto uncompressed;
+
+		cp = vj_encode(cp, delta_a);
+		changes |= NEW_A;
+	}
+
+	delta_s = get_host_long(TH_SEQ(th)) - get_host_long(TH_SEQ(oth));
+	if (delta_s != 0) {
+		if (delta_s > 0xffff)
+			goto uncompressed;
+
+		cp = vj_encode(cp, delta_s);
+		changes |= NEW_S;
+	}
+
+	switch (changes) {
+	case 0:
+		/*
+		 * Nothing changed.  Data following a bare ack is the usual
+		 * interactive case and goes compressed, anything else is
+		 * most likely a retransmission.
+		 */
+		if (get_host_short(IP_LEN(ip)) != olen && olen == hlen)
+			break;
+
+		goto uncompressed;
+	case SPECIAL_I:
+	case SPECIAL_D:
+		/* Would be mistaken for the special encodings */
+		goto uncompressed;
+	case NEW_S | NEW_A:
+		if (delta_s == delta_a && delta_s == (guint32) (olen - hlen)) {
+			changes = SPECIAL_I;
+			cp = deltas;
+		}
+		break;
+	case NEW_S:
+		if (delta_s == (guint32) (olen - hlen)) {
+			changes = SPECIAL_D;
+			cp = deltas;
+		}
+		break;
+	}
+
+	delta = get_host_short(IP_ID(ip)) - get_host_short(IP_ID(oip));
+	if (delta != 1) {
+		cp = vj_encode(cp, delta);
+		changes |= NEW_I;
+	}
+
+	if (*TH_FLAGS(th) & TH_PUSH)
+		changes |= TCP_PUSH_BIT;
+
+	memcpy(oip, ip, hlen);
+
+	chlen = 3 + (cp - deltas);
+	if (vj->xmit_cslot == FALSE || vj->xmit_last != id) {
+		changes |= NEW_C;
+		chlen += 1;
+	}
+
+	/* The compressed header ends where the original one did */
+	out = ip + hlen - chlen;
+	out[0] = changes;
+	out += 1;
+
+	if (changes & NEW_C) {
+		out[0] = id;
+		out += 1;
+	}
+
+	out[0] = TH_CKSUM(oth)[0];
+	out[1] = TH_CKSUM(oth)[1];
+	memcpy(out + 2, deltas, cp - deltas);
+
+	vj->xmit_last = id;
+	*offset = hlen - chlen;
+	*len -= *offset;
+
+	return PPP_VJ_COMP;
+
+uncompressed:
+	memcpy(vj->xmit[id].hdr, ip, hlen);
+	vj->xmit[id].hlen = hlen;
+	vj->xmit_last = id;
+
+	ip[9] = id;
+
+	return PPP_VJ_UNCOMP;
+}
+
+static const guint8 *vj_uncompressed(struct ppp_vj *vj, const guint8 *data,
+					gsize len, gsize *out_len)
+{
+	struct vj_slot *slot;
+	guint ihl, thl, hlen;
+
+	if (len < 40 || len > VJ_MAX_PACKET || (data[0] >> 4) != 4)
+		goto toss;
+
+	if (data[9] >= vj->recv_slots)
+		goto toss;
+
+	ihl = ip_hdr_len(data);
+	if (ihl < 20 || len < ihl + 20)
+		goto toss;
+
+	thl = tcp_hdr_len(data + ihl);
+	hlen = ihl + thl;
+
+	if (thl < 20 || hlen > len || hlen > VJ_MAX_HDR)
+		goto toss;
+
+	memcpy(vj->recv_buf, data, len);
+	vj->recv_buf[9] = IP_PROTO_TCP;
+
+	vj->recv_last = data[9];
+	vj->recv_toss = FALSE;
+
+	slot = &vj->recv[vj->recv_last];
+	memcpy(slot->hdr, vj->recv_buf, hlen);
+	slot->hlen = hlen;
+
+	*out_len = len;
+
+	return vj->recv_buf;
+
+toss:
+	vj->recv_toss = TRUE;
+	return NULL;
+}
+
+static const guint8 *vj_compressed(struct ppp_vj *vj, const guint8 *data,
+					gsize len, gsize *out_len)
+{
+	const guint8 *end = data + len;
+	const guint8 *cp = data;
+	struct vj_slot *slot;
+	guint8 *ip;
+	guint8 *th;
+	guint8 changes;
+	guint16 val;
+	guint16 olen;
+	gsize payload;
+
+	if (len < 3)
+		goto toss;
+
+	changes = *cp++;
+
+	if (changes & NEW_C) {
+		if (*cp >= vj->recv_slots)
+			goto toss;
+
+		vj->recv_last = *cp++;
+		vj->recv_toss = FALSE;
+	} else if (vj->recv_toss == TRUE)
+		return NULL;
+
+	slot = &vj->recv[vj->recv_last];
+	if (slot->hlen == 0)
+		goto toss;
+
+	ip = slot->hdr;
+	th = ip + ip_hdr_len(ip);
+	olen = get_host_short(IP_LEN(ip));
+
+	if (end - cp < 2)
+		goto toss;
+
+	memcpy(TH_CKSUM(th), cp, 2);
+	cp += 2;
+
+	if (changes & TCP_PUSH_BIT)
+		*TH_FLAGS(th) |= TH_PUSH;
+	else
+		*TH_FLAGS(th) &= ~TH_PUSH;
+
+	/* URG only ever goes along with an explicit urgent pointer */
+	*TH_FLAGS(th) &= ~TH_URG;
+
+	switch (changes & SPECIALS_MASK) {
+	case SPECIAL_I:
+		val = olen - slot->hlen;
+		put_network_long(TH_ACKNUM(th),
+					get_host_long(TH_ACKNUM(th)) + val);
+		put_network_long(TH_SEQ(th), get_host_long(TH_SEQ(th)) + val);
+		break;
+	case SPECIAL_D:
+		val = olen - slot->hlen;
+		put_network_long(TH_SEQ(th), get_host_long(TH_SEQ(th)) + val);
+		break;
+	default:
+		if (changes & NEW_U) {
+			*TH_FLAGS(th) |= TH_URG;
+
+			if (vj_decode(&cp, end, &val) == FALSE)
+				goto toss;
+
+			put_network_short(TH_URP(th), val);
+		}
+
+		if (changes & NEW_W) {
+			if (vj_decode(&cp, end, &val) == FALSE)
+				goto toss;
+
+			put_network_short(TH_WIN(th),
+					get_host_short(TH_WIN(th)) + val);
+		}
+
+		if (changes & NEW_A) {
+			if (vj_decode(&cp, end, &val) == FALSE)
+				goto toss;
+
+			put_network_long(TH_ACKNUM(th),
+					get_host_long(TH_ACKNUM(th)) + val);
+		}
+
+		if (changes & NEW_S) {
+			if (vj_decode(&cp, end, &val) == FALSE)
+				goto toss;
+
+			put_network_long(TH_SEQ(th),
+					get_host_long(TH_SEQ(th)) + val);
+		}
+		break;
+	}
+
+	if (changes & NEW_I) {
+		if (vj_decode(&cp, end, &val) == FALSE)
+			goto toss;
+	} else
+		val = 1;
+
+	put_network_short(IP_ID(ip), get_host_short(IP_ID(ip)) + val);
+
+	payload = end - cp;
+	if (slot->hlen + payload > VJ_MAX_PACKET)
+		goto toss;
+
+	put_network_short(IP_LEN(ip), slot->hlen + payload);
+	put_network_short(IP_CKSUM(ip), 0);
+	put_network_short(IP_CKSUM(ip), ip_checksum(ip, ip_hdr_len(ip)));
+
+	memcpy(vj->recv_buf, ip, slot->hlen);
+	memcpy(vj->recv_buf + slot->hlen, cp, payload);
+
+	*out_len = slot->hlen + payload;
+
+	return vj->recv_buf;
+
+toss:
+	vj->recv_toss = TRUE;
+	return NULL;
+}
+
+/*
+ * Rebuild the IP packet from a PPP_VJ_COMP or PPP_VJ_UNCOMP frame.  The
+ * returned buffer belongs to the decompressor and is only valid until
+ * the next call.
+ */
+const guint8 *ppp_vj_decompress(struct ppp_vj *vj, guint16 proto,
+				const guint8 *data, gsize len,
+				gsize *out_len)
+{
+	if (vj == NULL || vj->recv_slots == 0)
+		return NULL;
+
+	if (proto == PPP_VJ_UNCOMP)
+		return vj_uncompressed(vj, data, len, out_len);
+
+	return vj_compressed(vj, data, len, out_len);
+}
+
+struct ppp_vj *ppp_vj_new(guint recv_slots, guint xmit_slots,
+				gboolean xmit_cslot)
+{
+	struct ppp_vj *vj;
+
+	vj = g_try_new0(struct ppp_vj, 1);
+	if (vj == NULL)
+		return NULL;
+
+	if (recv_slots > 0) {
+		vj->recv = g_try_new0(struct vj_slot, recv_slots);
+		if (vj->recv == NULL)
+			goto error;
+	}
+
+	if (xmit_slots > 0) {
+		vj->xmit = g_try_new0(struct vj_slot, xmit_slots);
+		if (vj->xmit == NULL)
+			goto error;
+	}
+
+	vj->recv_slots = recv_slots;
+	vj->xmit_slots = xmit_slots;
+	vj->xmit_cslot = xmit_cslot;
+
+	/* Nothing sent yet, the first packet always carries the slot id */
+	vj->xmit_last = G_MAXUINT;
+
+	/* RFC 1144: start out discarding until an explicit slot id */
+	vj->recv_toss = TRUE;
+
+	return vj;
+
+error:
+	g_free(vj->recv);
+	g_free(vj);
+
+	return NULL;
+}
+
+void ppp_vj_free(struct ppp_vj *vj)
+{
+	if (vj == NULL)
+		return;
+
+	g_free(vj->recv);
+	g_free(vj->xmit);
+	g_free(vj);
+}
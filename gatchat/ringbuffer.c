@@ -24,6 +24,7 @@
 #endif
 
 #include <string.h>
+#include <sys/uio.h>
 
 #include <glib.h>
 
@@ -37,17 +38,31 @@ struct ring_buffer {
 	unsigned int mask;
 	unsigned int in;
 	unsigned int out;
+	unsigned int max_size;
 };
 
-struct ring_buffer *ring_buffer_new(unsigned int size)
+static unsigned int round_size(unsigned int size)
 {
 	unsigned int real_size = 1;
-	struct ring_buffer *buffer;
 
 	/* Find the next power of two for size */
 	while (real_size < size && real_size < MAX_SIZE)
 		real_size = real_size << 1;
 
+	return real_size;
+}
+
+struct ring_buffer *ring_buffer_new(unsigned int size)
+{
+	return ring_buffer_new_growable(size, size);
+}
+
+struct ring_buffer *ring_buffer_new_growable(unsigned int size,
+						unsigned int max_size)
+{
+	unsigned int real_size = round_size(size);
+	struct ring_buffer *buffer;
+
 	if (real_size > MAX_SIZE)
 		return NULL;
 
@@ -65,10 +80,41 @@ struct ring_buffer *ring_buffer_new(unsigned int size)
 	buffer->mask = real_size - 1;
 	buffer->in = 0;
 	buffer->out = 0;
+	buffer->max_size = MAX(real_size, round_size(max_size));
 
 	return buffer;
 }
 
+int ring_buffer_grow(struct ring_buffer *buf)
+{
+	unsigned int size = buf->size << 1;
+	unsigned int len = buf->in - buf->out;
+	unsigned int offset = buf->out & buf->mask;
+	unsigned int end = MIN(len, buf->size - offset);
+	unsigned char *buffer;
+
+	if (size > buf->max_size)
+		return -1;
+
+	buffer = g_slice_alloc(size);
+	if (buffer == NULL)
+		return -1;
+
+	/* Unwrap the contents to the beginning of the new buffer */
+	memcpy(buffer, buf->buffer + offset, end);
+	memcpy(buffer + end, buf->buffer, len - end);
+
+	g_slice_free1(buf->size, buf->buffer);
+
+	buf->buffer = buffer;
+	buf->size = size;
+	buf->mask = size - 1;
+	buf->out = 0;
+	buf->in = len;
+
+	return size;
+}
+
 int ring_buffer_write(struct ring_buffer *buf, const void *data,
 			unsigned int len)
 {
@@ -106,6 +152,27 @@ int ring_buffer_avail_no_wrap(struct ring_buffer *buf)
 	return MIN(len, buf->size - offset);
 }
 
+int ring_buffer_write_iov(struct ring_buffer *buf, struct iovec *iov)
+{
+	unsigned int offset = buf->in & buf->mask;
+	unsigned int len = buf->size - buf->in + buf->out;
+	unsigned int end = MIN(len, buf->size - offset);
+
+	if (len == 0)
+		return 0;
+
+	iov[0].iov_base = buf->buffer + offset;
+	iov[0].iov_len = end;
+
+	if (end == len)
+		return 1;
+
+	iov[1].iov_base = buf->buffer;
+	iov[1].iov_len = len - end;
+
+	return 2;
+}
+
 int ring_buffer_write_advance(struct ring_buffer *buf, unsigned int len)
 {
 	len = MIN(len, buf->size - buf->in + buf->out);
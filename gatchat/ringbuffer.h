@@ -20,12 +20,20 @@
  */
 
 struct ring_buffer;
+struct iovec;
 
 /*!
  * Creates a new ring buffer with capacity size
  */
 struct ring_buffer *ring_buffer_new(unsigned int size);
 
+/*!
+ * Creates a new ring buffer with capacity size, which can be grown with
+ * ring_buffer_grow up to a capacity of max_size
+ */
+struct ring_buffer *ring_buffer_new_growable(unsigned int size,
+						unsigned int max_size);
+
 /*!
  * Frees the resources allocated for the ring buffer
  */
@@ -36,6 +44,14 @@ void ring_buffer_free(struct ring_buffer *buf);
  */
 int ring_buffer_capacity(struct ring_buffer *buf);
 
+/*!
+ * Doubles the capacity of the ring buffer, keeping its contents.  Pointers
+ * previously returned by ring_buffer_read_ptr and ring_buffer_write_ptr are
+ * no longer valid afterwards.  Returns the new capacity, or -1 if the buffer
+ * is already at its maximum size
+ */
+int ring_buffer_grow(struct ring_buffer *buf);
+
 /*!
  * Resets the ring buffer, all data inside the buffer is lost
  */
@@ -63,6 +79,14 @@ int ring_buffer_write_advance(struct ring_buffer *buf, unsigned int len);
 unsigned char *ring_buffer_write_ptr(struct ring_buffer *buf,
 					unsigned int offset);
 
+/*!
+ * Fills iov with the free space of the buffer, the second segment being the
+ * part past the wrap point if any.  Meant to be used with readv followed by
+ * ring_buffer_write_advance.  Returns the number of segments, 0 if the
+ * buffer is full
+ */
+int ring_buffer_write_iov(struct ring_buffer *buf, struct iovec *iov);
+
 /*!
  * Returns the number of free bytes available in the buffer
  */
@@ -29,6 +29,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <sys/uio.h>
 
 #include <glib.h>
 
@@ -41,6 +42,7 @@ struct _GRilIO {
 	guint read_watch;			/* GSource read id, 0 if no */
 	guint write_watch;			/* GSource write id, 0 if no */
 	GIOChannel *channel;			/* comms channel */
+	int fd;					/* Raw fd of channel or -1 */
 	GRilDisconnectFunc user_disconnect;	/* user disconnect func */
 	gpointer user_disconnect_data;		/* user disconnect data */
 	struct ring_buffer *buf;		/* Current read buffer */
@@ -79,6 +81,45 @@ static void read_watcher_destroy_notify(gpointer user_data)
 		io->user_disconnect(io->user_disconnect_data);
 }
 
+static gsize read_iov(GRilIO *io, GIOStatus *status)
+{
+	struct iovec iov[2];
+	int count;
+	ssize_t rbytes;
+	gsize len;
+
+	count = ring_buffer_write_iov(io->buf, iov);
+
+	rbytes = readv(io->fd, iov, count);
+	if (rbytes < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			*status = G_IO_STATUS_AGAIN;
+		else
+			*status = G_IO_STATUS_ERROR;
+
+		return 0;
+	}
+
+	if (rbytes == 0) {
+		*status = G_IO_STATUS_EOF;
+		return 0;
+	}
+
+	*status = G_IO_STATUS_NORMAL;
+
+	len = MIN((gsize) rbytes, iov[0].iov_len);
+	g_ril_util_debug_hexdump(TRUE, iov[0].iov_base, len,
+					io->debugf, io->debug_data);
+
+	if ((gsize) rbytes > len)
+		g_ril_util_debug_hexdump(TRUE, iov[1].iov_base, rbytes - len,
+						io->debugf, io->debug_data);
+
+	ring_buffer_write_advance(io->buf, rbytes);
+
+	return rbytes;
+}
+
 static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 				gpointer data)
 {
@@ -93,6 +134,14 @@ static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 	if (cond & G_IO_NVAL)
 		return FALSE;
 
+	/* A single readv fills the buffer on both sides of the wrap */
+	if (io->fd >= 0 && ring_buffer_avail(io->buf) > 0) {
+		rbytes = read_iov(io, &status);
+		total_read = rbytes;
+		read_count = 1;
+		goto done;
+	}
+
 	/* Regardless of condition, try to read all the data available */
 	do {
 		toread = ring_buffer_avail_no_wrap(io->buf);
@@ -119,6 +168,7 @@ static gboolean received_data(GIOChannel *channel, GIOCondition cond,
 	} while (status == G_IO_STATUS_NORMAL && rbytes > 0 &&
 					read_count < io->max_read_attempts);
 
+done:
 	if (total_read > 0 && io->read_handler)
 		io->read_handler(io->buf, io->read_data);
 
@@ -214,6 +264,7 @@ static GRilIO *create_io(GIOChannel *channel, GIOFlags flags)
 		goto error;
 
 	io->channel = channel;
+	io->fd = g_io_channel_unix_get_fd(channel);
 	io->read_watch = g_io_add_watch_full(channel, G_PRIORITY_DEFAULT,
 				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
 				received_data, io,
@@ -75,6 +75,11 @@ struct ofono_modem_driver {
 
 	/* Populate the atoms available online */
 	void (*post_online)(struct ofono_modem *modem);
+
+	/* Optional: open a spare port, in command mode, on which a DUN
+	 * client can be connected straight to the modem's own PPP.  Returns
+	 * the fd, which the caller owns, or a negative errno */
+	int (*open_data_channel)(struct ofono_modem *modem);
 };
 
 void ofono_modem_add_interface(struct ofono_modem *modem,
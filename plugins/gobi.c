@@ -27,6 +27,10 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <termios.h>
+
+#include <glib.h>
+#include <gattty.h>
 
 #define OFONO_API_SUBJECT_TO_CHANGE
 #include <ofono/plugin.h>
@@ -517,6 +521,38 @@ static void gobi_post_online(struct ofono_modem *modem)
 	}
 }
 
+/* Data normally goes over QMI, which leaves the AT port free for DUN */
+static int gobi_open_data_channel(struct ofono_modem *modem)
+{
+	GIOChannel *channel;
+	struct termios ti;
+	const char *mdm;
+	int fd;
+
+	DBG("%p", modem);
+
+	mdm = ofono_modem_get_string(modem, "Modem");
+	if (!mdm)
+		return -ENODEV;
+
+	channel = g_at_tty_open(mdm, NULL);
+	if (!channel)
+		return -EIO;
+
+	fd = g_io_channel_unix_get_fd(channel);
+
+	/* Dropping DTR on close is what hangs up the call */
+	if (tcgetattr(fd, &ti) == 0) {
+		ti.c_cflag |= HUPCL;
+		tcsetattr(fd, TCSANOW, &ti);
+	}
+
+	g_io_channel_set_close_on_unref(channel, FALSE);
+	g_io_channel_unref(channel);
+
+	return fd;
+}
+
 static struct ofono_modem_driver gobi_driver = {
 	.name		= "gobi",
 	.probe		= gobi_probe,
@@ -527,6 +563,7 @@ static struct ofono_modem_driver gobi_driver = {
 	.pre_sim	= gobi_pre_sim,
 	.post_sim	= gobi_post_sim,
 	.post_online	= gobi_post_online,
+	.open_data_channel = gobi_open_data_channel,
 };
 
 static int gobi_init(void)
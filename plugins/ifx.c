@@ -443,6 +443,10 @@ static void setup_internal_mux(struct ofono_modem *modem)
 	for (i = 0; i < NUM_DLC; i++) {
 		GIOChannel *channel = g_at_mux_create_channel(data->mux);
 
+		if (i >= GPRS1_DLC && i <= GPRS3_DLC)
+			g_at_mux_set_channel_priority(data->mux, channel,
+						G_AT_MUX_PRIORITY_DATA, 1);
+
 		data->dlcs[i] = create_chat(channel, modem, dlc_prefixes[i]);
 		if (data->dlcs[i] == NULL) {
 			ofono_error("Failed to create channel");
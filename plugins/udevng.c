@@ -56,6 +56,7 @@ struct modem_info {
 	};
 	struct ofono_modem *modem;
 	const char *sysattr;
+	gboolean dun_passthrough;
 };
 
 struct device_info {
@@ -244,6 +245,9 @@ static gboolean setup_gobi(struct modem_info *modem)
 	ofono_modem_set_string(modem->modem, "Diag", diag);
 	ofono_modem_set_string(modem->modem, "NetworkInterface", net);
 
+	if (modem->dun_passthrough)
+		ofono_modem_set_boolean(modem->modem, "DunPassthrough", TRUE);
+
 	return TRUE;
 }
 
@@ -1530,9 +1534,9 @@ static void add_device(const char *syspath, const char *devname,
 			const char *driver, const char *vendor,
 			const char *model, struct udev_device *device)
 {
-	struct udev_device *usb_interface;
+	struct udev_device *usb_interface, *usb_device;
 	const char *devpath, *devnode, *interface, *number;
-	const char *label, *sysattr, *subsystem;
+	const char *label, *sysattr, *subsystem, *value;
 	struct modem_info *modem;
 	struct device_info *info;
 	struct udev_device *parent;
@@ -1568,6 +1572,13 @@ static void add_device(const char *syspath, const char *devname,
 
 		modem->sysattr = get_sysattr(driver);
 
+		/* Opt-in, the modem terminates DUN PPP on its own port */
+		usb_device = udev_device_get_parent_with_subsystem_devtype(
+					usb_interface, "usb", "usb_device");
+		value = udev_device_get_property_value(usb_device,
+						"OFONO_DUN_PASSTHROUGH");
+		modem->dun_passthrough = g_strcmp0(value, "1") == 0;
+
 		g_hash_table_replace(modem_list, modem->syspath, modem);
 	}
 
@@ -36,11 +36,15 @@
 #include "ofono.h"
 #include "common.h"
 #include "hfp.h"
+#include "gatchat.h"
 #include "gatserver.h"
 #include "gatppp.h"
+#include "gatrawip.h"
 
 #define RING_TIMEOUT 3
 
+static const char *none_prefix[] = { NULL };
+
 #define CVSD_OFFSET 0
 #define MSBC_OFFSET 1
 #define CODECS_COUNT (MSBC_OFFSET + 1)
@@ -55,6 +59,9 @@ struct ofono_emulator {
 	enum ofono_emulator_type type;
 	GAtServer *server;
 	GAtPPP *ppp;
+	GAtChat *dun_chat;	/* Modem port for PPP passthrough */
+	GAtRawIP *dun_relay;	/* Only while the server is suspended */
+	guint dun_source;
 	int l_features;
 	int r_features;
 	GSList *indicators;
@@ -175,6 +182,7 @@ static void request_private_network_cb(
 
 	g_at_ppp_set_acfc_enabled(em->ppp, TRUE);
 	g_at_ppp_set_pfc_enabled(em->ppp, TRUE);
+	g_at_ppp_set_vj_enabled(em->ppp, TRUE);
 
 	g_at_ppp_set_credentials(em->ppp, "", "");
 	g_at_ppp_set_debug(em->ppp, emulator_debug, "PPP");
@@ -196,6 +204,202 @@ error:
 	g_at_server_send_final(em->server, G_AT_SERVER_RESULT_ERROR);
 }
 
+static void cleanup_passthrough(struct ofono_emulator *em)
+{
+	DBG("");
+
+	if (em->dun_source > 0) {
+		g_source_remove(em->dun_source);
+		em->dun_source = 0;
+	}
+
+	g_at_rawip_unref(em->dun_relay);
+	em->dun_relay = NULL;
+
+	/* Closing the port hangs up the call on the modem side */
+	g_at_chat_unref(em->dun_chat);
+	em->dun_chat = NULL;
+}
+
+static gboolean passthrough_cleanup_cb(gpointer user_data)
+{
+	struct ofono_emulator *em = user_data;
+
+	em->dun_source = 0;
+	cleanup_passthrough(em);
+
+	return FALSE;
+}
+
+/*
+ * Hands the client back to the server with a final result.  We can be in
+ * a callback of the modem port, so the port is closed from idle.
+ */
+static void end_passthrough(struct ofono_emulator *em, GAtServerResult res)
+{
+	GAtIO *io = g_at_server_get_io(em->server);
+
+	if (em->dun_source > 0)
+		return;
+
+	DBG("");
+
+	/* In case CONNECT has not gone out yet */
+	g_at_io_set_write_done(io, NULL, NULL);
+
+	if (em->dun_relay) {
+		g_at_rawip_unref(em->dun_relay);
+		em->dun_relay = NULL;
+
+		g_at_server_resume(em->server);
+	}
+
+	g_at_server_send_final(em->server, res);
+
+	em->dun_source = g_idle_add(passthrough_cleanup_cb, em);
+}
+
+static void passthrough_disconnect(gpointer user_data)
+{
+	struct ofono_emulator *em = user_data;
+
+	end_passthrough(em, G_AT_SERVER_RESULT_NO_CARRIER);
+}
+
+/* The modem stays online, for ATO or ATH to follow */
+static void passthrough_suspend(gpointer user_data)
+{
+	struct ofono_emulator *em = user_data;
+
+	DBG("");
+
+	g_at_rawip_unref(em->dun_relay);
+	em->dun_relay = NULL;
+
+	g_at_server_resume(em->server);
+	g_at_server_send_final(em->server, G_AT_SERVER_RESULT_OK);
+}
+
+/*
+ * From here on the client talks PPP with the modem, we only copy (or
+ * splice) the bytes.  A '+++' escape from the client returns it to our
+ * command mode, with the call kept up.  The session ends when either
+ * side hangs up, or when a modem on a tty says NO CARRIER.
+ */
+static void start_passthrough(gpointer user_data)
+{
+	struct ofono_emulator *em = user_data;
+	GAtIO *io = g_at_server_get_io(em->server);
+	GIOChannel *channel = g_at_chat_get_channel(em->dun_chat);
+
+	em->dun_relay = g_at_rawip_new_from_io(io);
+	if (em->dun_relay == NULL) {
+		end_passthrough(em, G_AT_SERVER_RESULT_NO_CARRIER);
+		return;
+	}
+
+	g_at_server_suspend(em->server);
+
+	g_at_rawip_set_splice_enabled(em->dun_relay, TRUE);
+	g_at_rawip_set_suspend_function(em->dun_relay,
+						passthrough_suspend, em);
+
+	/*
+	 * Serial ports do not hang up, the modem only tells us.  Watching
+	 * for that and for the escape means both directions get copied on
+	 * a tty rather than spliced.
+	 */
+	if (isatty(g_io_channel_unix_get_fd(channel))) {
+		g_at_rawip_set_no_carrier_detect(em->dun_relay, TRUE);
+		g_at_rawip_set_disconnect_function(em->dun_relay,
+						passthrough_disconnect, em);
+	}
+
+	g_at_rawip_open_io(em->dun_relay, g_at_chat_get_io(em->dun_chat));
+}
+
+static GAtServerResult passthrough_dial_result(GAtResult *result)
+{
+	const char *final = g_at_result_final_response(result);
+
+	if (g_str_equal(final, "NO CARRIER"))
+		return G_AT_SERVER_RESULT_NO_CARRIER;
+
+	if (g_str_equal(final, "BUSY"))
+		return G_AT_SERVER_RESULT_BUSY;
+
+	if (g_str_equal(final, "NO ANSWER"))
+		return G_AT_SERVER_RESULT_NO_ANSWER;
+
+	if (g_str_equal(final, "NO DIALTONE"))
+		return G_AT_SERVER_RESULT_NO_DIALTONE;
+
+	return G_AT_SERVER_RESULT_ERROR;
+}
+
+static void passthrough_dial_cb(gboolean ok, GAtResult *result,
+						gpointer user_data)
+{
+	struct ofono_emulator *em = user_data;
+	GAtIO *io = g_at_server_get_io(em->server);
+
+	if (!ok) {
+		end_passthrough(em, passthrough_dial_result(result));
+		return;
+	}
+
+	/* Leave whatever follows CONNECT for the relay */
+	g_at_chat_suspend(em->dun_chat);
+
+	g_at_server_send_intermediate(em->server, "CONNECT");
+	g_at_io_set_write_done(io, start_passthrough, em);
+}
+
+/*
+ * Modems that bring a spare port can terminate PPP themselves, which
+ * saves us from re-framing every packet through GAtPPP and a private
+ * network.  This is opt-in with the modem's DunPassthrough setting.
+ * Returns FALSE if the modem has nothing to offer.
+ */
+static gboolean dial_passthrough(struct ofono_emulator *em,
+					const char *dial_str)
+{
+	struct ofono_modem *modem = __ofono_atom_get_modem(em->atom);
+	GIOChannel *channel;
+	GAtSyntax *syntax;
+	char *cmd;
+	int fd;
+
+	if (!ofono_modem_get_boolean(modem, "DunPassthrough"))
+		return FALSE;
+
+	fd = __ofono_modem_open_data_channel(modem);
+	if (fd < 0)
+		return FALSE;
+
+	channel = g_io_channel_unix_new(fd);
+	g_io_channel_set_close_on_unref(channel, TRUE);
+
+	syntax = g_at_syntax_new_gsm_permissive();
+	em->dun_chat = g_at_chat_new(channel, syntax);
+	g_at_syntax_unref(syntax);
+	g_io_channel_unref(channel);
+
+	if (em->dun_chat == NULL)
+		return FALSE;
+
+	g_at_chat_set_debug(em->dun_chat, emulator_debug, "Modem");
+	g_at_chat_set_disconnect_function(em->dun_chat,
+						passthrough_disconnect, em);
+
+	cmd = g_strconcat("ATD", dial_str, NULL);
+	g_at_chat_send(em->dun_chat, cmd, none_prefix,
+					passthrough_dial_cb, em, NULL);
+	g_free(cmd);
+
+	return TRUE;
+}
+
 static gboolean dial_call(struct ofono_emulator *em, const char *dial_str)
 {
 	char c = *dial_str;
@@ -203,6 +407,9 @@ static gboolean dial_call(struct ofono_emulator *em, const char *dial_str)
 	DBG("dial call %s", dial_str);
 
 	if (c == '*' || c == '#' || c == 'T' || c == 't') {
+		if (dial_passthrough(em, dial_str) == TRUE)
+			return TRUE;
+
 		if (__ofono_private_network_request(request_private_network_cb,
 						&em->pns_id, em) == FALSE)
 			return FALSE;
@@ -232,7 +439,7 @@ static void dial_cb(GAtServer *server, GAtServerRequestType type,
 	if (!dial_str)
 		goto error;
 
-	if (em->ppp)
+	if (em->ppp || em->dun_chat)
 		goto error;
 
 	if (!dial_call(em, dial_str))
@@ -267,6 +474,12 @@ static void dun_ath_cb(GAtServer *server, GAtServerRequestType type,
 		/* Fall through */
 
 	case G_AT_SERVER_REQUEST_TYPE_COMMAND_ONLY:
+		if (em->dun_chat && em->dun_source == 0) {
+			cleanup_passthrough(em);
+			g_at_server_send_final(server, G_AT_SERVER_RESULT_OK);
+			break;
+		}
+
 		if (em->ppp == NULL)
 			goto error;
 
@@ -317,6 +530,12 @@ static void dun_ato_cb(GAtServer *server, GAtServerRequestType type,
 
 		/* Fall through */
 	case G_AT_SERVER_REQUEST_TYPE_COMMAND_ONLY:
+		if (em->dun_chat && em->dun_source == 0) {
+			g_at_server_send_intermediate(em->server, "CONNECT");
+			g_at_io_set_write_done(io, start_passthrough, em);
+			break;
+		}
+
 		if (em->ppp == NULL)
 			goto error;
 
@@ -1173,6 +1392,8 @@ static void emulator_unregister(struct ofono_atom *atom)
 	g_at_ppp_unref(em->ppp);
 	em->ppp = NULL;
 
+	cleanup_passthrough(em);
+
 	if (em->pns_id > 0) {
 		__ofono_private_network_release(em->pns_id);
 		em->pns_id = 0;
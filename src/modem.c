@@ -2221,6 +2221,14 @@ void __ofono_modem_sim_reset(struct ofono_modem *modem)
 	modem_change_state(modem, MODEM_STATE_PRE_SIM);
 }
 
+int __ofono_modem_open_data_channel(struct ofono_modem *modem)
+{
+	if (modem->driver == NULL || modem->driver->open_data_channel == NULL)
+		return -ENOTSUP;
+
+	return modem->driver->open_data_channel(modem);
+}
+
 int ofono_modem_driver_register(const struct ofono_modem_driver *d)
 {
 	DBG("driver: %p, name: %s", d, d->name);
@@ -0,0 +1,109 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <errno.h>
+
+#include "bench-alloc.h"
+
+/*
+ * Interposing needs the glibc internal entry points, and sanitizers bring
+ * their own allocator which must not be bypassed.  Everything else still
+ * works without counting, the allocation figures just read as zero.
+ */
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#define BENCH_SANITIZER
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer) || \
+				__has_feature(memory_sanitizer)
+#define BENCH_SANITIZER
+#endif
+#endif
+
+#if defined(HAVE___LIBC_MALLOC) && !defined(BENCH_SANITIZER)
+#define BENCH_COUNT_ALLOCS
+#endif
+
+static unsigned long alloc_count;
+
+#ifdef BENCH_COUNT_ALLOCS
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+void *malloc(size_t size)
+{
+	alloc_count += 1;
+
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	alloc_count += 1;
+
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	alloc_count += 1;
+
+	return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	void *ptr;
+
+	alloc_count += 1;
+
+	ptr = __libc_memalign(alignment, size);
+	if (ptr == NULL)
+		return ENOMEM;
+
+	*memptr = ptr;
+
+	return 0;
+}
+#endif
+
+void bench_alloc_init(void)
+{
+	/* Make GSlice go through malloc so that it is counted as well */
+	setenv("G_SLICE", "always-malloc", 1);
+
+#ifndef BENCH_COUNT_ALLOCS
+	fprintf(stderr, "Allocation counting not available in this build\n");
+#endif
+}
+
+unsigned long bench_alloc_count(void)
+{
+	return alloc_count;
+}
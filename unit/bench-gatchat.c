@@ -0,0 +1,402 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <unistd.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "gatchat.h"
+#include "bench-alloc.h"
+#include "bench-replay.h"
+
+#define CPBR_ENTRIES	250
+#define CPBR_ROUNDS	20
+
+#define URC_BURSTS	200	/* Bursts of unsolicited results per round */
+#define URC_LINES	7	/* Lines within a burst */
+#define REPLAY_ROUNDS	20
+
+#define REPLAY_MARKER	"\r\n+BENCH: END\r\n"
+
+static const char *cpbr_prefix[] = { "+CPBR:", NULL };
+
+struct cpbr_bench {
+	GMainLoop *mainloop;
+	GAtChat *chat;
+	int modem_fd;
+	GString *reply;
+	gboolean listing;
+	unsigned int round;
+	unsigned int entries;
+	unsigned long allocs_start;
+	unsigned long allocs;
+	gint64 time_start;
+	gint64 time;
+};
+
+static void modem_write(int fd, const char *buf, gsize len)
+{
+	ssize_t written;
+
+	while (len > 0) {
+		written = write(fd, buf, len);
+		g_assert(written > 0);
+
+		buf += written;
+		len -= written;
+	}
+}
+
+static gboolean modem_received(GIOChannel *channel, GIOCondition cond,
+				gpointer user_data)
+{
+	struct cpbr_bench *bench = user_data;
+	char buf[256];
+	ssize_t len;
+
+	if (cond & (G_IO_HUP | G_IO_ERR | G_IO_NVAL))
+		return FALSE;
+
+	len = read(bench->modem_fd, buf, sizeof(buf));
+	if (len <= 0)
+		return FALSE;
+
+	/* Commands are short, the whole of it arrives at once */
+	if (memchr(buf, '\r', len))
+		modem_write(bench->modem_fd, bench->reply->str,
+						bench->reply->len);
+
+	return TRUE;
+}
+
+static void cpbr_parse(struct cpbr_bench *bench, GAtResult *result)
+{
+	GAtResultIter iter;
+	const char *number;
+	const char *text;
+	int index;
+	int type;
+
+	g_at_result_iter_init(&iter, result);
+
+	while (g_at_result_iter_next(&iter, "+CPBR:")) {
+		if (!g_at_result_iter_next_number(&iter, &index))
+			continue;
+
+		if (!g_at_result_iter_next_string(&iter, &number))
+			continue;
+
+		if (!g_at_result_iter_next_number(&iter, &type))
+			continue;
+
+		if (!g_at_result_iter_next_string(&iter, &text))
+			continue;
+
+		bench->entries += 1;
+	}
+}
+
+static void cpbr_notify(GAtResult *result, gpointer user_data)
+{
+	cpbr_parse(user_data, result);
+}
+
+static void cpbr_send(struct cpbr_bench *bench);
+
+static void cpbr_cb(gboolean ok, GAtResult *result, gpointer user_data)
+{
+	struct cpbr_bench *bench = user_data;
+
+	g_assert(ok);
+
+	if (bench->listing == FALSE)
+		cpbr_parse(bench, result);
+
+	g_assert(bench->entries == CPBR_ENTRIES);
+
+	/* The first round warms up the chat and is not accounted */
+	if (bench->round > 0) {
+		bench->allocs += bench_alloc_count() - bench->allocs_start;
+		bench->time += g_get_monotonic_time() - bench->time_start;
+	}
+
+	if (++bench->round > CPBR_ROUNDS) {
+		g_main_loop_quit(bench->mainloop);
+		return;
+	}
+
+	cpbr_send(bench);
+}
+
+static void cpbr_send(struct cpbr_bench *bench)
+{
+	char *cmd = g_strdup_printf("AT+CPBR=1,%d", CPBR_ENTRIES);
+	guint id;
+
+	bench->entries = 0;
+	bench->allocs_start = bench_alloc_count();
+	bench->time_start = g_get_monotonic_time();
+
+	if (bench->listing)
+		id = g_at_chat_send_listing(bench->chat, cmd, cpbr_prefix,
+						cpbr_notify, cpbr_cb,
+						bench, NULL);
+	else
+		id = g_at_chat_send(bench->chat, cmd, cpbr_prefix,
+					cpbr_cb, bench, NULL);
+
+	g_assert(id > 0);
+
+	g_free(cmd);
+}
+
+static void test_cpbr(gconstpointer data)
+{
+	struct cpbr_bench bench;
+	GIOChannel *channel;
+	GIOChannel *modem;
+	GAtSyntax *syntax;
+	int sv[2];
+	int err;
+	int i;
+
+	memset(&bench, 0, sizeof(bench));
+	bench.listing = GPOINTER_TO_INT(data);
+
+	err = socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+	g_assert(err == 0);
+
+	bench.reply = g_string_new(NULL);
+
+	for (i = 1; i <= CPBR_ENTRIES; i++)
+		g_string_append_printf(bench.reply,
+				"\r\n+CPBR: %d,\"+1555010%04d\",145,"
+				"\"Contact %d\"\r\n", i, i, i);
+
+	g_string_append(bench.reply, "\r\nOK\r\n");
+
+	bench.modem_fd = sv[1];
+	modem = g_io_channel_unix_new(sv[1]);
+	g_io_add_watch(modem, G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				modem_received, &bench);
+
+	channel = g_io_channel_unix_new(sv[0]);
+	g_io_channel_set_close_on_unref(channel, TRUE);
+
+	syntax = g_at_syntax_new_gsm_permissive();
+	bench.chat = g_at_chat_new(channel, syntax);
+	g_at_syntax_unref(syntax);
+	g_io_channel_unref(channel);
+
+	g_assert(bench.chat != NULL);
+
+	bench.mainloop = g_main_loop_new(NULL, FALSE);
+
+	cpbr_send(&bench);
+	g_main_loop_run(bench.mainloop);
+
+	g_print("%s: %d entries, %.1f allocs/listing, %.2f allocs/entry, "
+			"%.1f us/listing\n",
+			bench.listing ? "listing" : "response", CPBR_ENTRIES,
+			(double) bench.allocs / CPBR_ROUNDS,
+			(double) bench.allocs / CPBR_ROUNDS / CPBR_ENTRIES,
+			(double) bench.time / CPBR_ROUNDS);
+
+	g_at_chat_unref(bench.chat);
+	g_main_loop_unref(bench.mainloop);
+
+	g_io_channel_shutdown(modem, FALSE, NULL);
+	g_io_channel_unref(modem);
+	close(sv[1]);
+
+	g_string_free(bench.reply, TRUE);
+}
+
+static void urc_notify(GAtResult *result, gpointer user_data)
+{
+	GAtResultIter iter;
+	unsigned int lines = 0;
+
+	g_at_result_iter_init(&iter, result);
+
+	while (g_at_result_iter_next(&iter, NULL))
+		lines += 1;
+
+	/* The +CMT PDU comes as the final line, not as a result line */
+	if (g_at_result_pdu(result))
+		lines += 1;
+
+	bench_replay_delivered(user_data, lines);
+}
+
+static void marker_notify(GAtResult *result, gpointer user_data)
+{
+	bench_replay_round_done(user_data);
+}
+
+static GAtChat *replay_chat_new(struct bench_replay *replay)
+{
+	GIOChannel *channel;
+	GAtSyntax *syntax;
+	GAtChat *chat;
+
+	channel = g_io_channel_unix_new(bench_replay_get_fd(replay));
+	g_io_channel_set_close_on_unref(channel, TRUE);
+
+	syntax = g_at_syntax_new_gsm_permissive();
+	chat = g_at_chat_new(channel, syntax);
+	g_at_syntax_unref(syntax);
+	g_io_channel_unref(channel);
+
+	g_assert(chat != NULL);
+
+	g_at_chat_register(chat, "+BENCH:", marker_notify, FALSE,
+				replay, NULL);
+
+	return chat;
+}
+
+static void test_urc(void)
+{
+	struct bench_replay *replay;
+	GByteArray *stream;
+	GString *urcs;
+	GAtChat *chat;
+	int i;
+
+	urcs = g_string_new(NULL);
+
+	for (i = 0; i < URC_BURSTS; i++) {
+		g_string_append_printf(urcs,
+				"\r\n+CREG: 1,\"00A1\",\"%08X\",7\r\n", i);
+		g_string_append_printf(urcs, "\r\n+CIEV: 2,%d\r\n", i % 6);
+		g_string_append(urcs, "\r\nRING\r\n");
+		g_string_append_printf(urcs,
+				"\r\n+CLIP: \"+1555010%04d\",145,,,,0\r\n", i);
+		g_string_append(urcs, "\r\n+CMT: ,24\r\n"
+				"0791448720003023240DD0E474D81C0EBB010000"
+				"111011315214000BE474D81C0EBB5DE3771B\r\n");
+		g_string_append_printf(urcs,
+				"\r\n+CUSD: 0,\"Balance %d.00\",15\r\n", i);
+	}
+
+	g_string_append(urcs, REPLAY_MARKER);
+
+	stream = g_byte_array_new();
+	g_byte_array_append(stream, (guint8 *) urcs->str, urcs->len);
+	g_string_free(urcs, TRUE);
+
+	replay = bench_replay_new(stream, REPLAY_ROUNDS);
+	g_assert(replay != NULL);
+
+	chat = replay_chat_new(replay);
+
+	g_at_chat_register(chat, "+CREG:", urc_notify, FALSE, replay, NULL);
+	g_at_chat_register(chat, "+CIEV:", urc_notify, FALSE, replay, NULL);
+	g_at_chat_register(chat, "RING", urc_notify, FALSE, replay, NULL);
+	g_at_chat_register(chat, "+CLIP:", urc_notify, FALSE, replay, NULL);
+	g_at_chat_register(chat, "+CMT:", urc_notify, TRUE, replay, NULL);
+	g_at_chat_register(chat, "+CUSD:", urc_notify, FALSE, replay, NULL);
+
+	bench_replay_run(replay);
+
+	g_assert(bench_replay_get_units(replay) ==
+				URC_BURSTS * URC_LINES * REPLAY_ROUNDS);
+
+	bench_replay_report(replay, "urc", "line");
+
+	g_at_chat_unref(chat);
+	bench_replay_free(replay);
+	g_byte_array_unref(stream);
+}
+
+static void capture_notify(GAtResult *result, gpointer user_data)
+{
+	GAtResultIter iter;
+
+	/* Every line reaches here, the end of round marker included */
+	g_at_result_iter_init(&iter, result);
+
+	if (g_at_result_iter_next(&iter, "+BENCH:"))
+		return;
+
+	urc_notify(result, user_data);
+}
+
+static void test_capture(gconstpointer data)
+{
+	GByteArray *stream = (GByteArray *) data;
+	struct bench_replay *replay;
+	GAtChat *chat;
+
+	replay = bench_replay_new(stream, REPLAY_ROUNDS);
+	g_assert(replay != NULL);
+
+	chat = replay_chat_new(replay);
+
+	/* Nothing is pending, so the whole capture is seen as unsolicited */
+	g_at_chat_register(chat, "", capture_notify, FALSE, replay, NULL);
+
+	bench_replay_run(replay);
+	bench_replay_report(replay, "capture", "line");
+
+	g_at_chat_unref(chat);
+	bench_replay_free(replay);
+}
+
+int main(int argc, char **argv)
+{
+	GByteArray *capture = NULL;
+
+	bench_alloc_init();
+
+	g_test_init(&argc, &argv, NULL);
+
+	/* An optional capture, as written by g_at_hdlc_set_recording */
+	if (argc > 1) {
+		capture = bench_capture_load(argv[1]);
+		if (capture == NULL) {
+			g_printerr("Unable to load capture %s\n", argv[1]);
+			return 1;
+		}
+
+		g_byte_array_append(capture, (guint8 *) REPLAY_MARKER,
+						strlen(REPLAY_MARKER));
+	}
+
+	g_test_add_data_func("/benchgatchat/cpbr_listing",
+				GINT_TO_POINTER(TRUE), test_cpbr);
+	g_test_add_data_func("/benchgatchat/cpbr_response",
+				GINT_TO_POINTER(FALSE), test_cpbr);
+	g_test_add_func("/benchgatchat/urc", test_urc);
+
+	if (capture)
+		g_test_add_data_func("/benchgatchat/capture", capture,
+							test_capture);
+
+	return g_test_run();
+}
@@ -0,0 +1,199 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "gathdlc.h"
+#include "crc-ccitt.h"
+#include "bench-alloc.h"
+#include "bench-replay.h"
+
+#define HDLC_FRAMES	256	/* Frames per round */
+#define HDLC_MTU	1500
+#define REPLAY_ROUNDS	20
+
+static const guint8 replay_marker[] = {
+	0xff, 0x03, 0xbe, 0x4c, 'E', 'N', 'D'
+};
+
+struct hdlc_bench {
+	struct bench_replay *replay;
+	GAtHDLC *hdlc;
+};
+
+static void hdlc_put(GByteArray *stream, guint8 c)
+{
+	if (c < 0x20 || c == 0x7e || c == 0x7d) {
+		guint8 escaped[2] = { 0x7d, c ^ 0x20 };
+
+		g_byte_array_append(stream, escaped, 2);
+	} else
+		g_byte_array_append(stream, &c, 1);
+}
+
+static void hdlc_encode(GByteArray *stream, const guint8 *data, gsize size)
+{
+	guint8 flag = 0x7e;
+	guint16 fcs = 0xffff;
+	gsize i;
+
+	g_byte_array_append(stream, &flag, 1);
+
+	for (i = 0; i < size; i++) {
+		fcs = crc_ccitt_byte(fcs, data[i]);
+		hdlc_put(stream, data[i]);
+	}
+
+	fcs ^= 0xffff;
+	hdlc_put(stream, fcs & 0xff);
+	hdlc_put(stream, fcs >> 8);
+
+	g_byte_array_append(stream, &flag, 1);
+}
+
+static void hdlc_receive(const unsigned char *data, gsize size,
+							gpointer user_data)
+{
+	struct hdlc_bench *bench = user_data;
+
+	if (size == sizeof(replay_marker) &&
+			memcmp(data, replay_marker, size) == 0) {
+		bench_replay_round_done(bench->replay);
+		return;
+	}
+
+	bench_replay_delivered(bench->replay, 1);
+}
+
+static void hdlc_bench_run(struct hdlc_bench *bench, GByteArray *stream)
+{
+	GIOChannel *channel;
+
+	bench->replay = bench_replay_new(stream, REPLAY_ROUNDS);
+	g_assert(bench->replay != NULL);
+
+	channel = g_io_channel_unix_new(bench_replay_get_fd(bench->replay));
+	g_io_channel_set_close_on_unref(channel, TRUE);
+
+	bench->hdlc = g_at_hdlc_new(channel);
+	g_io_channel_unref(channel);
+
+	g_assert(bench->hdlc != NULL);
+
+	g_at_hdlc_set_receive(bench->hdlc, hdlc_receive, bench);
+
+	bench_replay_run(bench->replay);
+}
+
+static void hdlc_bench_free(struct hdlc_bench *bench)
+{
+	g_at_hdlc_unref(bench->hdlc);
+	bench_replay_free(bench->replay);
+}
+
+static void test_frames(void)
+{
+	struct hdlc_bench bench;
+	GByteArray *stream;
+	guint8 frame[HDLC_MTU];
+	gsize size;
+	int i;
+	gsize j;
+
+	stream = g_byte_array_new();
+
+	/*
+	 * PPP encapsulated IPv4 frames of varying size, the payload goes
+	 * through every byte value so escaping is exercised as well
+	 */
+	for (i = 0; i < HDLC_FRAMES; i++) {
+		size = 40 + (i * 97) % (HDLC_MTU - 40);
+
+		frame[0] = 0xff;
+		frame[1] = 0x03;
+		frame[2] = 0x00;
+		frame[3] = 0x21;
+
+		for (j = 4; j < size; j++)
+			frame[j] = i * 31 + j * 7;
+
+		hdlc_encode(stream, frame, size);
+	}
+
+	hdlc_encode(stream, replay_marker, sizeof(replay_marker));
+
+	memset(&bench, 0, sizeof(bench));
+	hdlc_bench_run(&bench, stream);
+
+	g_assert(bench_replay_get_units(bench.replay) ==
+					HDLC_FRAMES * REPLAY_ROUNDS);
+
+	bench_replay_report(bench.replay, "frames", "frame");
+
+	hdlc_bench_free(&bench);
+	g_byte_array_unref(stream);
+}
+
+static void test_capture(gconstpointer data)
+{
+	struct hdlc_bench bench;
+
+	memset(&bench, 0, sizeof(bench));
+	hdlc_bench_run(&bench, (GByteArray *) data);
+
+	bench_replay_report(bench.replay, "capture", "frame");
+
+	hdlc_bench_free(&bench);
+}
+
+int main(int argc, char **argv)
+{
+	GByteArray *capture = NULL;
+
+	bench_alloc_init();
+
+	g_test_init(&argc, &argv, NULL);
+
+	/* An optional capture, as written by g_at_hdlc_set_recording */
+	if (argc > 1) {
+		capture = bench_capture_load(argv[1]);
+		if (capture == NULL) {
+			g_printerr("Unable to load capture %s\n", argv[1]);
+			return 1;
+		}
+
+		hdlc_encode(capture, replay_marker, sizeof(replay_marker));
+	}
+
+	g_test_add_func("/benchhdlc/frames", test_frames);
+
+	if (capture)
+		g_test_add_data_func("/benchhdlc/capture", capture,
+							test_capture);
+
+	return g_test_run();
+}
@@ -0,0 +1,254 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "gatmux.h"
+#include "gsm0710.h"
+#include "bench-alloc.h"
+#include "bench-replay.h"
+
+#define MUX_DLCS	4	/* Data carrying DLCs */
+#define MARKER_DLC	(MUX_DLCS + 1)
+#define MUX_MESSAGES	1000	/* Messages per round */
+#define REPLAY_ROUNDS	20
+#define MUX_MAX_ALLOCS	10	/* Per round, far fewer than frames */
+
+struct mux_mode {
+	gboolean advanced;
+	int frame_size;
+};
+
+struct mux_bench {
+	struct bench_replay *replay;
+	GAtMux *mux;
+	GIOChannel *dlcs[MARKER_DLC];
+	guint watches[MARKER_DLC];
+	unsigned long received;		/* Payload bytes, warmup included */
+};
+
+static const struct mux_mode basic_mode = { FALSE, 31 };
+static const struct mux_mode advanced_mode = { TRUE, 64 };
+
+static void mux_encode(GByteArray *stream, const struct mux_mode *mode,
+				guint8 dlc, const guint8 *data, int len)
+{
+	guint8 *frame = g_alloca(mode->frame_size * 2 + 7);
+	int frame_len;
+	int size;
+
+	while (len > 0) {
+		size = MIN(len, mode->frame_size);
+
+		if (mode->advanced)
+			frame_len = gsm0710_advanced_fill_frame(frame, dlc,
+						GSM0710_DATA, data, size);
+		else
+			frame_len = gsm0710_basic_fill_frame(frame, dlc,
+						GSM0710_DATA, data, size);
+
+		g_byte_array_append(stream, frame, frame_len);
+
+		data += size;
+		len -= size;
+	}
+}
+
+static void mux_encode_marker(GByteArray *stream, const struct mux_mode *mode)
+{
+	/* Each byte seen on the marker DLC completes a round */
+	mux_encode(stream, mode, MARKER_DLC, (const guint8 *) "E", 1);
+}
+
+static gboolean dlc_received(GIOChannel *channel, GIOCondition cond,
+				gpointer user_data)
+{
+	struct mux_bench *bench = user_data;
+	char buf[256];
+	gsize bytes_read;
+	gsize total = 0;
+
+	if (cond & (G_IO_HUP | G_IO_ERR | G_IO_NVAL))
+		return FALSE;
+
+	do {
+		bytes_read = 0;
+		g_io_channel_read_chars(channel, buf, sizeof(buf),
+						&bytes_read, NULL);
+		total += bytes_read;
+	} while (bytes_read > 0);
+
+	if (channel != bench->dlcs[MARKER_DLC - 1]) {
+		bench->received += total;
+		bench_replay_delivered(bench->replay, total);
+		return TRUE;
+	}
+
+	while (total--)
+		bench_replay_round_done(bench->replay);
+
+	return TRUE;
+}
+
+static void mux_bench_run(struct mux_bench *bench,
+				const struct mux_mode *mode, GByteArray *stream)
+{
+	GIOChannel *channel;
+	int i;
+
+	bench->replay = bench_replay_new(stream, REPLAY_ROUNDS);
+	g_assert(bench->replay != NULL);
+
+	channel = g_io_channel_unix_new(bench_replay_get_fd(bench->replay));
+	g_io_channel_set_encoding(channel, NULL, NULL);
+	g_io_channel_set_buffered(channel, FALSE);
+	g_io_channel_set_flags(channel, G_IO_FLAG_NONBLOCK, NULL);
+
+	if (mode->advanced)
+		bench->mux = g_at_mux_new_gsm0710_advanced(channel,
+							mode->frame_size);
+	else
+		bench->mux = g_at_mux_new_gsm0710_basic(channel,
+							mode->frame_size);
+
+	g_io_channel_unref(channel);
+
+	g_assert(bench->mux != NULL);
+
+	g_at_mux_start(bench->mux);
+
+	for (i = 0; i < MARKER_DLC; i++) {
+		bench->dlcs[i] = g_at_mux_create_channel(bench->mux);
+		g_assert(bench->dlcs[i] != NULL);
+
+		bench->watches[i] = g_io_add_watch(bench->dlcs[i], G_IO_IN,
+							dlc_received, bench);
+	}
+
+	bench_replay_run(bench->replay);
+}
+
+static void mux_bench_free(struct mux_bench *bench)
+{
+	int i;
+
+	for (i = 0; i < MARKER_DLC; i++) {
+		g_source_remove(bench->watches[i]);
+		g_io_channel_unref(bench->dlcs[i]);
+	}
+
+	g_at_mux_unref(bench->mux);
+	bench_replay_free(bench->replay);
+}
+
+static void test_messages(gconstpointer data)
+{
+	const struct mux_mode *mode = data;
+	struct mux_bench bench;
+	GByteArray *stream;
+	unsigned long payload = 0;
+	char *msg;
+	int i;
+
+	stream = g_byte_array_new();
+
+	/* Unsolicited results spread over the DLCs, longer than a frame */
+	for (i = 0; i < MUX_MESSAGES; i++) {
+		msg = g_strdup_printf("\r\n+CREG: 1,\"00A1\",\"%08X\",7\r\n"
+					"\r\n+CIEV: 2,%d\r\n", i, i % 6);
+
+		mux_encode(stream, mode, i % MUX_DLCS + 1,
+					(const guint8 *) msg, strlen(msg));
+		payload += strlen(msg);
+
+		g_free(msg);
+	}
+
+	mux_encode_marker(stream, mode);
+
+	memset(&bench, 0, sizeof(bench));
+	mux_bench_run(&bench, mode, stream);
+
+	/*
+	 * The first round can arrive in the same read as the warmup marker
+	 * and the data DLCs are dispatched before the marker DLC, so the
+	 * replay's own count may miss some of it.  Check everything instead.
+	 */
+	g_assert(bench.received == payload * (REPLAY_ROUNDS + 1));
+
+	bench_replay_report(bench.replay, mode->advanced ? "advanced" : "basic",
+							"payload byte");
+
+	/* Delivering frames to the DLC watches must not touch the heap */
+	g_assert(bench_replay_get_allocs(bench.replay) <
+					MUX_MAX_ALLOCS * REPLAY_ROUNDS);
+
+	mux_bench_free(&bench);
+	g_byte_array_unref(stream);
+}
+
+static void test_capture(gconstpointer data)
+{
+	struct mux_bench bench;
+
+	memset(&bench, 0, sizeof(bench));
+	mux_bench_run(&bench, &basic_mode, (GByteArray *) data);
+
+	bench_replay_report(bench.replay, "capture", "payload byte");
+
+	mux_bench_free(&bench);
+}
+
+int main(int argc, char **argv)
+{
+	GByteArray *capture = NULL;
+
+	bench_alloc_init();
+
+	g_test_init(&argc, &argv, NULL);
+
+	/* An optional capture of a basic mode session */
+	if (argc > 1) {
+		capture = bench_capture_load(argv[1]);
+		if (capture == NULL) {
+			g_printerr("Unable to load capture %s\n", argv[1]);
+			return 1;
+		}
+
+		mux_encode_marker(capture, &basic_mode);
+	}
+
+	g_test_add_data_func("/benchmux/basic", &basic_mode, test_messages);
+	g_test_add_data_func("/benchmux/advanced", &advanced_mode,
+							test_messages);
+
+	if (capture)
+		g_test_add_data_func("/benchmux/capture", capture,
+							test_capture);
+
+	return g_test_run();
+}
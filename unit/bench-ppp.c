@@ -0,0 +1,400 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include <glib.h>
+
+#include "gatio.h"
+#include "gatppp.h"
+#include "bench-alloc.h"
+
+#define PPP_PACKETS	20000	/* Per configuration */
+#define PPP_WINDOW	8	/* Packets in flight, keeps HDLC from dropping */
+#define PPP_TIMEOUT	60	/* Seconds before a stalled run is failed */
+#define PPP_SERVER_IP	"192.168.1.1"
+#define PPP_CLIENT_IP	"192.168.1.2"
+#define PPP_SEQ_OFFSET	40	/* Past the IP and TCP headers */
+
+struct ppp_config {
+	const char *name;
+	guint16 mtu;
+	guint32 accm;
+	gboolean vj;
+};
+
+/*
+ * The client sends IP packets to the server over a socketpair standing
+ * in for the modem.  Packet sockets take the place of both tun
+ * interfaces, the benchmark writes to the client's and reads from the
+ * server's.
+ */
+struct ppp_bench {
+	const struct ppp_config *config;
+	GMainLoop *mainloop;
+	GAtPPP *client;
+	GAtPPP *server;
+	int source_fd;
+	int sink_fd;
+	guint source_watch;
+	guint sink_watch;
+	guint timeout;
+	guint connected;
+	guint sent;
+	guint received;
+	guint64 bytes;
+	gboolean failed;
+	gint64 time_start;
+	gdouble cpu_start;
+	unsigned long allocs_start;
+};
+
+static const struct ppp_config configs[] = {
+	{ "mtu 1500, default accm",	1500,	0xffffffff },
+	{ "mtu 1500, accm 0",		1500,	0x00000000 },
+	{ "mtu 576, default accm",	576,	0xffffffff },
+	{ "mtu 576, accm 0",		576,	0x00000000 },
+	{ "mtu 1500, vj",		1500,	0xffffffff,	TRUE },
+	{ "mtu 576, vj",		576,	0xffffffff,	TRUE },
+};
+
+static gdouble cpu_time(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+		usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/*
+ * An IPv4 header, as far as PPP cares, and every byte value after it.
+ * With VJ the packets are the segments of one TCP connection instead, so
+ * that their headers compress.
+ */
+static void fill_packet(guint8 *packet, guint16 len, guint32 seq,
+				gboolean tcp)
+{
+	guint32 tcp_seq = seq * (len - PPP_SEQ_OFFSET);
+	guint32 sum = 0;
+	guint16 i;
+
+	memset(packet, 0, PPP_SEQ_OFFSET);
+	packet[0] = 0x45;
+	packet[2] = len >> 8;
+	packet[3] = len & 0xff;
+	packet[9] = 17;
+
+	if (tcp) {
+		/* IP ID, don't fragment, TTL, protocol and checksum */
+		packet[4] = seq >> 8;
+		packet[5] = seq & 0xff;
+		packet[6] = 0x40;
+		packet[8] = 64;
+		packet[9] = 6;
+
+		for (i = 0; i < 20; i += 2)
+			sum += (packet[i] << 8) | packet[i + 1];
+
+		while (sum >> 16)
+			sum = (sum & 0xffff) + (sum >> 16);
+
+		packet[10] = ~sum >> 8;
+		packet[11] = ~sum & 0xff;
+
+		/* Ports, sequence number, header length, ACK and window */
+		packet[20] = 0x9c;
+		packet[23] = 80;
+		packet[24] = tcp_seq >> 24;
+		packet[25] = tcp_seq >> 16;
+		packet[26] = tcp_seq >> 8;
+		packet[27] = tcp_seq & 0xff;
+		packet[32] = 0x50;
+		packet[33] = 0x10;
+		packet[34] = 0x72;
+		packet[35] = 0x10;
+	}
+
+	memcpy(packet + PPP_SEQ_OFFSET, &seq, sizeof(seq));
+
+	for (i = PPP_SEQ_OFFSET + sizeof(seq); i < len; i++)
+		packet[i] = seq + i;
+}
+
+static gboolean source_cb(GIOChannel *channel, GIOCondition cond,
+				gpointer user_data)
+{
+	struct ppp_bench *bench = user_data;
+	guint16 len = bench->config->mtu;
+	guint8 packet[1500];
+
+	if (cond & (G_IO_NVAL | G_IO_HUP | G_IO_ERR))
+		goto stop;
+
+	while (bench->sent < PPP_PACKETS &&
+			bench->sent - bench->received < PPP_WINDOW) {
+		fill_packet(packet, len, bench->sent, bench->config->vj);
+
+		if (write(bench->source_fd, packet, len) < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				return TRUE;
+
+			goto stop;
+		}
+
+		bench->sent += 1;
+	}
+
+stop:
+	/* The sink wakes us up again once the window opens */
+	bench->source_watch = 0;
+	return FALSE;
+}
+
+static void source_start(struct ppp_bench *bench)
+{
+	GIOChannel *channel;
+
+	if (bench->source_watch > 0 || bench->sent == PPP_PACKETS)
+		return;
+
+	channel = g_io_channel_unix_new(bench->source_fd);
+	bench->source_watch = g_io_add_watch(channel,
+				G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				source_cb, bench);
+	g_io_channel_unref(channel);
+}
+
+static gboolean sink_cb(GIOChannel *channel, GIOCondition cond,
+				gpointer user_data)
+{
+	struct ppp_bench *bench = user_data;
+	guint8 packet[2048];
+	ssize_t len;
+	guint32 seq;
+
+	if (cond & (G_IO_NVAL | G_IO_HUP | G_IO_ERR))
+		goto fail;
+
+	while ((len = read(bench->sink_fd, packet, sizeof(packet))) > 0) {
+		g_assert(len == bench->config->mtu);
+
+		/* Nothing lost, nothing reordered, nothing garbled */
+		memcpy(&seq, packet + PPP_SEQ_OFFSET, sizeof(seq));
+		g_assert(seq == bench->received);
+		g_assert(packet[len - 1] == (guint8) (seq + len - 1));
+
+		bench->received += 1;
+		bench->bytes += len;
+	}
+
+	if (len == 0 || (errno != EAGAIN && errno != EINTR))
+		goto fail;
+
+	if (bench->received == PPP_PACKETS) {
+		g_main_loop_quit(bench->mainloop);
+		bench->sink_watch = 0;
+		return FALSE;
+	}
+
+	source_start(bench);
+
+	return TRUE;
+
+fail:
+	bench->failed = TRUE;
+	g_main_loop_quit(bench->mainloop);
+	bench->sink_watch = 0;
+	return FALSE;
+}
+
+static void connected(const char *iface, const char *local, const char *peer,
+			const char *dns1, const char *dns2, gpointer user_data)
+{
+	struct ppp_bench *bench = user_data;
+	GIOChannel *channel;
+
+	/* Both ends have to be up */
+	if (++bench->connected < 2)
+		return;
+
+	channel = g_io_channel_unix_new(bench->sink_fd);
+	bench->sink_watch = g_io_add_watch(channel,
+				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				sink_cb, bench);
+	g_io_channel_unref(channel);
+
+	bench->time_start = g_get_monotonic_time();
+	bench->cpu_start = cpu_time();
+	bench->allocs_start = bench_alloc_count();
+
+	source_start(bench);
+}
+
+static void disconnected(GAtPPPDisconnectReason reason, gpointer user_data)
+{
+	struct ppp_bench *bench = user_data;
+
+	g_printerr("PPP disconnected, reason %d\n", reason);
+
+	bench->failed = TRUE;
+	g_main_loop_quit(bench->mainloop);
+}
+
+static gboolean bench_timeout(gpointer user_data)
+{
+	struct ppp_bench *bench = user_data;
+
+	bench->timeout = 0;
+	bench->failed = TRUE;
+	g_main_loop_quit(bench->mainloop);
+
+	return FALSE;
+}
+
+static GAtPPP *ppp_setup(struct ppp_bench *bench, GAtPPP *ppp, int fd)
+{
+	GIOChannel *channel;
+	GAtIO *io;
+	gboolean ok;
+
+	g_assert(ppp != NULL);
+
+	g_at_ppp_set_mru(ppp, bench->config->mtu);
+	g_at_ppp_set_accm(ppp, bench->config->accm);
+	g_at_ppp_set_vj_enabled(ppp, bench->config->vj);
+	g_at_ppp_set_connect_function(ppp, connected, bench);
+	g_at_ppp_set_disconnect_function(ppp, disconnected, bench);
+
+	channel = g_io_channel_unix_new(fd);
+	g_io_channel_set_close_on_unref(channel, TRUE);
+	io = g_at_io_new(channel);
+	g_io_channel_unref(channel);
+	g_assert(io != NULL);
+
+	if (ppp == bench->server) {
+		g_at_ppp_set_server_info(ppp, PPP_CLIENT_IP,
+						PPP_SERVER_IP, PPP_SERVER_IP);
+		ok = g_at_ppp_listen(ppp, io);
+	} else
+		ok = g_at_ppp_open(ppp, io);
+
+	g_assert(ok);
+	g_at_io_unref(io);
+
+	return ppp;
+}
+
+static void test_throughput(gconstpointer data)
+{
+	struct ppp_bench bench;
+	int link[2];
+	int client_net[2];
+	int server_net[2];
+	gdouble secs;
+	gdouble cpu;
+	unsigned long allocs;
+
+	memset(&bench, 0, sizeof(bench));
+	bench.config = data;
+
+	g_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, link) == 0);
+	g_assert(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, client_net) == 0);
+	g_assert(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, server_net) == 0);
+
+	bench.source_fd = client_net[1];
+	bench.sink_fd = server_net[1];
+	fcntl(bench.source_fd, F_SETFL, O_NONBLOCK);
+	fcntl(bench.sink_fd, F_SETFL, O_NONBLOCK);
+
+	bench.mainloop = g_main_loop_new(NULL, FALSE);
+
+	bench.server = g_at_ppp_server_new_full(PPP_SERVER_IP, server_net[0]);
+	ppp_setup(&bench, bench.server, link[0]);
+
+	bench.client = g_at_ppp_new_full(client_net[0]);
+	ppp_setup(&bench, bench.client, link[1]);
+
+	bench.timeout = g_timeout_add_seconds(PPP_TIMEOUT,
+						bench_timeout, &bench);
+
+	g_main_loop_run(bench.mainloop);
+
+	secs = (gdouble) (g_get_monotonic_time() - bench.time_start) /
+							G_USEC_PER_SEC;
+	cpu = cpu_time() - bench.cpu_start;
+	allocs = bench_alloc_count() - bench.allocs_start;
+
+	g_assert(bench.failed == FALSE);
+	g_assert(bench.received == PPP_PACKETS);
+
+	g_print("%s: %.1f Mbit/s, %.0f packets/s, %.2f cpu seconds, "
+			"%.2f allocs/packet\n", bench.config->name,
+			bench.bytes * 8 / secs / 1e6, bench.received / secs,
+			cpu, (gdouble) allocs / bench.received);
+
+	if (bench.timeout > 0)
+		g_source_remove(bench.timeout);
+
+	if (bench.source_watch > 0)
+		g_source_remove(bench.source_watch);
+
+	if (bench.sink_watch > 0)
+		g_source_remove(bench.sink_watch);
+
+	g_at_ppp_set_disconnect_function(bench.client, NULL, NULL);
+	g_at_ppp_set_disconnect_function(bench.server, NULL, NULL);
+	g_at_ppp_unref(bench.client);
+	g_at_ppp_unref(bench.server);
+
+	close(bench.source_fd);
+	close(bench.sink_fd);
+
+	g_main_loop_unref(bench.mainloop);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int i;
+	char *path;
+
+	bench_alloc_init();
+
+	g_test_init(&argc, &argv, NULL);
+
+	for (i = 0; i < G_N_ELEMENTS(configs); i++) {
+		path = g_strdup_printf("/benchppp/%u", i);
+		g_test_add_data_func(path, &configs[i], test_throughput);
+		g_free(path);
+	}
+
+	return g_test_run();
+}
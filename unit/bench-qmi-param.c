@@ -0,0 +1,176 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "drivers/qmimodem/qmi.h"
+#include "drivers/qmimodem/nas.h"
+#include "drivers/qmimodem/wda.h"
+#include "drivers/qmimodem/wds.h"
+#include "bench-alloc.h"
+
+#define PARAM_ITERATIONS	1000000
+
+struct param_request {
+	const char *name;
+	struct qmi_param *(*build)(void);
+};
+
+static struct qmi_param *build_nas_set_event(void)
+{
+	struct qmi_nas_param_event_signal_strength ss = {
+		.report = 1, .count = 5,
+		.dbm = { -55, -65, -75, -85, -95 },
+	};
+	struct qmi_nas_param_event_rf_info rf = { .report = 1 };
+	struct qmi_param *param;
+
+	param = qmi_param_new();
+	qmi_param_append(param, QMI_NAS_PARAM_REPORT_SIGNAL_STRENGTH,
+						sizeof(ss), &ss);
+	qmi_param_append(param, QMI_NAS_PARAM_REPORT_RF_INFO,
+						sizeof(rf), &rf);
+
+	return param;
+}
+
+static struct qmi_param *build_nas_register_net(void)
+{
+	struct qmi_nas_param_register_manual_info info = {
+		.mcc = GUINT16_TO_LE(234), .mnc = GUINT16_TO_LE(15),
+		.rat = QMI_NAS_NETWORK_RAT_LTE,
+	};
+	struct qmi_param *param;
+
+	param = qmi_param_new_uint8(QMI_NAS_PARAM_REGISTER_ACTION,
+					QMI_NAS_REGISTER_ACTION_MANUAL);
+	qmi_param_append(param, QMI_NAS_PARAM_REGISTER_MANUAL_INFO,
+						sizeof(info), &info);
+
+	return param;
+}
+
+/* What qmi_activate_primary sends for an authenticated context */
+static struct qmi_param *build_wds_start_net(void)
+{
+	static const char apn[] = "internet.operator.example.com";
+	static const char username[] = "web";
+	static const char password[] = "password";
+	struct qmi_param *param;
+
+	param = qmi_param_new();
+	qmi_param_append(param, QMI_WDS_PARAM_APN, strlen(apn), apn);
+	qmi_param_append_uint8(param, QMI_WDS_PARAM_IP_FAMILY, 4);
+	qmi_param_append_uint8(param, QMI_WDS_PARAM_AUTHENTICATION_PREFERENCE,
+					QMI_WDS_AUTHENTICATION_CHAP);
+	qmi_param_append(param, QMI_WDS_PARAM_USERNAME,
+					strlen(username), username);
+	qmi_param_append(param, QMI_WDS_PARAM_PASSWORD,
+					strlen(password), password);
+
+	return param;
+}
+
+static struct qmi_param *build_wds_stop_net(void)
+{
+	return qmi_param_new_uint32(QMI_WDS_PARAM_PKT_HANDLE, 0x12345678);
+}
+
+static struct qmi_param *build_wda_set_data_format(void)
+{
+	struct qmi_wda_endpoint_info endpoint = {
+		.type = GUINT32_TO_LE(QMI_WDA_ENDPOINT_TYPE_HSUSB),
+		.interface = GUINT32_TO_LE(4),
+	};
+	struct qmi_param *param;
+
+	param = qmi_param_new();
+	qmi_param_append_uint32(param, QMI_WDA_LL_PROTOCOL,
+					QMI_WDA_DATA_LINK_PROTOCOL_RAW_IP);
+	qmi_param_append_uint32(param, QMI_WDA_UL_DATA_AGG_PROTOCOL,
+					QMI_WDA_DATA_AGG_PROTOCOL_QMAP);
+	qmi_param_append_uint32(param, QMI_WDA_DL_DATA_AGG_PROTOCOL,
+					QMI_WDA_DATA_AGG_PROTOCOL_QMAP);
+	qmi_param_append_uint32(param, QMI_WDA_DL_DATA_AGG_MAX_DATAGRAMS, 32);
+	qmi_param_append_uint32(param, QMI_WDA_DL_DATA_AGG_MAX_SIZE, 16384);
+	qmi_param_append(param, QMI_WDA_ENDPOINT_INFO,
+					sizeof(endpoint), &endpoint);
+
+	return param;
+}
+
+static const struct param_request requests[] = {
+	{ "nas set event",		build_nas_set_event		},
+	{ "nas register net",		build_nas_register_net		},
+	{ "wds start net",		build_wds_start_net		},
+	{ "wds stop net",		build_wds_stop_net		},
+	{ "wda set data format",	build_wda_set_data_format	},
+};
+
+static void test_build(gconstpointer data)
+{
+	const struct param_request *request = data;
+	unsigned long allocs;
+	gint64 start;
+	gdouble secs;
+	unsigned int i;
+
+	allocs = bench_alloc_count();
+	start = g_get_monotonic_time();
+
+	for (i = 0; i < PARAM_ITERATIONS; i++) {
+		struct qmi_param *param = request->build();
+
+		g_assert(param != NULL);
+		qmi_param_free(param);
+	}
+
+	secs = (gdouble) (g_get_monotonic_time() - start) / G_USEC_PER_SEC;
+	allocs = bench_alloc_count() - allocs;
+
+	g_print("%s: %.0f ns/request, %.2f allocs/request\n", request->name,
+			secs * 1e9 / PARAM_ITERATIONS,
+			(gdouble) allocs / PARAM_ITERATIONS);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int i;
+	char *path;
+
+	bench_alloc_init();
+
+	g_test_init(&argc, &argv, NULL);
+
+	for (i = 0; i < G_N_ELEMENTS(requests); i++) {
+		path = g_strdup_printf("/benchqmiparam/%u", i);
+		g_test_add_data_func(path, &requests[i], test_build);
+		g_free(path);
+	}
+
+	return g_test_run();
+}
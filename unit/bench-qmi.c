@@ -0,0 +1,298 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <sys/resource.h>
+
+#include <glib.h>
+
+#include "drivers/qmimodem/qmi.h"
+#include "drivers/qmimodem/nas.h"
+#include "qmi-test-server.h"
+#include "bench-alloc.h"
+
+#define BENCH_REQUESTS		100000
+#define BENCH_WINDOW		16	/* Requests in flight */
+#define BENCH_INDICATIONS	200000
+#define BENCH_BURST		64	/* Indications queued at a time */
+#define BENCH_LISTENERS		32	/* For other messages */
+#define BENCH_TIMEOUT		60	/* Seconds until a stall fails */
+
+static const unsigned char nas_ss_info[] = {
+	0x01, 0x06, 0x00, 0x01, 0x01, 0x01, 0x02, 0x01, 0x08,
+	0x12, 0x09, 0x00, 0xea, 0x00, 0x0f, 0x00, 0x04, 'T', 'e', 's', 't',
+	0x1d, 0x02, 0x00, 0x34, 0x12,
+};
+
+static const struct qmi_test_response script[] = {
+	{ QMI_SERVICE_NAS, QMI_NAS_GET_SS_INFO, 0,
+				nas_ss_info, sizeof(nas_ss_info) },
+};
+
+struct qmi_bench {
+	GMainLoop *mainloop;
+	struct qmi_test_server *server;
+	struct qmi_device *device;
+	struct qmi_service *nas;
+	guint timeout;
+	gboolean failed;
+	guint sent;
+	guint done;
+	gint64 time_start;
+	gdouble cpu_start;
+	unsigned long allocs_start;
+};
+
+static gdouble cpu_time(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+		usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+static void discover_cb(void *user_data)
+{
+	struct qmi_bench *bench = user_data;
+
+	g_main_loop_quit(bench->mainloop);
+}
+
+static void create_cb(struct qmi_service *service, void *user_data)
+{
+	struct qmi_bench *bench = user_data;
+
+	g_assert(service != NULL);
+
+	bench->nas = qmi_service_ref(service);
+	g_main_loop_quit(bench->mainloop);
+}
+
+static gboolean bench_timeout(gpointer user_data)
+{
+	struct qmi_bench *bench = user_data;
+
+	bench->timeout = 0;
+	bench->failed = TRUE;
+	g_main_loop_quit(bench->mainloop);
+
+	return FALSE;
+}
+
+static void bench_setup(struct qmi_bench *bench)
+{
+	memset(bench, 0, sizeof(*bench));
+
+	bench->mainloop = g_main_loop_new(NULL, FALSE);
+
+	bench->server = qmi_test_server_new(script, G_N_ELEMENTS(script));
+	g_assert(bench->server != NULL);
+
+	bench->device = qmi_device_new(qmi_test_server_get_fd(bench->server));
+	g_assert(bench->device != NULL);
+
+	g_assert(qmi_device_discover(bench->device, discover_cb, bench, NULL));
+	g_main_loop_run(bench->mainloop);
+
+	g_assert(qmi_service_create(bench->device, QMI_SERVICE_NAS,
+						create_cb, bench, NULL));
+	g_main_loop_run(bench->mainloop);
+
+	bench->timeout = g_timeout_add_seconds(BENCH_TIMEOUT,
+						bench_timeout, bench);
+}
+
+static void bench_start(struct qmi_bench *bench)
+{
+	bench->time_start = g_get_monotonic_time();
+	bench->cpu_start = cpu_time();
+	bench->allocs_start = bench_alloc_count();
+}
+
+static void bench_report(struct qmi_bench *bench, const char *name)
+{
+	gdouble secs;
+	gdouble cpu;
+	unsigned long allocs;
+
+	secs = (gdouble) (g_get_monotonic_time() - bench->time_start) /
+							G_USEC_PER_SEC;
+	cpu = cpu_time() - bench->cpu_start;
+	allocs = bench_alloc_count() - bench->allocs_start;
+
+	g_assert(bench->failed == FALSE);
+
+	g_print("%s: %.0f/s, %.2f cpu seconds, %.2f allocs each\n", name,
+			bench->done / secs, cpu,
+			(gdouble) allocs / bench->done);
+}
+
+static void shutdown_cb(void *user_data)
+{
+	struct qmi_bench *bench = user_data;
+
+	qmi_device_unref(bench->device);
+	g_main_loop_quit(bench->mainloop);
+}
+
+static void bench_cleanup(struct qmi_bench *bench)
+{
+	if (bench->timeout > 0)
+		g_source_remove(bench->timeout);
+
+	qmi_service_unref(bench->nas);
+
+	g_assert(qmi_device_shutdown(bench->device, shutdown_cb, bench, NULL));
+	g_main_loop_run(bench->mainloop);
+
+	qmi_test_server_free(bench->server);
+	g_main_loop_unref(bench->mainloop);
+}
+
+static void send_requests(struct qmi_bench *bench);
+
+static void request_cb(struct qmi_result *result, void *user_data)
+{
+	struct qmi_bench *bench = user_data;
+	uint16_t lac;
+
+	g_assert(!qmi_result_set_error(result, NULL));
+
+	/* The last TLV, to have the whole message looked at */
+	g_assert(qmi_result_get_uint16(result,
+				QMI_NAS_RESULT_LOCATION_AREA_CODE, &lac));
+	g_assert(lac == 0x1234);
+
+	if (++bench->done == BENCH_REQUESTS) {
+		g_main_loop_quit(bench->mainloop);
+		return;
+	}
+
+	send_requests(bench);
+}
+
+static void send_requests(struct qmi_bench *bench)
+{
+	while (bench->sent < BENCH_REQUESTS &&
+			bench->sent - bench->done < BENCH_WINDOW) {
+		g_assert(qmi_service_send(bench->nas, QMI_NAS_GET_SS_INFO,
+					NULL, request_cb, bench, NULL) > 0);
+		bench->sent += 1;
+	}
+}
+
+static void test_requests(void)
+{
+	struct qmi_bench bench;
+
+	bench_setup(&bench);
+	bench_start(&bench);
+
+	send_requests(&bench);
+	g_main_loop_run(bench.mainloop);
+
+	g_assert(bench.done == BENCH_REQUESTS);
+	bench_report(&bench, "requests");
+
+	bench_cleanup(&bench);
+}
+
+static void send_indications(struct qmi_bench *bench)
+{
+	unsigned int i;
+
+	for (i = 0; i < BENCH_BURST && bench->sent < BENCH_INDICATIONS; i++) {
+		qmi_test_server_indicate(bench->server, QMI_SERVICE_NAS, 0xff,
+					QMI_NAS_SS_INFO_IND,
+					nas_ss_info, sizeof(nas_ss_info));
+		bench->sent += 1;
+	}
+}
+
+static void indication_cb(struct qmi_result *result, void *user_data)
+{
+	struct qmi_bench *bench = user_data;
+	uint16_t lac;
+
+	g_assert(qmi_result_get_uint16(result,
+				QMI_NAS_RESULT_LOCATION_AREA_CODE, &lac));
+
+	if (++bench->done == BENCH_INDICATIONS) {
+		g_main_loop_quit(bench->mainloop);
+		return;
+	}
+
+	/* Keeps the server's queue short, as with a real modem */
+	if (bench->done == bench->sent)
+		send_indications(bench);
+}
+
+static void listener_cb(struct qmi_result *result, void *user_data)
+{
+	g_assert_not_reached();
+}
+
+/*
+ * Indications are broadcast to a NAS client that listens for many other
+ * messages as well, so dispatch cost should not depend on those
+ */
+static void test_indications(void)
+{
+	struct qmi_bench bench;
+	unsigned int i;
+
+	bench_setup(&bench);
+
+	for (i = 0; i < BENCH_LISTENERS; i++)
+		g_assert(qmi_service_register(bench.nas, 0x1000 + i,
+					listener_cb, &bench, NULL) > 0);
+
+	g_assert(qmi_service_register(bench.nas, QMI_NAS_SS_INFO_IND,
+					indication_cb, &bench, NULL) > 0);
+
+	bench_start(&bench);
+
+	send_indications(&bench);
+	g_main_loop_run(bench.mainloop);
+
+	g_assert(bench.done == BENCH_INDICATIONS);
+	bench_report(&bench, "indications");
+
+	bench_cleanup(&bench);
+}
+
+int main(int argc, char **argv)
+{
+	bench_alloc_init();
+
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/benchqmi/requests", test_requests);
+	g_test_add_func("/benchqmi/indications", test_indications);
+
+	return g_test_run();
+}
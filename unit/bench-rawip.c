@@ -0,0 +1,290 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#include <glib.h>
+
+#include "gatrawip.h"
+
+#define RAWIP_BYTES	(32 * 1024 * 1024)	/* Per direction */
+#define RAWIP_CHUNK	(64 * 1024)
+#define RAWIP_TIMEOUT	60	/* Seconds before a stalled run is failed */
+
+/*
+ * One direction of traffic: written into one end of a socketpair and
+ * expected to come out, unchanged, at the other socketpair
+ */
+struct rawip_flow {
+	struct rawip_bench *bench;
+	int write_fd;
+	int read_fd;
+	gsize written;
+	gsize read;
+	guint write_watch;
+	guint read_watch;
+};
+
+struct rawip_bench {
+	GMainLoop *mainloop;
+	GAtRawIP *rawip;
+	struct rawip_flow rx;		/* Modem to tun */
+	struct rawip_flow tx;		/* Tun to modem */
+	guint finished;
+	guint timeout;
+	gboolean timed_out;
+};
+
+static guint8 pattern[RAWIP_CHUNK + 256];
+
+static gboolean flow_write(GIOChannel *channel, GIOCondition cond,
+				gpointer user_data)
+{
+	struct rawip_flow *flow = user_data;
+	gsize len = MIN(RAWIP_BYTES - flow->written, RAWIP_CHUNK);
+	ssize_t written;
+
+	if (cond & (G_IO_HUP | G_IO_ERR | G_IO_NVAL))
+		goto done;
+
+	written = write(flow->write_fd, pattern + flow->written % 256, len);
+	if (written < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return TRUE;
+
+		goto done;
+	}
+
+	flow->written += written;
+
+	if (flow->written < RAWIP_BYTES)
+		return TRUE;
+
+done:
+	flow->write_watch = 0;
+	return FALSE;
+}
+
+static gboolean flow_read(GIOChannel *channel, GIOCondition cond,
+				gpointer user_data)
+{
+	struct rawip_flow *flow = user_data;
+	guint8 buf[RAWIP_CHUNK];
+	ssize_t len;
+
+	if (cond & G_IO_NVAL)
+		goto done;
+
+	len = read(flow->read_fd, buf, sizeof(buf));
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return TRUE;
+
+	if (len <= 0)
+		goto done;
+
+	g_assert(memcmp(buf, pattern + flow->read % 256, len) == 0);
+
+	flow->read += len;
+
+	if (flow->read < RAWIP_BYTES)
+		return TRUE;
+
+done:
+	flow->read_watch = 0;
+
+	if (++flow->bench->finished == 2)
+		g_main_loop_quit(flow->bench->mainloop);
+
+	return FALSE;
+}
+
+static gboolean bench_timeout(gpointer user_data)
+{
+	struct rawip_bench *bench = user_data;
+
+	bench->timeout = 0;
+	bench->timed_out = TRUE;
+	g_main_loop_quit(bench->mainloop);
+
+	return FALSE;
+}
+
+static void flow_start(struct rawip_bench *bench, struct rawip_flow *flow,
+				int write_fd, int read_fd)
+{
+	GIOChannel *channel;
+
+	flow->bench = bench;
+	flow->write_fd = write_fd;
+	flow->read_fd = read_fd;
+
+	fcntl(write_fd, F_SETFL, fcntl(write_fd, F_GETFL) | O_NONBLOCK);
+	fcntl(read_fd, F_SETFL, fcntl(read_fd, F_GETFL) | O_NONBLOCK);
+
+	channel = g_io_channel_unix_new(write_fd);
+	flow->write_watch = g_io_add_watch(channel,
+				G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				flow_write, flow);
+	g_io_channel_unref(channel);
+
+	channel = g_io_channel_unix_new(read_fd);
+	flow->read_watch = g_io_add_watch(channel,
+				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				flow_read, flow);
+	g_io_channel_unref(channel);
+}
+
+static void flow_stop(struct rawip_flow *flow)
+{
+	if (flow->write_watch > 0)
+		g_source_remove(flow->write_watch);
+
+	if (flow->read_watch > 0)
+		g_source_remove(flow->read_watch);
+}
+
+static gdouble cpu_time(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+		usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+}
+
+/*
+ * Shuffle RAWIP_BYTES each way between a socketpair standing in for the
+ * modem and another one standing in for the tun interface
+ */
+static void rawip_bench_run(gboolean use_splice, GAtRawIPStats *stats)
+{
+	struct rawip_bench bench;
+	GIOChannel *channel;
+	int modem[2];
+	int tun[2];
+	gint64 start;
+	gdouble cpu;
+	gdouble elapsed;
+
+	memset(&bench, 0, sizeof(bench));
+
+	g_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, modem) == 0);
+	g_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, tun) == 0);
+
+	channel = g_io_channel_unix_new(modem[0]);
+	bench.rawip = g_at_rawip_new(channel);
+	g_io_channel_unref(channel);
+	g_assert(bench.rawip != NULL);
+
+	g_at_rawip_set_splice_enabled(bench.rawip, use_splice);
+	g_at_rawip_open_full(bench.rawip, tun[0]);
+
+	bench.mainloop = g_main_loop_new(NULL, FALSE);
+	bench.timeout = g_timeout_add_seconds(RAWIP_TIMEOUT,
+						bench_timeout, &bench);
+
+	flow_start(&bench, &bench.rx, modem[1], tun[1]);
+	flow_start(&bench, &bench.tx, tun[1], modem[1]);
+
+	start = g_get_monotonic_time();
+	cpu = cpu_time();
+
+	g_main_loop_run(bench.mainloop);
+
+	elapsed = (g_get_monotonic_time() - start) / 1e6;
+	cpu = cpu_time() - cpu;
+
+	g_assert(bench.timed_out == FALSE);
+	g_assert(bench.rx.read == RAWIP_BYTES);
+	g_assert(bench.tx.read == RAWIP_BYTES);
+
+	g_assert(g_at_rawip_get_stats(bench.rawip, stats) == TRUE);
+
+	g_print("%s: %.0f Mbytes/s, %.2f cpu seconds per Gbyte, "
+			"%" G_GUINT64_FORMAT " bytes copied, "
+			"%" G_GUINT64_FORMAT " bytes spliced\n",
+			use_splice ? "splice" : "copy",
+			2.0 * RAWIP_BYTES / elapsed / 1e6,
+			cpu / (2.0 * RAWIP_BYTES / 1e9),
+			stats->copied, stats->spliced);
+
+	flow_stop(&bench.rx);
+	flow_stop(&bench.tx);
+
+	if (bench.timeout > 0)
+		g_source_remove(bench.timeout);
+
+	g_at_rawip_shutdown(bench.rawip);
+	g_at_rawip_unref(bench.rawip);
+
+	close(modem[1]);
+	close(tun[1]);
+
+	g_main_loop_unref(bench.mainloop);
+}
+
+static void test_copy(void)
+{
+	GAtRawIPStats stats;
+
+	rawip_bench_run(FALSE, &stats);
+
+	g_assert(stats.copied == 2 * RAWIP_BYTES);
+	g_assert(stats.spliced == 0);
+}
+
+static void test_splice(void)
+{
+	GAtRawIPStats stats;
+
+	rawip_bench_run(TRUE, &stats);
+
+	/* Unix sockets support splice both ways */
+	g_assert(stats.rx_spliced == TRUE);
+	g_assert(stats.tx_spliced == TRUE);
+	g_assert(stats.copied == 0);
+	g_assert(stats.spliced == 2 * RAWIP_BYTES);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(pattern); i++)
+		pattern[i] = i;
+
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/benchrawip/copy", test_copy);
+	g_test_add_func("/benchrawip/splice", test_splice);
+
+	return g_test_run();
+}
@@ -0,0 +1,266 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "bench-alloc.h"
+#include "bench-replay.h"
+
+#define REPLAY_TIMEOUT	60	/* Seconds before a stalled replay is failed */
+
+struct bench_replay {
+	GMainLoop *mainloop;
+	GByteArray *stream;
+	unsigned int rounds;		/* Accounted rounds */
+	unsigned int written;		/* Rounds written so far */
+	unsigned int round;		/* Rounds completed by the reader */
+	gsize offset;			/* Write offset within the stream */
+	int reader_fd;
+	int writer_fd;
+	GIOChannel *writer;
+	guint write_watch;
+	guint timeout;
+	gboolean timed_out;
+	gint64 last_write;		/* Time of the most recent write */
+	gint64 time_start;
+	gint64 time;
+	unsigned long allocs_start;
+	unsigned long allocs;
+	unsigned long units;
+	unsigned long callbacks;
+	gint64 latency_total;
+	gint64 latency_max;
+};
+
+GByteArray *bench_capture_load(const char *filename)
+{
+	GByteArray *stream;
+	gchar *contents;
+	gsize len;
+	gsize pos = 0;
+
+	if (g_file_get_contents(filename, &contents, &len, NULL) == FALSE)
+		return NULL;
+
+	stream = g_byte_array_new();
+
+	/*
+	 * Records are laid out as written by hdlc_record: 0x07, a 32-bit
+	 * timestamp, the direction (0x02 for received data), a 16-bit
+	 * length and the data itself.  Only what the modem sent is kept.
+	 */
+	while (pos + 8 <= len) {
+		const guint8 *record = (const guint8 *) contents + pos;
+		guint16 size = (record[6] << 8) | record[7];
+
+		if (record[0] != 0x07 || pos + 8 + size > len)
+			break;
+
+		if (record[5] == 0x02)
+			g_byte_array_append(stream, record + 8, size);
+
+		pos += 8 + size;
+	}
+
+	g_free(contents);
+
+	if (stream->len == 0) {
+		g_byte_array_free(stream, TRUE);
+		return NULL;
+	}
+
+	return stream;
+}
+
+static gboolean replay_write(GIOChannel *channel, GIOCondition cond,
+				gpointer user_data)
+{
+	struct bench_replay *replay = user_data;
+	ssize_t written;
+
+	if (cond & (G_IO_HUP | G_IO_ERR | G_IO_NVAL))
+		return FALSE;
+
+	written = write(replay->writer_fd,
+			replay->stream->data + replay->offset,
+			replay->stream->len - replay->offset);
+	if (written < 0)
+		return errno == EAGAIN || errno == EINTR;
+
+	replay->last_write = g_get_monotonic_time();
+	replay->offset += written;
+
+	if (replay->offset < replay->stream->len)
+		return TRUE;
+
+	replay->offset = 0;
+
+	/* Account for the warmup round */
+	return ++replay->written <= replay->rounds;
+}
+
+static void replay_write_destroy(gpointer user_data)
+{
+	struct bench_replay *replay = user_data;
+
+	replay->write_watch = 0;
+}
+
+static gboolean replay_timeout(gpointer user_data)
+{
+	struct bench_replay *replay = user_data;
+
+	replay->timeout = 0;
+	replay->timed_out = TRUE;
+
+	g_main_loop_quit(replay->mainloop);
+
+	return FALSE;
+}
+
+struct bench_replay *bench_replay_new(GByteArray *stream,
+					unsigned int rounds)
+{
+	struct bench_replay *replay;
+	int sv[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		return NULL;
+
+	replay = g_new0(struct bench_replay, 1);
+
+	replay->mainloop = g_main_loop_new(NULL, FALSE);
+	replay->stream = g_byte_array_ref(stream);
+	replay->rounds = rounds;
+	replay->reader_fd = sv[0];
+	replay->writer_fd = sv[1];
+
+	fcntl(replay->writer_fd, F_SETFL,
+			fcntl(replay->writer_fd, F_GETFL) | O_NONBLOCK);
+
+	replay->writer = g_io_channel_unix_new(replay->writer_fd);
+
+	return replay;
+}
+
+void bench_replay_free(struct bench_replay *replay)
+{
+	if (replay->write_watch > 0)
+		g_source_remove(replay->write_watch);
+
+	if (replay->timeout > 0)
+		g_source_remove(replay->timeout);
+
+	g_io_channel_unref(replay->writer);
+	close(replay->writer_fd);
+
+	g_byte_array_unref(replay->stream);
+	g_main_loop_unref(replay->mainloop);
+
+	g_free(replay);
+}
+
+int bench_replay_get_fd(struct bench_replay *replay)
+{
+	return replay->reader_fd;
+}
+
+void bench_replay_run(struct bench_replay *replay)
+{
+	replay->write_watch = g_io_add_watch_full(replay->writer,
+				G_PRIORITY_DEFAULT,
+				G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				replay_write, replay, replay_write_destroy);
+
+	replay->timeout = g_timeout_add_seconds(REPLAY_TIMEOUT,
+						replay_timeout, replay);
+
+	g_main_loop_run(replay->mainloop);
+
+	g_assert(replay->timed_out == FALSE);
+}
+
+void bench_replay_delivered(struct bench_replay *replay, unsigned int units)
+{
+	gint64 latency = g_get_monotonic_time() - replay->last_write;
+
+	replay->units += units;
+	replay->callbacks += 1;
+	replay->latency_total += latency;
+
+	if (latency > replay->latency_max)
+		replay->latency_max = latency;
+}
+
+void bench_replay_round_done(struct bench_replay *replay)
+{
+	if (replay->round == 0) {
+		replay->time_start = g_get_monotonic_time();
+		replay->allocs_start = bench_alloc_count();
+		replay->units = 0;
+		replay->callbacks = 0;
+		replay->latency_total = 0;
+		replay->latency_max = 0;
+	}
+
+	if (++replay->round <= replay->rounds)
+		return;
+
+	replay->time = g_get_monotonic_time() - replay->time_start;
+	replay->allocs = bench_alloc_count() - replay->allocs_start;
+
+	g_main_loop_quit(replay->mainloop);
+}
+
+unsigned long bench_replay_get_units(struct bench_replay *replay)
+{
+	return replay->units;
+}
+
+unsigned long bench_replay_get_allocs(struct bench_replay *replay)
+{
+	return replay->allocs;
+}
+
+void bench_replay_report(struct bench_replay *replay, const char *name,
+							const char *unit)
+{
+	double bytes = (double) replay->stream->len * replay->rounds;
+	double secs = (double) MAX(replay->time, 1) / G_USEC_PER_SEC;
+	unsigned long callbacks = MAX(replay->callbacks, 1);
+
+	g_print("%s: %u rounds of %u bytes, %.0f bytes/s, %.0f %s/s, "
+			"%.2f allocs/%s, %.1f us/callback (max %.1f us)\n",
+			name, replay->rounds, replay->stream->len,
+			bytes / secs, replay->units / secs, unit,
+			(double) replay->allocs / MAX(replay->units, 1), unit,
+			(double) replay->latency_total / callbacks,
+			(double) replay->latency_max);
+}
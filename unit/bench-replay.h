@@ -0,0 +1,49 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * Replay harness shared by the benchmarks.  A stream of bytes, either
+ * synthetic or loaded from a capture written by g_at_hdlc_set_recording,
+ * is pushed through a socketpair as fast as the reader drains it.  The
+ * stream is followed by a benchmark specific end of round marker, which
+ * the reader reports back with bench_replay_round_done.  The first round
+ * warms up the code under test and is not accounted.
+ */
+
+struct bench_replay;
+
+GByteArray *bench_capture_load(const char *filename);
+
+struct bench_replay *bench_replay_new(GByteArray *stream,
+					unsigned int rounds);
+void bench_replay_free(struct bench_replay *replay);
+
+int bench_replay_get_fd(struct bench_replay *replay);
+
+void bench_replay_run(struct bench_replay *replay);
+void bench_replay_delivered(struct bench_replay *replay, unsigned int units);
+void bench_replay_round_done(struct bench_replay *replay);
+
+unsigned long bench_replay_get_units(struct bench_replay *replay);
+unsigned long bench_replay_get_allocs(struct bench_replay *replay);
+
+void bench_replay_report(struct bench_replay *replay, const char *name,
+							const char *unit);
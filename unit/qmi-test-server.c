@@ -0,0 +1,469 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "drivers/qmimodem/qmi.h"
+#include "drivers/qmimodem/ctl.h"
+
+#include "qmi-test-server.h"
+
+#define MUX_HDR_SIZE		6
+#define CONTROL_HDR_SIZE	2
+#define SERVICE_HDR_SIZE	3
+#define MESSAGE_HDR_SIZE	4
+#define TLV_HDR_SIZE		3
+#define RESULT_TLV_SIZE		(TLV_HDR_SIZE + 4)
+
+/* Room for a partial frame plus the largest possible one */
+#define RX_BUF_SIZE		(2 * (0xffff + 1))
+
+#define ERROR_INVALID_QMI_CMD	0x0047
+
+struct qmi_test_server {
+	int fds[2];		/* The first one is for qmi_device_new */
+	guint read_watch;
+	guint write_watch;
+	uint8_t *rx_buf;
+	size_t rx_len;
+	GByteArray *tx_buf;
+	size_t tx_sent;
+	size_t chunk_size;
+	const struct qmi_test_response *script;
+	unsigned int count;
+	uint8_t last_client[256];
+	unsigned int clients;
+	qmi_test_request_func_t request_func;
+	void *user_data;
+};
+
+static const struct {
+	uint8_t type;
+	uint16_t major;
+	uint16_t minor;
+} versions[] = {
+	{ QMI_SERVICE_CONTROL,	1, 5	},
+	{ QMI_SERVICE_WDS,	1, 10	},
+	{ QMI_SERVICE_DMS,	1, 3	},
+	{ QMI_SERVICE_NAS,	1, 8	},
+	{ QMI_SERVICE_WMS,	1, 2	},
+	{ QMI_SERVICE_UIM,	1, 4	},
+	{ QMI_SERVICE_WDA,	1, 1	},
+};
+
+static const char version_str[] = "qmi-test-server";
+
+static gboolean can_write_data(GIOChannel *channel, GIOCondition cond,
+							gpointer user_data)
+{
+	struct qmi_test_server *server = user_data;
+	size_t len;
+	ssize_t written;
+
+	if (cond & (G_IO_NVAL | G_IO_HUP | G_IO_ERR))
+		goto stop;
+
+	len = server->tx_buf->len - server->tx_sent;
+
+	if (server->chunk_size && len > server->chunk_size)
+		len = server->chunk_size;
+
+	written = write(server->fds[1], server->tx_buf->data + server->tx_sent,
+									len);
+	if (written < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return TRUE;
+
+		goto stop;
+	}
+
+	server->tx_sent += written;
+
+	if (server->tx_sent < server->tx_buf->len)
+		return TRUE;
+
+	g_byte_array_set_size(server->tx_buf, 0);
+	server->tx_sent = 0;
+
+stop:
+	server->write_watch = 0;
+	return FALSE;
+}
+
+static void queue_message(struct qmi_test_server *server, uint8_t service,
+				uint8_t client, bool response, uint16_t tid,
+				uint16_t message, uint16_t error,
+				const void *data, uint16_t length)
+{
+	uint8_t hdr[MUX_HDR_SIZE + SERVICE_HDR_SIZE + MESSAGE_HDR_SIZE +
+							RESULT_TLV_SIZE];
+	uint16_t tlv_len = length + (response ? RESULT_TLV_SIZE : 0);
+	size_t hdr_len = 0;
+	size_t frame_len;
+	GIOChannel *channel;
+
+	if (service == QMI_SERVICE_CONTROL)
+		frame_len = MUX_HDR_SIZE + CONTROL_HDR_SIZE;
+	else
+		frame_len = MUX_HDR_SIZE + SERVICE_HDR_SIZE;
+
+	frame_len += MESSAGE_HDR_SIZE + tlv_len;
+
+	hdr[hdr_len++] = 0x01;
+	hdr[hdr_len++] = (frame_len - 1) & 0xff;
+	hdr[hdr_len++] = (frame_len - 1) >> 8;
+	hdr[hdr_len++] = 0x80;
+	hdr[hdr_len++] = service;
+	hdr[hdr_len++] = client;
+
+	if (service == QMI_SERVICE_CONTROL) {
+		hdr[hdr_len++] = response ? 0x01 : 0x02;
+		hdr[hdr_len++] = tid;
+	} else {
+		hdr[hdr_len++] = response ? 0x02 : 0x04;
+		hdr[hdr_len++] = tid & 0xff;
+		hdr[hdr_len++] = tid >> 8;
+	}
+
+	hdr[hdr_len++] = message & 0xff;
+	hdr[hdr_len++] = message >> 8;
+	hdr[hdr_len++] = tlv_len & 0xff;
+	hdr[hdr_len++] = tlv_len >> 8;
+
+	if (response) {
+		hdr[hdr_len++] = 0x02;
+		hdr[hdr_len++] = 4;
+		hdr[hdr_len++] = 0;
+		hdr[hdr_len++] = error ? 0x01 : 0x00;
+		hdr[hdr_len++] = 0x00;
+		hdr[hdr_len++] = error & 0xff;
+		hdr[hdr_len++] = error >> 8;
+	}
+
+	g_byte_array_append(server->tx_buf, hdr, hdr_len);
+
+	if (length > 0)
+		g_byte_array_append(server->tx_buf, data, length);
+
+	if (server->write_watch > 0)
+		return;
+
+	channel = g_io_channel_unix_new(server->fds[1]);
+	server->write_watch = g_io_add_watch(channel,
+				G_IO_OUT | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				can_write_data, server);
+	g_io_channel_unref(channel);
+}
+
+static const uint8_t *tlv_find(const uint8_t *data, uint16_t length,
+					uint8_t type, uint16_t *tlv_len)
+{
+	uint16_t offset = 0;
+
+	while (offset + TLV_HDR_SIZE <= length) {
+		uint16_t len = data[offset + 1] | data[offset + 2] << 8;
+
+		if (offset + TLV_HDR_SIZE + len > length)
+			break;
+
+		if (data[offset] == type) {
+			*tlv_len = len;
+			return data + offset + TLV_HDR_SIZE;
+		}
+
+		offset += TLV_HDR_SIZE + len;
+	}
+
+	return NULL;
+}
+
+static void handle_version_info(struct qmi_test_server *server, uint8_t tid)
+{
+	uint8_t buf[TLV_HDR_SIZE + 1 + G_N_ELEMENTS(versions) * 5 +
+				TLV_HDR_SIZE + 1 + sizeof(version_str)];
+	uint8_t count = G_N_ELEMENTS(versions);
+	size_t len = 0;
+	unsigned int i;
+
+	buf[len++] = 0x01;
+	buf[len++] = (1 + count * 5) & 0xff;
+	buf[len++] = 0;
+	buf[len++] = count;
+
+	for (i = 0; i < count; i++) {
+		buf[len++] = versions[i].type;
+		buf[len++] = versions[i].major & 0xff;
+		buf[len++] = versions[i].major >> 8;
+		buf[len++] = versions[i].minor & 0xff;
+		buf[len++] = versions[i].minor >> 8;
+	}
+
+	buf[len++] = 0x10;
+	buf[len++] = 1 + strlen(version_str);
+	buf[len++] = 0;
+	buf[len++] = strlen(version_str);
+	memcpy(buf + len, version_str, strlen(version_str));
+	len += strlen(version_str);
+
+	queue_message(server, QMI_SERVICE_CONTROL, 0x00, true, tid,
+				QMI_CTL_GET_VERSION_INFO, 0, buf, len);
+}
+
+static bool handle_control(struct qmi_test_server *server, uint8_t tid,
+				uint16_t message, const uint8_t *data,
+				uint16_t length)
+{
+	const uint8_t *value;
+	uint8_t buf[TLV_HDR_SIZE + 2];
+	uint16_t len;
+
+	switch (message) {
+	case QMI_CTL_GET_VERSION_INFO:
+		handle_version_info(server, tid);
+		return true;
+	case QMI_CTL_GET_CLIENT_ID:
+		value = tlv_find(data, length, 0x01, &len);
+		if (!value || len != 1)
+			return false;
+
+		/* 0x00 belongs to control and 0xff is broadcast */
+		if (++server->last_client[value[0]] == 0xff)
+			server->last_client[value[0]] = 0x01;
+
+		server->clients += 1;
+
+		buf[0] = 0x01;
+		buf[1] = 2;
+		buf[2] = 0;
+		buf[3] = value[0];
+		buf[4] = server->last_client[value[0]];
+		break;
+	case QMI_CTL_RELEASE_CLIENT_ID:
+		value = tlv_find(data, length, 0x01, &len);
+		if (!value || len != 2)
+			return false;
+
+		server->clients -= 1;
+
+		buf[0] = 0x01;
+		buf[1] = 2;
+		buf[2] = 0;
+		buf[3] = value[0];
+		buf[4] = value[1];
+		break;
+	default:
+		return false;
+	}
+
+	queue_message(server, QMI_SERVICE_CONTROL, 0x00, true, tid,
+					message, 0, buf, sizeof(buf));
+
+	return true;
+}
+
+static void handle_frame(struct qmi_test_server *server,
+				const uint8_t *frame, size_t size)
+{
+	uint8_t service = frame[4];
+	uint8_t client = frame[5];
+	const uint8_t *msg;
+	uint16_t tid;
+	uint16_t message;
+	uint16_t length;
+	unsigned int i;
+
+	if (service == QMI_SERVICE_CONTROL) {
+		tid = frame[MUX_HDR_SIZE + 1];
+		msg = frame + MUX_HDR_SIZE + CONTROL_HDR_SIZE;
+	} else {
+		tid = frame[MUX_HDR_SIZE + 1] | frame[MUX_HDR_SIZE + 2] << 8;
+		msg = frame + MUX_HDR_SIZE + SERVICE_HDR_SIZE;
+	}
+
+	message = msg[0] | msg[1] << 8;
+	length = msg[2] | msg[3] << 8;
+
+	g_assert(msg + MESSAGE_HDR_SIZE + length <= frame + size);
+
+	if (server->request_func)
+		server->request_func(service, client, message,
+					msg + MESSAGE_HDR_SIZE, length,
+					server->user_data);
+
+	for (i = 0; i < server->count; i++) {
+		const struct qmi_test_response *rsp = &server->script[i];
+
+		if (rsp->service != service || rsp->message != message)
+			continue;
+
+		if (rsp->error == QMI_TEST_NO_RESPONSE)
+			return;
+
+		queue_message(server, service, client, true, tid, message,
+					rsp->error, rsp->data, rsp->size);
+		return;
+	}
+
+	if (service == QMI_SERVICE_CONTROL &&
+			handle_control(server, tid, message,
+					msg + MESSAGE_HDR_SIZE, length))
+		return;
+
+	queue_message(server, service, client, true, tid, message,
+					ERROR_INVALID_QMI_CMD, NULL, 0);
+}
+
+static gboolean received_data(GIOChannel *channel, GIOCondition cond,
+							gpointer user_data)
+{
+	struct qmi_test_server *server = user_data;
+	ssize_t bytes_read;
+	size_t offset = 0;
+
+	if (cond & (G_IO_NVAL | G_IO_HUP | G_IO_ERR))
+		goto stop;
+
+	bytes_read = read(server->fds[1], server->rx_buf + server->rx_len,
+					RX_BUF_SIZE - server->rx_len);
+	if (bytes_read < 0 && (errno == EAGAIN || errno == EINTR))
+		return TRUE;
+
+	if (bytes_read <= 0)
+		goto stop;
+
+	server->rx_len += bytes_read;
+
+	while (server->rx_len - offset >= MUX_HDR_SIZE) {
+		const uint8_t *frame = server->rx_buf + offset;
+		size_t size = (frame[1] | frame[2] << 8) + 1;
+
+		/* qmi.c never sends anything but whole, valid frames */
+		g_assert(frame[0] == 0x01);
+
+		if (server->rx_len - offset < size)
+			break;
+
+		handle_frame(server, frame, size);
+		offset += size;
+	}
+
+	memmove(server->rx_buf, server->rx_buf + offset,
+					server->rx_len - offset);
+	server->rx_len -= offset;
+
+	return TRUE;
+
+stop:
+	server->read_watch = 0;
+	return FALSE;
+}
+
+struct qmi_test_server *qmi_test_server_new(
+				const struct qmi_test_response *script,
+				unsigned int count)
+{
+	struct qmi_test_server *server;
+	GIOChannel *channel;
+
+	server = g_new0(struct qmi_test_server, 1);
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, server->fds) < 0) {
+		g_free(server);
+		return NULL;
+	}
+
+	fcntl(server->fds[1], F_SETFL, O_NONBLOCK);
+
+	server->rx_buf = g_malloc(RX_BUF_SIZE);
+	server->tx_buf = g_byte_array_new();
+	server->script = script;
+	server->count = count;
+
+	channel = g_io_channel_unix_new(server->fds[1]);
+	server->read_watch = g_io_add_watch(channel,
+				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				received_data, server);
+	g_io_channel_unref(channel);
+
+	return server;
+}
+
+void qmi_test_server_free(struct qmi_test_server *server)
+{
+	if (!server)
+		return;
+
+	if (server->read_watch > 0)
+		g_source_remove(server->read_watch);
+
+	if (server->write_watch > 0)
+		g_source_remove(server->write_watch);
+
+	close(server->fds[0]);
+	close(server->fds[1]);
+
+	g_byte_array_free(server->tx_buf, TRUE);
+	g_free(server->rx_buf);
+	g_free(server);
+}
+
+int qmi_test_server_get_fd(struct qmi_test_server *server)
+{
+	return server->fds[0];
+}
+
+void qmi_test_server_set_request_func(struct qmi_test_server *server,
+					qmi_test_request_func_t func,
+					void *user_data)
+{
+	server->request_func = func;
+	server->user_data = user_data;
+}
+
+void qmi_test_server_set_chunk_size(struct qmi_test_server *server,
+						size_t size)
+{
+	server->chunk_size = size;
+}
+
+void qmi_test_server_indicate(struct qmi_test_server *server,
+				uint8_t service, uint8_t client,
+				uint16_t message, const void *data,
+				uint16_t length)
+{
+	queue_message(server, service, client, false, 0, message, 0,
+							data, length);
+}
+
+unsigned int qmi_test_server_get_clients(struct qmi_test_server *server)
+{
+	return server->clients;
+}
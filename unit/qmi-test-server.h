@@ -0,0 +1,69 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+/*
+ * A QMI modem on the far end of a socketpair.  The control service is
+ * built in: version info lists CTL, WDS, DMS, NAS, WMS, UIM and WDA,
+ * and client ids are handed out and released.  Requests to the other
+ * services are answered from a script, anything not in the script gets
+ * an INVALID_QMI_CMD error.
+ */
+
+struct qmi_test_server;
+
+/* As the error of a response, leaves the request unanswered */
+#define QMI_TEST_NO_RESPONSE	0xffff
+
+struct qmi_test_response {
+	uint8_t service;
+	uint16_t message;
+	uint16_t error;			/* In the result TLV, 0 for success */
+	const unsigned char *data;	/* TLVs following the result TLV */
+	size_t size;
+};
+
+typedef void (*qmi_test_request_func_t)(uint8_t service, uint8_t client,
+					uint16_t message, const void *data,
+					uint16_t length, void *user_data);
+
+struct qmi_test_server *qmi_test_server_new(
+				const struct qmi_test_response *script,
+				unsigned int count);
+void qmi_test_server_free(struct qmi_test_server *server);
+
+/* The end to hand to qmi_device_new, owned by the server */
+int qmi_test_server_get_fd(struct qmi_test_server *server);
+
+/* Called for every request, before it is answered */
+void qmi_test_server_set_request_func(struct qmi_test_server *server,
+					qmi_test_request_func_t func,
+					void *user_data);
+
+/* Split everything sent into writes of at most size bytes, 0 to not */
+void qmi_test_server_set_chunk_size(struct qmi_test_server *server,
+						size_t size);
+
+void qmi_test_server_indicate(struct qmi_test_server *server,
+				uint8_t service, uint8_t client,
+				uint16_t message, const void *data,
+				uint16_t length);
+
+unsigned int qmi_test_server_get_clients(struct qmi_test_server *server);
@@ -0,0 +1,239 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "gatchat.h"
+
+#define CMD_TIMEOUT	100	/* ms */
+
+static const char *none_prefix[] = { NULL };
+
+/* A GAtChat on one end of a socketpair, the test plays the modem */
+struct test_data {
+	GMainLoop *mainloop;
+	GAtChat *chat;
+	int fd[2];
+	guint timeout;
+	guint results;
+	gboolean ok;
+	char *final;
+};
+
+static void test_setup(struct test_data *data)
+{
+	GIOChannel *channel;
+	GAtSyntax *syntax;
+
+	memset(data, 0, sizeof(*data));
+
+	data->mainloop = g_main_loop_new(NULL, FALSE);
+
+	g_assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0,
+							data->fd) == 0);
+
+	channel = g_io_channel_unix_new(data->fd[1]);
+	g_assert(channel != NULL);
+
+	g_io_channel_set_close_on_unref(channel, TRUE);
+
+	syntax = g_at_syntax_new_gsm_permissive();
+	data->chat = g_at_chat_new(channel, syntax);
+	g_assert(data->chat != NULL);
+
+	g_at_syntax_unref(syntax);
+	g_io_channel_unref(channel);
+}
+
+static void test_cleanup(struct test_data *data)
+{
+	g_at_chat_unref(data->chat);
+
+	close(data->fd[0]);
+
+	g_free(data->final);
+	g_main_loop_unref(data->mainloop);
+}
+
+/* Everything goes over the socketpair, so idle means done */
+static void test_run(void)
+{
+	while (g_main_context_iteration(NULL, FALSE))
+		;
+}
+
+static gboolean timeout_cb(gpointer user_data)
+{
+	struct test_data *data = user_data;
+
+	data->timeout = 0;
+	g_main_loop_quit(data->mainloop);
+
+	return FALSE;
+}
+
+/* Runs for ms, or until a result comes in */
+static void test_wait(struct test_data *data, guint ms)
+{
+	data->timeout = g_timeout_add(ms, timeout_cb, data);
+
+	g_main_loop_run(data->mainloop);
+
+	if (data->timeout > 0) {
+		g_source_remove(data->timeout);
+		data->timeout = 0;
+	}
+}
+
+static void test_write(int fd, const char *str)
+{
+	size_t len = strlen(str);
+
+	g_assert(write(fd, str, len) == (ssize_t) len);
+}
+
+static void test_read(int fd, const char *expected)
+{
+	char buf[64];
+	ssize_t n;
+
+	n = read(fd, buf, sizeof(buf));
+	if (expected == NULL) {
+		g_assert(n < 0 && errno == EAGAIN);
+		return;
+	}
+
+	g_assert(n == (ssize_t) strlen(expected));
+	g_assert(memcmp(buf, expected, n) == 0);
+}
+
+static void result_cb(gboolean ok, GAtResult *result, gpointer user_data)
+{
+	struct test_data *data = user_data;
+
+	data->results += 1;
+	data->ok = ok;
+
+	g_free(data->final);
+	data->final = g_strdup(g_at_result_final_response(result));
+
+	g_main_loop_quit(data->mainloop);
+}
+
+static void test_timeout(void)
+{
+	struct test_data data;
+	GAtChatLatency latency;
+
+	test_setup(&data);
+
+	g_assert(g_at_chat_send_with_timeout(data.chat, "AT+CFOO",
+					none_prefix, CMD_TIMEOUT,
+					result_cb, &data, NULL) > 0);
+	g_assert(g_at_chat_send(data.chat, "AT+CBAR", none_prefix,
+					result_cb, &data, NULL) > 0);
+	test_run();
+
+	test_read(data.fd[0], "AT+CFOO\r");
+
+	test_wait(&data, 10 * CMD_TIMEOUT);
+
+	g_assert(data.results == 1);
+	g_assert(data.ok == FALSE);
+	g_assert_cmpstr(data.final, ==, "ERROR");
+
+	g_assert(g_at_chat_get_latency(data.chat, &latency));
+	g_assert(latency.timeouts == 1);
+
+	/* Held back while the final of AT+CFOO may still come */
+	test_run();
+
+	test_read(data.fd[0], NULL);
+
+	/* Late, and not taken for the final of AT+CBAR */
+	test_write(data.fd[0], "\r\nOK\r\n");
+	test_run();
+
+	g_assert(data.results == 1);
+	test_read(data.fd[0], "AT+CBAR\r");
+
+	test_write(data.fd[0], "\r\nOK\r\n");
+	test_run();
+
+	g_assert(data.results == 2);
+	g_assert(data.ok == TRUE);
+	g_assert_cmpstr(data.final, ==, "OK");
+
+	test_cleanup(&data);
+}
+
+static void test_timeout_no_final(void)
+{
+	struct test_data data;
+
+	test_setup(&data);
+
+	g_assert(g_at_chat_send_with_timeout(data.chat, "AT+CFOO",
+					none_prefix, CMD_TIMEOUT,
+					result_cb, &data, NULL) > 0);
+	g_assert(g_at_chat_send(data.chat, "AT+CBAR", none_prefix,
+					result_cb, &data, NULL) > 0);
+	test_run();
+
+	test_read(data.fd[0], "AT+CFOO\r");
+
+	test_wait(&data, 10 * CMD_TIMEOUT);
+
+	g_assert(data.results == 1);
+	g_assert_cmpstr(data.final, ==, "ERROR");
+
+	/* The modem really swallowed it, go on after another timeout */
+	test_wait(&data, 2 * CMD_TIMEOUT);
+
+	test_read(data.fd[0], "AT+CBAR\r");
+
+	test_write(data.fd[0], "\r\nOK\r\n");
+	test_run();
+
+	g_assert(data.results == 2);
+	g_assert(data.ok == TRUE);
+
+	test_cleanup(&data);
+}
+
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/testgatchat/timeout", test_timeout);
+	g_test_add_func("/testgatchat/timeout/no-final", test_timeout_no_final);
+
+	return g_test_run();
+}
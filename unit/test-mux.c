@@ -23,6 +23,7 @@
 #include <config.h>
 #endif
 
+#include <fcntl.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -38,6 +39,8 @@
 #include "gatmux.h"
 #include "gsm0710.h"
 
+#define PARSER_FRAMES	64
+
 static int do_connect(const char *address, unsigned short port)
 {
 	struct sockaddr_in addr;
@@ -556,6 +559,260 @@ static void test_extract_advanced(void)
 	g_assert(total == sizeof(advanced_input2) - 1);
 }
 
+
+struct parser_result {
+	int frames;
+	int bytes;
+	gboolean mismatch;
+};
+
+static guint8 parser_payload(int frame, int i)
+{
+	/* Plenty of flag and escape bytes for both modes */
+	static const guint8 special[] = { 0x7E, 0x7D, 0xF9, 0x20 };
+
+	if ((i + frame) % 7 == 0)
+		return special[(i / 7) % 4];
+
+	return (frame * 31 + i) & 0xFF;
+}
+
+static int parser_frame_len(int frame)
+{
+	return (frame * 37) % 300;
+}
+
+static void parser_frame(guint8 dlc, guint8 type, const guint8 *data,
+				int len, gpointer user_data)
+{
+	struct parser_result *result = user_data;
+	int frame = result->frames;
+	int i;
+
+	/* Every fifth frame went out with a broken FCS */
+	if (frame % 5 == 4)
+		frame += 1;
+
+	result->frames = frame + 1;
+	result->bytes += len;
+
+	if (dlc != frame % 5 + 1 || type != GSM0710_DATA ||
+			len != parser_frame_len(frame)) {
+		result->mismatch = TRUE;
+		return;
+	}
+
+	for (i = 0; i < len; i++)
+		if (data[i] != parser_payload(frame, i))
+			result->mismatch = TRUE;
+}
+
+/* Break the FCS without turning it into a flag or an escape */
+static void parser_corrupt(guint8 *fcs)
+{
+	guint8 mask = 0x01;
+
+	while ((*fcs ^ mask) == 0x7E || (*fcs ^ mask) == 0x7D ||
+			(*fcs ^ mask) == 0xF9)
+		mask <<= 1;
+
+	*fcs ^= mask;
+}
+
+static GByteArray *parser_stream(gboolean advanced)
+{
+	static const guint8 garbage[] = { 0x00, 0xF9, 0x7E, 0x12, 0x7D };
+	GByteArray *stream = g_byte_array_new();
+	guint8 payload[300];
+	guint8 frame[2 * 300 + 8];
+	int len;
+	int size;
+	int i, j;
+
+	g_byte_array_append(stream, garbage, sizeof(garbage));
+
+	for (i = 0; i < PARSER_FRAMES; i++) {
+		len = parser_frame_len(i);
+
+		for (j = 0; j < len; j++)
+			payload[j] = parser_payload(i, j);
+
+		if (advanced)
+			size = gsm0710_advanced_fill_frame(frame, i % 5 + 1,
+						GSM0710_DATA, payload, len);
+		else
+			size = gsm0710_basic_fill_frame(frame, i % 5 + 1,
+						GSM0710_DATA, payload, len);
+
+		/* Both modes keep the FCS right before the closing flag */
+		if (i % 5 == 4)
+			parser_corrupt(frame + size - 2);
+
+		g_byte_array_append(stream, frame, size);
+	}
+
+	return stream;
+}
+
+static void parser_run(gboolean advanced, int max_chunk)
+{
+	struct parser_result result;
+	struct gsm0710_parser *parser;
+	GByteArray *stream = parser_stream(advanced);
+	guint pos;
+	int chunk;
+	int expected = 0;
+	int i;
+
+	memset(&result, 0, sizeof(result));
+
+	parser = gsm0710_parser_new(advanced, 512, parser_frame, &result);
+	g_assert(parser != NULL);
+
+	/* Feed in ever changing pieces, splitting frames everywhere */
+	for (pos = 0; pos < stream->len; pos += chunk) {
+		chunk = MIN((int) (pos % max_chunk) + 1,
+					(int) (stream->len - pos));
+		gsm0710_parser_feed(parser, stream->data + pos, chunk);
+	}
+
+	for (i = 0; i < PARSER_FRAMES; i++)
+		if (i % 5 != 4)
+			expected += parser_frame_len(i);
+
+	/* Frames lost past a broken FCS would also show up here */
+	g_assert(result.mismatch == FALSE);
+	g_assert(result.frames == PARSER_FRAMES);
+	g_assert(result.bytes == expected);
+
+	gsm0710_parser_free(parser);
+	g_byte_array_free(stream, TRUE);
+}
+
+static void test_parser_basic(void)
+{
+	int chunk;
+
+	for (chunk = 1; chunk < 64; chunk++)
+		parser_run(FALSE, chunk);
+
+	parser_run(FALSE, G_MAXINT);
+}
+
+static void test_parser_advanced(void)
+{
+	int chunk;
+
+	for (chunk = 1; chunk < 64; chunk++)
+		parser_run(TRUE, chunk);
+
+	parser_run(TRUE, G_MAXINT);
+}
+
+static GIOChannel *priority_channel(GAtMux *mux, GAtMuxPriority priority)
+{
+	GIOChannel *channel = g_at_mux_create_channel(mux);
+
+	g_assert(channel != NULL);
+	g_assert(g_at_mux_set_channel_priority(mux, channel, priority, 1));
+
+	g_io_channel_set_encoding(channel, NULL, NULL);
+	g_io_channel_set_buffered(channel, FALSE);
+
+	return channel;
+}
+
+static void test_priority(void)
+{
+	static const char command[] = "ATA\r";
+	guint8 payload[2048];
+	guint8 stream[8192];
+	GAtMuxChannelStats stats;
+	GIOChannel *io;
+	GIOChannel *data;
+	GIOChannel *control;
+	gsize written;
+	guint8 dlc, ctrl;
+	guint8 *frame;
+	int frame_len;
+	int first_dlc = -1;
+	int data_bytes = 0;
+	int len, pos, nread;
+	int sk[2];
+
+	memset(payload, 0x55, sizeof(payload));
+
+	g_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sk) == 0);
+	fcntl(sk[0], F_SETFL, fcntl(sk[0], F_GETFL) | O_NONBLOCK);
+
+	io = g_io_channel_unix_new(sk[0]);
+	g_io_channel_set_encoding(io, NULL, NULL);
+	g_io_channel_set_buffered(io, FALSE);
+
+	mux = g_at_mux_new_gsm0710_basic(io, 31);
+	g_io_channel_unref(io);
+	g_assert(g_at_mux_start(mux));
+
+	/* DLC 1 carries bulk data, DLC 2 the AT commands */
+	data = priority_channel(mux, G_AT_MUX_PRIORITY_DATA);
+	control = priority_channel(mux, G_AT_MUX_PRIORITY_CONTROL);
+
+	/* The bulk write is queued first, the command must still win */
+	g_io_channel_write_chars(data, (gchar *) payload, sizeof(payload),
+					&written, NULL);
+	g_assert(written == sizeof(payload));
+
+	g_io_channel_write_chars(control, command, strlen(command),
+					&written, NULL);
+	g_assert(written == strlen(command));
+
+	g_assert(g_at_mux_get_channel_stats(mux, data, &stats));
+	g_assert(stats.queue_depth == sizeof(payload));
+
+	while (g_main_context_iteration(NULL, FALSE))
+		;
+
+	len = read(sk[1], stream, sizeof(stream));
+	g_assert(len > 0);
+
+	for (pos = 0; pos < len; pos += nread) {
+		frame = NULL;
+		nread = gsm0710_basic_extract_frame(stream + pos, len - pos,
+						&dlc, &ctrl, &frame, &frame_len);
+		if (frame == NULL)
+			break;
+
+		if (ctrl != GSM0710_DATA)
+			continue;
+
+		if (first_dlc < 0)
+			first_dlc = dlc;
+
+		if (dlc == 1)
+			data_bytes += frame_len;
+	}
+
+	g_assert(first_dlc == 2);
+	g_assert(data_bytes == sizeof(payload));
+
+	g_assert(g_at_mux_get_channel_stats(mux, data, &stats));
+	g_assert(stats.bytes_queued == sizeof(payload));
+	g_assert(stats.bytes_sent == sizeof(payload));
+	g_assert(stats.queue_depth == 0);
+
+	g_assert(g_at_mux_get_channel_stats(mux, control, &stats));
+	g_assert(stats.bytes_sent == strlen(command));
+
+	g_io_channel_unref(data);
+	g_io_channel_unref(control);
+
+	g_at_mux_shutdown(mux);
+	g_at_mux_unref(mux);
+	mux = NULL;
+
+	close(sk[1]);
+}
+
 int main(int argc, char **argv)
 {
 	g_test_init(&argc, &argv, NULL);
@@ -564,7 +821,13 @@ int main(int argc, char **argv)
 	g_test_add_func("/testmux/fill_advanced", test_fill_advanced);
 	g_test_add_func("/testmux/extract_basic", test_extract_basic);
 	g_test_add_func("/testmux/extract_advanced", test_extract_advanced);
-	g_test_add_func("/testmux/basic", test_basic);
+	g_test_add_func("/testmux/parser_basic", test_parser_basic);
+	g_test_add_func("/testmux/parser_advanced", test_parser_advanced);
+	g_test_add_func("/testmux/priority", test_priority);
+
+	/* Talks to a real modem, so only run on request */
+	if (g_test_thorough())
+		g_test_add_func("/testmux/basic", test_basic);
 
 	return g_test_run();
 }
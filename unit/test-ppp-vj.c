@@ -0,0 +1,778 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <glib.h>
+
+#include "gatio.h"
+#include "gatppp.h"
+#include "ppp.h"
+
+#define VJ_SLOTS	16
+#define MAX_PACKET	1500
+
+#define LOOPBACK_PACKETS	50
+#define LOOPBACK_TIMEOUT	10	/* Seconds */
+#define LOOPBACK_SERVER_IP	"192.168.1.1"
+#define LOOPBACK_CLIENT_IP	"192.168.1.2"
+
+struct tcp_flow {
+	guint32 saddr;
+	guint32 daddr;
+	guint16 sport;
+	guint16 dport;
+	guint32 seq;
+	guint32 ack;
+	guint16 win;
+	guint16 id;
+};
+
+struct vj_link {
+	struct ppp_vj *tx;
+	struct ppp_vj *rx;
+	guint compressed;
+	guint uncompressed;
+	gsize bytes_out;
+};
+
+static void flow_init(struct tcp_flow *flow, guint n)
+{
+	memset(flow, 0, sizeof(*flow));
+
+	flow->saddr = 0x0a000001;
+	flow->daddr = 0xc0a80000 + n;
+	flow->sport = 40000 + n;
+	flow->dport = 80;
+	flow->seq = 0x10000000 * n + 1;
+	flow->ack = 0x20000000 + n;
+	flow->win = 29200;
+	flow->id = n * 1000;
+}
+
+static void put_long(guint8 *p, guint32 val)
+{
+	p[0] = val >> 24;
+	p[1] = val >> 16;
+	p[2] = val >> 8;
+	p[3] = val;
+}
+
+static void put_short(guint8 *p, guint16 val)
+{
+	p[0] = val >> 8;
+	p[1] = val;
+}
+
+/*
+ * Build the next segment of the flow, the sequence number advances past
+ * the payload and the IP ID by one like a typical stack would do
+ */
+static guint build_segment(guint8 *buf, struct tcp_flow *flow, guint8 flags,
+				guint payload, const guint8 *options,
+				guint options_len)
+{
+	guint8 *th = buf + 20;
+	guint thl = 20 + options_len;
+	guint len = 20 + thl + payload;
+	guint32 sum = 0;
+	guint i;
+
+	memset(buf, 0, 20 + thl);
+
+	buf[0] = 0x45;
+	put_short(buf + 2, len);
+	put_short(buf + 4, flow->id++);
+	put_short(buf + 6, 0x4000);
+	buf[8] = 64;
+	buf[9] = 6;
+	put_long(buf + 12, flow->saddr);
+	put_long(buf + 16, flow->daddr);
+
+	for (i = 0; i < 20; i += 2)
+		sum += (buf[i] << 8) | buf[i + 1];
+
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	put_short(buf + 10, ~sum);
+
+	put_short(th, flow->sport);
+	put_short(th + 2, flow->dport);
+	put_long(th + 4, flow->seq);
+	put_long(th + 8, flow->ack);
+	th[12] = (thl / 4) << 4;
+	th[13] = flags;
+	put_short(th + 14, flow->win);
+	put_short(th + 16, flow->seq ^ flow->ack);
+
+	if (options_len)
+		memcpy(th + 20, options, options_len);
+
+	for (i = 0; i < payload; i++)
+		th[thl + i] = flow->seq + i;
+
+	flow->seq += payload;
+
+	return len;
+}
+
+static void vj_link_init(struct vj_link *link, gboolean cslot)
+{
+	memset(link, 0, sizeof(*link));
+
+	link->tx = ppp_vj_new(0, VJ_SLOTS, cslot);
+	g_assert(link->tx != NULL);
+
+	link->rx = ppp_vj_new(VJ_SLOTS, 0, FALSE);
+	g_assert(link->rx != NULL);
+}
+
+static void vj_link_free(struct vj_link *link)
+{
+	ppp_vj_free(link->tx);
+	ppp_vj_free(link->rx);
+}
+
+/*
+ * Compress the packet, hand it to the decompressor and check that what
+ * comes out matches what went in.  Returns the protocol the packet was
+ * sent with.
+ */
+static guint16 vj_loopback(struct vj_link *link, const guint8 *packet,
+				guint len)
+{
+	guint8 buf[MAX_PACKET];
+	const guint8 *out;
+	gsize out_len;
+	guint offset;
+	guint16 proto;
+	guint frame_len = len;
+
+	memcpy(buf, packet, len);
+
+	proto = ppp_vj_compress(link->tx, buf, &frame_len, &offset);
+
+	link->bytes_out += frame_len;
+
+	if (proto == PPP_IP_PROTO) {
+		g_assert(offset == 0);
+		g_assert(frame_len == len);
+		g_assert(memcmp(buf, packet, len) == 0);
+
+		return proto;
+	}
+
+	if (proto == PPP_VJ_COMP)
+		link->compressed += 1;
+	else
+		link->uncompressed += 1;
+
+	out = ppp_vj_decompress(link->rx, proto, buf + offset, frame_len,
+					&out_len);
+	g_assert(out != NULL);
+	g_assert(out_len == len);
+	g_assert(memcmp(out, packet, len) == 0);
+
+	return proto;
+}
+
+static void test_bulk(void)
+{
+	struct vj_link link;
+	struct tcp_flow flow;
+	guint8 packet[MAX_PACKET];
+	guint16 proto;
+	guint len;
+	int i;
+
+	vj_link_init(&link, TRUE);
+	flow_init(&flow, 1);
+
+	for (i = 0; i < 1000; i++) {
+		guint8 flags = 0x10;
+
+		/* Every few segments the sender sets PSH */
+		if (i % 4 == 3)
+			flags |= 0x08;
+
+		len = build_segment(packet, &flow, flags, 536, NULL, 0);
+		proto = vj_loopback(&link, packet, len);
+
+		if (i == 0)
+			g_assert(proto == PPP_VJ_UNCOMP);
+		else
+			g_assert(proto == PPP_VJ_COMP);
+	}
+
+	/* Unidirectional data is sent with a 3 byte header */
+	g_assert(link.bytes_out == 1000 * 536 + 40 + 999 * 3);
+
+	vj_link_free(&link);
+}
+
+static void test_interactive(void)
+{
+	struct vj_link link;
+	struct tcp_flow flow;
+	guint8 packet[MAX_PACKET];
+	guint len;
+	int i;
+
+	vj_link_init(&link, TRUE);
+	flow_init(&flow, 2);
+
+	/* Echoed keystrokes, both seq and ack move by one byte */
+	for (i = 0; i < 100; i++) {
+		len = build_segment(packet, &flow, 0x18, 1, NULL, 0);
+		vj_loopback(&link, packet, len);
+		flow.ack += 1;
+	}
+
+	g_assert(link.uncompressed == 1);
+	g_assert(link.compressed == 99);
+
+	/* Pure acks in between data are not sent compressed twice */
+	len = build_segment(packet, &flow, 0x10, 0, NULL, 0);
+	vj_loopback(&link, packet, len);
+	len = build_segment(packet, &flow, 0x10, 0, NULL, 0);
+	flow.id -= 1;
+	g_assert(vj_loopback(&link, packet, len) == PPP_VJ_UNCOMP);
+
+	vj_link_free(&link);
+}
+
+static void test_slots(void)
+{
+	struct vj_link link;
+	struct tcp_flow flows[VJ_SLOTS * 2];
+	guint8 packet[MAX_PACKET];
+	guint len;
+	int i, n;
+
+	vj_link_init(&link, TRUE);
+
+	for (n = 0; n < VJ_SLOTS * 2; n++)
+		flow_init(&flows[n], n);
+
+	/* As many connections as slots, only the first round is sent full */
+	for (i = 0; i < 10; i++) {
+		for (n = 0; n < VJ_SLOTS; n++) {
+			len = build_segment(packet, &flows[n], 0x10,
+						100 + n, NULL, 0);
+			vj_loopback(&link, packet, len);
+		}
+	}
+
+	g_assert(link.uncompressed == VJ_SLOTS);
+	g_assert(link.compressed == VJ_SLOTS * 9);
+
+	vj_link_free(&link);
+
+	/* Cycling through more connections than slots never hits */
+	vj_link_init(&link, TRUE);
+
+	for (i = 0; i < 10; i++) {
+		for (n = 0; n < VJ_SLOTS * 2; n++) {
+			len = build_segment(packet, &flows[n], 0x10,
+						100 + n, NULL, 0);
+			vj_loopback(&link, packet, len);
+		}
+	}
+
+	g_assert(link.compressed == 0);
+	g_assert(link.uncompressed == VJ_SLOTS * 2 * 10);
+
+	vj_link_free(&link);
+}
+
+static void test_uncompressible(void)
+{
+	static const guint8 timestamp[] = {
+		0x01, 0x01, 0x08, 0x0a, 0x00, 0x00, 0x10, 0x00,
+		0x00, 0x00, 0x20, 0x00,
+	};
+	guint8 options[sizeof(timestamp)];
+	struct vj_link link;
+	struct tcp_flow flow;
+	guint8 packet[MAX_PACKET];
+	guint len;
+
+	vj_link_init(&link, FALSE);
+	flow_init(&flow, 3);
+
+	/* Connection setup and teardown go as plain IP */
+	len = build_segment(packet, &flow, 0x02, 0, NULL, 0);
+	g_assert(vj_loopback(&link, packet, len) == PPP_IP_PROTO);
+
+	len = build_segment(packet, &flow, 0x11, 0, NULL, 0);
+	g_assert(vj_loopback(&link, packet, len) == PPP_IP_PROTO);
+
+	/* As do fragments */
+	len = build_segment(packet, &flow, 0x10, 100, NULL, 0);
+	put_short(packet + 6, 0x2000);
+	g_assert(vj_loopback(&link, packet, len) == PPP_IP_PROTO);
+
+	/* And anything that is not TCP */
+	len = build_segment(packet, &flow, 0x10, 100, NULL, 0);
+	packet[9] = 17;
+	g_assert(vj_loopback(&link, packet, len) == PPP_IP_PROTO);
+
+	len = build_segment(packet, &flow, 0x10, 100, NULL, 0);
+	g_assert(vj_loopback(&link, packet, len) == PPP_VJ_UNCOMP);
+
+	/* Window and urgent pointer changes are carried as deltas */
+	flow.win -= 1000;
+	len = build_segment(packet, &flow, 0x10, 100, NULL, 0);
+	g_assert(vj_loopback(&link, packet, len) == PPP_VJ_COMP);
+
+	len = build_segment(packet, &flow, 0x30, 100, NULL, 0);
+	put_short(packet + 20 + 18, 50);
+	g_assert(vj_loopback(&link, packet, len) == PPP_VJ_COMP);
+
+	len = build_segment(packet, &flow, 0x10, 100, NULL, 0);
+	put_short(packet + 20 + 18, 50);
+	g_assert(vj_loopback(&link, packet, len) == PPP_VJ_COMP);
+
+	/* The urgent pointer may only change along with URG */
+	len = build_segment(packet, &flow, 0x10, 100, NULL, 0);
+	g_assert(vj_loopback(&link, packet, len) == PPP_VJ_UNCOMP);
+
+	/* Sequence jumps that do not fit in 16 bits */
+	flow.seq += 0x20000;
+	len = build_segment(packet, &flow, 0x10, 100, NULL, 0);
+	g_assert(vj_loopback(&link, packet, len) == PPP_VJ_UNCOMP);
+
+	/* Changing TCP options, e.g. timestamps */
+	memcpy(options, timestamp, sizeof(options));
+	len = build_segment(packet, &flow, 0x10, 100, options,
+						sizeof(options));
+	g_assert(vj_loopback(&link, packet, len) == PPP_VJ_UNCOMP);
+
+	len = build_segment(packet, &flow, 0x10, 100, options,
+						sizeof(options));
+	g_assert(vj_loopback(&link, packet, len) == PPP_VJ_COMP);
+
+	options[7] += 1;
+	len = build_segment(packet, &flow, 0x10, 100, options,
+						sizeof(options));
+	g_assert(vj_loopback(&link, packet, len) == PPP_VJ_UNCOMP);
+
+	vj_link_free(&link);
+}
+
+static void test_toss(void)
+{
+	struct tcp_flow flow;
+	struct ppp_vj *tx;
+	struct ppp_vj *rx;
+	guint8 packet[MAX_PACKET];
+	const guint8 *out;
+	gsize out_len;
+	guint offset;
+	guint len;
+	guint16 proto;
+
+	tx = ppp_vj_new(0, VJ_SLOTS, TRUE);
+	rx = ppp_vj_new(VJ_SLOTS, 0, FALSE);
+	flow_init(&flow, 4);
+
+	/* Nothing to go on before the first explicit slot id */
+	len = build_segment(packet, &flow, 0x10, 100, NULL, 0);
+	packet[0] = 0x00;
+	out = ppp_vj_decompress(rx, PPP_VJ_COMP, packet, 10, &out_len);
+	g_assert(out == NULL);
+
+	len = build_segment(packet, &flow, 0x10, 100, NULL, 0);
+	proto = ppp_vj_compress(tx, packet, &len, &offset);
+	g_assert(proto == PPP_VJ_UNCOMP);
+	g_assert(ppp_vj_decompress(rx, proto, packet + offset, len,
+					&out_len) != NULL);
+
+	/* A truncated frame makes us drop until the next slot id */
+	len = build_segment(packet, &flow, 0x10, 100, NULL, 0);
+	proto = ppp_vj_compress(tx, packet, &len, &offset);
+	g_assert(proto == PPP_VJ_COMP);
+	packet[offset] |= 0x20;
+	g_assert(ppp_vj_decompress(rx, proto, packet + offset, 3,
+					&out_len) == NULL);
+
+	len = build_segment(packet, &flow, 0x10, 100, NULL, 0);
+	proto = ppp_vj_compress(tx, packet, &len, &offset);
+	g_assert(proto == PPP_VJ_COMP);
+	g_assert(ppp_vj_decompress(rx, proto, packet + offset, len,
+					&out_len) == NULL);
+
+	/* Slots beyond what we negotiated */
+	len = build_segment(packet, &flow, 0x10, 100, NULL, 0);
+	packet[9] = VJ_SLOTS;
+	g_assert(ppp_vj_decompress(rx, PPP_VJ_UNCOMP, packet, len,
+					&out_len) == NULL);
+
+	/* TCP retransmits, which go uncompressed and resync us */
+	flow.seq -= 200;
+	len = build_segment(packet, &flow, 0x10, 100, NULL, 0);
+	proto = ppp_vj_compress(tx, packet, &len, &offset);
+	g_assert(proto == PPP_VJ_UNCOMP);
+	g_assert(ppp_vj_decompress(rx, proto, packet + offset, len,
+					&out_len) != NULL);
+
+	len = build_segment(packet, &flow, 0x10, 100, NULL, 0);
+	proto = ppp_vj_compress(tx, packet, &len, &offset);
+	g_assert(proto == PPP_VJ_COMP);
+	g_assert(ppp_vj_decompress(rx, proto, packet + offset, len,
+					&out_len) != NULL);
+
+	ppp_vj_free(tx);
+	ppp_vj_free(rx);
+}
+
+/*
+ * One direction of the link between two GAtPPP ends.  The test relays the
+ * bytes and picks the HDLC frames apart to see the protocol they carry.
+ */
+struct link_snoop {
+	int in_fd;
+	int out_fd;
+	guint watch;
+	guint8 frame[MAX_PACKET + 16];
+	guint len;
+	gboolean escape;
+	guint ip;
+	guint vj_comp;
+	guint vj_uncomp;
+};
+
+/*
+ * A GAtPPP client and server talking over the test, packet sockets stand
+ * in for both tun interfaces
+ */
+struct loopback {
+	GMainLoop *mainloop;
+	GAtPPP *client;
+	GAtPPP *server;
+	int client_net;
+	int server_net;
+	struct link_snoop to_server;
+	struct link_snoop to_client;
+	guint connected;
+	guint timeout;
+	gboolean failed;
+};
+
+static void snoop_frame(struct link_snoop *snoop)
+{
+	guint offset = 0;
+	guint16 proto;
+
+	/* Address, control, protocol and FCS at the least */
+	if (snoop->len < 5)
+		return;
+
+	if (snoop->frame[0] == 0xff && snoop->frame[1] == 0x03)
+		offset = 2;
+
+	if (snoop->frame[offset] & 0x1)
+		proto = snoop->frame[offset];
+	else
+		proto = (snoop->frame[offset] << 8) | snoop->frame[offset + 1];
+
+	switch (proto) {
+	case PPP_IP_PROTO:
+		snoop->ip += 1;
+		break;
+	case PPP_VJ_COMP:
+		snoop->vj_comp += 1;
+		break;
+	case PPP_VJ_UNCOMP:
+		snoop->vj_uncomp += 1;
+		break;
+	}
+}
+
+static void snoop_byte(struct link_snoop *snoop, guint8 c)
+{
+	if (c == 0x7e) {
+		snoop_frame(snoop);
+		snoop->len = 0;
+		snoop->escape = FALSE;
+		return;
+	}
+
+	if (c == 0x7d) {
+		snoop->escape = TRUE;
+		return;
+	}
+
+	if (snoop->escape) {
+		c ^= 0x20;
+		snoop->escape = FALSE;
+	}
+
+	if (snoop->len < sizeof(snoop->frame))
+		snoop->frame[snoop->len++] = c;
+}
+
+static gboolean relay_cb(GIOChannel *channel, GIOCondition cond,
+				gpointer user_data)
+{
+	struct link_snoop *snoop = user_data;
+	guint8 buf[4096];
+	ssize_t len;
+	ssize_t i;
+
+	if (cond & (G_IO_NVAL | G_IO_HUP | G_IO_ERR))
+		goto done;
+
+	len = read(snoop->in_fd, buf, sizeof(buf));
+	if (len <= 0)
+		goto done;
+
+	for (i = 0; i < len; i++)
+		snoop_byte(snoop, buf[i]);
+
+	if (write(snoop->out_fd, buf, len) != len)
+		goto done;
+
+	return TRUE;
+
+done:
+	snoop->watch = 0;
+	return FALSE;
+}
+
+static void snoop_start(struct link_snoop *snoop, int in_fd, int out_fd)
+{
+	GIOChannel *channel;
+
+	memset(snoop, 0, sizeof(*snoop));
+
+	snoop->in_fd = in_fd;
+	snoop->out_fd = out_fd;
+
+	channel = g_io_channel_unix_new(in_fd);
+	g_io_channel_set_close_on_unref(channel, TRUE);
+	snoop->watch = g_io_add_watch(channel,
+				G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+				relay_cb, snoop);
+	g_io_channel_unref(channel);
+}
+
+static void loopback_connected(const char *iface, const char *local,
+				const char *peer, const char *dns1,
+				const char *dns2, gpointer user_data)
+{
+	struct loopback *lb = user_data;
+
+	/* Both ends have to be up */
+	if (++lb->connected == 2)
+		g_main_loop_quit(lb->mainloop);
+}
+
+static void loopback_disconnected(GAtPPPDisconnectReason reason,
+					gpointer user_data)
+{
+	struct loopback *lb = user_data;
+
+	lb->failed = TRUE;
+	g_main_loop_quit(lb->mainloop);
+}
+
+static gboolean loopback_timeout(gpointer user_data)
+{
+	struct loopback *lb = user_data;
+
+	lb->timeout = 0;
+	lb->failed = TRUE;
+	g_main_loop_quit(lb->mainloop);
+
+	return FALSE;
+}
+
+static void loopback_open(struct loopback *lb, GAtPPP *ppp, int fd)
+{
+	GIOChannel *channel;
+	GAtIO *io;
+	gboolean ok;
+
+	g_assert(ppp != NULL);
+
+	g_at_ppp_set_vj_enabled(ppp, TRUE);
+	g_at_ppp_set_connect_function(ppp, loopback_connected, lb);
+	g_at_ppp_set_disconnect_function(ppp, loopback_disconnected, lb);
+
+	channel = g_io_channel_unix_new(fd);
+	g_io_channel_set_close_on_unref(channel, TRUE);
+	io = g_at_io_new(channel);
+	g_io_channel_unref(channel);
+	g_assert(io != NULL);
+
+	if (ppp == lb->server) {
+		g_at_ppp_set_server_info(ppp, LOOPBACK_CLIENT_IP,
+						LOOPBACK_SERVER_IP,
+						LOOPBACK_SERVER_IP);
+		ok = g_at_ppp_listen(ppp, io);
+	} else
+		ok = g_at_ppp_open(ppp, io);
+
+	g_assert(ok);
+	g_at_io_unref(io);
+}
+
+static void loopback_setup(struct loopback *lb)
+{
+	int client_link[2];
+	int server_link[2];
+	int client_net[2];
+	int server_net[2];
+
+	memset(lb, 0, sizeof(*lb));
+
+	g_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, client_link) == 0);
+	g_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, server_link) == 0);
+	g_assert(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, client_net) == 0);
+	g_assert(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, server_net) == 0);
+
+	lb->client_net = client_net[1];
+	lb->server_net = server_net[1];
+	fcntl(lb->client_net, F_SETFL, O_NONBLOCK);
+	fcntl(lb->server_net, F_SETFL, O_NONBLOCK);
+
+	snoop_start(&lb->to_server, client_link[0], server_link[0]);
+	snoop_start(&lb->to_client, server_link[0], client_link[0]);
+
+	lb->mainloop = g_main_loop_new(NULL, FALSE);
+	lb->timeout = g_timeout_add_seconds(LOOPBACK_TIMEOUT,
+						loopback_timeout, lb);
+
+	lb->server = g_at_ppp_server_new_full(LOOPBACK_SERVER_IP,
+							server_net[0]);
+	loopback_open(lb, lb->server, server_link[1]);
+
+	lb->client = g_at_ppp_new_full(client_net[0]);
+	loopback_open(lb, lb->client, client_link[1]);
+
+	g_main_loop_run(lb->mainloop);
+
+	g_assert(lb->failed == FALSE);
+	g_assert(lb->connected == 2);
+}
+
+static void loopback_cleanup(struct loopback *lb)
+{
+	if (lb->timeout > 0)
+		g_source_remove(lb->timeout);
+
+	g_at_ppp_set_disconnect_function(lb->client, NULL, NULL);
+	g_at_ppp_set_disconnect_function(lb->server, NULL, NULL);
+	g_at_ppp_unref(lb->client);
+	g_at_ppp_unref(lb->server);
+
+	/* Closes the test ends of the link */
+	if (lb->to_server.watch > 0)
+		g_source_remove(lb->to_server.watch);
+
+	if (lb->to_client.watch > 0)
+		g_source_remove(lb->to_client.watch);
+
+	close(lb->client_net);
+	close(lb->server_net);
+
+	g_main_loop_unref(lb->mainloop);
+}
+
+/* Sends the next segment of the flow and waits for it on the other end */
+static void loopback_send(struct loopback *lb, int in_fd, int out_fd,
+				struct tcp_flow *flow, guint payload)
+{
+	guint8 packet[MAX_PACKET];
+	guint8 buf[MAX_PACKET];
+	guint len;
+	ssize_t n;
+
+	len = build_segment(packet, flow, 0x10, payload, NULL, 0);
+	g_assert(write(in_fd, packet, len) == (ssize_t) len);
+
+	while ((n = read(out_fd, buf, sizeof(buf))) < 0) {
+		g_assert(errno == EAGAIN);
+		g_assert(lb->failed == FALSE);
+
+		g_main_context_iteration(NULL, TRUE);
+	}
+
+	g_assert(n == (ssize_t) len);
+	g_assert(memcmp(buf, packet, len) == 0);
+}
+
+static void test_loopback(void)
+{
+	struct loopback lb;
+	struct tcp_flow up;
+	struct tcp_flow down;
+	int i;
+
+	loopback_setup(&lb);
+
+	flow_init(&up, 7);
+	flow_init(&down, 8);
+
+	/* A TCP flow each way, interleaved */
+	for (i = 0; i < LOOPBACK_PACKETS; i++) {
+		loopback_send(&lb, lb.client_net, lb.server_net, &up,
+						100 + (i % 5) * 100);
+		loopback_send(&lb, lb.server_net, lb.client_net, &down,
+						1400 - (i % 3) * 400);
+	}
+
+	/* Both ends negotiated VJ and compress all but the first */
+	g_assert(lb.to_server.ip == 0);
+	g_assert(lb.to_server.vj_uncomp == 1);
+	g_assert(lb.to_server.vj_comp == LOOPBACK_PACKETS - 1);
+
+	g_assert(lb.to_client.ip == 0);
+	g_assert(lb.to_client.vj_uncomp == 1);
+	g_assert(lb.to_client.vj_comp == LOOPBACK_PACKETS - 1);
+
+	loopback_cleanup(&lb);
+}
+
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/testpppvj/bulk", test_bulk);
+	g_test_add_func("/testpppvj/interactive", test_interactive);
+	g_test_add_func("/testpppvj/slots", test_slots);
+	g_test_add_func("/testpppvj/uncompressible", test_uncompressible);
+	g_test_add_func("/testpppvj/toss", test_toss);
+	g_test_add_func("/testpppvj/loopback", test_loopback);
+
+	return g_test_run();
+}
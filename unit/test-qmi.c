@@ -0,0 +1,530 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "drivers/qmimodem/qmi.h"
+#include "drivers/qmimodem/dms.h"
+#include "drivers/qmimodem/nas.h"
+#include "drivers/qmimodem/wds.h"
+#include "drivers/qmimodem/wms.h"
+#include "drivers/qmimodem/uim.h"
+#include "drivers/qmimodem/wda.h"
+#include "qmi-test-server.h"
+
+/* The first client the server hands out for each service */
+#define FIRST_CLIENT	0x01
+
+static const unsigned char dms_ids[] = {
+	0x11, 0x0f, 0x00, '3', '5', '6', '9', '3', '8', '0', '3', '5',
+	'6', '4', '3', '8', '0', '9',
+};
+
+static const unsigned char nas_ss_info[] = {
+	0x01, 0x06, 0x00, 0x01, 0x01, 0x01, 0x02, 0x01, 0x08,
+	0x12, 0x09, 0x00, 0xea, 0x00, 0x0f, 0x00, 0x04, 'T', 'e', 's', 't',
+};
+
+static const unsigned char wds_start_net[] = {
+	0x01, 0x04, 0x00, 0x78, 0x56, 0x34, 0x12,
+};
+
+static const unsigned char wms_smsc_addr[] = {
+	0x01, 0x11, 0x00, '1', '4', '5', 0x0d, '+', '4', '4', '7', '7',
+	'8', '5', '0', '1', '6', '0', '0', '5',
+};
+
+static const unsigned char uim_event_registration[] = {
+	0x10, 0x04, 0x00, 0x01, 0x00, 0x00, 0x00,
+};
+
+static const unsigned char wda_data_format[] = {
+	0x11, 0x04, 0x00, 0x02, 0x00, 0x00, 0x00,
+};
+
+static const struct qmi_test_response script[] = {
+	{ QMI_SERVICE_DMS, QMI_DMS_GET_IDS, 0,
+				dms_ids, sizeof(dms_ids) },
+	{ QMI_SERVICE_DMS, QMI_DMS_GET_NUMBER, 0x0010, NULL, 0 },
+	{ QMI_SERVICE_DMS, QMI_DMS_GET_MODEL_ID, QMI_TEST_NO_RESPONSE,
+				NULL, 0 },
+	{ QMI_SERVICE_NAS, QMI_NAS_GET_SS_INFO, 0,
+				nas_ss_info, sizeof(nas_ss_info) },
+	{ QMI_SERVICE_WDS, QMI_WDS_START_NET, 0,
+				wds_start_net, sizeof(wds_start_net) },
+	{ QMI_SERVICE_WMS, QMI_WMS_GET_SMSC_ADDR, 0,
+				wms_smsc_addr, sizeof(wms_smsc_addr) },
+	{ QMI_SERVICE_UIM, QMI_UIM_EVENT_REGISTRATION, 0,
+				uim_event_registration,
+				sizeof(uim_event_registration) },
+	{ QMI_SERVICE_WDA, QMI_WDA_GET_DATA_FORMAT, 0,
+				wda_data_format, sizeof(wda_data_format) },
+};
+
+struct request_test {
+	uint8_t service;
+	uint16_t message;
+	uint8_t type;		/* TLV to look at in the response */
+	const unsigned char *value;
+	uint16_t length;
+};
+
+static const struct request_test request_tests[] = {
+	{ QMI_SERVICE_DMS, QMI_DMS_GET_IDS, QMI_DMS_RESULT_IMEI,
+				dms_ids + 3, sizeof(dms_ids) - 3 },
+	{ QMI_SERVICE_NAS, QMI_NAS_GET_SS_INFO, QMI_NAS_RESULT_CURRENT_PLMN,
+				nas_ss_info + 12, sizeof(nas_ss_info) - 12 },
+	{ QMI_SERVICE_WDS, QMI_WDS_START_NET, QMI_WDS_RESULT_PKT_HANDLE,
+				wds_start_net + 3, sizeof(wds_start_net) - 3 },
+	{ QMI_SERVICE_WMS, QMI_WMS_GET_SMSC_ADDR, QMI_WMS_RESULT_SMSC_ADDR,
+				wms_smsc_addr + 3, sizeof(wms_smsc_addr) - 3 },
+	{ QMI_SERVICE_UIM, QMI_UIM_EVENT_REGISTRATION,
+				QMI_UIM_RESULT_EVENT_MASK,
+				uim_event_registration + 3,
+				sizeof(uim_event_registration) - 3 },
+	{ QMI_SERVICE_WDA, QMI_WDA_GET_DATA_FORMAT, QMI_WDA_LL_PROTOCOL,
+				wda_data_format + 3,
+				sizeof(wda_data_format) - 3 },
+};
+
+struct test_data {
+	GMainLoop *mainloop;
+	struct qmi_test_server *server;
+	struct qmi_device *device;
+	struct qmi_service *service;
+	const struct request_test *request;
+	unsigned int replies;
+	unsigned int indications;
+	unsigned int destroyed;
+	uint16_t error;
+	uint16_t cancel_tid;
+};
+
+static void qmi_debug(const char *str, void *user_data)
+{
+	const char *prefix = user_data;
+
+	g_print("%s%s\n", prefix, str);
+}
+
+static void discover_cb(void *user_data)
+{
+	struct test_data *data = user_data;
+
+	g_main_loop_quit(data->mainloop);
+}
+
+static void create_cb(struct qmi_service *service, void *user_data)
+{
+	struct test_data *data = user_data;
+
+	g_assert(service != NULL);
+
+	data->service = qmi_service_ref(service);
+	g_main_loop_quit(data->mainloop);
+}
+
+static void test_setup(struct test_data *data, size_t chunk_size)
+{
+	memset(data, 0, sizeof(*data));
+
+	data->mainloop = g_main_loop_new(NULL, FALSE);
+
+	data->server = qmi_test_server_new(script, G_N_ELEMENTS(script));
+	g_assert(data->server != NULL);
+
+	qmi_test_server_set_chunk_size(data->server, chunk_size);
+
+	data->device = qmi_device_new(qmi_test_server_get_fd(data->server));
+	g_assert(data->device != NULL);
+
+	if (g_test_verbose())
+		qmi_device_set_debug(data->device, qmi_debug, "QMI: ");
+
+	g_assert(qmi_device_discover(data->device, discover_cb, data, NULL));
+	g_main_loop_run(data->mainloop);
+}
+
+static void test_create_service(struct test_data *data, uint8_t type)
+{
+	qmi_service_unref(data->service);
+	data->service = NULL;
+
+	g_assert(qmi_service_create(data->device, type, create_cb,
+							data, NULL));
+	g_main_loop_run(data->mainloop);
+}
+
+static void shutdown_cb(void *user_data)
+{
+	struct test_data *data = user_data;
+
+	/* Freed once the shutdown has finished */
+	qmi_device_unref(data->device);
+	g_main_loop_quit(data->mainloop);
+}
+
+static void test_cleanup(struct test_data *data)
+{
+	qmi_service_unref(data->service);
+
+	/* Waits for the client ids to be released */
+	g_assert(qmi_device_shutdown(data->device, shutdown_cb, data, NULL));
+	g_main_loop_run(data->mainloop);
+
+	g_assert(qmi_test_server_get_clients(data->server) == 0);
+
+	qmi_test_server_free(data->server);
+	g_main_loop_unref(data->mainloop);
+}
+
+static void test_discover(void)
+{
+	struct test_data data;
+	uint16_t major, minor;
+
+	test_setup(&data, 0);
+
+	g_assert(qmi_device_has_service(data.device, QMI_SERVICE_DMS));
+	g_assert(qmi_device_has_service(data.device, QMI_SERVICE_NAS));
+	g_assert(qmi_device_has_service(data.device, QMI_SERVICE_WDS));
+	g_assert(qmi_device_has_service(data.device, QMI_SERVICE_WMS));
+	g_assert(qmi_device_has_service(data.device, QMI_SERVICE_UIM));
+	g_assert(qmi_device_has_service(data.device, QMI_SERVICE_WDA));
+	g_assert(!qmi_device_has_service(data.device, QMI_SERVICE_PDS));
+
+	g_assert(qmi_device_get_service_version(data.device, QMI_SERVICE_NAS,
+							&major, &minor));
+	g_assert(major == 1 && minor == 8);
+
+	test_cleanup(&data);
+}
+
+static void request_cb(struct qmi_result *result, void *user_data)
+{
+	struct test_data *data = user_data;
+	const struct request_test *request = data->request;
+	const void *value;
+	uint16_t len;
+
+	g_assert(!qmi_result_set_error(result, NULL));
+
+	value = qmi_result_get(result, request->type, &len);
+	g_assert(value != NULL);
+	g_assert(len == request->length);
+	g_assert(memcmp(value, request->value, len) == 0);
+
+	data->replies += 1;
+	g_main_loop_quit(data->mainloop);
+}
+
+static void test_request(gconstpointer chunk_size)
+{
+	struct test_data data;
+	unsigned int i;
+
+	test_setup(&data, GPOINTER_TO_UINT(chunk_size));
+
+	for (i = 0; i < G_N_ELEMENTS(request_tests); i++) {
+		data.request = &request_tests[i];
+
+		test_create_service(&data, data.request->service);
+
+		g_assert(qmi_service_send(data.service, data.request->message,
+					NULL, request_cb, &data, NULL) > 0);
+		g_main_loop_run(data.mainloop);
+	}
+
+	g_assert(data.replies == G_N_ELEMENTS(request_tests));
+
+	test_cleanup(&data);
+}
+
+static void error_cb(struct qmi_result *result, void *user_data)
+{
+	struct test_data *data = user_data;
+
+	g_assert(qmi_result_set_error(result, &data->error));
+
+	data->replies += 1;
+	g_main_loop_quit(data->mainloop);
+}
+
+static void test_error(void)
+{
+	struct test_data data;
+
+	test_setup(&data, 0);
+	test_create_service(&data, QMI_SERVICE_DMS);
+
+	/* Scripted failure */
+	g_assert(qmi_service_send(data.service, QMI_DMS_GET_NUMBER, NULL,
+					error_cb, &data, NULL) > 0);
+	g_main_loop_run(data.mainloop);
+	g_assert(data.error == 0x0010);
+
+	/* Not in the script at all */
+	g_assert(qmi_service_send(data.service, QMI_DMS_GET_CAPS, NULL,
+					error_cb, &data, NULL) > 0);
+	g_main_loop_run(data.mainloop);
+	g_assert(data.error == 0x0047);
+
+	g_assert(data.replies == 2);
+
+	test_cleanup(&data);
+}
+
+static void test_timeout(void)
+{
+	struct test_data data;
+
+	test_setup(&data, 0);
+	test_create_service(&data, QMI_SERVICE_DMS);
+
+	g_assert(!qmi_device_set_request_timeout(data.device, 0));
+	g_assert(qmi_device_set_request_timeout(data.device, 1));
+
+	/* Never answered, fails without any response data */
+	g_assert(qmi_service_send(data.service, QMI_DMS_GET_MODEL_ID, NULL,
+					error_cb, &data, NULL) > 0);
+	g_main_loop_run(data.mainloop);
+	g_assert(data.error == 0x0003);
+
+	/* The device carries on as usual afterwards */
+	g_assert(qmi_service_send(data.service, QMI_DMS_GET_NUMBER, NULL,
+					error_cb, &data, NULL) > 0);
+	g_main_loop_run(data.mainloop);
+	g_assert(data.error == 0x0010);
+
+	g_assert(data.replies == 2);
+
+	test_cleanup(&data);
+}
+
+static void indication_cb(struct qmi_result *result, void *user_data)
+{
+	struct test_data *data = user_data;
+	uint16_t len;
+
+	g_assert(qmi_result_get(result, QMI_NAS_RESULT_SERVING_SYSTEM,
+								&len) != NULL);
+
+	data->indications += 1;
+}
+
+static void sync_cb(struct qmi_result *result, void *user_data)
+{
+	struct test_data *data = user_data;
+
+	g_main_loop_quit(data->mainloop);
+}
+
+static void test_indication(void)
+{
+	struct test_data data;
+
+	test_setup(&data, 0);
+	test_create_service(&data, QMI_SERVICE_NAS);
+
+	g_assert(qmi_service_register(data.service, QMI_NAS_SS_INFO_IND,
+					indication_cb, &data, NULL) > 0);
+
+	qmi_test_server_indicate(data.server, QMI_SERVICE_NAS, FIRST_CLIENT,
+					QMI_NAS_SS_INFO_IND,
+					nas_ss_info, sizeof(nas_ss_info));
+	qmi_test_server_indicate(data.server, QMI_SERVICE_NAS,
+					FIRST_CLIENT + 1, QMI_NAS_SS_INFO_IND,
+					nas_ss_info, sizeof(nas_ss_info));
+	qmi_test_server_indicate(data.server, QMI_SERVICE_NAS, 0xff,
+					QMI_NAS_SS_INFO_IND,
+					nas_ss_info, sizeof(nas_ss_info));
+	qmi_test_server_indicate(data.server, QMI_SERVICE_DMS, FIRST_CLIENT,
+					QMI_NAS_SS_INFO_IND,
+					nas_ss_info, sizeof(nas_ss_info));
+
+	/* The response is sent after all of the indications */
+	g_assert(qmi_service_send(data.service, QMI_NAS_GET_SS_INFO, NULL,
+					sync_cb, &data, NULL) > 0);
+	g_main_loop_run(data.mainloop);
+
+	/* Not the ones for another client or another service */
+	g_assert(data.indications == 2);
+
+	g_assert(qmi_service_unregister_all(data.service));
+
+	qmi_test_server_indicate(data.server, QMI_SERVICE_NAS, FIRST_CLIENT,
+					QMI_NAS_SS_INFO_IND,
+					nas_ss_info, sizeof(nas_ss_info));
+	g_assert(qmi_service_send(data.service, QMI_NAS_GET_SS_INFO, NULL,
+					sync_cb, &data, NULL) > 0);
+	g_main_loop_run(data.mainloop);
+
+	g_assert(data.indications == 2);
+
+	test_cleanup(&data);
+}
+
+static void cancelled_cb(struct qmi_result *result, void *user_data)
+{
+	g_assert_not_reached();
+}
+
+static void cancelled_destroy(void *user_data)
+{
+	struct test_data *data = user_data;
+
+	data->destroyed += 1;
+}
+
+static void unregister_cb(struct qmi_result *result, void *user_data)
+{
+	struct test_data *data = user_data;
+
+	data->indications += 1;
+
+	/* Including the ones still to be called for this indication */
+	g_assert(qmi_service_unregister_all(data->service));
+}
+
+static void test_indication_unregister(void)
+{
+	struct test_data data;
+
+	test_setup(&data, 0);
+	test_create_service(&data, QMI_SERVICE_NAS);
+
+	g_assert(qmi_service_register(data.service, QMI_NAS_SS_INFO_IND,
+				unregister_cb, &data, cancelled_destroy) > 0);
+	g_assert(qmi_service_register(data.service, QMI_NAS_SS_INFO_IND,
+				cancelled_cb, &data, cancelled_destroy) > 0);
+	g_assert(qmi_service_register(data.service, QMI_NAS_SS_INFO_IND,
+				cancelled_cb, &data, cancelled_destroy) > 0);
+
+	qmi_test_server_indicate(data.server, QMI_SERVICE_NAS, FIRST_CLIENT,
+					QMI_NAS_SS_INFO_IND,
+					nas_ss_info, sizeof(nas_ss_info));
+	g_assert(qmi_service_send(data.service, QMI_NAS_GET_SS_INFO, NULL,
+					sync_cb, &data, NULL) > 0);
+	g_main_loop_run(data.mainloop);
+
+	g_assert(data.indications == 1);
+	g_assert(data.destroyed == 3);
+
+	test_cleanup(&data);
+}
+
+/* Runs once the request is on the wire, before its response */
+static void cancel_request(uint8_t service, uint8_t client, uint16_t message,
+				const void *buf, uint16_t length,
+				void *user_data)
+{
+	struct test_data *data = user_data;
+
+	if (service != QMI_SERVICE_DMS || !data->cancel_tid)
+		return;
+
+	g_assert(qmi_service_cancel(data->service, data->cancel_tid));
+	data->cancel_tid = 0;
+}
+
+static void test_cancel(void)
+{
+	struct test_data data;
+	uint16_t tid;
+
+	test_setup(&data, 0);
+	test_create_service(&data, QMI_SERVICE_DMS);
+
+	/* Still queued */
+	tid = qmi_service_send(data.service, QMI_DMS_GET_IDS, NULL,
+				cancelled_cb, &data, cancelled_destroy);
+	g_assert(tid > 0);
+	g_assert(qmi_service_cancel(data.service, tid));
+	g_assert(data.destroyed == 1);
+
+	/* Already sent, the response has to be dropped */
+	qmi_test_server_set_request_func(data.server, cancel_request, &data);
+
+	data.cancel_tid = qmi_service_send(data.service, QMI_DMS_GET_IDS, NULL,
+				cancelled_cb, &data, cancelled_destroy);
+	g_assert(data.cancel_tid > 0);
+
+	g_assert(qmi_service_send(data.service, QMI_DMS_GET_IDS, NULL,
+					sync_cb, &data, NULL) > 0);
+	g_main_loop_run(data.mainloop);
+
+	g_assert(data.cancel_tid == 0);
+	g_assert(data.destroyed == 2);
+
+	qmi_test_server_set_request_func(data.server, NULL, NULL);
+
+	test_cleanup(&data);
+}
+
+static void shared_cb(struct qmi_service *service, void *user_data)
+{
+	struct test_data *data = user_data;
+
+	g_assert(service == data->service);
+	g_main_loop_quit(data->mainloop);
+}
+
+static void test_shared(void)
+{
+	struct test_data data;
+
+	test_setup(&data, 0);
+	test_create_service(&data, QMI_SERVICE_WDS);
+
+	qmi_service_create_shared(data.device, QMI_SERVICE_WDS,
+						shared_cb, &data, NULL);
+	g_main_loop_run(data.mainloop);
+
+	g_assert(qmi_test_server_get_clients(data.server) == 1);
+
+	test_cleanup(&data);
+}
+
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/testqmi/discover", test_discover);
+	g_test_add_data_func("/testqmi/request", GUINT_TO_POINTER(0),
+							test_request);
+	g_test_add_data_func("/testqmi/request/split", GUINT_TO_POINTER(5),
+							test_request);
+	g_test_add_func("/testqmi/error", test_error);
+	g_test_add_func("/testqmi/timeout", test_timeout);
+	g_test_add_func("/testqmi/indication", test_indication);
+	g_test_add_func("/testqmi/indication/unregister",
+					test_indication_unregister);
+	g_test_add_func("/testqmi/cancel", test_cancel);
+	g_test_add_func("/testqmi/shared", test_shared);
+
+	return g_test_run();
+}
@@ -0,0 +1,574 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include <ofono/modem.h>
+#include <ofono/gprs-context.h>
+
+#include "drivers/qmimodem/qmi.h"
+#include "drivers/qmimodem/wda.h"
+#include "drivers/qmimodem/wds.h"
+#include "drivers/qmimodem/qmimodem.h"
+#include "qmi-test-server.h"
+
+#define TEST_ENDPOINT	4
+#define TEST_MUX_LINK	"qmimux0"
+#define TEST_MTU	1500
+
+static const unsigned char wda_format_qmap[] = {
+	0x11, 0x04, 0x00, 0x02, 0x00, 0x00, 0x00,
+	0x12, 0x04, 0x00, 0x05, 0x00, 0x00, 0x00,
+	0x13, 0x04, 0x00, 0x05, 0x00, 0x00, 0x00,
+	0x15, 0x04, 0x00, 0x20, 0x00, 0x00, 0x00,
+	0x16, 0x04, 0x00, 0x00, 0x20, 0x00, 0x00,
+};
+
+static const unsigned char wda_format_802_3[] = {
+	0x11, 0x04, 0x00, 0x01, 0x00, 0x00, 0x00,
+};
+
+/* A modem doing QMAP */
+static const struct qmi_test_response qmap_script[] = {
+	{ QMI_SERVICE_WDA, QMI_WDA_SET_DATA_FORMAT, 0,
+				wda_format_qmap, sizeof(wda_format_qmap) },
+	{ QMI_SERVICE_WDS, QMI_WDS_BIND_MUX_DATA_PORT, 0, NULL, 0 },
+};
+
+/* Firmware without SET_DATA_FORMAT */
+static const struct qmi_test_response legacy_script[] = {
+	{ QMI_SERVICE_WDA, QMI_WDA_GET_DATA_FORMAT, 0,
+				wda_format_802_3, sizeof(wda_format_802_3) },
+};
+
+/* Firmware that does QMAP but has no mux ids */
+static const struct qmi_test_response no_bind_script[] = {
+	{ QMI_SERVICE_WDA, QMI_WDA_SET_DATA_FORMAT, 0,
+				wda_format_qmap, sizeof(wda_format_qmap) },
+	{ QMI_SERVICE_WDS, QMI_WDS_BIND_MUX_DATA_PORT, 0x0047, NULL, 0 },
+};
+
+/* Firmware that would do either */
+static const struct qmi_test_response both_script[] = {
+	{ QMI_SERVICE_WDA, QMI_WDA_SET_DATA_FORMAT, 0,
+				wda_format_qmap, sizeof(wda_format_qmap) },
+	{ QMI_SERVICE_WDA, QMI_WDA_GET_DATA_FORMAT, 0,
+				wda_format_802_3, sizeof(wda_format_802_3) },
+};
+
+/*
+ * The qmi_wwan side of the device, standing in for sysfs and the
+ * ioctls through the qmi_device_* calls wrapped at link time
+ */
+static struct {
+	enum qmi_device_expected_data_format raw_ip;	/* UNKNOWN: no knob */
+	bool qmimux;
+	unsigned int add_mux;
+	unsigned int del_mux;
+	uint32_t mtu;			/* Raised only along with a link */
+} kernel;
+
+enum qmi_device_expected_data_format
+	__wrap_qmi_device_get_expected_data_format(struct qmi_device *device);
+bool __wrap_qmi_device_set_expected_data_format(struct qmi_device *device,
+				enum qmi_device_expected_data_format format);
+char *__wrap_qmi_device_add_mux_link(struct qmi_device *device,
+					uint8_t mux_id, uint32_t max_size);
+bool __wrap_qmi_device_del_mux_link(struct qmi_device *device,
+							uint8_t mux_id);
+bool __wrap_qmi_device_get_endpoint(struct qmi_device *device,
+							uint32_t *number);
+
+enum qmi_device_expected_data_format
+	__wrap_qmi_device_get_expected_data_format(struct qmi_device *device)
+{
+	return kernel.raw_ip;
+}
+
+bool __wrap_qmi_device_set_expected_data_format(struct qmi_device *device,
+				enum qmi_device_expected_data_format format)
+{
+	if (kernel.raw_ip == QMI_DEVICE_EXPECTED_DATA_FORMAT_UNKNOWN)
+		return false;
+
+	kernel.raw_ip = format;
+
+	return true;
+}
+
+char *__wrap_qmi_device_add_mux_link(struct qmi_device *device,
+					uint8_t mux_id, uint32_t max_size)
+{
+	g_assert(kernel.raw_ip == QMI_DEVICE_EXPECTED_DATA_FORMAT_RAW_IP);
+
+	kernel.add_mux += 1;
+
+	if (!kernel.qmimux)
+		return NULL;
+
+	kernel.mtu = max_size;
+
+	return g_strdup(TEST_MUX_LINK);
+}
+
+bool __wrap_qmi_device_del_mux_link(struct qmi_device *device,
+							uint8_t mux_id)
+{
+	kernel.del_mux += 1;
+	kernel.mtu = TEST_MTU;
+
+	return kernel.qmimux;
+}
+
+bool __wrap_qmi_device_get_endpoint(struct qmi_device *device,
+							uint32_t *number)
+{
+	*number = TEST_ENDPOINT;
+
+	return true;
+}
+
+/* Declarations && Re-implementations of core functions. */
+struct ofono_modem {
+	const char *interface;
+};
+
+struct ofono_gprs_context {
+	void *driver_data;
+	struct ofono_modem *modem;
+};
+
+static const struct ofono_gprs_context_driver *gc_drv;
+
+int ofono_gprs_context_driver_register(
+				const struct ofono_gprs_context_driver *d)
+{
+	if (gc_drv == NULL)
+		gc_drv = d;
+
+	return 0;
+}
+
+void ofono_gprs_context_driver_unregister(
+				const struct ofono_gprs_context_driver *d)
+{
+	gc_drv = NULL;
+}
+
+void ofono_gprs_context_set_data(struct ofono_gprs_context *gc, void *data)
+{
+	gc->driver_data = data;
+}
+
+void *ofono_gprs_context_get_data(struct ofono_gprs_context *gc)
+{
+	return gc->driver_data;
+}
+
+struct ofono_modem *ofono_gprs_context_get_modem(struct ofono_gprs_context *gc)
+{
+	return gc->modem;
+}
+
+const char *ofono_modem_get_string(struct ofono_modem *modem, const char *key)
+{
+	g_assert(g_str_equal(key, "NetworkInterface"));
+
+	return modem->interface;
+}
+
+void ofono_gprs_context_remove(struct ofono_gprs_context *gc)
+{
+	g_assert_not_reached();
+}
+
+void ofono_gprs_context_deactivated(struct ofono_gprs_context *gc,
+					unsigned int id)
+{
+	g_assert_not_reached();
+}
+
+void ofono_gprs_context_set_interface(struct ofono_gprs_context *gc,
+					const char *interface)
+{
+	g_assert_not_reached();
+}
+
+void ofono_gprs_context_set_ipv4_address(struct ofono_gprs_context *gc,
+						const char *address,
+						ofono_bool_t static_ip)
+{
+	g_assert_not_reached();
+}
+
+void ofono_gprs_context_set_ipv4_netmask(struct ofono_gprs_context *gc,
+						const char *netmask)
+{
+	g_assert_not_reached();
+}
+
+void ofono_gprs_context_set_ipv4_gateway(struct ofono_gprs_context *gc,
+						const char *gateway)
+{
+	g_assert_not_reached();
+}
+
+void ofono_gprs_context_set_ipv4_dns_servers(struct ofono_gprs_context *gc,
+						const char **dns)
+{
+	g_assert_not_reached();
+}
+
+struct test_data {
+	GMainLoop *mainloop;
+	struct qmi_test_server *server;
+	struct qmi_device *device;
+	struct ofono_modem modem;
+	struct ofono_gprs_context gc;
+	unsigned int set_data_format;
+	unsigned int get_data_format;
+	unsigned int bind_mux;
+	unsigned char set_params[64];	/* Of the last SET_DATA_FORMAT */
+	uint16_t set_length;
+	unsigned char bind_params[32];
+	uint16_t bind_length;
+};
+
+static void qmi_debug(const char *str, void *user_data)
+{
+	const char *prefix = user_data;
+
+	g_print("%s%s\n", prefix, str);
+}
+
+static const void *tlv_get(const unsigned char *params, uint16_t length,
+					uint8_t type, uint16_t *len)
+{
+	uint16_t offset = 0;
+
+	while (offset + 3 <= length) {
+		uint16_t size = params[offset + 1] | params[offset + 2] << 8;
+
+		g_assert(offset + 3 + size <= length);
+
+		if (params[offset] == type) {
+			*len = size;
+			return params + offset + 3;
+		}
+
+		offset += 3 + size;
+	}
+
+	return NULL;
+}
+
+static bool tlv_get_uint32(const unsigned char *params, uint16_t length,
+					uint8_t type, uint32_t *value)
+{
+	const unsigned char *ptr;
+	uint16_t len;
+
+	ptr = tlv_get(params, length, type, &len);
+	if (!ptr || len != 4)
+		return false;
+
+	*value = ptr[0] | ptr[1] << 8 | ptr[2] << 16 | (uint32_t) ptr[3] << 24;
+
+	return true;
+}
+
+static void request_func(uint8_t service, uint8_t client, uint16_t message,
+				const void *params, uint16_t length,
+				void *user_data)
+{
+	struct test_data *data = user_data;
+
+	if (service == QMI_SERVICE_WDA && message == QMI_WDA_SET_DATA_FORMAT) {
+		g_assert(length <= sizeof(data->set_params));
+
+		memcpy(data->set_params, params, length);
+		data->set_length = length;
+		data->set_data_format += 1;
+	} else if (service == QMI_SERVICE_WDA &&
+				message == QMI_WDA_GET_DATA_FORMAT) {
+		data->get_data_format += 1;
+	} else if (service == QMI_SERVICE_WDS &&
+				message == QMI_WDS_BIND_MUX_DATA_PORT) {
+		g_assert(length <= sizeof(data->bind_params));
+
+		memcpy(data->bind_params, params, length);
+		data->bind_length = length;
+		data->bind_mux += 1;
+	}
+}
+
+static void discover_cb(void *user_data)
+{
+	struct test_data *data = user_data;
+
+	g_main_loop_quit(data->mainloop);
+}
+
+/*
+ * Everything goes over the socketpair or through zero timeouts, so the
+ * driver is done once there is nothing left to dispatch
+ */
+static void test_run(void)
+{
+	while (g_main_context_iteration(NULL, FALSE))
+		;
+}
+
+static void test_setup(struct test_data *data,
+				const struct qmi_test_response *script,
+				unsigned int count)
+{
+	memset(data, 0, sizeof(*data));
+
+	data->mainloop = g_main_loop_new(NULL, FALSE);
+
+	data->server = qmi_test_server_new(script, count);
+	g_assert(data->server != NULL);
+
+	qmi_test_server_set_request_func(data->server, request_func, data);
+
+	data->device = qmi_device_new(qmi_test_server_get_fd(data->server));
+	g_assert(data->device != NULL);
+
+	if (g_test_verbose())
+		qmi_device_set_debug(data->device, qmi_debug, "QMI: ");
+
+	g_assert(qmi_device_discover(data->device, discover_cb, data, NULL));
+	g_main_loop_run(data->mainloop);
+
+	data->modem.interface = "wwan0";
+	data->gc.modem = &data->modem;
+
+	qmi_gprs_context_init();
+	g_assert(gc_drv != NULL);
+
+	g_assert(gc_drv->probe(&data->gc, 0, data->device) == 0);
+	test_run();
+
+	/* The WDA client and the WDS one */
+	g_assert(qmi_test_server_get_clients(data->server) == 2);
+}
+
+static void shutdown_cb(void *user_data)
+{
+	struct test_data *data = user_data;
+
+	qmi_device_unref(data->device);
+	g_main_loop_quit(data->mainloop);
+}
+
+static void test_cleanup(struct test_data *data)
+{
+	gc_drv->remove(&data->gc);
+	g_assert(data->gc.driver_data == NULL);
+
+	qmi_gprs_context_exit();
+
+	g_assert(qmi_device_shutdown(data->device, shutdown_cb, data, NULL));
+	g_main_loop_run(data->mainloop);
+
+	g_assert(qmi_test_server_get_clients(data->server) == 0);
+
+	qmi_test_server_free(data->server);
+	g_main_loop_unref(data->mainloop);
+}
+
+static void test_set_data_format(void)
+{
+	struct test_data data;
+	const struct qmi_wda_endpoint_info *endpoint;
+	const uint8_t *mux_id;
+	uint32_t value;
+	uint16_t len;
+
+	memset(&kernel, 0, sizeof(kernel));
+	kernel.mtu = TEST_MTU;
+	kernel.raw_ip = QMI_DEVICE_EXPECTED_DATA_FORMAT_802_3;
+	kernel.qmimux = true;
+
+	test_setup(&data, qmap_script, G_N_ELEMENTS(qmap_script));
+
+	g_assert(data.set_data_format == 1);
+	g_assert(data.get_data_format == 0);
+
+	g_assert(tlv_get_uint32(data.set_params, data.set_length,
+					QMI_WDA_LL_PROTOCOL, &value));
+	g_assert(value == QMI_WDA_DATA_LINK_PROTOCOL_RAW_IP);
+	g_assert(tlv_get_uint32(data.set_params, data.set_length,
+					QMI_WDA_UL_DATA_AGG_PROTOCOL, &value));
+	g_assert(value == QMI_WDA_DATA_AGG_PROTOCOL_QMAP);
+	g_assert(tlv_get_uint32(data.set_params, data.set_length,
+					QMI_WDA_DL_DATA_AGG_PROTOCOL, &value));
+	g_assert(value == QMI_WDA_DATA_AGG_PROTOCOL_QMAP);
+
+	endpoint = tlv_get(data.set_params, data.set_length,
+					QMI_WDA_ENDPOINT_INFO, &len);
+	g_assert(endpoint != NULL && len == sizeof(*endpoint));
+	g_assert(GUINT32_FROM_LE(endpoint->interface) == TEST_ENDPOINT);
+
+	/* What the modem settled for */
+	g_assert(kernel.raw_ip == QMI_DEVICE_EXPECTED_DATA_FORMAT_RAW_IP);
+	g_assert(kernel.add_mux == 1);
+	g_assert(kernel.mtu == 8192);
+
+	g_assert(data.bind_mux == 1);
+
+	mux_id = tlv_get(data.bind_params, data.bind_length,
+					QMI_WDS_PARAM_MUX_ID, &len);
+	g_assert(mux_id != NULL && len == 1 && *mux_id == 1);
+
+	endpoint = tlv_get(data.bind_params, data.bind_length,
+					QMI_WDS_PARAM_ENDPOINT_INFO, &len);
+	g_assert(endpoint != NULL && len == sizeof(*endpoint));
+	g_assert(GUINT32_FROM_LE(endpoint->interface) == TEST_ENDPOINT);
+
+	test_cleanup(&data);
+
+	g_assert(kernel.del_mux == 1);
+	g_assert(kernel.mtu == TEST_MTU);
+}
+
+static void test_set_data_format_fallback(void)
+{
+	struct test_data data;
+
+	memset(&kernel, 0, sizeof(kernel));
+	kernel.raw_ip = QMI_DEVICE_EXPECTED_DATA_FORMAT_RAW_IP;
+	kernel.qmimux = true;
+
+	test_setup(&data, legacy_script, G_N_ELEMENTS(legacy_script));
+
+	/* Rejected, then the format the modem uses is looked up */
+	g_assert(data.set_data_format == 1);
+	g_assert(data.get_data_format == 1);
+
+	g_assert(kernel.raw_ip == QMI_DEVICE_EXPECTED_DATA_FORMAT_802_3);
+	g_assert(kernel.add_mux == 0);
+	g_assert(data.bind_mux == 0);
+
+	test_cleanup(&data);
+
+	g_assert(kernel.del_mux == 0);
+}
+
+static void test_no_raw_ip(void)
+{
+	struct test_data data;
+
+	memset(&kernel, 0, sizeof(kernel));
+	kernel.raw_ip = QMI_DEVICE_EXPECTED_DATA_FORMAT_UNKNOWN;
+
+	test_setup(&data, both_script, G_N_ELEMENTS(both_script));
+
+	/* The modem is left in a format the kernel can follow */
+	g_assert(data.set_data_format == 0);
+	g_assert(data.get_data_format == 1);
+
+	g_assert(kernel.add_mux == 0);
+	g_assert(data.bind_mux == 0);
+
+	test_cleanup(&data);
+}
+
+static void test_no_qmimux(void)
+{
+	struct test_data data;
+	uint32_t value;
+
+	memset(&kernel, 0, sizeof(kernel));
+	kernel.mtu = TEST_MTU;
+	kernel.raw_ip = QMI_DEVICE_EXPECTED_DATA_FORMAT_802_3;
+
+	test_setup(&data, qmap_script, G_N_ELEMENTS(qmap_script));
+
+	/* Aggregation is turned off again */
+	g_assert(kernel.add_mux == 1);
+	g_assert(data.set_data_format == 2);
+	g_assert(tlv_get_uint32(data.set_params, data.set_length,
+					QMI_WDA_DL_DATA_AGG_PROTOCOL, &value));
+	g_assert(value == QMI_WDA_DATA_AGG_PROTOCOL_DISABLED);
+
+	g_assert(data.bind_mux == 0);
+	g_assert(kernel.mtu == TEST_MTU);
+
+	test_cleanup(&data);
+
+	g_assert(kernel.del_mux == 0);
+}
+
+static void test_bind_mux_failed(void)
+{
+	struct test_data data;
+	uint32_t value;
+
+	memset(&kernel, 0, sizeof(kernel));
+	kernel.mtu = TEST_MTU;
+	kernel.raw_ip = QMI_DEVICE_EXPECTED_DATA_FORMAT_802_3;
+	kernel.qmimux = true;
+
+	test_setup(&data, no_bind_script, G_N_ELEMENTS(no_bind_script));
+
+	g_assert(data.bind_mux == 1);
+
+	/* The link goes and aggregation is turned off again */
+	g_assert(kernel.add_mux == 1);
+	g_assert(kernel.del_mux == 1);
+	g_assert(kernel.mtu == TEST_MTU);
+	g_assert(data.set_data_format == 2);
+	g_assert(tlv_get_uint32(data.set_params, data.set_length,
+					QMI_WDA_UL_DATA_AGG_PROTOCOL, &value));
+	g_assert(value == QMI_WDA_DATA_AGG_PROTOCOL_DISABLED);
+	g_assert(tlv_get_uint32(data.set_params, data.set_length,
+					QMI_WDA_DL_DATA_AGG_PROTOCOL, &value));
+	g_assert(value == QMI_WDA_DATA_AGG_PROTOCOL_DISABLED);
+
+	test_cleanup(&data);
+
+	/* Not deleted a second time */
+	g_assert(kernel.del_mux == 1);
+}
+
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/testqmimodemgprscontext/set-data-format",
+						test_set_data_format);
+	g_test_add_func("/testqmimodemgprscontext/set-data-format/fallback",
+						test_set_data_format_fallback);
+	g_test_add_func("/testqmimodemgprscontext/no-raw-ip", test_no_raw_ip);
+	g_test_add_func("/testqmimodemgprscontext/no-qmimux", test_no_qmimux);
+	g_test_add_func("/testqmimodemgprscontext/bind-mux-failed",
+						test_bind_mux_failed);
+
+	return g_test_run();
+}
@@ -0,0 +1,410 @@
+/*
+ *
+ *  oFono - Open Source Telephony
+ *
+ *  Copyright (C) 2008-2011  Intel Corporation. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include "gatrawip.h"
+
+#define GUARD_TIME	1100	/* Just over the escape guard time, in ms */
+
+/* Well past the sockets plus the 128 KB read buffer ceiling */
+#define FILL_SIZE	(1024 * 1024)
+
+static const char ppp_frame[] = "~\xff\x03\xc0\x21\x01\x01\x00\x04~";
+
+/* A CR inside a frame is PPP data */
+static const char ppp_frame_cr[] = "~\xff\x03\r\nNO CARRIER\r\n~";
+
+/*
+ * A DUN client and a modem port, each a socketpair with the relay on one
+ * end and the test on the other
+ */
+struct test_data {
+	GMainLoop *mainloop;
+	GAtRawIP *rawip;
+	GAtIO *client_io;
+	GAtIO *modem_io;
+	int client[2];
+	int modem[2];
+	guint timeout;
+	guint suspended;
+	guint disconnected;
+};
+
+static GAtIO *io_new(int fd)
+{
+	GIOChannel *channel;
+	GAtIO *io;
+
+	channel = g_io_channel_unix_new(fd);
+	g_assert(channel != NULL);
+
+	g_io_channel_set_close_on_unref(channel, TRUE);
+
+	io = g_at_io_new(channel);
+	g_assert(io != NULL);
+
+	g_io_channel_unref(channel);
+
+	return io;
+}
+
+static void suspend_cb(gpointer user_data)
+{
+	struct test_data *data = user_data;
+
+	data->suspended += 1;
+	g_main_loop_quit(data->mainloop);
+}
+
+static void disconnect_cb(gpointer user_data)
+{
+	struct test_data *data = user_data;
+
+	data->disconnected += 1;
+}
+
+static void test_setup(struct test_data *data, gboolean splice,
+				gboolean escape, gboolean no_carrier)
+{
+	memset(data, 0, sizeof(*data));
+
+	data->mainloop = g_main_loop_new(NULL, FALSE);
+
+	g_assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0,
+						data->client) == 0);
+	g_assert(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0,
+						data->modem) == 0);
+
+	data->client_io = io_new(data->client[1]);
+	data->modem_io = io_new(data->modem[1]);
+
+	data->rawip = g_at_rawip_new_from_io(data->client_io);
+	g_assert(data->rawip != NULL);
+
+	g_at_rawip_set_splice_enabled(data->rawip, splice);
+
+	if (escape)
+		g_at_rawip_set_suspend_function(data->rawip, suspend_cb, data);
+
+	g_at_rawip_set_no_carrier_detect(data->rawip, no_carrier);
+	g_at_rawip_set_disconnect_function(data->rawip, disconnect_cb, data);
+
+	g_at_rawip_open_io(data->rawip, data->modem_io);
+}
+
+static void test_cleanup(struct test_data *data)
+{
+	g_at_rawip_unref(data->rawip);
+
+	g_at_io_unref(data->client_io);
+	g_at_io_unref(data->modem_io);
+
+	close(data->client[0]);
+	close(data->modem[0]);
+
+	g_main_loop_unref(data->mainloop);
+}
+
+/* Everything goes over the socketpairs, so idle means done */
+static void test_run(void)
+{
+	while (g_main_context_iteration(NULL, FALSE))
+		;
+}
+
+static gboolean timeout_cb(gpointer user_data)
+{
+	struct test_data *data = user_data;
+
+	data->timeout = 0;
+	g_main_loop_quit(data->mainloop);
+
+	return FALSE;
+}
+
+/* Runs for ms, or until suspended */
+static void test_wait(struct test_data *data, guint ms)
+{
+	data->timeout = g_timeout_add(ms, timeout_cb, data);
+
+	g_main_loop_run(data->mainloop);
+
+	if (data->timeout > 0) {
+		g_source_remove(data->timeout);
+		data->timeout = 0;
+	}
+}
+
+static void test_write(int fd, const char *str, size_t len)
+{
+	g_assert(write(fd, str, len) == (ssize_t) len);
+}
+
+static void test_read(int fd, const char *expected, size_t len)
+{
+	char buf[64];
+	ssize_t n;
+
+	n = read(fd, buf, sizeof(buf));
+	if (len == 0) {
+		g_assert(n < 0 && errno == EAGAIN);
+		return;
+	}
+
+	g_assert(n == (ssize_t) len);
+	g_assert(memcmp(buf, expected, len) == 0);
+}
+
+static void test_relay(void)
+{
+	struct test_data data;
+
+	test_setup(&data, TRUE, FALSE, FALSE);
+
+	test_write(data.client[0], ppp_frame, sizeof(ppp_frame) - 1);
+	test_write(data.modem[0], ppp_frame_cr, sizeof(ppp_frame_cr) - 1);
+	test_run();
+
+	test_read(data.modem[0], ppp_frame, sizeof(ppp_frame) - 1);
+	test_read(data.client[0], ppp_frame_cr, sizeof(ppp_frame_cr) - 1);
+
+	test_cleanup(&data);
+}
+
+static void test_no_carrier(void)
+{
+	struct test_data data;
+
+	test_setup(&data, TRUE, FALSE, TRUE);
+
+	test_write(data.modem[0], ppp_frame_cr, sizeof(ppp_frame_cr) - 1);
+	test_run();
+
+	test_read(data.client[0], ppp_frame_cr, sizeof(ppp_frame_cr) - 1);
+	g_assert(data.disconnected == 0);
+
+	/* Held back until it is known what it is */
+	test_write(data.modem[0], "\r\nNO CAR", 8);
+	test_run();
+
+	test_read(data.client[0], NULL, 0);
+	g_assert(data.disconnected == 0);
+
+	test_write(data.modem[0], "RIER\r\n", 6);
+	test_run();
+
+	test_read(data.client[0], NULL, 0);
+	g_assert(data.disconnected == 1);
+
+	/* Not relaying anymore */
+	test_write(data.client[0], ppp_frame, sizeof(ppp_frame) - 1);
+	test_run();
+
+	test_read(data.modem[0], NULL, 0);
+
+	test_cleanup(&data);
+}
+
+static void test_escape(void)
+{
+	struct test_data data;
+
+	test_setup(&data, TRUE, TRUE, FALSE);
+
+	/* No guard time before it, so it is data */
+	test_write(data.client[0], "+++", 3);
+	test_run();
+
+	test_read(data.modem[0], "+++", 3);
+
+	test_wait(&data, GUARD_TIME);
+
+	test_write(data.client[0], "+++", 3);
+	test_run();
+
+	test_read(data.modem[0], NULL, 0);
+
+	/* Suspended after the guard time that follows */
+	test_wait(&data, 2 * GUARD_TIME);
+
+	g_assert(data.suspended == 1);
+	test_read(data.modem[0], NULL, 0);
+
+	test_cleanup(&data);
+}
+
+static void test_escape_data(void)
+{
+	struct test_data data;
+
+	test_setup(&data, TRUE, TRUE, FALSE);
+
+	test_wait(&data, GUARD_TIME);
+
+	test_write(data.client[0], "++", 2);
+	test_run();
+
+	test_read(data.modem[0], NULL, 0);
+
+	/* Within the guard time, so all of it was data */
+	test_write(data.client[0], "+x", 2);
+	test_run();
+
+	test_read(data.modem[0], "+++x", 4);
+
+	test_wait(&data, GUARD_TIME);
+
+	g_assert(data.suspended == 0);
+
+	test_cleanup(&data);
+}
+
+/* Writes the next part of a counting pattern, as much as fits */
+static gboolean fill_write(int fd, gsize *written)
+{
+	guint8 buf[4096];
+	gsize len = MIN(sizeof(buf), FILL_SIZE - *written);
+	gsize i;
+	ssize_t n;
+
+	if (len == 0)
+		return FALSE;
+
+	for (i = 0; i < len; i++)
+		buf[i] = (*written + i) % 251;
+
+	n = write(fd, buf, len);
+	if (n < 0) {
+		g_assert(errno == EAGAIN);
+		return FALSE;
+	}
+
+	*written += n;
+
+	return TRUE;
+}
+
+static gboolean fill_read(int fd, gsize *received)
+{
+	guint8 buf[4096];
+	ssize_t n;
+	ssize_t i;
+
+	n = read(fd, buf, sizeof(buf));
+	if (n < 0) {
+		g_assert(errno == EAGAIN);
+		return FALSE;
+	}
+
+	for (i = 0; i < n; i++)
+		g_assert(buf[i] == (*received + i) % 251);
+
+	*received += n;
+
+	return TRUE;
+}
+
+/*
+ * The far side reads nothing until the relay has buffered all it may and
+ * paused, then everything must still come through
+ */
+static void test_resume(int in_fd, int out_fd, GAtIO *paused)
+{
+	GAtIOStats stats;
+	gsize written = 0;
+	gsize received = 0;
+	gboolean progress;
+
+	do {
+		progress = FALSE;
+
+		while (fill_write(in_fd, &written))
+			progress = TRUE;
+
+		test_run();
+	} while (progress);
+
+	g_assert(written < FILL_SIZE);
+
+	g_assert(g_at_io_get_stats(paused, &stats));
+	g_assert(stats.pauses > 0);
+
+	do {
+		progress = FALSE;
+
+		while (fill_write(in_fd, &written))
+			progress = TRUE;
+
+		while (fill_read(out_fd, &received))
+			progress = TRUE;
+
+		test_run();
+	} while (progress);
+
+	g_assert(written == FILL_SIZE);
+	g_assert(received == FILL_SIZE);
+}
+
+static void test_resume_tx(void)
+{
+	struct test_data data;
+
+	test_setup(&data, FALSE, FALSE, FALSE);
+
+	test_resume(data.client[0], data.modem[0], data.client_io);
+
+	test_cleanup(&data);
+}
+
+static void test_resume_rx(void)
+{
+	struct test_data data;
+
+	test_setup(&data, FALSE, FALSE, FALSE);
+
+	test_resume(data.modem[0], data.client[0], data.modem_io);
+
+	test_cleanup(&data);
+}
+
+int main(int argc, char **argv)
+{
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/testrawip/relay", test_relay);
+	g_test_add_func("/testrawip/no-carrier", test_no_carrier);
+	g_test_add_func("/testrawip/escape", test_escape);
+	g_test_add_func("/testrawip/escape/data", test_escape_data);
+	g_test_add_func("/testrawip/resume/tx", test_resume_tx);
+	g_test_add_func("/testrawip/resume/rx", test_resume_rx);
+
+	return g_test_run();
+}